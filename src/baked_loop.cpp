@@ -0,0 +1,579 @@
+#define _CRT_SECURE_NO_WARNINGS // for fopen
+#include "baked_loop.h"
+
+#include <GL/gl3w.h>
+#include "external/imgui.h"
+#include "height_sequence.h"
+#include "snapshot.h"
+#include "thread_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h> // for malloc/free
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+using namespace baked;
+
+static constexpr uint32_t LOOP_MAGIC = snapshot::id("WLOP");
+static constexpr uint32_t LOOP_VERSION = 1;
+
+// frames are compared by their averages over a coarse grid of this many cells across, which is plenty
+// to tell waves apart and keeps comparing every pair of frames cheap
+static constexpr int SIGNATURE_SIZE = 32;
+
+// every frame keeps a histogram of how tall its cells are, from 0 to the capture range, to pick the range from
+static constexpr int HISTOGRAM_BINS = 256;
+
+static_assert(sizeof(Header) == 32, "baked loop header layout");
+
+// blends between two frames, both BC4 so they come out between -1 and 1
+const char* loopHeightFragSource = /* fragment shader */ R"(
+#version 460 core
+in vec2 fragUv;
+in vec2 screenUv;
+
+out vec4 outValue;
+
+uniform sampler2D frameA;
+uniform sampler2D frameB;
+uniform float blend;
+uniform float range;
+
+void main() {
+	float a = texture(frameA, fragUv).r;
+	float b = texture(frameB, fragUv).r;
+
+	outValue = vec4(mix(a, b, blend) * range, 0.0, 0.0, 1.0);
+}
+)";
+
+// same colours as the GPU iWave, with no obstructions
+const char* loopDisplayFragSource = /* fragment shader */ R"(
+#version 460 core
+in vec2 fragUv;
+in vec2 screenUv;
+
+out vec4 outValue;
+
+uniform sampler2D heights;
+
+void main() {
+	float height = texture(heights, fragUv).r;
+
+	outValue = vec4(0.0, 0.0, (height + 1.0) / 2.0, 1.0);
+}
+)";
+
+static size_t frame_bytes(int width, int height) {
+	return static_cast<size_t>((width + 3) / 4) * static_cast<size_t>((height + 3) / 4) * 8;
+}
+
+// fits 16 values between -1 and 1 to the 8 points from endpoint r0 down to r1, r0 > r1
+// returns the squared error, and the indices in their 3 bit slots
+static float fit_bc4(const float values[16], int r0, int r1, uint64_t& indices) {
+	const float span = static_cast<float>(r0 - r1);
+	float error = 0.0f;
+	indices = 0;
+
+	for (int i = 0; i < 16; i++) {
+		// 7 is endpoint 0, 0 is endpoint 1, and p in between is index 8 - p
+		const float t = (values[i] * 127.0f - static_cast<float>(r1)) / span;
+		const int p = std::clamp(static_cast<int>(lroundf(t * 7.0f)), 0, 7);
+		const uint64_t index = p == 7 ? 0 : (p == 0 ? 1 : static_cast<uint64_t>(8 - p));
+		indices |= index << (3 * i);
+
+		const float decoded = (static_cast<float>(r1) + span * static_cast<float>(p) / 7.0f) / 127.0f;
+		error += (values[i] - decoded) * (values[i] - decoded);
+	}
+
+	return error;
+}
+
+// one signed BC4 block out of 16 values between -1 and 1, returns the squared error of the block
+// the endpoints start at the block's extremes, in the mode with 6 points between them (endpoint 0 > endpoint 1),
+// and each is moved a step in or out if that fits better, since rounding them to 8 bits throws the points
+// in between off by as much
+static float encode_bc4(const float values[16], uint8_t out[8]) {
+	float low = values[0], high = values[0];
+	for (int i = 1; i < 16; i++) {
+		low = std::min(low, values[i]);
+		high = std::max(high, values[i]);
+	}
+
+	const int high8 = std::clamp(static_cast<int>(lroundf(high * 127.0f)), -127, 127);
+	const int low8 = std::clamp(static_cast<int>(lroundf(low * 127.0f)), -127, 127);
+
+	int r0 = high8, r1 = high8;
+	uint64_t indices = 0;
+	float error = 0.0f;
+
+	// flat block, every index 0 is endpoint 0 in either mode
+	const float value = static_cast<float>(high8) / 127.0f;
+	for (int i = 0; i < 16; i++)
+		error += (values[i] - value) * (values[i] - value);
+
+	for (int d0 = -1; d0 <= 1 && error > 0.0f; d0++) {
+		for (int d1 = -1; d1 <= 1; d1++) {
+			const int c0 = std::clamp(high8 + d0, -127, 127);
+			const int c1 = std::clamp(low8 + d1, -127, 127);
+			if (c0 <= c1) continue;
+
+			uint64_t candidate;
+			const float candidateError = fit_bc4(values, c0, c1, candidate);
+			if (candidateError < error) {
+				error = candidateError;
+				indices = candidate;
+				r0 = c0;
+				r1 = c1;
+			}
+		}
+	}
+
+	out[0] = static_cast<uint8_t>(static_cast<int8_t>(r0));
+	out[1] = static_cast<uint8_t>(static_cast<int8_t>(r1));
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = static_cast<uint8_t>(indices >> (8 * i));
+
+	return error;
+}
+
+// BC4 blocks for a whole frame across the thread pool, edges are padded by repeating the last row and column
+static double encode_frame(const float* heights, int width, int height, float range, uint8_t* out, double* rowErrors) {
+	const int blocksX = (width + 3) / 4;
+	const int blocksY = (height + 3) / 4;
+	const float inverseRange = 1.0f / range;
+
+	ThreadPool::shared().parallel_for(static_cast<size_t>(blocksY), [&](size_t begin, size_t end) {
+		for (size_t by = begin; by < end; by++) {
+			double error = 0.0;
+
+			for (int bx = 0; bx < blocksX; bx++) {
+				float values[16];
+				for (int i = 0; i < 16; i++) {
+					const int x = std::min(bx * 4 + (i & 3), width - 1);
+					const int y = std::min(static_cast<int>(by) * 4 + (i >> 2), height - 1);
+					values[i] = std::clamp(heights[y * width + x] * inverseRange, -1.0f, 1.0f);
+				}
+
+				error += encode_bc4(values, out + (by * blocksX + bx) * 8);
+			}
+
+			rowErrors[by] = error;
+		}
+	});
+
+	double error = 0.0;
+	for (int by = 0; by < blocksY; by++)
+		error += rowErrors[by];
+
+	// back to height units
+	return error * static_cast<double>(range) * static_cast<double>(range);
+}
+
+//
+// private
+//
+
+// returns the texture slot that holds the frame, never the one in keep
+int BakedLoop::upload_frame(int frame, int keep) {
+	for (int slot = 0; slot < 2; slot++) {
+		if (loadedFrames[slot] == frame)
+			return slot;
+	}
+
+	const int slot = keep == 0 ? 1 : 0;
+	const uint8_t* data = mapped.data() + sizeof(Header) + static_cast<size_t>(frame) * header.frameBytes;
+	glCompressedTextureSubImage2D(frameTextures[slot], 0, 0, 0, header.width, header.height,
+		GL_COMPRESSED_SIGNED_RED_RGTC1, static_cast<GLsizei>(header.frameBytes), data);
+
+	loadedFrames[slot] = frame;
+	return slot;
+}
+
+void BakedLoop::update_heights() {
+	const double position = time / static_cast<double>(header.frameTime);
+	const int frame = static_cast<int>(position) % header.frameCount;
+	const int next = (frame + 1) % header.frameCount;
+	const float blend = static_cast<float>(position - floor(position));
+
+	const int slotA = upload_frame(frame, -1);
+	const int slotB = upload_frame(next, slotA);
+
+	Renderer::pass_state();
+	heights.set_target();
+	Renderer::attach_tex(heightShader, h_frameA, frameTextures[slotA], 0);
+	Renderer::attach_tex(heightShader, h_frameB, frameTextures[slotB], 1);
+	glUniform1f(h_blend, blend);
+	glUniform1f(h_range, header.range);
+	Renderer::draw_quad();
+
+	TextureTarget::reset_target();
+}
+
+//
+// public
+//
+
+BakedLoop::~BakedLoop() {
+	close();
+}
+
+bool BakedLoop::bake(SurfaceSim& sim, int w, int h, float delta, const char* path, const Settings& settings, Result& result) {
+	result = {};
+
+	const int fade = std::max(settings.fadeSteps, 0);
+	if (w <= 0 || h <= 0 || delta <= 0.0f || settings.minLength < 2 || settings.maxLength < settings.minLength)
+		return false;
+
+	// the loop needs one frame before its start to match velocities, and fade frames to fade into
+	const int firstStart = std::max(fade, 1);
+	if (settings.captureSteps < firstStart + settings.minLength + 1)
+		return false;
+
+	char sequencePath[512];
+	snprintf(sequencePath, sizeof(sequencePath), "%s.wseq", path);
+
+	//
+	// simulate, with rain
+	//
+	uint32_t random = settings.seed != 0 ? settings.seed : 1;
+	auto next_random = [&]() {
+		// xorshift32, so a bake doesn't depend on rand's state or implementation
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		return random;
+	};
+
+	float drops = 0.0f;
+	auto step = [&]() {
+		drops += settings.dropsPerStep;
+		while (drops >= 1.0f) {
+			drops -= 1.0f;
+			const int x = static_cast<int>(next_random() % static_cast<uint32_t>(w));
+			const int y = static_cast<int>(next_random() % static_cast<uint32_t>(h));
+			sim.place_source(x, y, settings.dropRadius, settings.dropStrength);
+		}
+
+		sim.sim_frame(delta);
+	};
+
+	sim.reset();
+	for (int i = 0; i < settings.warmupSteps; i++)
+		step();
+
+	SequenceWriter writer;
+	if (!writer.open(sequencePath, w, h, settings.captureRange))
+		return false;
+
+	for (int i = 0; i < settings.captureSteps; i++) {
+		step();
+		writer.capture(sim, true);
+	}
+
+	if (!writer.close()) {
+		remove(sequencePath);
+		return false;
+	}
+
+	SequenceReader reader, lead;
+	if (!reader.open(sequencePath) || !lead.open(sequencePath) || reader.get_frame_count() != settings.captureSteps) {
+		reader.close();
+		lead.close();
+		remove(sequencePath);
+		return false;
+	}
+
+	//
+	// signatures, and how tall every frame's cells are for the range
+	//
+	const int frames = reader.get_frame_count();
+	const int sigWidth = std::min(SIGNATURE_SIZE, w);
+	const int sigHeight = std::min(SIGNATURE_SIZE, h);
+	const int sigCells = sigWidth * sigHeight;
+	const size_t cells = static_cast<size_t>(w) * h;
+
+	float* signatures = static_cast<float*>(calloc(static_cast<size_t>(frames) * sigCells, sizeof(float)));
+	uint32_t* histograms = static_cast<uint32_t*>(calloc(static_cast<size_t>(frames) * HISTOGRAM_BINS, sizeof(uint32_t)));
+	float* frame = static_cast<float*>(malloc(sizeof(float) * cells));
+	float* other = static_cast<float*>(malloc(sizeof(float) * cells));
+
+	double energy = 0.0;
+	bool valid = signatures && histograms && frame && other;
+	const float binScale = static_cast<float>(HISTOGRAM_BINS) / settings.captureRange;
+
+	for (int f = 0; valid && f < frames; f++) {
+		if (!reader.read_frame(f, frame)) {
+			valid = false;
+			break;
+		}
+
+		float* signature = signatures + static_cast<size_t>(f) * sigCells;
+		uint32_t* histogram = histograms + static_cast<size_t>(f) * HISTOGRAM_BINS;
+
+		for (int y = 0; y < h; y++) {
+			float* sigRow = signature + (y * sigHeight / h) * sigWidth;
+			for (int x = 0; x < w; x++) {
+				const float value = frame[y * w + x];
+				sigRow[x * sigWidth / w] += value;
+				histogram[std::min(static_cast<int>(fabsf(value) * binScale), HISTOGRAM_BINS - 1)]++;
+			}
+		}
+
+		// every signature cell covers about the same number of grid cells, so an average isn't needed to compare them
+		for (int i = 0; i < sigCells; i++)
+			energy += static_cast<double>(signature[i]) * signature[i];
+	}
+	energy /= frames;
+
+	//
+	// the best seam, where a frame and the one before it look most like a later frame and the one before that
+	//
+	const int lastStart = frames - 1 - settings.minLength;
+	const int starts = lastStart - firstStart + 1;
+	double* bestCost = static_cast<double*>(malloc(sizeof(double) * std::max(starts, 1)));
+	int* bestEnd = static_cast<int*>(malloc(sizeof(int) * std::max(starts, 1)));
+	valid = valid && bestCost && bestEnd && starts > 0;
+
+	auto distance = [&](int a, int b) {
+		const float* sigA = signatures + static_cast<size_t>(a) * sigCells;
+		const float* sigB = signatures + static_cast<size_t>(b) * sigCells;
+
+		double sum = 0.0;
+		for (int i = 0; i < sigCells; i++) {
+			const float difference = sigA[i] - sigB[i];
+			sum += difference * difference;
+		}
+		return sum;
+	};
+
+	if (valid) {
+		ThreadPool::shared().parallel_for(static_cast<size_t>(starts), [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				const int start = firstStart + static_cast<int>(i);
+				bestCost[i] = DBL_MAX;
+				bestEnd[i] = -1;
+
+				// the loop is start to end - 1, so end is the frame that should look like start
+				const int lastEnd = std::min(start + settings.maxLength, frames - 1);
+				for (int end = start + settings.minLength; end <= lastEnd; end++) {
+					const double cost = distance(start, end) + distance(start - 1, end - 1);
+					if (cost < bestCost[i]) {
+						bestCost[i] = cost;
+						bestEnd[i] = end;
+					}
+				}
+			}
+		});
+
+		int best = 0;
+		for (int i = 1; i < starts; i++) {
+			if (bestCost[i] < bestCost[best])
+				best = i;
+		}
+
+		result.start = firstStart + best;
+		result.length = bestEnd[best] - result.start;
+		result.seamError = energy > 0.0 ? static_cast<float>(bestCost[best] / (2.0 * energy)) : 0.0f;
+		result.faded = fade > 0 && result.seamError > settings.fadeThreshold;
+		valid = bestEnd[best] > result.start;
+	}
+
+	//
+	// write the loop, fading its last frames into the ones before its start if the seam shows
+	//
+	FILE* file = nullptr;
+	uint8_t* blocks = nullptr;
+	double* rowErrors = nullptr;
+
+	if (valid) {
+		// BC4 only has 8 bit endpoints, so a range set by the few cells a drop just landed on would cost
+		// every other cell its precision, those are clamped instead
+		// the fade adds up two frames, with weights that keep the waves about as tall, so it's left out
+		uint64_t counts[HISTOGRAM_BINS] = {};
+		for (int f = result.start; f < result.start + result.length; f++) {
+			for (int bin = 0; bin < HISTOGRAM_BINS; bin++)
+				counts[bin] += histograms[static_cast<size_t>(f) * HISTOGRAM_BINS + bin];
+		}
+
+		const uint64_t kept = static_cast<uint64_t>((1.0 - static_cast<double>(settings.clampFraction)) * static_cast<double>(cells) * result.length);
+		uint64_t total = 0;
+		int bin = 0;
+		while (bin < HISTOGRAM_BINS - 1 && (total += counts[bin]) < kept)
+			bin++;
+		result.range = static_cast<float>(bin + 1) / binScale;
+
+		const size_t bytes = frame_bytes(w, h);
+		blocks = static_cast<uint8_t*>(malloc(bytes));
+		rowErrors = static_cast<double*>(malloc(sizeof(double) * ((h + 3) / 4)));
+		file = fopen(path, "wb");
+		valid = blocks && rowErrors && file;
+
+		Header header = { LOOP_MAGIC, LOOP_VERSION, w, h, result.length, delta, result.range, static_cast<uint32_t>(bytes) };
+		if (valid && fwrite(&header, sizeof(header), 1, file) != 1)
+			valid = false;
+
+		double squaredError = 0.0;
+		const int fadeStart = result.faded ? result.length - fade : result.length;
+
+		for (int i = 0; valid && i < result.length; i++) {
+			if (!reader.read_frame(result.start + i, frame)) {
+				valid = false;
+				break;
+			}
+
+			if (i >= fadeStart) {
+				// by the last frame it's almost all the frame before the start, which leads into the start
+				const int j = i - fadeStart;
+				if (!lead.read_frame(result.start - fade + j, other)) {
+					valid = false;
+					break;
+				}
+
+				const float t = static_cast<float>(j + 1) / static_cast<float>(fade + 1);
+				const float weightA = cosf(t * 1.5707963f);
+				const float weightB = sinf(t * 1.5707963f);
+				for (size_t c = 0; c < cells; c++)
+					frame[c] = frame[c] * weightA + other[c] * weightB;
+			}
+
+			squaredError += encode_frame(frame, w, h, result.range, blocks, rowErrors);
+			if (fwrite(blocks, 1, bytes, file) != bytes)
+				valid = false;
+		}
+
+		result.rmsError = static_cast<float>(sqrt(squaredError / (static_cast<double>(cells) * result.length)));
+		result.bytes = sizeof(Header) + bytes * result.length;
+	}
+
+	if (file && fclose(file) != 0)
+		valid = false;
+	if (file && !valid)
+		remove(path);
+
+	free(signatures);
+	free(histograms);
+	free(frame);
+	free(other);
+	free(bestCost);
+	free(bestEnd);
+	free(blocks);
+	free(rowErrors);
+
+	reader.close();
+	lead.close();
+	remove(sequencePath);
+
+	return valid;
+}
+
+bool BakedLoop::open(const char* path) {
+	close();
+
+	if (!mapped.open(path) || mapped.size() < sizeof(Header)) return false;
+
+	Header loaded;
+	memcpy(&loaded, mapped.data(), sizeof(loaded));
+	if (loaded.magic != LOOP_MAGIC || loaded.version != LOOP_VERSION || loaded.width <= 0 || loaded.height <= 0
+		|| loaded.frameCount <= 0 || loaded.frameTime <= 0.0f || loaded.frameBytes != frame_bytes(loaded.width, loaded.height)
+		|| (mapped.size() - sizeof(Header)) / loaded.frameBytes < static_cast<size_t>(loaded.frameCount)) {
+		mapped.close();
+		return false;
+	}
+
+	header = loaded;
+
+	if (heightShader == 0) {
+		heightShader = Renderer::compile_shader(Renderer::vertexSource, loopHeightFragSource);
+		h_frameA = Renderer::shader_loc(heightShader, "frameA");
+		h_frameB = Renderer::shader_loc(heightShader, "frameB");
+		h_blend = Renderer::shader_loc(heightShader, "blend");
+		h_range = Renderer::shader_loc(heightShader, "range");
+
+		displayShader = Renderer::compile_shader(Renderer::vertexSource, loopDisplayFragSource);
+		d_heights = Renderer::shader_loc(displayShader, "heights");
+	}
+
+	for (GLuint& texture : frameTextures) {
+		glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+		Renderer::sampler_settings(texture);
+		glTextureStorage2D(texture, 1, GL_COMPRESSED_SIGNED_RED_RGTC1, header.width, header.height);
+	}
+
+	heights.init(header.width, header.height);
+	display.init(header.width, header.height, GL_RGBA8);
+
+	reset();
+	return true;
+}
+
+void BakedLoop::close() {
+	if (!is_open()) return;
+
+	heights.clean();
+	display.clean();
+
+	for (GLuint& texture : frameTextures) {
+		glDeleteTextures(1, &texture);
+		texture = 0;
+	}
+	loadedFrames[0] = loadedFrames[1] = -1;
+
+	// open compiles them again when they're 0
+	Renderer::delete_program(heightShader);
+	Renderer::delete_program(displayShader);
+	heightShader = displayShader = 0;
+
+	mapped.close();
+	header = {};
+}
+
+void BakedLoop::sim_frame(float delta) {
+	if (!is_open()) return;
+
+	const double length = static_cast<double>(header.frameTime) * header.frameCount;
+	time = fmod(time + delta, length);
+
+	update_heights();
+}
+
+void BakedLoop::reset() {
+	if (!is_open()) return;
+
+	time = 0.0;
+	update_heights();
+}
+
+GLuint BakedLoop::get_display() {
+	if (!is_open()) return 0;
+
+	Renderer::pass_state();
+	display.set_target();
+	Renderer::attach_tex(displayShader, d_heights, heights.texture, 0);
+	Renderer::draw_quad();
+
+	TextureTarget::reset_target();
+
+	return display.texture;
+}
+
+GLuint BakedLoop::get_height_tex() {
+	return heights.texture;
+}
+
+void BakedLoop::imgui_builder(bool* open) {
+	if (!open || !*open || !is_open()) return;
+
+	if (ImGui::Begin("BakedLoop", open, ImGuiWindowFlags_AlwaysAutoResize)) {
+		const double position = time / static_cast<double>(header.frameTime);
+
+		ImGui::LabelText("Size", "%dx%d", header.width, header.height);
+		ImGui::LabelText("Frame", "%.2f of %d", position, header.frameCount);
+		ImGui::LabelText("Length", "%.2f s", static_cast<double>(header.frameTime) * header.frameCount);
+		ImGui::LabelText("Per Frame", "%.1f KB", static_cast<double>(header.frameBytes) / 1024.0);
+	}
+
+	ImGui::End();
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stddef.h> // for size_t
+#include <stdint.h>
+
+#include "surface_sim.h"
+#include "gl_renderer.h"
+#include "mapped_file.h"
+
+// baked loops are a stretch of a simulation that wraps around seamlessly, for water in the distance that
+// nobody interacts with, played back without simulating anything
+//
+// layout, everything little endian:
+//   header              magic, version, size, frame count, seconds per frame, height range
+//   frames              frameBytes each, one after the other
+// frames are BC4 (signed RGTC1) blocks, heights divided by the range, 4 bits per cell, which the GPU
+// decodes by itself, so playing a frame back is one compressed upload straight out of the mapped file
+namespace baked {
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		int32_t width, height;
+		int32_t frameCount;
+		float frameTime; // seconds
+		float range; // a texel of 1 is this high
+		uint32_t frameBytes;
+	};
+
+	struct Settings {
+		int warmupSteps = 300; // simulated before anything is captured, so the surface is busy everywhere
+		int captureSteps = 900; // candidates for the loop
+		int minLength = 150, maxLength = 600; // in steps
+
+		// rain keeps the surface moving while it's baked, drops land at random
+		float dropsPerStep = 0.5f;
+		float dropRadius = 3.0f;
+		float dropStrength = 1.0f;
+		uint32_t seed = 1;
+
+		// the tallest height that's captured, drops can stack up well past 1 where they land
+		float captureRange = 16.0f;
+
+		// the loop's range leaves this much of the tallest cells out, they're clamped to it
+		float clampFraction = 0.001f;
+
+		// if the best loop's ends differ by more than this (relative to the surface's energy), the last
+		// fadeSteps frames are cross faded into the frames before the start
+		float fadeThreshold = 0.02f;
+		int fadeSteps = 60;
+	};
+
+	struct Result {
+		int start, length; // within the captured steps
+		float seamError; // difference across the seam relative to the surface's energy, before any fade
+		bool faded;
+		float range;
+		float rmsError; // of the compressed heights, in height units
+		size_t bytes;
+	};
+}
+
+// plays a baked loop back, blending between frames so it can run at any rate
+// it can't be interacted with, sources and obstructions are ignored
+class BakedLoop : public SurfaceSim {
+	MappedFile mapped;
+	baked::Header header = {};
+
+	// the two frames being blended between, uploaded when they're needed
+	GLuint frameTextures[2] = {};
+	int loadedFrames[2] = { -1, -1 };
+	double time = 0.0;
+
+	TextureTarget heights, display;
+	GLuint heightShader = 0, displayShader = 0;
+	GLint h_frameA, h_frameB, h_blend, h_range;
+	GLint d_heights;
+
+	int upload_frame(int frame, int keep);
+	void update_heights();
+
+public:
+	BakedLoop() = default;
+	~BakedLoop();
+
+	// runs sim offline (rain falling on it) and writes a loop of its heights to path, delta is the step time
+	// the steps go through a height sequence next to the loop (path + ".wseq"), which is removed after
+	static bool bake(SurfaceSim& sim, int w, int h, float delta, const char* path, const baked::Settings& settings, baked::Result& result);
+
+	bool open(const char* path);
+	void close();
+	bool is_open() const { return header.frameCount > 0; }
+
+	int get_width() const { return header.width; }
+	int get_height() const { return header.height; }
+	int get_frame_count() const { return header.frameCount; }
+
+	void place_source(int x, int y, float r, float strength) override {}
+	void set_obstruction(int x, int y, float r, float strength) override {}
+	void sim_frame(float delta) override;
+	void reset() override;
+
+	GLuint get_display() override;
+	GLuint get_height_tex() override;
+
+	void imgui_builder(bool* open = nullptr) override;
+};
@@ -1,46 +1,317 @@
 #include "ewave.h"
 
 #include <stdlib.h> // for calloc/free
+#include <string.h>
 #include <math.h>
 #include <algorithm>
+#include <bit>
 
 #include <GL/gl3w.h>
 #include "gl_renderer.h"
+#include "snapshot.h"
+#include "external/imgui.h"
 
 // NOTE: i'm lazy lol
 #define DOALLOC static_cast<float*>(malloc(bufferSize))
 #define DOFREE(x) free(x); x = nullptr;
 #define SETZERO(x) memset(x, 0, bufferSize)
 
+//
+// private
+//
+int EWaveSurface::get_idx(int x, int y) const {
+	if (x < 0 || x >= width || y < 0 || y >= height)
+		return -1;
+
+	return x + (y * fftWidth);
+}
+
+// with w(k) = sqrt(g|k|), the linearized system dh/dt = |k|phi, dphi/dt = -gh has the exact solution
+//   h'   = h cos(w dt) + phi (|k|/w) sin(w dt)
+//   phi' = phi cos(w dt) - h (g/w) sin(w dt)
+// so any timestep is stable. damping scales both by d = e^(-2 damping |k|^2 dt), which is how viscosity
+// takes energy out of a linear wave, so ripples die off well before swells do
+void EWaveSurface::build_propagator(float delta) {
+	const float dkx = smath::tau / static_cast<float>(fftWidth);
+	const float dky = smath::tau / static_cast<float>(fftHeight);
+
+	for (int y = 0; y < fftHeight; y++) {
+		// wavenumbers past the nyquist frequency are the negative ones
+		float ky = dky * static_cast<float>(y < fftHeight / 2 ? y : y - fftHeight);
+
+		// only kx >= 0 is stored, the negative half is the conjugate of this one
+		for (int x = 0; x < spectrumWidth; x++) {
+			float kx = dkx * static_cast<float>(x);
+			float k2 = (kx * kx) + (ky * ky);
+			float k = sqrtf(k2);
+			float omega = sqrtf(gravity * k);
+
+			float d = damping > 0.0f ? expf(-2.0f * damping * k2 * delta) : 1.0f;
+			float c = cosf(omega * delta);
+			float s = sinf(omega * delta);
+
+			// at k = 0 the limits are |k|/w -> 0 and g sin(w dt)/w -> g dt
+			float heightCoeff = omega > 0.0f ? (k / omega) * s : 0.0f;
+			float velocityCoeff = omega > 0.0f ? (gravity / omega) * s : gravity * delta;
+
+			int idx = (x + (y * spectrumWidth)) * 2;
+			propagateCos[idx] = propagateCos[idx + 1] = d * c;
+			propagateHeight[idx] = propagateHeight[idx + 1] = d * heightCoeff;
+			propagateVelocity[idx] = propagateVelocity[idx + 1] = d * velocityCoeff;
+		}
+	}
+
+	tableDelta = delta;
+	tableGravity = gravity;
+	tableDamping = damping;
+	tableValid = true;
+}
+
+// the re and im parts of every mode get the same real coefficients, so the spectra can be treated as
+// flat float arrays, one plain loop that the compiler vectorizes with the baseline instruction set
+void EWaveSurface::apply_propagator() {
+	float* h = reinterpret_cast<float*>(fourierHeight);
+	float* phi = reinterpret_cast<float*>(fourierVelocity);
+	const float* c = propagateCos;
+	const float* ch = propagateHeight;
+	const float* cv = propagateVelocity;
+	const int count = spectrumCount * 2;
+
+	for (int i = 0; i < count; i++) {
+		float hv = h[i];
+		float pv = phi[i];
+		h[i] = (hv * c[i]) + (pv * ch[i]);
+		phi[i] = (pv * c[i]) - (hv * cv[i]);
+	}
+}
+
+//
+// public
+//
 EWaveSurface::EWaveSurface(int w, int h) {
 	width = w;
 	height = h;
+#if EWAVE_PAD_POWER_OF_2
+	fftWidth = static_cast<int>(std::bit_ceil(static_cast<unsigned int>(w)));
+	fftHeight = static_cast<int>(std::bit_ceil(static_cast<unsigned int>(h)));
+#else
+	fftWidth = static_cast<int>(smath::fft_good_size(w + WALL_BORDER));
+	fftHeight = static_cast<int>(smath::fft_good_size(h + WALL_BORDER));
+#endif
+	bufferCount = fftWidth * fftHeight;
+	spectrumWidth = fftWidth / 2 + 1;
+	spectrumCount = spectrumWidth * fftHeight;
+	const size_t bufferSize = sizeof(float) * bufferCount;
 
+	obstruction = DOALLOC;
+	source = DOALLOC;
+	velocityPotential = DOALLOC;
+	heightGrid = DOALLOC;
+
+	fourierVelocity = static_cast<Complex*>(malloc(sizeof(Complex) * spectrumCount));
+	fourierHeight = static_cast<Complex*>(malloc(sizeof(Complex) * spectrumCount));
+
+	propagateCos = static_cast<float*>(malloc(sizeof(float) * spectrumCount * 2));
+	propagateHeight = static_cast<float*>(malloc(sizeof(float) * spectrumCount * 2));
+	propagateVelocity = static_cast<float*>(malloc(sizeof(float) * spectrumCount * 2));
+
+	// allocate display texture
+	displayPixels = static_cast<uint32_t*>(malloc(sizeof(uint32_t) * width * height));
+	displayTexture = Renderer::create_tex(width, height, GL_RGBA8);
+	glTextureParameteri(displayTexture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTextureParameteri(displayTexture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	heightTexture = Renderer::create_tex(width, height, GL_R32F);
+
+	reset();
 }
 
 EWaveSurface::~EWaveSurface() {
+	DOFREE(obstruction);
+	DOFREE(source);
+	DOFREE(velocityPotential);
+	DOFREE(heightGrid);
+	DOFREE(fourierVelocity);
+	DOFREE(fourierHeight);
+	DOFREE(propagateCos);
+	DOFREE(propagateHeight);
+	DOFREE(propagateVelocity);
+	DOFREE(displayPixels);
 
+	clean();
 }
+
+void EWaveSurface::clean() {
+	if (heightTexture != 0) {
+		glDeleteTextures(1, &displayTexture);
+		glDeleteTextures(1, &heightTexture);
+		displayTexture = 0;
+		heightTexture = 0;
+	}
+}
+
+// same shape as the iWave version
 void EWaveSurface::place_source(int x, int y, float r, float strength) {
+	int s = static_cast<int>(r + 0.5f);
 
+	for (int iy = -s; iy <= s; iy++) {
+		for (int ix = -s; ix <= s; ix++) {
+			float ir = r - sqrtf(static_cast<float>((iy * iy) + (ix * ix)));
+			if (ir > 0.0f) {
+				int idx = get_idx(x + ix, y + iy);
+				if (idx < 0) continue;
+
+				source[idx] = ir * strength;
+			}
+		}
+	}
 }
 
 void EWaveSurface::set_obstruction(int x, int y, float r, float strength) {
+	int extent = static_cast<int>(fabsf(r + 0.5f));
+	strength = 1.0f - strength;
+
+	for (int iy = -extent; iy <= extent; iy++) {
+		for (int ix = -extent; ix <= extent; ix++) {
+			int idx = get_idx(x + ix, y + iy);
+			if (idx < 0) continue;
 
+			if (strength < obstruction[idx])
+				obstruction[idx] = strength;
+		}
+	}
 }
 
-// the simulation happens entirely in fourier space, which means that get_display
-// has to do an inverse fourier transform to get back to spatial data
-void EWaveSurface::sim_frame(float delta) {
+void EWaveSurface::reset() {
+	const size_t bufferSize = sizeof(float) * bufferCount;
+	SETZERO(source);
+	SETZERO(velocityPotential);
+	SETZERO(heightGrid);
 
+	// the padding around the visible grid is a wall, otherwise waves would wrap around the edges
+	SETZERO(obstruction);
+	for (int y = 0; y < height; y++)
+		std::fill_n(&obstruction[y * fftWidth], width, 1.0f);
 }
 
-void EWaveSurface::reset() {
+// the propagator tables notice these changing on their own
+int EWaveSurface::get_params(float* out) const {
+	out[0] = gravity;
+	out[1] = damping;
+	return 2;
+}
+
+void EWaveSurface::set_params(const float* values, int count) {
+	if (count != 2) return;
 
+	gravity = values[0];
+	damping = values[1];
+}
+
+static constexpr uint32_t SNAPSHOT_KIND = snapshot::id("EWAV");
+static constexpr uint32_t VELOCITY_POTENTIAL = snapshot::id("VPOT");
+
+// the whole padded grid is saved, the walls around the visible part compress to nothing
+// the spectra are recomputed from these every step, so they don't need saving
+bool EWaveSurface::save_state(const char* path, bool lossy) {
+	const snapshot::Encoding fields = lossy ? snapshot::Encoding::Quantized : snapshot::Encoding::Lossless;
+
+	SnapshotWriter writer;
+	if (!writer.open(path, SNAPSHOT_KIND, 4)) return false;
+
+	writer.write_channel(snapshot::CURRENT, heightGrid, fftWidth, fftHeight, 1, fields);
+	writer.write_channel(VELOCITY_POTENTIAL, velocityPotential, fftWidth, fftHeight, 1, fields);
+	writer.write_channel(snapshot::OBSTRUCTION, obstruction, fftWidth, fftHeight, 1, snapshot::Encoding::Lossless);
+	writer.write_channel(snapshot::SOURCE, source, fftWidth, fftHeight, 1, snapshot::Encoding::Lossless);
+	return writer.close();
+}
+
+bool EWaveSurface::load_state(const char* path) {
+	SnapshotReader reader;
+	if (!reader.open(path) || reader.get_kind() != SNAPSHOT_KIND) return false;
+
+	const uint32_t channels[] = { snapshot::CURRENT, VELOCITY_POTENTIAL, snapshot::OBSTRUCTION, snapshot::SOURCE };
+	for (uint32_t id : channels) {
+		const snapshot::Channel* channel = reader.find(id);
+		if (!channel || channel->width != fftWidth || channel->height != fftHeight || channel->components != 1)
+			return false;
+	}
+
+	// same as IWaveSurface, a corrupt block past this point resets instead of leaving half a state
+	bool loaded = reader.read_grid(snapshot::CURRENT, heightGrid, fftWidth, fftHeight)
+		&& reader.read_grid(VELOCITY_POTENTIAL, velocityPotential, fftWidth, fftHeight)
+		&& reader.read_grid(snapshot::OBSTRUCTION, obstruction, fftWidth, fftHeight)
+		&& reader.read_grid(snapshot::SOURCE, source, fftWidth, fftHeight);
+
+	if (!loaded)
+		reset();
+
+	return loaded;
+}
+
+// sources and obstructions are applied in the spatial domain, then both fields are taken to
+// fourier space where each wavenumber is advanced analytically (see build_propagator), and then brought back
+void EWaveSurface::sim_frame(float delta) {
+	for (int i = 0; i < bufferCount; i++) {
+		heightGrid[i] += source[i];
+		heightGrid[i] *= obstruction[i];
+		velocityPotential[i] *= obstruction[i];
+
+		source[i] = 0.0f;
+	}
+
+	if (!tableValid || delta != tableDelta || gravity != tableGravity || damping != tableDamping)
+		build_propagator(delta);
+
+	smath::rfft(fftWidth, fftHeight, fourierHeight, heightGrid);
+	smath::rfft(fftWidth, fftHeight, fourierVelocity, velocityPotential);
+
+	apply_propagator();
+
+	smath::irfft(fftWidth, fftHeight, heightGrid, fourierHeight);
+	smath::irfft(fftWidth, fftHeight, velocityPotential, fourierVelocity);
 }
 
 GLuint EWaveSurface::get_display() {
+	if (!displayPixels) return { 0 };
+
+	// same coloring as the iWave CPU version
+	float extents = 5.0f;
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int idx = get_idx(x, y);
+			uint8_t* pixel = reinterpret_cast<uint8_t*>(&displayPixels[x + (y * width)]);
+			float h = std::clamp(heightGrid[idx], -extents, extents);
+
+			pixel[0] = pix_from_normalized(1.0f - obstruction[idx]);
+			pixel[1] = 0;
+			pixel[2] = pix_from_normalized((h + extents) / (extents * 2.0f));
+			pixel[3] = 255;
+		}
+	}
 
+	glTextureSubImage2D(displayTexture, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, displayPixels);
 
-	return 0;
-}
\ No newline at end of file
+	return displayTexture;
+}
+
+// only the visible part of the padded grid is uploaded
+GLuint EWaveSurface::get_height_tex() {
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, fftWidth);
+	glTextureSubImage2D(heightTexture, 0, 0, 0, width, height, GL_RED, GL_FLOAT, heightGrid);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+	return heightTexture;
+}
+
+void EWaveSurface::imgui_builder(bool* open) {
+	if (open && *open) {
+		if (ImGui::Begin("EWaveSurface", open, ImGuiWindowFlags_AlwaysAutoResize)) {
+			ImGui::LabelText("Grid", "%d x %d", width, height);
+			ImGui::LabelText("FFT Grid", "%d x %d", fftWidth, fftHeight);
+			ImGui::SliderFloat("Gravity", &gravity, 0.1f, 50.0f);
+			ImGui::SliderFloat("Damping", &damping, 0.0f, 1.0f, "%.4f", ImGuiSliderFlags_Logarithmic);
+		}
+
+		ImGui::End();
+	}
+}
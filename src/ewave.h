@@ -2,29 +2,61 @@
 
 #include "surface_sim.h"
 #include "gl_renderer.h"
+#include "smath.h"
 
 #define EWAVESURFACE_CPU
 
+// set to 1 to pad the grid all the way up to a power of 2
+// otherwise it only gets a border of walls and is rounded up to a size the FFT is fast at
+#define EWAVE_PAD_POWER_OF_2 0
+
 // https://people.computing.clemson.edu/~jtessen/students/goswami_thesis.pdf
 class EWaveSurface : public SurfaceSim {
 	int width, height;
-	float gravity = 1.0f; // this is g in the paper
+
+	// the FFT treats the grid as periodic, so the simulation runs on a padded grid where everything
+	// outside of width x height is treated as an obstruction, otherwise waves would wrap around
+	static constexpr int WALL_BORDER = 32;
+	int fftWidth, fftHeight;
+	int bufferCount = 0; // fftWidth * fftHeight
+	int spectrumWidth = 0; // fftWidth / 2 + 1, the fields are real so only half the spectrum is stored
+	int spectrumCount = 0; // spectrumWidth * fftHeight
 
 	float* obstruction = nullptr;
+	float* source = nullptr;
 	float* velocityPotential = nullptr; // this is phi in the paper
 	float* heightGrid = nullptr; // this is h in the paper
 
-	// 
-	float* fourierVelocity = nullptr;
-	float* fourierHeight = nullptr;
+	// the same values as above, but in fourier space (hermitian packed, see smath::RealFFTPlan2D)
+	Complex* fourierVelocity = nullptr;
+	Complex* fourierHeight = nullptr;
+
+	// per-mode propagator coefficients (see sim_frame), they only depend on the timestep, gravity and damping,
+	// so they're cached and rebuilt when one of those changes instead of doing a sqrt, sin and cos per mode per frame
+	// every value is stored twice, once for the re and once for the im lane of the interleaved spectra,
+	// so the update is one flat loop over the spectra's floats
+	float* propagateCos = nullptr; // d cos(w dt)
+	float* propagateHeight = nullptr; // d (|k|/w) sin(w dt)
+	float* propagateVelocity = nullptr; // d (g/w) sin(w dt)
+	float tableDelta = 0.0f, tableGravity = 0.0f, tableDamping = 0.0f;
+	bool tableValid = false;
+
+	void build_propagator(float delta);
+	void apply_propagator();
 
+	uint32_t* displayPixels = nullptr;
+	GLuint displayTexture = 0;
+	GLuint heightTexture = 0;
 
-	uint32_t* displayPixels;
-	TextureTarget displayTexture;
+	int get_idx(int x, int y) const;
 
 public:
+	float gravity = 9.81f; // this is g in the paper, in cells/s^2
+	float damping = 0.0f; // viscosity of the spectral damping in cells^2/s, short waves die off as e^(-2 damping |k|^2 t)
+
 	EWaveSurface(int w, int h);
 	~EWaveSurface();
+	void clean() override;
 
 	void place_source(int x, int y, float r, float strength) override;
 	void set_obstruction(int x, int y, float r, float strength) override;
@@ -32,5 +64,13 @@ public:
 	void sim_frame(float delta) override;
 
 	void reset() override;
+	int get_params(float* out) const override;
+	void set_params(const float* values, int count) override;
+	bool save_state(const char* path, bool lossy = false) override;
+	bool load_state(const char* path) override;
+
 	GLuint get_display() override;
-};
\ No newline at end of file
+	GLuint get_height_tex() override;
+
+	void imgui_builder(bool* open = nullptr) override;
+};
@@ -1,3 +1,5 @@
+#define _CRT_SECURE_NO_WARNINGS // for fopen
+
 #include "gl_renderer.h"
 
 
@@ -6,21 +8,26 @@
 #include <stdint.h>
 #include <stdlib.h>
 
-void TextureTarget::init(int w, int h, int format) {
-	clean();
-
-	width = w;
-	height = h;
-	texture = Renderer::create_tex(w, h, format);
-
-	glCreateFramebuffers(1, &framebuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// creates a brand new texture + framebuffer pair, TexturePool is the only one that calls this
+static void create_target(TextureTarget& target, int w, int h, int format) {
+	target.width = w;
+	target.height = h;
+	target.format = format;
+	target.texture = Renderer::create_tex(w, h, format);
+
+	glCreateFramebuffers(1, &target.framebuffer);
+	glNamedFramebufferTexture(target.framebuffer, GL_COLOR_ATTACHMENT0, target.texture, 0);
 	
 	// the one texture in this struct will be the only color attachment, and we have no need for depth/stencil buffer
 	// in addition, we're going to attach the texture as a texture2D because other shaders will be sampling them
 	
-	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	GLenum status = glCheckNamedFramebufferStatus(target.framebuffer, GL_FRAMEBUFFER);
 	if (status != GL_FRAMEBUFFER_COMPLETE)
 		fprintf(stderr, "Framebuffer creation error: ");
 
@@ -38,27 +45,63 @@ void TextureTarget::init(int w, int h, int format) {
 		fprintf(stderr, "Attached images have unsupported formats\n");
 		break;
 	}
+}
+
+static void destroy_target(TextureTarget& target) {
+	Renderer::release_handle(target.texture);
+	glDeleteFramebuffers(1, &target.framebuffer);
+	glDeleteTextures(1, &target.texture);
+
+	// deleting bound objects unbinds them, and GL is free to hand the same names out again
+	Renderer::invalidate_state();
+}
+
+TextureTarget::TextureTarget(TextureTarget&& from) noexcept {
+	*this = std::move(from);
+}
+
+TextureTarget& TextureTarget::operator=(TextureTarget&& from) noexcept {
+	if (this == &from)
+		return *this;
 
-	TextureTarget::reset_target();
+	clean();
+	framebuffer = from.framebuffer;
+	texture = from.texture;
+	width = from.width;
+	height = from.height;
+	format = from.format;
+
+	from.framebuffer = 0;
+	from.texture = 0;
+	from.width = 0;
+	from.height = 0;
+	from.format = 0;
+	return *this;
+}
+
+void TextureTarget::init(int w, int h, int format) {
+	clean();
+	TexturePool::acquire(*this, w, h, format);
 }
 
 extern int screenWidth, screenHeight; // from main.cpp
 void TextureTarget::reset_target() {
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glViewport(0, 0, screenWidth, screenHeight);
+	Renderer::bind_framebuffer(0);
+	Renderer::viewport(0, 0, screenWidth, screenHeight);
 }
 
 void TextureTarget::set_target() const {
-	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-	glViewport(0, 0, width, height);
+	Renderer::bind_framebuffer(framebuffer);
+	Renderer::viewport(0, 0, width, height);
 }
 
 void TextureTarget::clean() {
-	glDeleteFramebuffers(1, &framebuffer);
-	glDeleteTextures(1, &texture);
+	if (texture != 0)
+		TexturePool::release(*this);
 
 	width = 0;
 	height = 0;
+	format = 0;
 	texture = 0;
 	framebuffer = 0;
 }
@@ -67,6 +110,153 @@ void TextureTarget::copy_from(const TextureTarget& from) {
 	glCopyImageSubData(from.texture, GL_TEXTURE_2D, 0, 0, 0, 0, texture, GL_TEXTURE_2D, 0, 0, 0, 0, width, height, 1);
 }
 
+//
+// texture pool
+// targets are never deleted when released, they go into a free list keyed by (width, height, format)
+// and get handed out again the next time something asks for the same shape
+//
+TexturePool::Stats TexturePool::stats = {};
+static std::unordered_map<uint64_t, std::vector<TextureTarget>> freeTargets;
+
+static uint64_t pool_key(int w, int h, int format) {
+	return (static_cast<uint64_t>(w) << 40) | (static_cast<uint64_t>(h) << 16) | static_cast<uint64_t>(format & 0xFFFF);
+}
+
+static size_t target_bytes(int w, int h, int format) {
+	int dataFormat = 0, dataType = 0;
+	Renderer::get_format_info(format, dataFormat, dataType);
+	return static_cast<size_t>(w) * h * Renderer::byte_size(dataFormat, dataType);
+}
+
+void TexturePool::acquire(TextureTarget& target, int w, int h, int format) {
+	std::vector<TextureTarget>& targets = freeTargets[pool_key(w, h, format)];
+
+	if (targets.empty()) {
+		create_target(target, w, h, format);
+		stats.misses++;
+		stats.residentBytes += target_bytes(w, h, format);
+	} else {
+		target = std::move(targets.back());
+		targets.pop_back();
+		stats.hits++;
+		stats.idle--;
+
+		// callers expect a new target to start out zeroed
+		int dataFormat = 0, dataType = 0;
+		Renderer::get_format_info(format, dataFormat, dataType);
+		glClearTexImage(target.texture, 0, dataFormat, dataType, nullptr);
+	}
+
+	stats.live++;
+}
+
+void TexturePool::release(TextureTarget& target) {
+	freeTargets[pool_key(target.width, target.height, target.format)].push_back(std::move(target));
+	stats.live--;
+	stats.idle++;
+}
+
+void TexturePool::reserve(int w, int h, int format, int count) {
+	std::vector<TextureTarget>& targets = freeTargets[pool_key(w, h, format)];
+
+	while (static_cast<int>(targets.size()) < count) {
+		TextureTarget target;
+		create_target(target, w, h, format);
+		targets.push_back(std::move(target));
+
+		stats.idle++;
+		stats.residentBytes += target_bytes(w, h, format);
+	}
+}
+
+void TexturePool::trim() {
+	for (auto& [key, targets] : freeTargets) {
+		for (TextureTarget& target : targets) {
+			stats.residentBytes -= target_bytes(target.width, target.height, target.format);
+			destroy_target(target);
+		}
+
+		targets.clear();
+	}
+
+	stats.idle = 0;
+}
+
+void ReadbackRing::init(size_t bytes) {
+	clean();
+
+	capacity = bytes;
+	for (Slot& slot : slots) {
+		glCreateBuffers(1, &slot.buffer);
+		glNamedBufferStorage(slot.buffer, capacity, nullptr, GL_CLIENT_STORAGE_BIT);
+	}
+}
+
+void ReadbackRing::clean() {
+	for (Slot& slot : slots) {
+		if (slot.fence)
+			glDeleteSync(slot.fence);
+		if (slot.buffer)
+			glDeleteBuffers(1, &slot.buffer);
+
+		slot = Slot();
+	}
+
+	capacity = 0;
+	next = 0;
+}
+
+bool ReadbackRing::push(GLuint source, size_t bytes, int tag) {
+	if (bytes > capacity) return false;
+
+	if (full()) return false;
+	Slot& slot = slots[next];
+
+	glCopyNamedBufferSubData(source, slot.buffer, 0, 0, bytes);
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.used = bytes;
+	slot.tag = tag;
+
+	next = (next + 1) % SLOT_COUNT;
+	return true;
+}
+
+bool ReadbackRing::pop(int tag, void* output) {
+	for (Slot& slot : slots) {
+		if (slot.tag != tag || tag < 0) continue;
+
+		// a timeout of 0 only polls the fence, it won't flush or wait
+		GLenum status = glClientWaitSync(slot.fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			return false;
+
+		// the copy has landed by now, so this doesn't stall
+		glGetNamedBufferSubData(slot.buffer, 0, slot.used, output);
+
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+		slot.used = 0;
+		slot.tag = -1;
+		return true;
+	}
+
+	return false;
+}
+
+bool ReadbackRing::pending(int tag) const {
+	for (const Slot& slot : slots) {
+		if (slot.tag == tag && tag >= 0)
+			return true;
+	}
+
+	return false;
+}
+
+// slots are handed out round robin, so if the next one is still taken then every slot is
+bool ReadbackRing::full() const {
+	return slots[next].tag >= 0;
+}
+
 // we probably won't use all of these texture formats, but the initialization for them are here if we ever do
 int Renderer::byte_size(int format, int type) {
 	int size = 0;
@@ -124,8 +314,6 @@ int Renderer::byte_size(int format, int type) {
 
 // like the above function, this function probably does not cover every OpenGL sized texture format
 void Renderer::get_format_info(int internalFormat, int& dataFormat, int& dataType) {
-	if (!dataFormat || !dataType) return;
-	
 	switch (internalFormat) {
 	case GL_R8:
 	case GL_R16:
@@ -253,75 +441,245 @@ float regularVertices[QUAD_VERTICES_LENGTH] = {
 	  1.0f,  1.0f, 1.0f, 1.0f,  // Top-right
 };
 
+// position (xy) and uv (zw) interleaved
+static GLuint create_quad_vao(GLuint vbo) {
+	GLuint vao = 0;
+	glCreateVertexArrays(1, &vao);
+	glVertexArrayVertexBuffer(vao, 0, vbo, 0, sizeof(float) * 4);
+
+	glEnableVertexArrayAttrib(vao, 0);
+	glVertexArrayAttribFormat(vao, 0, 2, GL_FLOAT, GL_FALSE, 0);
+	glVertexArrayAttribBinding(vao, 0, 0);
+
+	glEnableVertexArrayAttrib(vao, 1);
+	glVertexArrayAttribFormat(vao, 1, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2);
+	glVertexArrayAttribBinding(vao, 1, 0);
+
+	return vao;
+}
+
+static void init_bindless(); // further down with the rest of the bindless code
 void Renderer::init() {
+	init_bindless();
+
 	// create quad vao and quad vbo
-	glGenVertexArrays(1, &quadVao);
-	glBindVertexArray(quadVao);
-	glGenBuffers(1, &quadVbo);
-	glBindBuffer(GL_ARRAY_BUFFER, quadVbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(regularVertices), regularVertices, GL_STATIC_DRAW);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 2, GL_FLOAT, false, sizeof(float) * 4, (void*)0);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 2, GL_FLOAT, false, sizeof(float) * 4, (void*)(sizeof(float) * 2));
-	glBindVertexArray(0);
-
-	// create transformed quad vao and vbo... this will be a dynamic draw vbo
-	glGenVertexArrays(1, &tQuadVao);
-	glBindVertexArray(tQuadVao);
-	glGenBuffers(1, &tQuadVbo);
-	glBindBuffer(GL_ARRAY_BUFFER, tQuadVbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(regularVertices), regularVertices, GL_DYNAMIC_DRAW);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 2, GL_FLOAT, false, sizeof(float) * 4, (void*)0);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 2, GL_FLOAT, false, sizeof(float) * 4, (void*)(sizeof(float) * 2));
-	glBindVertexArray(0);
+	glCreateBuffers(1, &quadVbo);
+	glNamedBufferStorage(quadVbo, sizeof(regularVertices), regularVertices, 0);
+	quadVao = create_quad_vao(quadVbo);
+
+	// create transformed quad vao and vbo... this one gets rewritten on every draw
+	glCreateBuffers(1, &tQuadVbo);
+	glNamedBufferStorage(tQuadVbo, sizeof(regularVertices), regularVertices, GL_DYNAMIC_STORAGE_BIT);
+	tQuadVao = create_quad_vao(tQuadVbo);
 
 	flippedShader = compile_shader(flippedVertexSource, sampleTextureFragSource);
+
+	invalidate_state();
 }
 
 void Renderer::cleanup() {
 	// TODO... I'm not really concerned about end-of-program cleanup right now
 }
 
-void Renderer::sampler_settings() {
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+void Renderer::sampler_settings(GLuint texture) {
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 }
 
+// textures get immutable storage, so they can only be resized by making a new one
 GLuint Renderer::create_tex(int w, int h, int format, const void* data) {
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
 	GLuint tex = 0;
-	glGenTextures(1, &tex);
+	glCreateTextures(GL_TEXTURE_2D, 1, &tex);
+	sampler_settings(tex);
+	glTextureStorage2D(tex, 1, format, w, h);
 
-	glBindTexture(GL_TEXTURE_2D, tex);
-	sampler_settings();
-
-	int dataFormat, dataType;
+	int dataFormat = 0, dataType = 0;
 	get_format_info(format, dataFormat, dataType);
 
 	if (!data) {
-		void* initialData = calloc(1, w * h * byte_size(dataFormat, dataType));
-		glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0, dataFormat, dataType, initialData);
-		free(initialData);
+		// a null pointer clears to zero
+		glClearTexImage(tex, 0, dataFormat, dataType, nullptr);
 	} else {
-		glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0, dataFormat, dataType, data);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTextureSubImage2D(tex, 0, 0, 0, w, h, dataFormat, dataType, data);
 	}
 
-	glBindTexture(GL_TEXTURE_2D, 0);
-
 	return tex;
 }
 
+//
+// program binary cache
+// linked programs are saved to disk with glGetProgramBinary and loaded back with glProgramBinary,
+// so we only pay for compilation the first time a shader (or the driver) changes
+//
+const char* Renderer::shaderCacheDir = "shader_cache";
+int Renderer::cacheHits = 0;
+int Renderer::cacheMisses = 0;
+
+struct ProgramCacheHeader {
+	uint32_t magic;
+	uint32_t binaryFormat;
+	uint64_t driverHash;
+	uint64_t sourceHash;
+	uint32_t length;
+};
+static constexpr uint32_t PROGRAM_CACHE_MAGIC = 0x57505243; // "WPRC"
+
+// FNV-1a, which is plenty for telling shader sources apart
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t len) {
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+static uint64_t hash_string(uint64_t hash, const char* str) {
+	// include the terminator so that ("ab", "c") and ("a", "bc") hash differently
+	return hash_bytes(hash, str, strlen(str) + 1);
+}
+
+static constexpr uint64_t HASH_SEED = 0xcbf29ce484222325ull;
+
+// vendor, renderer and version together identify a driver build well enough for binary compatibility
+static uint64_t driver_hash() {
+	static uint64_t hash = 0;
+	if (hash == 0) {
+		hash = HASH_SEED;
+		hash = hash_string(hash, reinterpret_cast<const char*>(glGetString(GL_VENDOR)));
+		hash = hash_string(hash, reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+		hash = hash_string(hash, reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+	}
+
+	return hash;
+}
+
+static void cache_path(char* path, size_t len, uint64_t sourceHash) {
+	snprintf(path, len, "%s/%016llx.bin", Renderer::shaderCacheDir, static_cast<unsigned long long>(sourceHash));
+}
+
+// returns 0 if there is no usable binary for this source
+static GLuint load_cached_program(uint64_t sourceHash) {
+	char path[256];
+	cache_path(path, sizeof(path), sourceHash);
+
+	FILE* file = fopen(path, "rb");
+	if (!file) return 0;
+
+	ProgramCacheHeader header;
+	void* binary = nullptr;
+	bool valid = 1 == fread(&header, sizeof(header), 1, file)
+		&& header.magic == PROGRAM_CACHE_MAGIC
+		&& header.driverHash == driver_hash()
+		&& header.sourceHash == sourceHash
+		&& header.length > 0;
+
+	if (valid) {
+		binary = malloc(header.length);
+		valid = binary && 1 == fread(binary, header.length, 1, file);
+	}
+
+	fclose(file);
+
+	GLuint program = 0;
+	if (valid) {
+		program = glCreateProgram();
+		glProgramBinary(program, header.binaryFormat, binary, static_cast<GLsizei>(header.length));
+
+		// drivers are allowed to reject binaries for any reason, in which case we just recompile
+		GLint success;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		if (GL_TRUE != success) {
+			Renderer::delete_program(program);
+			program = 0;
+		}
+	}
+
+	free(binary);
+	return program;
+}
+
+static void save_cached_program(GLuint program, uint64_t sourceHash) {
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) return;
+
+	void* binary = malloc(length);
+	if (!binary) return;
+
+	ProgramCacheHeader header = {};
+	header.magic = PROGRAM_CACHE_MAGIC;
+	header.driverHash = driver_hash();
+	header.sourceHash = sourceHash;
+
+	GLenum binaryFormat = 0;
+	GLsizei written = 0;
+	glGetProgramBinary(program, length, &written, &binaryFormat, binary);
+	header.binaryFormat = binaryFormat;
+	header.length = static_cast<uint32_t>(written);
+
+	std::error_code error;
+	std::filesystem::create_directories(Renderer::shaderCacheDir, error);
+
+	char path[256];
+	cache_path(path, sizeof(path), sourceHash);
+
+	FILE* file = fopen(path, "wb");
+	if (file) {
+		fwrite(&header, sizeof(header), 1, file);
+		fwrite(binary, written, 1, file);
+		fclose(file);
+	}
+
+	free(binary);
+}
+
+float Renderer::cache_hit_rate() {
+	int total = cacheHits + cacheMisses;
+	return total > 0 ? static_cast<float>(cacheHits) / static_cast<float>(total) : 0.0f;
+}
+
+// goes right after the #version line of every shader
+static const char* bindlessPrelude = R"(
+#extension GL_ARB_bindless_texture : require
+#define TEXTURE layout (bindless_sampler) uniform
+)";
+
+static const char* boundPrelude = R"(
+#define TEXTURE uniform
+)";
+
+static std::string add_prelude(const char* source) {
+	std::string result = source;
+	size_t version = result.find("#version");
+	size_t lineEnd = version == std::string::npos ? 0 : result.find('\n', version);
+	if (lineEnd == std::string::npos)
+		lineEnd = result.size();
+
+	result.insert(lineEnd, Renderer::useBindless ? bindlessPrelude : boundPrelude);
+	return result;
+}
+
 static char compilationLog[1024];
-GLuint Renderer::compile_shader(const char* vs, const char* fs) {
+GLuint Renderer::compile_shader(const char* vsSource, const char* fsSource) {
+	std::string vertexFull = add_prelude(vsSource);
+	std::string fragFull = add_prelude(fsSource);
+	const char* vs = vertexFull.c_str();
+	const char* fs = fragFull.c_str();
+
+	uint64_t sourceHash = hash_string(hash_string(HASH_SEED, vs), fs);
+
+	GLuint program = load_cached_program(sourceHash);
+	if (program) {
+		cacheHits++;
+		return program;
+	}
+	cacheMisses++;
+
 	GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
 	GLuint fragShader = glCreateShader(GL_FRAGMENT_SHADER);
 
@@ -347,7 +705,8 @@ GLuint Renderer::compile_shader(const char* vs, const char* fs) {
 		fprintf(stderr, "ERROR: Shader compilation failed!\n\t%s\n", compilationLog);
 	}
 
-	GLuint program = glCreateProgram();
+	program = glCreateProgram();
+	glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glAttachShader(program, vertexShader);
 	glAttachShader(program, fragShader);
 	glLinkProgram(program);
@@ -356,6 +715,8 @@ GLuint Renderer::compile_shader(const char* vs, const char* fs) {
 	if (GL_TRUE != success) {
 		glGetProgramInfoLog(program, 1024, nullptr, compilationLog);
 		fprintf(stderr, "ERROR: Shader linking failed!\n\t%s\n", compilationLog);
+	} else {
+		save_cached_program(program, sourceHash);
 	}
 
 	glDeleteShader(vertexShader);
@@ -364,7 +725,19 @@ GLuint Renderer::compile_shader(const char* vs, const char* fs) {
 	return program;
 }
 
-GLuint Renderer::compile_shader(const char* cs) {
+GLuint Renderer::compile_shader(const char* csSource) {
+	std::string computeFull = add_prelude(csSource);
+	const char* cs = computeFull.c_str();
+
+	uint64_t sourceHash = hash_string(HASH_SEED, cs);
+
+	GLuint program = load_cached_program(sourceHash);
+	if (program) {
+		cacheHits++;
+		return program;
+	}
+	cacheMisses++;
+
 	GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
 
 	GLint computeLen = static_cast<GLint>(strlen(cs));
@@ -379,7 +752,8 @@ GLuint Renderer::compile_shader(const char* cs) {
 		fprintf(stderr, "ERROR: Compute shader compilation failed!\n\t%s\n", compilationLog);
 	}
 	
-	GLuint program = glCreateProgram();
+	program = glCreateProgram();
+	glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	
 	glAttachShader(program, computeShader);
 	glLinkProgram(program);
@@ -388,6 +762,8 @@ GLuint Renderer::compile_shader(const char* cs) {
 	if (GL_TRUE != success) {
 		glGetProgramInfoLog(program, 1024, nullptr, compilationLog);
 		fprintf(stderr, "ERROR: Compute shader linking failed!\n\t%s\n", compilationLog);
+	} else {
+		save_cached_program(program, sourceHash);
 	}
 	
 	glDeleteShader(computeShader);
@@ -397,17 +773,207 @@ GLuint Renderer::compile_shader(const char* cs) {
 //
 // these functions exist more for organizational purposes than functional
 //
+
+// keyed by program name, which GL hands out again once a program is deleted, so delete_program drops its entry
+static std::unordered_map<GLuint, std::unordered_map<std::string, GLint>> locations;
+
 GLint Renderer::shader_loc(GLuint shader, const char* location) {
-	return glGetUniformLocation(shader, location);
+	auto& programLocations = locations[shader];
+	auto it = programLocations.find(location);
+	if (it != programLocations.end())
+		return it->second;
+
+	GLint loc = glGetUniformLocation(shader, location);
+	programLocations.emplace(location, loc);
+	return loc;
+}
+
+//
+// GL state tracking
+// the simulation passes all set their own state, so most of the changes they ask for end up being redundant
+//
+static constexpr GLuint UNKNOWN = 0xFFFFFFFF;
+static constexpr int MAX_TEXTURE_SLOTS = 32;
+
+// only the capabilities we actually toggle get tracked, anything else goes straight to GL
+static constexpr GLenum TRACKED_CAPABILITIES[] = { GL_DEPTH_TEST, GL_BLEND, GL_CULL_FACE };
+static constexpr int TRACKED_CAPABILITY_COUNT = sizeof(TRACKED_CAPABILITIES) / sizeof(GLenum);
+
+static struct {
+	GLuint program;
+	GLuint framebuffer;
+	GLuint vao;
+	GLuint textures[MAX_TEXTURE_SLOTS];
+	int viewport[4];
+	int capabilities[TRACKED_CAPABILITY_COUNT]; // -1 = unknown
+} state;
+
+int Renderer::callsIssued = 0;
+int Renderer::callsSkipped = 0;
+
+// returns true if the call should go through to GL
+static bool update_state(GLuint& cached, GLuint value) {
+	if (cached == value) {
+		Renderer::callsSkipped++;
+		return false;
+	}
+
+	cached = value;
+	Renderer::callsIssued++;
+	return true;
+}
+
+void Renderer::invalidate_state() {
+	state.program = UNKNOWN;
+	state.framebuffer = UNKNOWN;
+	state.vao = UNKNOWN;
+
+	for (GLuint& texture : state.textures)
+		texture = UNKNOWN;
+	for (int& v : state.viewport)
+		v = -1;
+	for (int& capability : state.capabilities)
+		capability = -1;
+}
+
+void Renderer::reset_call_stats() {
+	callsIssued = 0;
+	callsSkipped = 0;
+}
+
+void Renderer::use_program(GLuint program) {
+	if (update_state(state.program, program))
+		glUseProgram(program);
+}
+
+void Renderer::bind_framebuffer(GLuint framebuffer) {
+	if (update_state(state.framebuffer, framebuffer))
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+void Renderer::bind_vertex_array(GLuint vao) {
+	if (update_state(state.vao, vao))
+		glBindVertexArray(vao);
+}
+
+void Renderer::viewport(int x, int y, int w, int h) {
+	int* v = state.viewport;
+	if (v[0] == x && v[1] == y && v[2] == w && v[3] == h) {
+		callsSkipped++;
+		return;
+	}
+
+	v[0] = x;
+	v[1] = y;
+	v[2] = w;
+	v[3] = h;
+	callsIssued++;
+	glViewport(x, y, w, h);
+}
+
+void Renderer::set_capability(GLenum capability, bool enabled) {
+	for (int i = 0; i < TRACKED_CAPABILITY_COUNT; i++) {
+		if (TRACKED_CAPABILITIES[i] != capability) continue;
+
+		if (state.capabilities[i] == static_cast<int>(enabled)) {
+			callsSkipped++;
+			return;
+		}
+
+		state.capabilities[i] = static_cast<int>(enabled);
+		break;
+	}
+
+	callsIssued++;
+	if (enabled)
+		glEnable(capability);
+	else
+		glDisable(capability);
+}
+
+void Renderer::pass_state() {
+	set_capability(GL_DEPTH_TEST, false);
+	set_capability(GL_BLEND, false);
+	set_capability(GL_CULL_FACE, false);
+}
+
+void Renderer::delete_program(GLuint program) {
+	if (program == 0) return;
+
+	locations.erase(program);
+	if (state.program == program)
+		state.program = UNKNOWN;
+
+	glDeleteProgram(program);
+}
+
+//
+// bindless textures
+// the entry points aren't part of core GL so gl3w doesn't load them for us
+//
+bool Renderer::bindlessSupported = false;
+bool Renderer::useBindless = false;
+
+static PFNGLGETTEXTUREHANDLEARBPROC getTextureHandle = nullptr;
+static PFNGLMAKETEXTUREHANDLERESIDENTARBPROC makeHandleResident = nullptr;
+static PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC makeHandleNonResident = nullptr;
+static PFNGLPROGRAMUNIFORMHANDLEUI64ARBPROC programUniformHandle = nullptr;
+
+static std::unordered_map<GLuint, GLuint64> residentHandles;
+
+static void init_bindless() {
+	GLint extensionCount = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+
+	bool found = false;
+	for (GLint i = 0; i < extensionCount && !found; i++) {
+		const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+		found = 0 == strcmp(extension, "GL_ARB_bindless_texture");
+	}
+
+	if (!found) return;
+
+	getTextureHandle = reinterpret_cast<PFNGLGETTEXTUREHANDLEARBPROC>(gl3wGetProcAddress("glGetTextureHandleARB"));
+	makeHandleResident = reinterpret_cast<PFNGLMAKETEXTUREHANDLERESIDENTARBPROC>(gl3wGetProcAddress("glMakeTextureHandleResidentARB"));
+	makeHandleNonResident = reinterpret_cast<PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC>(gl3wGetProcAddress("glMakeTextureHandleNonResidentARB"));
+	programUniformHandle = reinterpret_cast<PFNGLPROGRAMUNIFORMHANDLEUI64ARBPROC>(gl3wGetProcAddress("glProgramUniformHandleui64ARB"));
+
+	Renderer::bindlessSupported = getTextureHandle && makeHandleResident && makeHandleNonResident && programUniformHandle;
+	Renderer::useBindless = Renderer::bindlessSupported;
+}
+
+GLuint64 Renderer::texture_handle(GLuint texture) {
+	auto it = residentHandles.find(texture);
+	if (it != residentHandles.end())
+		return it->second;
+
+	// this freezes the texture's sampler state, which is fine since we never change it after creation
+	GLuint64 handle = getTextureHandle(texture);
+	makeHandleResident(handle);
+	residentHandles.emplace(texture, handle);
+	return handle;
+}
+
+void Renderer::release_handle(GLuint texture) {
+	auto it = residentHandles.find(texture);
+	if (it == residentHandles.end()) return;
+
+	makeHandleNonResident(it->second);
+	residentHandles.erase(it);
+}
+
+void Renderer::uniform_handle(GLuint shader, GLint location, GLuint texture) {
+	programUniformHandle(shader, location, texture_handle(texture));
 }
 
 void Renderer::bind_tex(GLuint textureSlot, GLuint texture) {
-	glActiveTexture(GL_TEXTURE0 + textureSlot);
-	glBindTexture(GL_TEXTURE_2D, texture);
+	// DSA binding doesn't go through the active texture unit, so that's one less call to track
+	if (textureSlot >= MAX_TEXTURE_SLOTS || update_state(state.textures[textureSlot], texture))
+		glBindTextureUnit(textureSlot, texture);
 }
 
 void Renderer::uniform_tex(GLuint shader, GLuint slot, GLint location) {
-	glUseProgram(shader);
+	use_program(shader);
 	glUniform1i(location, slot);
 }
 
@@ -419,21 +985,21 @@ void Renderer::attach_tex(GLuint shader, GLint location, GLuint texture, GLuint
 }
 
 void Renderer::draw_quad() {
-	glBindVertexArray(quadVao);
+	bind_vertex_array(quadVao);
 	glDrawArrays(GL_TRIANGLES, 0, 6);
-	glBindVertexArray(0);
 }
 
 void Renderer::draw_transformed_quad(float x, float y, float w, float h) {
-	glBindVertexArray(tQuadVao);
+	bind_vertex_array(tQuadVao);
 
-	float width = 0.0f, height = 0.0f;
-	{
+	// the cached viewport saves a round trip to the driver
+	if (state.viewport[2] < 0) {
 		GLint viewport[4];
 		glGetIntegerv(GL_VIEWPORT, viewport);
-		width = static_cast<float>(viewport[2] - viewport[0]);
-		height = static_cast<float>(viewport[3] - viewport[1]);
+		Renderer::viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
 	}
+	float width = static_cast<float>(state.viewport[2] - state.viewport[0]);
+	float height = static_cast<float>(state.viewport[3] - state.viewport[1]);
 
 	// transform the vertices on the CPU and update the buffer
 	float newVertices[QUAD_VERTICES_LENGTH];
@@ -444,15 +1010,10 @@ void Renderer::draw_transformed_quad(float x, float y, float w, float h) {
 		newVertices[i + 1] = newVertices[i + 1] * (h / height) + (2.0f * y / height) - 1.0f;
 	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, tQuadVbo);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(regularVertices), newVertices);
+	glNamedBufferSubData(tQuadVbo, 0, sizeof(regularVertices), newVertices);
 
-	glDisable(GL_DEPTH_TEST);
-	glDisable(GL_CULL_FACE);
+	set_capability(GL_DEPTH_TEST, false);
+	set_capability(GL_CULL_FACE, false);
 
 	glDrawArrays(GL_TRIANGLES, 0, 6);
-	glBindVertexArray(0);
-
-	glEnable(GL_CULL_FACE);
-	glEnable(GL_DEPTH_TEST);
 }
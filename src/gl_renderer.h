@@ -1,12 +1,23 @@
 #pragma once
 
 #include <GL/glcorearb.h> // for GL types
+#include <stddef.h> // for size_t
 
 struct TextureTarget {
-	GLuint framebuffer;
-	GLuint texture;
-	int width, height;
+	GLuint framebuffer = 0;
+	GLuint texture = 0;
+	int width = 0, height = 0;
+	int format = 0;
 
+	// a copy that got cleaned would hand the same texture back to the pool a second time, so targets only move
+	// moving leaves the source empty
+	TextureTarget() = default;
+	TextureTarget(const TextureTarget&) = delete;
+	TextureTarget& operator=(const TextureTarget&) = delete;
+	TextureTarget(TextureTarget&& from) noexcept;
+	TextureTarget& operator=(TextureTarget&& from) noexcept;
+
+	// these take from and give back to TexturePool, so they're cheap after the first time
 	void init(int w, int h, int format = GL_R32F);
 	void clean();
 
@@ -16,6 +27,57 @@ struct TextureTarget {
 	void copy_from(const TextureTarget& from);
 };
 
+// recycles immutable texture + framebuffer pairs so that creating/destroying surfaces doesn't churn GL allocations
+class TexturePool {
+public:
+	struct Stats {
+		int hits, misses;
+		int live, idle; // targets handed out, and targets waiting in the pool
+		size_t residentBytes; // texture memory owned by the pool, live or idle
+	};
+	static Stats stats;
+
+	static void acquire(TextureTarget& target, int w, int h, int format);
+	static void release(TextureTarget& target);
+
+	// creates targets up front so that later acquires don't allocate
+	static void reserve(int w, int h, int format, int count);
+
+	// actually deletes all idle targets
+	static void trim();
+};
+
+// a small ring of plain buffers that GPU data gets copied into (glCopyNamedBufferSubData), each copy
+// guarded by a fence, so it can be read back a frame or two later without waiting on the pipeline
+struct ReadbackRing {
+	static constexpr int SLOT_COUNT = 3;
+
+	struct Slot {
+		GLuint buffer = 0;
+		GLsync fence = nullptr;
+		size_t used = 0; // in bytes
+		int tag = -1; // -1 means the slot is free
+	};
+
+	Slot slots[SLOT_COUNT];
+	size_t capacity = 0;
+	int next = 0;
+
+	void init(size_t bytes);
+	void clean();
+
+	// copies `bytes` from the start of source into a free slot and fences it
+	// returns false if every slot is still waiting to be read
+	bool push(GLuint source, size_t bytes, int tag);
+
+	// never blocks, returns false if the tag isn't done yet (or doesn't exist)
+	// output needs to hold at least as many bytes as were pushed
+	bool pop(int tag, void* output);
+
+	bool pending(int tag) const;
+	bool full() const;
+};
+
 // this project is simple enough that I'll just leave this as a singleton
 class Renderer {
 	static GLuint tQuadVao, tQuadVbo;
@@ -36,7 +98,7 @@ public:
 	static void get_format_info(int internalFormat, int& dataFormat, int& dataType);
 
 	// used to organize a few opengl calls
-	static void sampler_settings();
+	static void sampler_settings(GLuint texture);
 	static GLuint create_tex(int w, int h, int format = GL_R32F, const void* data = nullptr);
 
 	// for vertex/fragment pipelines
@@ -44,9 +106,48 @@ public:
 
 	// for compute pipelines
 	static GLuint compile_shader(const char* cs);
+
+	// both compile_shader functions insert a small prelude after the #version line, which defines
+	// TEXTURE as the qualifier for sampler uniforms (bindless or regular, see below)
+	// they also go through an on-disk program binary cache
+	static const char* shaderCacheDir;
+	static int cacheHits, cacheMisses;
+	static float cache_hit_rate();
 	
+	// locations are cached per program, so this is cheap to call every frame
 	static GLint shader_loc(GLuint shader, const char* location);
 
+	// programs have to be deleted through this, GL reuses their names and the location cache would go stale
+	static void delete_program(GLuint program);
+
+	// cached GL state, these skip the GL call when the state wouldn't change
+	static void use_program(GLuint program);
+	static void bind_framebuffer(GLuint framebuffer);
+	static void bind_vertex_array(GLuint vao);
+	static void viewport(int x, int y, int w, int h);
+	static void set_capability(GLenum capability, bool enabled);
+
+	// turns depth testing, blending and culling off for the fullscreen passes that render into TextureTargets
+	// nothing is restored afterwards, so anything that needs one of them (the 3D views) turns it on itself
+	// through set_capability, and anything that changes GL state behind Renderer's back has to call
+	// invalidate_state before the next pass
+	static void pass_state();
+
+	// call after anything outside of Renderer might have changed GL state
+	static void invalidate_state();
+
+	// how many state changes went through to the driver, and how many were skipped as redundant
+	static int callsIssued, callsSkipped;
+	static void reset_call_stats();
+
+	// GL_ARB_bindless_texture, only used when the driver supports it
+	// with it, samplers declared as TEXTURE take resident handles instead of texture units
+	static bool bindlessSupported;
+	static bool useBindless; // has to be decided before any shaders are compiled
+	static GLuint64 texture_handle(GLuint texture); // makes the texture resident the first time
+	static void release_handle(GLuint texture); // has to be called before a texture with a handle is deleted
+	static void uniform_handle(GLuint shader, GLint location, GLuint texture);
+
 	static void bind_tex(GLuint textureSlot, GLuint texture);
 	static void uniform_tex(GLuint shader, GLuint texture, GLint location);
 	static void attach_tex(GLuint shader, GLint location, GLuint texture, GLuint textureSlot);
@@ -0,0 +1,651 @@
+#define _CRT_SECURE_NO_WARNINGS // for fopen
+#include "height_sequence.h"
+
+#include <stdlib.h> // for malloc/free
+#include <string.h>
+#include <algorithm>
+#include <bit>
+
+#include <GL/gl3w.h>
+#include "snapshot.h"
+#include "thread_pool.h"
+#include "varint.h"
+
+using namespace sequence;
+
+static constexpr uint32_t SEQUENCE_MAGIC = snapshot::id("WSEQ");
+static constexpr uint32_t SEQUENCE_VERSION = 1;
+
+// 32 rows of a 1024 wide grid is about 64 KB of heights, enough bands to go around the cores
+static constexpr int BAND_ROWS = 32;
+
+// residuals are Rice coded in groups of GROUP, each group starting with its 5 bit parameter
+// ZERO_GROUP as the parameter means every residual in the group is 0 and nothing else follows
+// a quotient of ESCAPE or more is written as ESCAPE ones followed by the raw 32 bit value
+static constexpr int GROUP = 16;
+static constexpr uint32_t ZERO_GROUP = 31;
+static constexpr int MAX_PARAMETER = 20;
+static constexpr uint32_t ESCAPE = 24;
+
+static_assert(sizeof(Header) == 32, "sequence header layout");
+static_assert(sizeof(Frame) == 8, "sequence frame layout");
+
+static int band_count(int height) {
+	return (height + BAND_ROWS - 1) / BAND_ROWS;
+}
+
+// worst case for one band, every value escaped
+static size_t band_bound(int cells) {
+	return static_cast<size_t>(cells) * 8 + static_cast<size_t>(cells / GROUP + 1) + 8;
+}
+
+//
+// bit streams
+//
+
+// least significant bit first, written 32 bits at a time
+struct BitWriter {
+	uint8_t* out;
+	uint64_t bits = 0;
+	int count = 0;
+
+	explicit BitWriter(uint8_t* output) : out(output) {}
+
+	// value can't have anything above its lowest n bits, n is at most 32
+	void put(uint32_t value, int n) {
+		bits |= static_cast<uint64_t>(value) << count;
+		count += n;
+
+		if (count >= 32) {
+			uint32_t word = static_cast<uint32_t>(bits);
+			memcpy(out, &word, sizeof(word));
+			out += sizeof(word);
+			bits >>= 32;
+			count -= 32;
+		}
+	}
+
+	uint8_t* finish() {
+		while (count > 0) {
+			*out++ = static_cast<uint8_t>(bits);
+			bits >>= 8;
+			count -= 8;
+		}
+
+		count = 0;
+		return out;
+	}
+};
+
+// reads past the end as zeros, and remembers that it did, so broken streams can't read out of bounds
+struct BitReader {
+	const uint8_t* in;
+	const uint8_t* end;
+	uint64_t bits = 0;
+	int count = 0;
+	size_t padding = 0; // zero bytes made up past the end
+
+	BitReader(const uint8_t* data, size_t bytes) : in(data), end(data + bytes) {}
+
+	// afterwards there are at least 57 bits to take
+	void refill() {
+		if (end - in >= 8) {
+			uint64_t word;
+			memcpy(&word, in, sizeof(word));
+			bits |= word << count;
+			in += (63 - count) >> 3;
+			count |= 56;
+			return;
+		}
+
+		while (count <= 56) {
+			if (in < end)
+				bits |= static_cast<uint64_t>(*in++) << count;
+			else
+				padding++;
+			count += 8;
+		}
+	}
+
+	uint32_t take(int n) {
+		uint32_t value = static_cast<uint32_t>(bits & ((uint64_t(1) << n) - 1));
+		bits >>= n;
+		count -= n;
+		return value;
+	}
+
+	// true if anything past the end was used
+	bool overrun() const {
+		return padding * 8 > static_cast<size_t>(count);
+	}
+};
+
+//
+// band coding
+//
+
+// per thread row of decoded values that only grows, the decoder predicts from the row above
+struct ThreadRow {
+	int32_t* values = nullptr;
+	size_t count = 0;
+
+	~ThreadRow() {
+		free(values);
+	}
+};
+
+static int32_t* thread_row(size_t count) {
+	static thread_local ThreadRow row;
+
+	if (row.count < count) {
+		free(row.values);
+		row.values = static_cast<int32_t*>(malloc(sizeof(int32_t) * count));
+		row.count = row.values ? count : 0;
+	}
+
+	return row.values;
+}
+
+// the values coded are the heights for key frames and the change from the frame before for delta frames,
+// each predicted from the plane through its left, upper and upper left neighbours (left + up - upper left),
+// which is exact for a slope, the first row only from the left and the first column only from above
+// the first row of a band has nothing above it, so bands can be coded on their own
+template <bool Delta>
+static void predict_band(const int16_t* values, const int16_t* previous, int width, int rows, uint32_t* residuals) {
+	auto value = [&](int i) -> int32_t {
+		return Delta ? values[i] - previous[i] : values[i];
+	};
+
+	residuals[0] = zigzag(value(0));
+	for (int x = 1; x < width; x++)
+		residuals[x] = zigzag(value(x) - value(x - 1));
+
+	for (int y = 1; y < rows; y++) {
+		const int row = y * width;
+		residuals[row] = zigzag(value(row) - value(row - width));
+
+		for (int i = row + 1; i < row + width; i++)
+			residuals[i] = zigzag(value(i) - (value(i - 1) + value(i - width) - value(i - width - 1)));
+	}
+}
+
+static uint8_t* encode_band(const int16_t* values, const int16_t* previous, int width, int rows, uint32_t* residuals, uint8_t* out) {
+	const int cells = width * rows;
+
+	if (previous)
+		predict_band<true>(values, previous, width, rows, residuals);
+	else
+		predict_band<false>(values, nullptr, width, rows, residuals);
+
+	BitWriter writer(out);
+
+	for (int group = 0; group < cells; group += GROUP) {
+		const int count = std::min(GROUP, cells - group);
+		const uint32_t* u = residuals + group;
+
+		uint32_t sum = 0;
+		for (int i = 0; i < count; i++)
+			sum += u[i];
+
+		if (sum == 0) {
+			writer.put(ZERO_GROUP, 5);
+			continue;
+		}
+
+		// about log2 of half the mean, close enough to the best parameter for these
+		const int k = std::min(static_cast<int>(std::bit_width(sum / (2 * GROUP))), MAX_PARAMETER);
+		writer.put(static_cast<uint32_t>(k), 5);
+
+		const uint32_t mask = (uint32_t(1) << k) - 1;
+		for (int i = 0; i < count; i++) {
+			const uint32_t quotient = u[i] >> k;
+			if (quotient < ESCAPE) {
+				writer.put((uint32_t(1) << quotient) - 1, static_cast<int>(quotient) + 1);
+				if (k > 0)
+					writer.put(u[i] & mask, k);
+			} else {
+				writer.put((uint32_t(1) << ESCAPE) - 1, ESCAPE);
+				writer.put(u[i], 32);
+			}
+		}
+	}
+
+	return writer.finish();
+}
+
+// values holds the frame before for delta frames, and is overwritten with this one
+static bool decode_band(const uint8_t* data, size_t bytes, int16_t* values, int width, int rows, bool key) {
+	const int cells = width * rows;
+	BitReader reader(data, bytes);
+
+	int32_t* above = thread_row(static_cast<size_t>(width));
+	if (!above) return false;
+
+	uint32_t u[GROUP];
+	int32_t left = 0, aboveLeft = 0;
+	int x = 0, y = 0;
+	int16_t* out = values;
+
+	for (int group = 0; group < cells; group += GROUP) {
+		const int count = std::min(GROUP, cells - group);
+
+		reader.refill();
+		const uint32_t k = reader.take(5);
+
+		if (k == ZERO_GROUP) {
+			for (int i = 0; i < count; i++)
+				u[i] = 0;
+		} else if (k > MAX_PARAMETER) {
+			return false;
+		} else {
+			for (int i = 0; i < count; i++) {
+				reader.refill();
+
+				const int ones = std::countr_one(reader.bits);
+				if (ones < static_cast<int>(ESCAPE)) {
+					reader.take(ones + 1);
+					u[i] = (static_cast<uint32_t>(ones) << k) | (k > 0 ? reader.take(static_cast<int>(k)) : 0);
+				} else {
+					reader.take(ESCAPE);
+					u[i] = reader.take(32);
+				}
+			}
+		}
+
+		for (int i = 0; i < count; i++) {
+			int32_t value = unzigzag(u[i]);
+			if (y == 0)
+				value += x > 0 ? left : 0;
+			else if (x == 0)
+				value += above[0];
+			else
+				value += left + above[x] - aboveLeft;
+
+			// above[x] is still the row above's until it's replaced here, the next cell needs it as its upper left
+			aboveLeft = above[x];
+			above[x] = value;
+			left = value;
+
+			*out = key ? static_cast<int16_t>(value) : static_cast<int16_t>(*out + value);
+			out++;
+
+			if (++x == width) {
+				x = 0;
+				y++;
+			}
+		}
+	}
+
+	return !reader.overrun();
+}
+
+//
+// SequenceWriter
+//
+
+SequenceWriter::~SequenceWriter() {
+	if (file)
+		close();
+}
+
+bool SequenceWriter::open(const char* path, int w, int h, float range, int keyFrames, int queueFrames) {
+	if (file)
+		close();
+
+	if (w <= 0 || h <= 0 || range <= 0.0f || keyFrames <= 0 || queueFrames <= 0) return false;
+
+	file = fopen(path, "wb");
+	if (!file) return false;
+
+	width = w;
+	height = h;
+	scale = range / 32767.0f;
+	keyInterval = keyFrames;
+	failed = false;
+	framesWritten = 0;
+	bytesWritten = 0;
+	framesDropped = 0;
+	steps = 0;
+	pendingHead = pendingCount = 0;
+
+	const size_t cells = static_cast<size_t>(w) * h;
+	const size_t bytes = sizeof(float) * cells;
+
+	glCreateBuffers(1, &stagingBuffer);
+	glNamedBufferStorage(stagingBuffer, bytes, nullptr, 0);
+	readback.init(bytes);
+
+	slotCount = queueFrames;
+	slots = static_cast<Slot*>(malloc(sizeof(Slot) * slotCount));
+	freeSlots = static_cast<int*>(malloc(sizeof(int) * slotCount));
+	filledSlots = static_cast<int*>(malloc(sizeof(int) * slotCount));
+	for (int i = 0; i < slotCount; i++) {
+		slots[i].heights = static_cast<float*>(malloc(bytes));
+		slots[i].step = 0;
+		freeSlots[i] = i;
+	}
+	freeCount = slotCount;
+	filledHead = filledCount = 0;
+
+	const int bandCells = w * std::min(BAND_ROWS, h);
+	quantized = static_cast<int16_t*>(malloc(sizeof(int16_t) * cells));
+	previous = static_cast<int16_t*>(malloc(sizeof(int16_t) * cells));
+	residuals = static_cast<uint32_t*>(malloc(sizeof(uint32_t) * bandCells));
+	encodedCapacity = sizeof(uint32_t) * band_count(h) + band_bound(bandCells) * band_count(h);
+	encoded = static_cast<uint8_t*>(malloc(encodedCapacity));
+
+	Header header = { SEQUENCE_MAGIC, SEQUENCE_VERSION, w, h, scale, keyFrames, BAND_ROWS, 0 };
+	if (fwrite(&header, sizeof(header), 1, file) != 1)
+		failed = true;
+	bytesWritten = sizeof(header);
+
+	stopping = false;
+	writer = std::thread(&SequenceWriter::writer_loop, this);
+
+	return !failed;
+}
+
+bool SequenceWriter::close() {
+	if (!file) return false;
+
+	// everything that was captured gets written, the GPU and the writer thread are waited on here
+	glFinish();
+	while (pendingCount > 0) {
+		drain_readback();
+		if (pendingCount > 0)
+			std::this_thread::yield();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	writer.join();
+
+	if (fclose(file) != 0)
+		failed = true;
+	file = nullptr;
+
+	readback.clean();
+	glDeleteBuffers(1, &stagingBuffer);
+	stagingBuffer = 0;
+
+	for (int i = 0; i < slotCount; i++)
+		free(slots[i].heights);
+	free(slots);
+	free(freeSlots);
+	free(filledSlots);
+	slots = nullptr;
+	freeSlots = filledSlots = nullptr;
+	slotCount = freeCount = filledCount = 0;
+
+	free(quantized);
+	free(previous);
+	free(residuals);
+	free(encoded);
+	quantized = previous = nullptr;
+	residuals = nullptr;
+	encoded = nullptr;
+	encodedCapacity = 0;
+
+	return !failed;
+}
+
+void SequenceWriter::capture(SurfaceSim& sim, bool wait) {
+	if (!file) return;
+
+	drain_readback();
+	if (wait && readback.full()) {
+		// ReadbackRing polls its fences without GL_SYNC_FLUSH_COMMANDS_BIT, so unless the copies are flushed
+		// here nothing guarantees they ever get submitted, and this would spin forever
+		glFlush();
+		while (readback.full()) {
+			std::this_thread::yield();
+			drain_readback();
+		}
+	}
+
+	const int step = steps++;
+	if (readback.full()) {
+		framesDropped++;
+		return;
+	}
+
+	// with a pack buffer bound the image goes into it instead of memory, so this only queues the copy
+	const size_t bytes = sizeof(float) * width * height;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, stagingBuffer);
+	glGetTextureImage(sim.get_height_tex(), 0, GL_RED, GL_FLOAT, static_cast<GLsizei>(bytes), nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	readback.push(stagingBuffer, bytes, step);
+	pendingSteps[(pendingHead + pendingCount) % ReadbackRing::SLOT_COUNT] = step;
+	pendingCount++;
+}
+
+// moves readbacks that have landed into the queue, in the order they were captured
+// stops at the first one that hasn't landed, or when the queue is full
+void SequenceWriter::drain_readback() {
+	while (pendingCount > 0) {
+		int slot;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (freeCount == 0) return;
+			slot = freeSlots[--freeCount];
+		}
+
+		const int step = pendingSteps[pendingHead];
+		const bool landed = readback.pop(step, slots[slot].heights);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!landed) {
+				freeSlots[freeCount++] = slot;
+				return;
+			}
+
+			slots[slot].step = static_cast<uint32_t>(step);
+			filledSlots[(filledHead + filledCount) % slotCount] = slot;
+			filledCount++;
+		}
+		wake.notify_one();
+
+		pendingHead = (pendingHead + 1) % ReadbackRing::SLOT_COUNT;
+		pendingCount--;
+	}
+}
+
+void SequenceWriter::writer_loop() {
+	while (true) {
+		int slot;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return stopping || filledCount > 0; });
+			if (filledCount == 0) return; // stopping, and nothing left to write
+
+			slot = filledSlots[filledHead];
+			filledHead = (filledHead + 1) % slotCount;
+			filledCount--;
+		}
+
+		write_frame(slots[slot].heights, slots[slot].step);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		freeSlots[freeCount++] = slot;
+	}
+}
+
+void SequenceWriter::write_frame(const float* heights, uint32_t step) {
+	const size_t cells = static_cast<size_t>(width) * height;
+
+	const float inverseScale = 1.0f / scale;
+	for (size_t i = 0; i < cells; i++) {
+		float value = std::clamp(heights[i] * inverseScale, -32767.0f, 32767.0f);
+		quantized[i] = static_cast<int16_t>(value >= 0.0f ? value + 0.5f : value - 0.5f);
+	}
+
+	const bool key = framesWritten % keyInterval == 0;
+	const int bands = band_count(height);
+
+	uint32_t* sizes = reinterpret_cast<uint32_t*>(encoded);
+	uint8_t* out = encoded + sizeof(uint32_t) * bands;
+	for (int band = 0; band < bands; band++) {
+		const int y = band * BAND_ROWS;
+		const int rows = std::min(BAND_ROWS, height - y);
+		const size_t offset = static_cast<size_t>(y) * width;
+
+		uint8_t* end = encode_band(quantized + offset, key ? nullptr : previous + offset, width, rows, residuals, out);
+		sizes[band] = static_cast<uint32_t>(end - out);
+		out = end;
+	}
+
+	std::swap(quantized, previous);
+
+	const Frame frame = { static_cast<uint32_t>(out - encoded), step };
+	if (fwrite(&frame, sizeof(frame), 1, file) != 1 || fwrite(encoded, 1, frame.bytes, file) != frame.bytes)
+		failed = true;
+
+	bytesWritten += sizeof(frame) + frame.bytes;
+	framesWritten++;
+}
+
+//
+// SequenceReader
+//
+
+SequenceReader::~SequenceReader() {
+	close();
+}
+
+bool SequenceReader::open(const char* path) {
+	close();
+
+	if (!mapped.open(path) || mapped.size() < sizeof(Header)) return false;
+
+	memcpy(&header, mapped.data(), sizeof(header));
+	if (header.magic != SEQUENCE_MAGIC || header.version != SEQUENCE_VERSION || header.width <= 0 || header.height <= 0
+		|| header.keyInterval <= 0 || header.bandRows != BAND_ROWS) {
+		close();
+		return false;
+	}
+
+	// walk the frames twice, once to count them and once to remember where they are
+	for (int pass = 0; pass < 2; pass++) {
+		size_t position = sizeof(Header);
+		int count = 0;
+
+		while (mapped.size() - position >= sizeof(Frame)) {
+			Frame frame;
+			memcpy(&frame, mapped.data() + position, sizeof(frame));
+			if (frame.bytes > mapped.size() - position - sizeof(Frame))
+				break; // cut off
+
+			if (frameOffsets)
+				frameOffsets[count] = position;
+			count++;
+			position += sizeof(Frame) + frame.bytes;
+		}
+
+		if (pass == 0) {
+			frameCount = count;
+			frameOffsets = static_cast<size_t*>(malloc(sizeof(size_t) * (count > 0 ? count : 1)));
+		}
+	}
+
+	current = static_cast<int16_t*>(malloc(sizeof(int16_t) * header.width * header.height));
+	currentFrame = -1;
+
+	return true;
+}
+
+void SequenceReader::close() {
+	mapped.close();
+
+	free(frameOffsets);
+	free(current);
+	frameOffsets = nullptr;
+	current = nullptr;
+	frameCount = 0;
+	currentFrame = -1;
+	header = {};
+}
+
+uint32_t SequenceReader::get_step(int frame) const {
+	if (frame < 0 || frame >= frameCount) return 0;
+
+	Frame entry;
+	memcpy(&entry, mapped.data() + frameOffsets[frame], sizeof(entry));
+	return entry.step;
+}
+
+bool SequenceReader::decode(int frame) {
+	if (frame < 0 || frame >= frameCount) return false;
+	if (frame == currentFrame) return true;
+
+	// a delta frame needs the one before it, so start from its key frame unless we're already past that
+	int first = frame - frame % header.keyInterval;
+	if (currentFrame >= first && currentFrame < frame)
+		first = currentFrame + 1;
+
+	const int bands = band_count(header.height);
+	const size_t sizesBytes = sizeof(uint32_t) * bands;
+
+	for (int index = first; index <= frame; index++) {
+		currentFrame = -1; // in case this one is broken
+
+		Frame entry;
+		const uint8_t* data = mapped.data() + frameOffsets[index];
+		memcpy(&entry, data, sizeof(entry));
+		data += sizeof(entry);
+
+		if (entry.bytes < sizesBytes) return false;
+
+		// every band's offset, and a check that they all fit in the frame
+		uint32_t offsets[1024];
+		uint32_t sizes[1024];
+		if (bands > 1024) return false;
+
+		memcpy(sizes, data, sizesBytes);
+		uint64_t offset = sizesBytes;
+		for (int band = 0; band < bands; band++) {
+			offsets[band] = static_cast<uint32_t>(offset);
+			offset += sizes[band];
+		}
+		if (offset > entry.bytes) return false;
+
+		const bool key = index % header.keyInterval == 0;
+		std::atomic<bool> valid = true;
+
+		ThreadPool::shared().parallel_for(static_cast<size_t>(bands), [&](size_t begin, size_t end) {
+			for (size_t band = begin; band < end; band++) {
+				const int y = static_cast<int>(band) * BAND_ROWS;
+				const int rows = std::min(BAND_ROWS, header.height - y);
+
+				if (!decode_band(data + offsets[band], sizes[band], current + static_cast<size_t>(y) * header.width, header.width, rows, key))
+					valid = false;
+			}
+		});
+
+		if (!valid) return false;
+		currentFrame = index;
+	}
+
+	return true;
+}
+
+bool SequenceReader::read_frame(int frame, int16_t* out) {
+	if (!decode(frame)) return false;
+
+	memcpy(out, current, sizeof(int16_t) * header.width * header.height);
+	return true;
+}
+
+bool SequenceReader::read_frame(int frame, float* out) {
+	if (!decode(frame)) return false;
+
+	const size_t cells = static_cast<size_t>(header.width) * header.height;
+	for (size_t i = 0; i < cells; i++)
+		out[i] = static_cast<float>(current[i]) * header.scale;
+
+	return true;
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stddef.h> // for size_t
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "gl_renderer.h"
+#include "mapped_file.h"
+#include "surface_sim.h"
+
+// height sequences are every captured step of a simulation's heights, for baking animations
+//
+// layout, everything little endian:
+//   header              magic, version, size, quantization step, key interval, rows per band
+//   per frame           sequence::Frame, then one uint32 size per band, then the bands' bit streams
+// heights are quantized to 16 bits, and every keyInterval-th frame is a key frame that only holds the
+// heights, the others hold the change from the frame before, either way every cell is predicted from its
+// neighbours within the band (left + up - upper left) and only what's left over is stored
+// the residuals are Rice coded in groups of 16 with their own parameter, so calm water costs
+// next to nothing and a group of zeros costs 5 bits
+// bands of rows are coded on their own, so the reader decodes them across every core
+// there's no index, the reader finds the frames by walking their headers, so a capture that was cut off
+// still plays up to its last whole frame
+namespace sequence {
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		int32_t width, height;
+		float scale; // height of one quantization step
+		int32_t keyInterval;
+		int32_t bandRows; // rows per band, the last band can have fewer
+		uint32_t reserved;
+	};
+
+	struct Frame {
+		uint32_t bytes; // band sizes and bands, not counting this
+		uint32_t step; // captures since the sequence was opened, steps are missing where frames were dropped
+	};
+}
+
+// captures a simulation's heights every step and writes them out on a thread of its own
+//
+// capture only queues a copy of the height texture into a fenced buffer (see ReadbackRing), the copy is
+// picked up a few steps later once the GPU is done with it and handed to the writer thread, which does
+// all the quantizing, encoding and writing
+// it never waits on the GPU or the disk, if either falls behind frames are dropped (and counted) instead
+class SequenceWriter {
+	FILE* file = nullptr;
+	std::atomic<bool> failed = false;
+
+	int width = 0, height = 0;
+	float scale = 0.0f;
+	int keyInterval = 0;
+
+	// the main thread's side, height texture -> staging buffer -> readback ring -> queue
+	GLuint stagingBuffer = 0;
+	ReadbackRing readback;
+	int steps = 0; // captures so far, dropped ones included
+	int pendingSteps[ReadbackRing::SLOT_COUNT]; // fifo of what's in the ring, they're popped in order
+	int pendingHead = 0, pendingCount = 0;
+
+	// frames waiting for the writer thread, a fixed number of slots that move between free and filled
+	struct Slot {
+		float* heights;
+		uint32_t step;
+	};
+
+	Slot* slots = nullptr;
+	int slotCount = 0;
+	int* freeSlots = nullptr; // stack
+	int freeCount = 0;
+	int* filledSlots = nullptr; // fifo
+	int filledHead = 0, filledCount = 0;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+	std::thread writer;
+
+	std::atomic<int> framesWritten = 0;
+	std::atomic<size_t> bytesWritten = 0;
+	int framesDropped = 0;
+
+	// only touched by the writer thread
+	int16_t* quantized = nullptr; // this frame
+	int16_t* previous = nullptr; // the frame before, what delta frames are predicted from
+	uint32_t* residuals = nullptr; // one band's
+	uint8_t* encoded = nullptr;
+	size_t encodedCapacity = 0;
+
+	void writer_loop();
+	void write_frame(const float* heights, uint32_t step);
+	void drain_readback();
+
+public:
+	SequenceWriter() = default;
+	~SequenceWriter();
+
+	// range is the largest height that's kept, anything beyond is clamped
+	// queueFrames is how far the writer thread can fall behind before frames are dropped
+	bool open(const char* path, int w, int h, float range = 4.0f, int keyFrames = 60, int queueFrames = 8);
+
+	// waits for every captured frame to be written, false if any write failed
+	bool close();
+	bool is_open() const { return file != nullptr; }
+
+	// call once per step, after sim_frame, never blocks unless wait is set
+	// offline captures set it to wait for the GPU and the writer thread instead of dropping the frame
+	void capture(SurfaceSim& sim, bool wait = false);
+
+	int get_frames() const { return framesWritten; }
+	int get_dropped() const { return framesDropped; }
+	size_t get_bytes() const { return bytesWritten; }
+};
+
+// plays a sequence back out of a mapped file, decoding the bands across the shared thread pool
+class SequenceReader {
+	MappedFile mapped;
+	sequence::Header header = {};
+
+	// where every frame's sequence::Frame is, found on open
+	size_t* frameOffsets = nullptr;
+	int frameCount = 0;
+
+	// the last decoded frame, which the next delta frame builds on
+	int16_t* current = nullptr;
+	int currentFrame = -1;
+
+	bool decode(int frame);
+
+public:
+	SequenceReader() = default;
+	~SequenceReader();
+
+	bool open(const char* path);
+	void close();
+
+	int get_width() const { return header.width; }
+	int get_height() const { return header.height; }
+	int get_frame_count() const { return frameCount; }
+	float get_scale() const { return header.scale; }
+	uint32_t get_step(int frame) const;
+
+	// stepping forward one frame at a time only decodes that frame, jumping anywhere else decodes from
+	// the key frame before it
+	// out has to hold width * height values, heights are the quantized value times get_scale()
+	bool read_frame(int frame, int16_t* out);
+	bool read_frame(int frame, float* out);
+};
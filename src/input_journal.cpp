@@ -0,0 +1,410 @@
+#define _CRT_SECURE_NO_WARNINGS // for fopen
+#include "input_journal.h"
+
+#include <stdlib.h> // for malloc/free
+#include <string.h>
+#include <float.h>
+#include <algorithm>
+
+#include <GL/gl3w.h>
+#include <GLFW/glfw3.h>
+#include "mapped_file.h"
+#include "snapshot.h"
+#include "varint.h"
+
+static constexpr uint32_t JOURNAL_MAGIC = snapshot::id("WJNL");
+static constexpr uint32_t JOURNAL_VERSION = 2; // 1 had no Params records, it still replays
+static constexpr uint32_t FLAG_FROM_SNAPSHOT = 1;
+
+static constexpr uint8_t TAG_TYPE = 7;
+static constexpr uint8_t TAG_FRAMES = 1 << 3;
+static constexpr uint8_t TAG_RADIUS = 1 << 4;
+static constexpr uint8_t TAG_STRENGTH = 1 << 5;
+
+struct JournalHeader {
+	uint32_t magic;
+	uint32_t version;
+	int32_t width, height;
+	float delta; // until the first Delta record
+	uint32_t flags;
+};
+
+static void snapshot_path(char* out, size_t size, const char* path) {
+	snprintf(out, size, "%s.snap", path);
+}
+
+static void texture_size(GLuint texture, int& w, int& h) {
+	w = h = 0;
+	glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_WIDTH, &w);
+	glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_HEIGHT, &h);
+}
+
+//
+// private
+//
+
+void InputJournal::write_bytes(const void* data, size_t bytes) {
+	if (failed) return;
+
+	if (fwrite(data, 1, bytes, file) != bytes)
+		failed = true;
+	bytesWritten += bytes;
+}
+
+void InputJournal::write_record(Record type, bool hasPosition, int x, int y, float r, float strength) {
+	uint8_t buffer[32];
+	uint8_t* out = buffer + 1;
+	uint8_t tag = static_cast<uint8_t>(type);
+
+	if (frame != lastFrame) {
+		tag |= TAG_FRAMES;
+		out = put_varint(out, frame - lastFrame);
+		lastFrame = frame;
+	}
+
+	if (hasPosition) {
+		if (r != lastR) {
+			tag |= TAG_RADIUS;
+			memcpy(out, &r, sizeof(r));
+			out += sizeof(r);
+			lastR = r;
+		}
+
+		if (strength != lastStrength) {
+			tag |= TAG_STRENGTH;
+			memcpy(out, &strength, sizeof(strength));
+			out += sizeof(strength);
+			lastStrength = strength;
+		}
+
+		out = put_varint(out, zigzag(x - lastX));
+		out = put_varint(out, zigzag(y - lastY));
+		lastX = x;
+		lastY = y;
+	}
+
+	buffer[0] = tag;
+	write_bytes(buffer, static_cast<size_t>(out - buffer));
+}
+
+// compared bit for bit, so the NaNs start_recording fills lastParams with never match
+void InputJournal::record_params(SurfaceSim& sim) {
+	float params[SurfaceSim::MAX_PARAMS];
+	const int count = std::min(sim.get_params(params), SurfaceSim::MAX_PARAMS);
+
+	uint32_t changed = 0;
+	for (int i = 0; i < count; i++) {
+		if (memcmp(&params[i], &lastParams[i], sizeof(float)) != 0)
+			changed |= 1u << i;
+	}
+
+	if (!changed) return;
+
+	write_record(Record::Params, false, 0, 0, 0.0f, 0.0f);
+
+	uint8_t buffer[4 + (sizeof(float) * SurfaceSim::MAX_PARAMS)];
+	uint8_t* out = put_varint(buffer, changed);
+	for (int i = 0; i < count; i++) {
+		if (!(changed & (1u << i))) continue;
+
+		memcpy(out, &params[i], sizeof(float));
+		out += sizeof(float);
+		lastParams[i] = params[i];
+	}
+
+	write_bytes(buffer, static_cast<size_t>(out - buffer));
+	eventsWritten++;
+}
+
+//
+// public
+//
+
+InputJournal::~InputJournal() {
+	if (file)
+		stop_recording();
+
+	free(heights);
+}
+
+bool InputJournal::start_recording(const char* path, SurfaceSim& sim, int w, int h, float delta) {
+	if (file)
+		stop_recording();
+
+	int texWidth, texHeight;
+	texture_size(sim.get_height_tex(), texWidth, texHeight);
+	if (texWidth != w || texHeight != h) return false;
+
+	// the starting state, so the replay doesn't depend on whatever happened before
+	char snapshot[512];
+	snapshot_path(snapshot, sizeof(snapshot), path);
+	const bool fromSnapshot = sim.save_state(snapshot);
+	if (!fromSnapshot)
+		sim.reset();
+
+	file = fopen(path, "wb");
+	if (!file) return false;
+
+	failed = false;
+	width = w;
+	height = h;
+	frame = lastFrame = 0;
+	lastX = lastY = 0;
+	lastR = lastStrength = 0.0f;
+	lastDelta = delta;
+	bytesWritten = 0;
+	eventsWritten = 0;
+
+	JournalHeader header = { JOURNAL_MAGIC, JOURNAL_VERSION, w, h, delta, fromSnapshot ? FLAG_FROM_SNAPSHOT : 0 };
+	write_bytes(&header, sizeof(header));
+
+	// snapshots don't hold the tunables, so the first record has all of them
+	memset(lastParams, 0xff, sizeof(lastParams));
+	record_params(sim);
+
+	return !failed;
+}
+
+bool InputJournal::stop_recording() {
+	if (!file) return false;
+
+	write_record(Record::End, false, 0, 0, 0.0f, 0.0f);
+
+	if (fclose(file) != 0)
+		failed = true;
+	file = nullptr;
+
+	return !failed;
+}
+
+void InputJournal::place_source(SurfaceSim& sim, int x, int y, float r, float strength) {
+	sim.place_source(x, y, r, strength);
+	if (!file) return;
+
+	write_record(Record::Source, true, x, y, r, strength);
+	eventsWritten++;
+}
+
+void InputJournal::set_obstruction(SurfaceSim& sim, int x, int y, float r, float strength) {
+	sim.set_obstruction(x, y, r, strength);
+	if (!file) return;
+
+	write_record(Record::Obstruction, true, x, y, r, strength);
+	eventsWritten++;
+}
+
+void InputJournal::reset(SurfaceSim& sim) {
+	if (file)
+		record_params(sim);
+
+	sim.reset();
+	if (!file) return;
+
+	write_record(Record::Reset, false, 0, 0, 0.0f, 0.0f);
+	eventsWritten++;
+}
+
+void InputJournal::sim_frame(SurfaceSim& sim, float delta) {
+	if (file)
+		record_params(sim);
+
+	if (file && delta != lastDelta) {
+		write_record(Record::Delta, false, 0, 0, 0.0f, 0.0f);
+		write_bytes(&delta, sizeof(delta));
+		lastDelta = delta;
+	}
+
+	sim.sim_frame(delta);
+	if (!file) return;
+
+	frame++;
+	if (checksumInterval > 0 && frame % static_cast<uint32_t>(checksumInterval) == 0) {
+		uint64_t sum = checksum(sim);
+		write_record(Record::Checksum, false, 0, 0, 0.0f, 0.0f);
+		write_bytes(&sum, sizeof(sum));
+	}
+}
+
+bool InputJournal::replay(const char* path, SurfaceSim& sim, int w, int h, ReplayStats& stats) {
+	stats = {};
+	stats.firstMismatch = -1;
+	stats.minFrame = DBL_MAX;
+
+	MappedFile mapped;
+	if (!mapped.open(path) || mapped.size() < sizeof(JournalHeader)) return false;
+
+	JournalHeader header;
+	memcpy(&header, mapped.data(), sizeof(header));
+	if (header.magic != JOURNAL_MAGIC || header.version < 1 || header.version > JOURNAL_VERSION || header.width != w || header.height != h)
+		return false;
+
+	int texWidth, texHeight;
+	texture_size(sim.get_height_tex(), texWidth, texHeight);
+	if (texWidth != w || texHeight != h) return false;
+
+	if (header.flags & FLAG_FROM_SNAPSHOT) {
+		char snapshot[512];
+		snapshot_path(snapshot, sizeof(snapshot), path);
+		if (!sim.load_state(snapshot)) return false;
+	} else {
+		sim.reset();
+	}
+
+	float delta = header.delta;
+	uint32_t frames = 0;
+	int x = 0, y = 0;
+	float r = 0.0f, strength = 0.0f;
+
+	// every step is waited on, otherwise a GPU simulation would only be timed for queuing its commands
+	auto step_to = [&](uint32_t target) {
+		while (frames < target) {
+			double start = glfwGetTime();
+			sim.sim_frame(delta);
+			glFinish();
+			double time = glfwGetTime() - start;
+
+			stats.totalTime += time;
+			stats.minFrame = time < stats.minFrame ? time : stats.minFrame;
+			stats.maxFrame = time > stats.maxFrame ? time : stats.maxFrame;
+			frames++;
+		}
+	};
+
+	const uint8_t* in = mapped.data() + sizeof(header);
+	const uint8_t* end = mapped.data() + mapped.size();
+	bool valid = true, finished = false;
+
+	while (valid && !finished && in < end) {
+		const uint8_t tag = *in++;
+		const Record type = static_cast<Record>(tag & TAG_TYPE);
+
+		uint32_t value = 0;
+		if (tag & TAG_FRAMES) {
+			in = get_varint(in, end, value);
+			if (!in) {
+				valid = false;
+				break;
+			}
+		}
+		step_to(frames + value);
+
+		switch (type) {
+			case Record::Source:
+			case Record::Obstruction: {
+				if (tag & TAG_RADIUS) {
+					if (end - in < 4) { valid = false; break; }
+					memcpy(&r, in, sizeof(r));
+					in += sizeof(r);
+				}
+
+				if (tag & TAG_STRENGTH) {
+					if (end - in < 4) { valid = false; break; }
+					memcpy(&strength, in, sizeof(strength));
+					in += sizeof(strength);
+				}
+
+				uint32_t dx, dy;
+				in = get_varint(in, end, dx);
+				if (in) in = get_varint(in, end, dy);
+				if (!in) { valid = false; break; }
+
+				x += unzigzag(dx);
+				y += unzigzag(dy);
+				if (type == Record::Source)
+					sim.place_source(x, y, r, strength);
+				else
+					sim.set_obstruction(x, y, r, strength);
+				stats.events++;
+			} break;
+
+			case Record::Reset:
+				sim.reset();
+				stats.events++;
+				break;
+
+			case Record::Checksum: {
+				uint64_t expected;
+				if (end - in < 8) { valid = false; break; }
+				memcpy(&expected, in, sizeof(expected));
+				in += sizeof(expected);
+
+				stats.checksums++;
+				if (checksum(sim) != expected) {
+					if (stats.mismatches++ == 0)
+						stats.firstMismatch = static_cast<int>(frames);
+				}
+			} break;
+
+			case Record::Delta:
+				if (end - in < 4) { valid = false; break; }
+				memcpy(&delta, in, sizeof(delta));
+				in += sizeof(delta);
+				break;
+
+			case Record::End:
+				finished = true;
+				break;
+
+			case Record::Params: {
+				// only the changed ones are stored, the rest stay what the simulation has now
+				float params[SurfaceSim::MAX_PARAMS];
+				const int count = std::min(sim.get_params(params), SurfaceSim::MAX_PARAMS);
+
+				uint32_t changed;
+				in = get_varint(in, end, changed);
+				if (!in || (changed >> count) != 0) { valid = false; break; }
+
+				for (int i = 0; i < count && valid; i++) {
+					if (!(changed & (1u << i))) continue;
+
+					if (end - in < 4) { valid = false; break; }
+					memcpy(&params[i], in, sizeof(float));
+					in += sizeof(float);
+				}
+
+				if (!valid) break;
+				sim.set_params(params, count);
+				stats.events++;
+			} break;
+
+			default:
+				valid = false;
+				break;
+		}
+	}
+
+	if (stats.minFrame == DBL_MAX)
+		stats.minFrame = 0.0;
+	stats.frames = static_cast<int>(frames);
+	stats.finalChecksum = checksum(sim);
+
+	// a journal that was cut off (the program crashed while recording) still replays up to where it ends
+	return valid && finished;
+}
+
+// FNV-1a over 32 bit words instead of bytes, it's only there to tell runs apart, not to resist anyone
+uint64_t InputJournal::checksum(SurfaceSim& sim) {
+	const GLuint texture = sim.get_height_tex();
+	int w, h;
+	texture_size(texture, w, h);
+
+	const size_t count = static_cast<size_t>(w) * h;
+	if (heightsCount < count) {
+		free(heights);
+		heights = static_cast<float*>(malloc(sizeof(float) * count));
+		heightsCount = heights ? count : 0;
+	}
+
+	if (!heights) return 0;
+
+	glGetTextureImage(texture, 0, GL_RED, GL_FLOAT, static_cast<GLsizei>(sizeof(float) * count), heights);
+
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < count; i++) {
+		uint32_t word;
+		memcpy(&word, &heights[i], sizeof(word));
+		hash = (hash ^ word) * 0x100000001b3ull;
+	}
+
+	return hash;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stddef.h> // for size_t
+#include <stdint.h>
+#include <stdio.h>
+
+#include "surface_sim.h"
+
+// records every call that changes a simulation (sources, obstructions, resets and steps), and changes to its
+// tunables (SurfaceSim::get_params) made between them, so a session can be played back exactly, headless and as fast as possible, to compare performance and output across builds
+//
+// the journal starts from a snapshot of the simulation (path + ".snap", see snapshot.h), or from a reset if
+// the simulation can't save its state, and every checksumInterval steps a checksum of the heights is recorded
+// so a replay can tell where it starts to differ
+//
+// the log is a header followed by records, each a tag byte and then only what changed since the last record:
+//   tag bits 0-2  type, see Record
+//   tag bit 3     a varint number of steps since the last record follows, otherwise it's the same step
+//   tag bit 4     the radius changed, a float follows
+//   tag bit 5     the strength changed, a float follows
+// sources and obstructions then have x and y as zigzag varints relative to the last ones, since strokes
+// move a cell or two at a time they're usually 3 bytes in all
+class InputJournal {
+public:
+	enum class Record : uint8_t {
+		Source,
+		Obstruction,
+		Reset,
+		Checksum, // 8 bytes, of the heights after the step
+		Delta, // 4 bytes, a new timestep for the steps after it
+		End, // the step count is the total
+		Params, // a varint mask of the tunables that changed, then each of those as 4 bytes
+	};
+
+	struct ReplayStats {
+		int frames, events;
+		int checksums, mismatches;
+		int firstMismatch; // the step, -1 if everything matched
+		double totalTime, minFrame, maxFrame; // seconds, each step is waited on so GPU time is included
+		uint64_t finalChecksum;
+	};
+
+private:
+	FILE* file = nullptr;
+	bool failed = false;
+
+	int width = 0, height = 0;
+
+	// what the last record left behind, records only store the difference
+	uint32_t frame = 0, lastFrame = 0;
+	int lastX = 0, lastY = 0;
+	float lastR = 0.0f, lastStrength = 0.0f, lastDelta = 0.0f;
+	float lastParams[SurfaceSim::MAX_PARAMS];
+	size_t bytesWritten = 0;
+	int eventsWritten = 0;
+
+	// readback of the heights for checksums
+	float* heights = nullptr;
+	size_t heightsCount = 0;
+
+	void write_record(Record type, bool hasPosition, int x, int y, float r, float strength);
+	void write_bytes(const void* data, size_t bytes);
+	void record_params(SurfaceSim& sim); // a Params record if any of them changed since the last one
+
+public:
+	// steps between checksums, 0 turns them off
+	int checksumInterval = 60;
+
+	InputJournal() = default;
+	~InputJournal();
+
+	// width and height are the simulation's, a journal only replays on a simulation of the same size
+	// refuses to record if the height texture isn't w x h, the checksums wouldn't cover the right cells
+	bool start_recording(const char* path, SurfaceSim& sim, int w, int h, float delta);
+	bool stop_recording(); // false if any write failed
+	bool is_recording() const { return file != nullptr; }
+
+	int get_frames() const { return static_cast<int>(frame); }
+	int get_events() const { return eventsWritten; }
+	size_t get_bytes() const { return bytesWritten; }
+
+	// these always call through to the simulation, and only record the call while recording
+	void place_source(SurfaceSim& sim, int x, int y, float r, float strength);
+	void set_obstruction(SurfaceSim& sim, int x, int y, float r, float strength);
+	void reset(SurfaceSim& sim);
+	void sim_frame(SurfaceSim& sim, float delta);
+
+	// plays a journal back onto sim, false if it couldn't be read (stats are still filled in as far as it got)
+	bool replay(const char* path, SurfaceSim& sim, int w, int h, ReplayStats& stats);
+
+	// hash of the simulation's height texture, bit for bit, at whatever size the texture really is
+	uint64_t checksum(SurfaceSim& sim);
+};
@@ -7,12 +7,52 @@
 #include <GL/gl3w.h>
 #include "gl_renderer.h"
 #include "smath.h"
+#include "snapshot.h"
 
 // NOTE: i'm lazy lol
 #define DOALLOC static_cast<float*>(malloc(bufferSize))
 #define DOFREE(x) free(x); x = nullptr;
 #define SETZERO(x) memset(x, 0, bufferSize)
 
+void iwave_kernel(float* kernel, int radius) {
+	const int kernelLength = (2 * radius) + 1;
+
+	// G0 scales the kernel so that the center value is 1.0f
+	float G0 = 0.0f;
+
+	// these are parameters for calculating G0 and the kernel
+	int n = 10000;
+	float dq = 0.001f; // this is apparently a good choice for accuracy
+	float sigma = 1.0f; // this is some sigma that makes the sum converge to a reasonable number
+	                     // but the symbol isn't rendering in the PDF so idk what it represents
+
+	// calculate G0
+	for (int i = 1; i <= n; i++) {
+		float qi2 = (dq * static_cast<float>(i)) * (dq * static_cast<float>(i));
+		G0 += qi2 * expf(-sigma * qi2);
+	}
+
+	// now compute the derivative kernel G(k, l)
+	for (int y = 0; y < kernelLength; y++) {
+		for (int x = 0; x < kernelLength; x++) {
+			float k = static_cast<float>(x - radius);
+			float l = static_cast<float>(y - radius);
+
+			float r = sqrtf((k * k) + (l * l));
+
+			float sum = 0.0f;
+			for (int i = 1; i <= n; i++) {
+				float qi = dq * static_cast<float>(i);
+				float qi2 = qi * qi;
+
+				sum += qi2 * expf(-sigma * qi2) * static_cast<float>(_j0(qi * r)) / G0;
+			}
+
+			kernel[x + (y * kernelLength)] = sum;
+		}
+	}
+}
+
 //
 // private
 //
@@ -47,12 +87,10 @@ IWaveSurface::IWaveSurface(int w, int h, int p) {
 
 	// allocate display texture
 	waterPixels = (uint32_t*)malloc(sizeof(uint32_t) * width * height);
-
-	glGenTextures(1, &waterTexture);
-	Renderer::sampler_settings();
-	Renderer::bind_tex(0, waterTexture);
-	glBindTexture(GL_TEXTURE_2D, waterTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, waterPixels);
+	waterTexture = Renderer::create_tex(width, height, GL_RGBA8);
+	glTextureParameteri(waterTexture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTextureParameteri(waterTexture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	heightTexture = Renderer::create_tex(width, height, GL_R32F);
 
 
 	// CFL condition says that https://en.wikipedia.org/wiki/Courant%E2%80%93Friedrichs%E2%80%93Lewy_condition 
@@ -75,46 +113,7 @@ IWaveSurface::IWaveSurface(int w, int h, int p) {
 	kernelLength = (2 * p) + 1;
 	derivativeKernel = static_cast<float*>(calloc(1, sizeof(float) * kernelLength * kernelLength));
 
-	// G0 scales the kernel so that the center value is 1.0f
-	float G0 = 0.0f;
-
-	// these are parameters for calculating G0 and the kernel
-	int n = 10000;
-	float dq = 0.001f; // this is apparently a good choice for accuracy
-	float sigma = 1.0f; // this is some sigma that makes the sum converge to a reasonable number
-	                     // but the symbol isn't rendering in the PDF so idk what it represents
-
-	// calculate G0
-	for (int i = 1; i <= n; i++) {
-		float qi2 = (dq * static_cast<float>(i)) * (dq * static_cast<float>(i));
-		G0 += qi2 * expf(-sigma * qi2);
-	}
-
-	// now compute the derivative kernel G(k, l)
-	for (int y = 0; y < kernelLength; y++) {
-		for (int x = 0; x < kernelLength; x++) {
-			int idx = x + (y * kernelLength);
-			float k = static_cast<float>(x - kernelRadius);
-			float l = static_cast<float>(y - kernelRadius);
-
-			float r = sqrtf((k * k) + (l * l));
-			
-			for (int i = 1; i <= n; i++) {
-				float qi = dq * static_cast<float>(i);
-				float qi2 = qi * qi;
-
-				derivativeKernel[idx] += qi2 * expf(-sigma * qi2) * static_cast<float>(_j0(qi * r)) / G0;
-			}
-		}
-	}
-
-	for (int y = 0; y < kernelLength; y++) {
-		for (int x = 0; x < kernelLength; x++) {
-			int idx = x + (y * kernelLength);
-			printf("%f \t", derivativeKernel[idx]);
-		}
-		printf("\n");
-	}
+	iwave_kernel(derivativeKernel, kernelRadius);
 
 	reset();
 }
@@ -126,6 +125,17 @@ IWaveSurface::~IWaveSurface() {
 	DOFREE(source);
 	DOFREE(obstruction);
 	DOFREE(derivativeKernel);
+
+	clean();
+}
+
+void IWaveSurface::clean() {
+	if (heightTexture != 0) {
+		glDeleteTextures(1, &waterTexture);
+		glDeleteTextures(1, &heightTexture);
+		waterTexture = 0;
+		heightTexture = 0;
+	}
 }
 
 void IWaveSurface::place_source(int x, int y, float r, float strength) {
@@ -185,6 +195,59 @@ void IWaveSurface::reset() {
 	std::fill_n(obstruction, bufferCount, 1.0f);
 }
 
+int IWaveSurface::get_params(float* out) const {
+	out[0] = velocityDamping;
+	out[1] = accelerationTerm;
+	return 2;
+}
+
+void IWaveSurface::set_params(const float* values, int count) {
+	if (count != 2) return;
+
+	velocityDamping = values[0];
+	accelerationTerm = values[1];
+}
+
+static constexpr uint32_t SNAPSHOT_KIND = snapshot::id("IWAV");
+
+bool IWaveSurface::save_state(const char* path, bool lossy) {
+	const snapshot::Encoding heights = lossy ? snapshot::Encoding::Quantized : snapshot::Encoding::Lossless;
+
+	SnapshotWriter writer;
+	if (!writer.open(path, SNAPSHOT_KIND, 4)) return false;
+
+	// the previous heights are predicted from the current ones, so they cost next to nothing
+	// obstructions and pending sources are almost all one value, so they stay exact even when lossy
+	writer.write_channel(snapshot::CURRENT, currentGrid, width, height, 1, heights);
+	writer.write_channel(snapshot::PREVIOUS, prevGrid, width, height, 1, heights, snapshot::CURRENT, currentGrid);
+	writer.write_channel(snapshot::OBSTRUCTION, obstruction, width, height, 1, snapshot::Encoding::Lossless);
+	writer.write_channel(snapshot::SOURCE, source, width, height, 1, snapshot::Encoding::Lossless);
+	return writer.close();
+}
+
+bool IWaveSurface::load_state(const char* path) {
+	SnapshotReader reader;
+	if (!reader.open(path) || reader.get_kind() != SNAPSHOT_KIND) return false;
+
+	const uint32_t channels[] = { snapshot::CURRENT, snapshot::PREVIOUS, snapshot::OBSTRUCTION, snapshot::SOURCE };
+	for (uint32_t id : channels) {
+		const snapshot::Channel* channel = reader.find(id);
+		if (!channel || channel->width != width || channel->height != height || channel->components != 1)
+			return false;
+	}
+
+	// past this point a corrupt block would leave a mix of old and new state, so that resets instead
+	bool loaded = reader.read_grid(snapshot::CURRENT, currentGrid, width, height)
+		&& reader.read_grid(snapshot::PREVIOUS, prevGrid, width, height, 1, currentGrid)
+		&& reader.read_grid(snapshot::OBSTRUCTION, obstruction, width, height)
+		&& reader.read_grid(snapshot::SOURCE, source, width, height);
+
+	if (!loaded)
+		reset();
+
+	return loaded;
+}
+
 static float move_towards(float current, float target, float step) {
 	float diff = target - current;
 	if (diff > 0.0f) {
@@ -282,12 +345,13 @@ GLuint IWaveSurface::get_display() {
 		}
 	}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glBindTexture(GL_TEXTURE_2D, waterTexture);
-	//glTextureSubImage2D(waterTexture, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, waterPixels);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, waterPixels);
+	glTextureSubImage2D(waterTexture, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, waterPixels);
 
 	// texture struct is 20 bytes, surely it it isn't too much to just return it directly
 	return waterTexture;
+}
+
+GLuint IWaveSurface::get_height_tex() {
+	glTextureSubImage2D(heightTexture, 0, 0, 0, width, height, GL_RED, GL_FLOAT, currentGrid);
+	return heightTexture;
 }
\ No newline at end of file
@@ -4,6 +4,11 @@
 
 #define IWAVESURFACE_CPU
 
+// fills kernel ((2 * radius) + 1 squared floats) with the vertical derivative kernel G(k, l), scaled so the
+// center is 1.0f
+// every iWave variant uses this one (IWaveSurfaceGPU uploads it as a texture, OceanTiles wraps it around its ring)
+void iwave_kernel(float* kernel, int radius);
+
 // https://people.computing.clemson.edu/~jtessen/reports/papers_files/Interactive_Water_Surfaces.pdf
 class IWaveSurface : public SurfaceSim {
 	int width = 0, height = 0;
@@ -25,6 +30,7 @@ class IWaveSurface : public SurfaceSim {
 	// for display
 	uint32_t* waterPixels = nullptr;
 	GLuint waterTexture;
+	GLuint heightTexture;
 
 	int get_idx(int x, int y) const;
 	int get_kernel_reflected_idx(int x, int y) const;
@@ -37,12 +43,26 @@ public:
 
 	IWaveSurface(int w, int h, int p);
 	~IWaveSurface();
+	void clean() override;
 
 	void place_source(int x, int y, float r, float strength) override;
 	void set_obstruction(int x, int y, float r, float strength) override;
 	void sim_frame(float delta) override;
 
 	GLuint get_display() override;
+	GLuint get_height_tex() override;
 
 	void reset() override;
+	int get_params(float* out) const override;
+	void set_params(const float* values, int count) override;
+	bool save_state(const char* path, bool lossy = false) override;
+	bool load_state(const char* path) override;
+
+	// raw grids, for coupling several grids together (see NestedIWave)
+	int get_grid_width() const { return width; }
+	int get_grid_height() const { return height; }
+	float* get_grid() { return currentGrid; }
+	float* get_prev_grid() { return prevGrid; }
+	float* get_obstruction_grid() { return obstruction; }
+	float* get_source_grid() { return source; }
 };
\ No newline at end of file
@@ -3,10 +3,14 @@
 #include <GL/gl3w.h>
 #include <GLFW/glfw3.h>
 #include "external/imgui.h"
+#include "iwave.h" // for iwave_kernel
+#include "smath.h"
+#include "snapshot.h"
 
 #include <stdlib.h> // for calloc/free
 #include <math.h>
 #include <algorithm>
+#include <bit> // for bit_ceil
 
 // NOTE: i'm lazy lol
 #define DOALLOC static_cast<float*>(malloc(bufferSize))
@@ -22,7 +26,7 @@ in vec2 screenUv;
 
 out vec4 outColor;
 
-uniform sampler2D sourceObstruct;
+TEXTURE sampler2D sourceObstruct;
 uniform vec2 maxValue;
 
 void main() {
@@ -56,7 +60,7 @@ in vec2 screenUv;
 
 out vec4 nextValue;
 
-uniform sampler2D sourceObstruct;
+TEXTURE sampler2D sourceObstruct;
 uniform float speed;
 
 float to_zero(float x, float s) {
@@ -84,8 +88,8 @@ in vec2 screenUv;
 
 out vec4 nextValue;
 
-uniform sampler2D currentGrid;
-uniform sampler2D sourceObstruct;
+TEXTURE sampler2D currentGrid;
+TEXTURE sampler2D sourceObstruct;
 
 void main() {
 	float currentValue = texture(currentGrid, fragUv).r;
@@ -107,8 +111,8 @@ in vec2 screenUv;
 
 out vec4 nextValue;
 
-uniform sampler2D currentGrid;
-uniform sampler2D kernel;
+TEXTURE sampler2D currentGrid;
+TEXTURE sampler2D kernel;
 uniform vec2 kernelCellSize;
 uniform vec2 gridCellSize;
 uniform int kernelRadius;
@@ -157,9 +161,9 @@ in vec2 screenUv;
 
 out vec4 nextValue;
 
-uniform sampler2D currentGrid;
-uniform sampler2D prevGrid;
-uniform sampler2D verticalDerivative;
+TEXTURE sampler2D currentGrid;
+TEXTURE sampler2D prevGrid;
+TEXTURE sampler2D verticalDerivative;
 uniform vec3 coefficients; // these are computed once on the CPU each frame
 
 void main() {
@@ -180,8 +184,8 @@ in vec2 screenUv;
 
 out vec4 outValue;
 
-uniform sampler2D currentGrid;
-uniform sampler2D sourceObstruct;
+TEXTURE sampler2D currentGrid;
+TEXTURE sampler2D sourceObstruct;
 
 void main() {
 	float gridValue = texture(currentGrid, fragUv).r;
@@ -196,6 +200,192 @@ void main() {
 }
 )";
 
+// samples the grid at a batch of points for gameplay queries (buoyancy, splashes, etc)
+const char* samplePointsCompSource = /* compute shader */ R"(
+#version 460 core
+
+layout (local_size_x = 64) in;
+
+layout (std430, binding = 0) readonly buffer Points { vec2 points[]; };
+layout (std430, binding = 1) writeonly buffer Results { float results[]; };
+
+TEXTURE sampler2D currentGrid;
+TEXTURE sampler2D pyramid;
+uniform int count;
+uniform vec2 gridSize;
+uniform float lod;
+
+void main() {
+	uint i = gl_GlobalInvocationID.x;
+	if(i >= count)
+		return;
+
+	// + 0.5 puts integer coordinates on texel centers, so bilinear filtering gives exact cell values there
+	vec2 uv = (points[i] + 0.5) / gridSize;
+
+	if(lod <= 0.0) {
+		results[i] = texture(currentGrid, uv).r;
+		return;
+	}
+
+	// coarse queries (a big hull, something far away) get an already averaged height from the pyramid
+	// it's bigger than the grid, and its level 0 is only half floats, so below 1 it blends with the grid instead
+	vec2 pyramidUv = (points[i] + 0.5) / vec2(textureSize(pyramid, 0));
+	if(lod < 1.0)
+		results[i] = mix(texture(currentGrid, uv).r, textureLod(pyramid, pyramidUv, 1.0).r, lod);
+	else
+		results[i] = textureLod(pyramid, pyramidUv, lod).r;
+}
+)";
+
+// box filters the grid down by an integer factor
+const char* downsampleCompSource = /* compute shader */ R"(
+#version 460 core
+
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (std430, binding = 1) writeonly buffer Results { float results[]; };
+
+TEXTURE sampler2D currentGrid;
+uniform int factor;
+uniform ivec2 outputSize;
+
+void main() {
+	ivec2 cell = ivec2(gl_GlobalInvocationID.xy);
+	if(cell.x >= outputSize.x || cell.y >= outputSize.y)
+		return;
+
+	float sum = 0.0;
+	for(int y = 0; y < factor; y++) {
+		for(int x = 0; x < factor; x++) {
+			sum += texelFetch(currentGrid, cell * factor + ivec2(x, y), 0).r;
+		}
+	}
+
+	results[cell.x + cell.y * outputSize.x] = sum / float(factor * factor);
+}
+)";
+
+// builds the pyramid in one dispatch, like AMD's single pass downsampler
+// every workgroup reduces a 64x64 tile of the base level down to 1x1 (6 levels) through shared memory,
+// then the last workgroup to finish reduces everyone's 1x1 results into one more level
+// only 8 image units are guaranteed, so one dispatch covers 8 levels, bigger fields need one more
+// dispatch per 7 levels after that, starting from the last level the previous one wrote
+const char* pyramidCompSource = /* compute shader */ R"(
+#version 460 core
+
+layout (local_size_x = 256) in;
+
+// levels baseLevel to baseLevel + 7
+layout (rgba16f, binding = 0) coherent uniform image2D levels[8];
+
+layout (std430, binding = 0) coherent buffer Counter { uint finishedGroups; };
+
+TEXTURE sampler2D currentGrid;
+uniform int baseLevel; // 0 computes the base level from currentGrid, otherwise it's read from levels[0]
+uniform int levelCount;
+uniform float foamScale;
+
+// levels 1 to 6 of the tile, 32x32 first and 1x1 last
+shared vec4 reduced[(32 * 32) + (16 * 16) + (8 * 8) + (4 * 4) + (2 * 2) + 1];
+shared bool lastGroup;
+
+void store(int level, ivec2 p, vec4 value) {
+	if(baseLevel + level < levelCount && all(lessThan(p, imageSize(levels[level]))))
+		imageStore(levels[level], p, value);
+}
+
+float grid_at(ivec2 p) {
+	return texelFetch(currentGrid, clamp(p, ivec2(0), textureSize(currentGrid, 0) - 1), 0).r;
+}
+
+vec4 base_texel(ivec2 p) {
+	if(baseLevel > 0)
+		return imageLoad(levels[0], min(p, imageSize(levels[0]) - 1));
+
+	// the pyramid is rounded up to a power of 2, past the grid's edge it repeats the edge
+	ivec2 clamped = min(p, textureSize(currentGrid, 0) - 1);
+	float h = grid_at(clamped);
+	float left = grid_at(clamped - ivec2(1, 0));
+	float right = grid_at(clamped + ivec2(1, 0));
+	float down = grid_at(clamped - ivec2(0, 1));
+	float up = grid_at(clamped + ivec2(0, 1));
+
+	// crests are where the surface curves down the hardest, that's where it would break into foam
+	float laplacian = left + right + down + up - (4.0 * h);
+	vec4 value = vec4(h, (right - left) * 0.5, (up - down) * 0.5, clamp(-laplacian * foamScale, 0.0, 1.0));
+
+	if(all(lessThan(p, imageSize(levels[0]))))
+		imageStore(levels[0], p, value);
+	return value;
+}
+
+void main() {
+	uint t = gl_LocalInvocationIndex;
+	ivec2 tile = ivec2(gl_WorkGroupID.xy) * 64;
+
+	// level 1, 4 texels per thread
+	for(uint i = 0; i < 4; i++) {
+		uint index = t + (i * 256);
+		ivec2 local = ivec2(index % 32, index / 32);
+		ivec2 p = tile + (local * 2);
+
+		vec4 value = (base_texel(p) + base_texel(p + ivec2(1, 0)) + base_texel(p + ivec2(0, 1)) + base_texel(p + ivec2(1, 1))) * 0.25;
+		reduced[index] = value;
+		store(1, (tile / 2) + local, value);
+	}
+	barrier();
+
+	// levels 2 to 6, each one reads the previous one from shared memory
+	int source = 0;
+	for(int level = 2; level <= 6; level++) {
+		int levelWidth = 64 >> level;
+		int sourceWidth = levelWidth * 2;
+		int target = source + (sourceWidth * sourceWidth);
+
+		if(t < levelWidth * levelWidth) {
+			ivec2 local = ivec2(t % levelWidth, t / levelWidth);
+			int i = source + (local.x * 2) + (local.y * 2 * sourceWidth);
+
+			vec4 value = (reduced[i] + reduced[i + 1] + reduced[i + sourceWidth] + reduced[i + sourceWidth + 1]) * 0.25;
+			reduced[target + t] = value;
+			store(level, (tile >> level) + local, value);
+		}
+
+		source = target;
+		barrier();
+	}
+
+	// level 6 was written by thread 0, which makes it visible before counting its group as finished
+	if(t == 0) {
+		memoryBarrierImage();
+		uint groups = gl_NumWorkGroups.x * gl_NumWorkGroups.y;
+		lastGroup = atomicAdd(finishedGroups, 1) == groups - 1;
+	}
+	barrier();
+
+	if(!lastGroup)
+		return;
+
+	// reset for the next dispatch
+	if(t == 0)
+		finishedGroups = 0;
+
+	ivec2 size = max(imageSize(levels[6]) / 2, ivec2(1));
+	ivec2 sourceMax = imageSize(levels[6]) - 1;
+	for(int i = int(t); i < size.x * size.y; i += 256) {
+		ivec2 p = ivec2(i % size.x, i / size.x);
+		ivec2 q = p * 2;
+
+		vec4 value = imageLoad(levels[6], q);
+		value += imageLoad(levels[6], min(q + ivec2(1, 0), sourceMax));
+		value += imageLoad(levels[6], min(q + ivec2(0, 1), sourceMax));
+		value += imageLoad(levels[6], min(q + ivec2(1, 1), sourceMax));
+		store(7, p, value * 0.25);
+	}
+}
+)";
+
 IWaveSurfaceGPU::IWaveSurfaceGPU(int w, int h, int p) {
 	width = w;
 	height = h;
@@ -249,55 +439,93 @@ IWaveSurfaceGPU::IWaveSurfaceGPU(int w, int h, int p) {
 	p3_verticalDerivative = Renderer::shader_loc(propagateShader, "verticalDerivative");
 	p3_coefficients = Renderer::shader_loc(propagateShader, "coefficients");
 
+	samplePointsShader = Renderer::compile_shader(samplePointsCompSource);
+	r1_currentGrid = Renderer::shader_loc(samplePointsShader, "currentGrid");
+	r1_pyramid = Renderer::shader_loc(samplePointsShader, "pyramid");
+	r1_count = Renderer::shader_loc(samplePointsShader, "count");
+	r1_gridSize = Renderer::shader_loc(samplePointsShader, "gridSize");
+	r1_lod = Renderer::shader_loc(samplePointsShader, "lod");
+
+	downsampleShader = Renderer::compile_shader(downsampleCompSource);
+	r2_currentGrid = Renderer::shader_loc(downsampleShader, "currentGrid");
+	r2_factor = Renderer::shader_loc(downsampleShader, "factor");
+	r2_outputSize = Renderer::shader_loc(downsampleShader, "outputSize");
+
+	pyramidShader = Renderer::compile_shader(pyramidCompSource);
+	m1_currentGrid = Renderer::shader_loc(pyramidShader, "currentGrid");
+	m1_baseLevel = Renderer::shader_loc(pyramidShader, "baseLevel");
+	m1_levelCount = Renderer::shader_loc(pyramidShader, "levelCount");
+	m1_foamScale = Renderer::shader_loc(pyramidShader, "foamScale");
+
+	// every level down to 1x1, with trilinear filtering so it can be sampled at fractional lods
+	pyramidWidth = static_cast<int>(std::bit_ceil(static_cast<unsigned>(width)));
+	pyramidHeight = static_cast<int>(std::bit_ceil(static_cast<unsigned>(height)));
+	pyramidLevels = smath::log2i(std::max(pyramidWidth, pyramidHeight)) + 1;
+	glCreateTextures(GL_TEXTURE_2D, 1, &pyramid);
+	Renderer::sampler_settings(pyramid);
+	glTextureParameteri(pyramid, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTextureStorage2D(pyramid, pyramidLevels, GL_RGBA16F, pyramidWidth, pyramidHeight);
+
+	// the shader puts the counter back to 0 when it's done, so it only needs clearing once
+	const GLuint zero = 0;
+	glCreateBuffers(1, &pyramidCounter);
+	glNamedBufferStorage(pyramidCounter, sizeof(GLuint), &zero, 0);
+
+	// a full resolution field is the largest thing we'll ever read back
+	size_t resultsSize = sizeof(float) * std::max(width * height, MAX_READBACK_POINTS);
+	glCreateBuffers(1, &pointsBuffer);
+	glNamedBufferStorage(pointsBuffer, sizeof(float) * 2 * MAX_READBACK_POINTS, nullptr, GL_DYNAMIC_STORAGE_BIT);
+	glCreateBuffers(1, &resultsBuffer);
+	glNamedBufferStorage(resultsBuffer, resultsSize, nullptr, 0);
+	readback.init(resultsSize);
+
+	// the grids are copied around instead of swapped, so every pass always samples the same textures
+	add_pass_tex(drawAuxPass, drawAuxShader, n1_sourceObstruct, pingpongSO.texture);
+	add_pass_tex(progressSoPass, progressSoShader, n2_sourceObstruct, pingpongSO.texture);
+	add_pass_tex(preprocessPass, preprocessShader, p1_currentGrid, pingpongGrid.texture);
+	add_pass_tex(preprocessPass, preprocessShader, p1_sourceObstruct, sourceObstruct.texture);
+	add_pass_tex(convolutionPass, convolutionShader, p2_currentGrid, currentGrid.texture);
+	add_pass_tex(convolutionPass, convolutionShader, p2_kernel, kernelTexture);
+	add_pass_tex(propagatePass, propagateShader, p3_currentGrid, currentGrid.texture);
+	add_pass_tex(propagatePass, propagateShader, p3_prevGrid, prevGrid.texture);
+	add_pass_tex(propagatePass, propagateShader, p3_verticalDerivative, verticalDerivative.texture);
+	add_pass_tex(displayPass, displayShader, d_currentGrid, currentGrid.texture);
+	add_pass_tex(displayPass, displayShader, d_sourceObstruct, sourceObstruct.texture);
+	add_pass_tex(samplePointsPass, samplePointsShader, r1_currentGrid, currentGrid.texture);
+	add_pass_tex(samplePointsPass, samplePointsShader, r1_pyramid, pyramid);
+	add_pass_tex(downsamplePass, downsampleShader, r2_currentGrid, currentGrid.texture);
+	add_pass_tex(pyramidPass, pyramidShader, m1_currentGrid, currentGrid.texture);
+
 	reset();
 }
 
-unsigned int IWaveSurfaceGPU::compute_kernel(int radius) {
-	int kernelLength = (2 * radius) + 1;
-	float* derivativeKernel = static_cast<float*>(calloc(1, sizeof(float) * kernelLength * kernelLength));
-
-	if (!derivativeKernel) return { 0 };
+// with bindless textures the handle goes straight into the program, otherwise the sampler
+// gets a fixed texture unit so a pass only has to bind its textures
+void IWaveSurfaceGPU::add_pass_tex(PassTextures& pass, GLuint shader, GLint location, GLuint texture) {
+	if (pass.count >= PassTextures::MAX_TEXTURES) return;
 
-	// G0 scales the kernel so that the center value is 1.0f
-	float G0 = 0.0f;
+	if (Renderer::useBindless)
+		Renderer::uniform_handle(shader, location, texture);
+	else
+		glProgramUniform1i(shader, location, pass.count);
 
-	// these are parameters for calculating G0 and the kernel
-	int n = 10000;
-	float dq = 0.001f; // this is apparently a good choice for accuracy
-	float sigma = 1.0f; // this is some sigma that makes the sum converge to a reasonable number
-	// but the symbol isn't rendering in the PDF so idk what it represents
-
-	// calculate G0
-	for (int i = 1; i <= n; i++) {
-		float qi2 = (dq * static_cast<float>(i)) * (dq * static_cast<float>(i));
-		G0 += qi2 * expf(-sigma * qi2);
-	}
+	pass.textures[pass.count++] = texture;
+}
 
-	// now compute the derivative kernel G(k, l)
-	for (int y = 0; y < kernelLength; y++) {
-		for (int x = 0; x < kernelLength; x++) {
-			int idx = x + (y * kernelLength);
-			float k = static_cast<float>(x - radius);
-			float l = static_cast<float>(y - radius);
+void IWaveSurfaceGPU::bind_pass(const PassTextures& pass) {
+	if (Renderer::useBindless) return;
 
-			float r = sqrtf((k * k) + (l * l));
+	for (int i = 0; i < pass.count; i++)
+		Renderer::bind_tex(i, pass.textures[i]);
+}
 
-			for (int i = 1; i <= n; i++) {
-				float qi = dq * static_cast<float>(i);
-				float qi2 = qi * qi;
+unsigned int IWaveSurfaceGPU::compute_kernel(int radius) {
+	int kernelLength = (2 * radius) + 1;
+	float* derivativeKernel = static_cast<float*>(calloc(1, sizeof(float) * kernelLength * kernelLength));
 
-				derivativeKernel[idx] += qi2 * expf(-sigma * qi2) * static_cast<float>(_j0(qi * r)) / G0;
-			}
-		}
-	}
+	if (!derivativeKernel) return { 0 };
 
-	for (int y = 0; y < kernelLength; y++) {
-		for (int x = 0; x < kernelLength; x++) {
-			int idx = x + (y * kernelLength);
-			printf("%f \t", derivativeKernel[idx]);
-		}
-		printf("\n");
-	}
+	iwave_kernel(derivativeKernel, radius);
 
 	unsigned int derivativeTexture = Renderer::create_tex(kernelLength, kernelLength, GL_R32F, derivativeKernel);
 	free(derivativeKernel);
@@ -305,6 +533,41 @@ unsigned int IWaveSurfaceGPU::compute_kernel(int radius) {
 }
 
 IWaveSurfaceGPU::~IWaveSurfaceGPU() {
+	clean();
+}
+
+void IWaveSurfaceGPU::clean() {
+	// targets go back to the pool, so the next surface with the same size doesn't allocate
+	display.clean();
+	currentGrid.clean();
+	prevGrid.clean();
+	pingpongGrid.clean();
+	verticalDerivative.clean();
+	sourceObstruct.clean();
+	pingpongSO.clean();
+
+	readback.clean();
+
+	if (kernelTexture != 0) {
+		Renderer::release_handle(kernelTexture);
+		glDeleteTextures(1, &kernelTexture);
+		kernelTexture = 0;
+	}
+
+	if (pointsBuffer != 0) {
+		glDeleteBuffers(1, &pointsBuffer);
+		glDeleteBuffers(1, &resultsBuffer);
+		pointsBuffer = 0;
+		resultsBuffer = 0;
+	}
+
+	if (pyramid != 0) {
+		Renderer::release_handle(pyramid);
+		glDeleteTextures(1, &pyramid);
+		glDeleteBuffers(1, &pyramidCounter);
+		pyramid = 0;
+		pyramidCounter = 0;
+	}
 }
 
 // this might be a bit expensive since it copies a super large texture for each call
@@ -313,24 +576,14 @@ void IWaveSurfaceGPU::draw_aux(int x, int y, float r, float v1, float v2) {
 	pingpongSO.copy_from(sourceObstruct);
 	sourceObstruct.set_target();
 
-	glUseProgram(drawAuxShader);
+	Renderer::use_program(drawAuxShader);
 
-	glDisable(GL_DEPTH_TEST);
-	glDisable(GL_BLEND);
-	glDisable(GL_CULL_FACE);
+	Renderer::pass_state();
 
-	Renderer::attach_tex(drawAuxShader, n1_sourceObstruct, pingpongSO.texture, 0);
+	bind_pass(drawAuxPass);
 	glUniform2f(n1_maxValue, v1, v2);
 
 	Renderer::draw_transformed_quad(static_cast<float>(x), static_cast<float>(y), r, r);
-	Renderer::bind_tex(0, 0);
-
-	glEnable(GL_CULL_FACE);
-	glEnable(GL_BLEND);
-	glEnable(GL_DEPTH_TEST);
-
-	glUseProgram(0);
-
 	TextureTarget::reset_target();
 }
 
@@ -342,6 +595,47 @@ void IWaveSurfaceGPU::set_obstruction(int x, int y, float r, float strength) {
 	draw_aux(x, y, r, 0.0f, -strength);
 }
 
+void IWaveSurfaceGPU::place_stamps(const Stamp* stamps, int count) {
+	if (count <= 0) return;
+
+	pingpongSO.copy_from(sourceObstruct);
+	sourceObstruct.set_target();
+
+	Renderer::use_program(drawAuxShader);
+	Renderer::pass_state();
+	bind_pass(drawAuxPass);
+
+	// the copy above isn't affected by the scissor, only the quads are
+	Renderer::set_capability(GL_SCISSOR_TEST, true);
+	for (int i = 0; i < count; i++) {
+		const Stamp& stamp = stamps[i];
+		glScissor(stamp.clipX, stamp.clipY, stamp.clipW, stamp.clipH);
+		glUniform2f(n1_maxValue, stamp.source, -stamp.obstruction);
+		Renderer::draw_transformed_quad(stamp.x, stamp.y, stamp.r, stamp.r);
+	}
+	Renderer::set_capability(GL_SCISSOR_TEST, false);
+
+	TextureTarget::reset_target();
+}
+
+void IWaveSurfaceGPU::clear_region(int x, int y, int w, int h, float obstruction) {
+	x = std::clamp(x, 0, width);
+	y = std::clamp(y, 0, height);
+	w = std::min(w, width - x);
+	h = std::min(h, height - y);
+	if (w <= 0 || h <= 0) return;
+
+	const float zero = 0.0f;
+	const float so[4] = { 0.0f, obstruction, 0.0f, 1.0f }; // same layout reset clears to
+
+	const GLuint grids[] = { currentGrid.texture, prevGrid.texture, pingpongGrid.texture, verticalDerivative.texture };
+	for (GLuint grid : grids)
+		glClearTexSubImage(grid, 0, x, y, 0, w, h, 1, GL_RED, GL_FLOAT, &zero);
+
+	glClearTexSubImage(sourceObstruct.texture, 0, x, y, 0, w, h, 1, GL_RGBA, GL_FLOAT, so);
+	glClearTexSubImage(pingpongSO.texture, 0, x, y, 0, w, h, 1, GL_RGBA, GL_FLOAT, so);
+}
+
 void IWaveSurfaceGPU::reset() {
 	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 	
@@ -365,10 +659,115 @@ void IWaveSurfaceGPU::reset() {
 	TextureTarget::reset_target();
 }
 
+int IWaveSurfaceGPU::get_params(float* out) const {
+	out[0] = velocityDamping;
+	out[1] = accelerationTerm;
+	return 2;
+}
+
+void IWaveSurfaceGPU::set_params(const float* values, int count) {
+	if (count != 2) return;
+
+	velocityDamping = values[0];
+	accelerationTerm = values[1];
+}
+
+static constexpr uint32_t SNAPSHOT_KIND = snapshot::id("IWGP");
+
+bool IWaveSurfaceGPU::save_state(const char* path, bool lossy) {
+	const snapshot::Encoding heights = lossy ? snapshot::Encoding::Quantized : snapshot::Encoding::Lossless;
+	const size_t cells = static_cast<size_t>(width) * height;
+
+	// sourceObstruct's r is the source and g the obstruction, they're split up so they compress like the CPU's
+	float* current = static_cast<float*>(malloc(sizeof(float) * cells));
+	float* prev = static_cast<float*>(malloc(sizeof(float) * cells));
+	float* so = static_cast<float*>(malloc(sizeof(float) * cells * 4));
+	float* source = static_cast<float*>(malloc(sizeof(float) * cells));
+	float* obstruction = static_cast<float*>(malloc(sizeof(float) * cells));
+
+	// out of memory fails the save instead of writing garbage
+	if (!current || !prev || !so || !source || !obstruction) {
+		free(current);
+		free(prev);
+		free(so);
+		free(source);
+		free(obstruction);
+		return false;
+	}
+
+	glGetTextureImage(currentGrid.texture, 0, GL_RED, GL_FLOAT, static_cast<GLsizei>(sizeof(float) * cells), current);
+	glGetTextureImage(prevGrid.texture, 0, GL_RED, GL_FLOAT, static_cast<GLsizei>(sizeof(float) * cells), prev);
+	glGetTextureImage(sourceObstruct.texture, 0, GL_RGBA, GL_FLOAT, static_cast<GLsizei>(sizeof(float) * cells * 4), so);
+
+	for (size_t i = 0; i < cells; i++) {
+		source[i] = so[(i * 4) + 0];
+		obstruction[i] = so[(i * 4) + 1];
+	}
+
+	SnapshotWriter writer;
+	bool saved = writer.open(path, SNAPSHOT_KIND, 4);
+	if (saved) {
+		writer.write_channel(snapshot::CURRENT, current, width, height, 1, heights);
+		writer.write_channel(snapshot::PREVIOUS, prev, width, height, 1, heights, snapshot::CURRENT, current);
+		writer.write_channel(snapshot::OBSTRUCTION, obstruction, width, height, 1, snapshot::Encoding::Lossless);
+		writer.write_channel(snapshot::SOURCE, source, width, height, 1, snapshot::Encoding::Lossless);
+		saved = writer.close();
+	}
+
+	free(current);
+	free(prev);
+	free(so);
+	free(source);
+	free(obstruction);
+	return saved;
+}
+
+bool IWaveSurfaceGPU::load_state(const char* path) {
+	SnapshotReader reader;
+	if (!reader.open(path) || reader.get_kind() != SNAPSHOT_KIND) return false;
+
+	const size_t cells = static_cast<size_t>(width) * height;
+	float* current = static_cast<float*>(malloc(sizeof(float) * cells));
+	float* prev = static_cast<float*>(malloc(sizeof(float) * cells));
+	float* so = static_cast<float*>(malloc(sizeof(float) * cells * 4));
+	float* source = static_cast<float*>(malloc(sizeof(float) * cells));
+	float* obstruction = static_cast<float*>(malloc(sizeof(float) * cells));
+
+	// everything's decoded before anything gets uploaded, so a bad file (or running out of memory) leaves
+	// the simulation alone
+	bool loaded = current && prev && so && source && obstruction
+		&& reader.read_grid(snapshot::CURRENT, current, width, height)
+		&& reader.read_grid(snapshot::PREVIOUS, prev, width, height, 1, current)
+		&& reader.read_grid(snapshot::OBSTRUCTION, obstruction, width, height)
+		&& reader.read_grid(snapshot::SOURCE, source, width, height);
+
+	if (loaded) {
+		// same layout reset clears to
+		for (size_t i = 0; i < cells; i++) {
+			so[(i * 4) + 0] = source[i];
+			so[(i * 4) + 1] = obstruction[i];
+			so[(i * 4) + 2] = 0.0f;
+			so[(i * 4) + 3] = 1.0f;
+		}
+
+		glTextureSubImage2D(currentGrid.texture, 0, 0, 0, width, height, GL_RED, GL_FLOAT, current);
+		glTextureSubImage2D(prevGrid.texture, 0, 0, 0, width, height, GL_RED, GL_FLOAT, prev);
+		glTextureSubImage2D(sourceObstruct.texture, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, so);
+
+		// the pyramid is only built after a step, so it would show the old state until the next one
+		build_pyramid();
+	}
+
+	free(current);
+	free(prev);
+	free(so);
+	free(source);
+	free(obstruction);
+	return loaded;
+}
+
 void IWaveSurfaceGPU::sim_frame(float delta) {
-	glDisable(GL_DEPTH_TEST);
-	glDisable(GL_BLEND);
-	glDisable(GL_CULL_FACE);
+	Renderer::pass_state();
 
 	// our steps are as follows:
 	// - render to pingpong, use sourceObstruct as input
@@ -383,18 +782,17 @@ void IWaveSurfaceGPU::sim_frame(float delta) {
 
 	pingpongGrid.copy_from(currentGrid);
 	currentGrid.set_target();
-	glUseProgram(preprocessShader);
+	Renderer::use_program(preprocessShader);
 
-	Renderer::attach_tex(preprocessShader, p1_currentGrid, pingpongGrid.texture, 0);
-	Renderer::attach_tex(preprocessShader, p1_sourceObstruct, sourceObstruct.texture, 1);
+	bind_pass(preprocessPass);
 	Renderer::draw_quad();
 
 	// progress source obstruct (either fade sources towards 0 or zero them out)
 	pingpongSO.copy_from(sourceObstruct);
 	sourceObstruct.set_target();
-	glUseProgram(progressSoShader);
+	Renderer::use_program(progressSoShader);
 
-	Renderer::attach_tex(progressSoShader, n2_sourceObstruct, pingpongSO.texture, 0);
+	bind_pass(progressSoPass);
 	glUniform1f(n2_speed, delta);
 	Renderer::draw_quad();
 
@@ -403,10 +801,9 @@ void IWaveSurfaceGPU::sim_frame(float delta) {
 	// convolve grid with kernel, put it into verticalDerivative
 	//
 	verticalDerivative.set_target();
-	glUseProgram(convolutionShader);
+	Renderer::use_program(convolutionShader);
 
-	Renderer::attach_tex(convolutionShader, p2_currentGrid, currentGrid.texture, 0);
-	Renderer::attach_tex(convolutionShader, p2_kernel, kernelTexture, 1);
+	bind_pass(convolutionPass);
 	glUniform2f(p2_gridCellSize, 1.0f / static_cast<float>(width), 1.0f / static_cast<float>(height));
 	glUniform2f(p2_kernelCellSize, 1.0f / static_cast<float>((kernelRadius * 2) + 1), 1.0f / static_cast<float>((kernelRadius * 2) + 1));
 	glUniform1i(p2_kernelRadius, kernelRadius);
@@ -417,11 +814,9 @@ void IWaveSurfaceGPU::sim_frame(float delta) {
 	//
 	pingpongGrid.copy_from(currentGrid);
 	currentGrid.set_target();
-	glUseProgram(propagateShader);
+	Renderer::use_program(propagateShader);
 	
-	Renderer::attach_tex(propagateShader, p3_currentGrid, currentGrid.texture, 0);
-	Renderer::attach_tex(propagateShader, p3_prevGrid, prevGrid.texture, 1);
-	Renderer::attach_tex(propagateShader, p3_verticalDerivative, verticalDerivative.texture, 2);
+	bind_pass(propagatePass);
 
 	// these mirror the coefficients of currentGrid, prevGrid, verticalDerivative in the CPU version
 	float alphaDt = velocityDamping * delta;
@@ -438,31 +833,107 @@ void IWaveSurfaceGPU::sim_frame(float delta) {
 
 	TextureTarget::reset_target();
 
-	glEnable(GL_CULL_FACE);
-	glEnable(GL_BLEND);
-	glEnable(GL_DEPTH_TEST);
+	build_pyramid();
+}
+
+void IWaveSurfaceGPU::build_pyramid() {
+	Renderer::use_program(pyramidShader);
+	bind_pass(pyramidPass);
+	glUniform1i(m1_levelCount, pyramidLevels);
+	glUniform1f(m1_foamScale, foamScale);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, pyramidCounter);
+
+	// the first dispatch writes levels 0 to 7, which is all of them for anything up to 255 cells across
+	for (int base = 0; base == 0 || base < pyramidLevels - 1; base += 7) {
+		// units past the last level get the last level again, the shader never writes to them
+		for (int i = 0; i < 8; i++)
+			glBindImageTexture(i, pyramid, std::min(base + i, pyramidLevels - 1), GL_FALSE, 0, GL_READ_WRITE, GL_RGBA16F);
+
+		int baseWidth = std::max(pyramidWidth >> base, 1);
+		int baseHeight = std::max(pyramidHeight >> base, 1);
+		glUniform1i(m1_baseLevel, base);
+		glDispatchCompute((baseWidth + 63) / 64, (baseHeight + 63) / 64, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
 }
 
 GLuint IWaveSurfaceGPU::get_display() {
-	glDisable(GL_DEPTH_TEST);
-	glDisable(GL_BLEND);
-	glDisable(GL_CULL_FACE);
+	Renderer::pass_state();
 
 	display.set_target();
-	glUseProgram(displayShader);
-	Renderer::attach_tex(displayShader, d_currentGrid, currentGrid.texture, 0);
-	Renderer::attach_tex(displayShader, d_sourceObstruct, sourceObstruct.texture, 1);
+	Renderer::use_program(displayShader);
+	bind_pass(displayPass);
 	Renderer::draw_quad();
 
 	TextureTarget::reset_target();
 
-	glEnable(GL_CULL_FACE);
-	glEnable(GL_BLEND);
-	glEnable(GL_DEPTH_TEST);
-
 	return display.texture;
 }
 
+// the grid is already a float texture, and the ping-pong copies back into it so it never changes
+GLuint IWaveSurfaceGPU::get_height_tex() {
+	return currentGrid.texture;
+}
+
+GLuint IWaveSurfaceGPU::get_pyramid_tex() {
+	return pyramid;
+}
+
+int IWaveSurfaceGPU::request_heights(const float* points, int count, float lod) {
+	count = std::clamp(count, 0, MAX_READBACK_POINTS);
+
+	// check for a free slot before doing any work
+	int request = nextReadback;
+	if (count == 0 || readback.full())
+		return -1;
+
+	glNamedBufferSubData(pointsBuffer, 0, sizeof(float) * 2 * count, points);
+
+	Renderer::use_program(samplePointsShader);
+	bind_pass(samplePointsPass);
+	glUniform1i(r1_count, count);
+	glUniform2f(r1_gridSize, static_cast<float>(width), static_cast<float>(height));
+	glUniform1f(r1_lod, lod);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, pointsBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, resultsBuffer);
+	glDispatchCompute((count + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	readback.push(resultsBuffer, sizeof(float) * count, request);
+	nextReadback++;
+	return request;
+}
+
+int IWaveSurfaceGPU::request_field(int factor) {
+	factor = std::max(factor, 1);
+	int outWidth = width / factor;
+	int outHeight = height / factor;
+
+	int request = nextReadback;
+	if (outWidth == 0 || outHeight == 0 || readback.full())
+		return -1;
+
+	Renderer::use_program(downsampleShader);
+	bind_pass(downsamplePass);
+	glUniform1i(r2_factor, factor);
+	glUniform2i(r2_outputSize, outWidth, outHeight);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, resultsBuffer);
+	glDispatchCompute((outWidth + 7) / 8, (outHeight + 7) / 8, 1);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	readback.push(resultsBuffer, sizeof(float) * outWidth * outHeight, request);
+	nextReadback++;
+	return request;
+}
+
+bool IWaveSurfaceGPU::fetch_readback(int request, float* output) {
+	return readback.pop(request, output);
+}
+
 extern int screenWidth, screenHeight; // from main.cpp
 void IWaveSurfaceGPU::imgui_builder(bool* open) {
 	if (open && *open) {
@@ -484,6 +955,10 @@ void IWaveSurfaceGPU::imgui_builder(bool* open) {
 
 			ImGui::SeparatorText("Previous Grid");
 			ImGui::Image(prevGrid.texture, ImVec2(imgWidth, imgHeight));
+
+			ImGui::SeparatorText("Height Pyramid");
+			ImGui::Text("%dx%d, %d levels", pyramidWidth, pyramidHeight, pyramidLevels);
+			ImGui::SliderFloat("Foam Scale", &foamScale, 0.0f, 32.0f);
 		}
 
 		ImGui::End();
@@ -47,18 +47,96 @@ class IWaveSurfaceGPU : public SurfaceSim {
 
 	void draw_aux(int x, int y, float r, float v1, float v2);
 
+	// the textures a pass samples, in texture unit order
+	struct PassTextures {
+		static constexpr int MAX_TEXTURES = 4;
+		GLuint textures[MAX_TEXTURES];
+		int count = 0;
+	};
+
+	PassTextures drawAuxPass, progressSoPass;
+	PassTextures preprocessPass, convolutionPass, propagatePass;
+	PassTextures displayPass, samplePointsPass, downsamplePass;
+	PassTextures pyramidPass;
+
+	void add_pass_tex(PassTextures& pass, GLuint shader, GLint location, GLuint texture);
+	void bind_pass(const PassTextures& pass);
+
+	// for reading heights back to the CPU without stalling
+	GLuint pointsBuffer, resultsBuffer;
+	ReadbackRing readback;
+	int nextReadback = 0;
+
+	GLuint samplePointsShader;
+	GLint r1_currentGrid, r1_pyramid, r1_count, r1_gridSize, r1_lod;
+
+	GLuint downsampleShader;
+	GLint r2_currentGrid, r2_factor, r2_outputSize;
+
+	// mip chain of the height field, rebuilt at the end of every sim_frame
+	// r = height, gb = slope (dh/dx, dh/dy), a = foam
+	// slopes are kept instead of normals since they can be box filtered like the heights
+	// its level 0 is the grid rounded up to a power of 2 on both sides, GL floors odd level sizes, so
+	// otherwise every odd level would drop its last row or column and the top ones only cover part of the grid
+	GLuint pyramid = 0;
+	int pyramidWidth = 0, pyramidHeight = 0;
+	int pyramidLevels = 0;
+	GLuint pyramidCounter; // one uint, the number of workgroups that finished the current dispatch
+
+	GLuint pyramidShader;
+	GLint m1_currentGrid, m1_baseLevel, m1_levelCount, m1_foamScale;
+
+	void build_pyramid();
+
 public:
 	float velocityDamping;
 	float accelerationTerm;
+	float foamScale = 4.0f; // foam per unit of (negative) curvature
 
 	IWaveSurfaceGPU(int w, int h, int p);
 	~IWaveSurfaceGPU();
+	void clean() override;
 
 	void place_source(int x, int y, float r, float strength) override;
 	void set_obstruction(int x, int y, float r, float strength) override;
 	void sim_frame(float delta) override;
 	void reset() override;
+	int get_params(float* out) const override;
+	void set_params(const float* values, int count) override;
+
+	// these read the grids back (or upload them) synchronously, so they stall for a frame or so
+	bool save_state(const char* path, bool lossy = false) override;
+	bool load_state(const char* path) override;
+
 	GLuint get_display() override;
+	GLuint get_height_tex() override;
+	GLuint get_pyramid_tex() override;
+
+	// async readback, the results of a request become available one or two frames later
+	// these return a request id, or -1 if all readback slots are still in flight
+	static constexpr int MAX_READBACK_POINTS = 4096;
+	// points are (x, y) pairs in grid coordinates, a lod above 0 samples the pyramid instead of the grid
+	// (below 1 it blends between the grid and level 1)
+	int request_heights(const float* points, int count, float lod = 0.0f);
+	int request_field(int factor); // box filtered field, (width / factor) x (height / factor)
+
+	// never blocks, returns false if the request isn't ready yet
+	bool fetch_readback(int request, float* output);
+
+	// for packing several bodies of water into one grid (see WaterWorld)
+	// a source or obstruction like place_source/set_obstruction, that can't draw outside of its clip rectangle
+	struct Stamp {
+		float x, y, r;
+		float source, obstruction;
+		int clipX, clipY, clipW, clipH;
+	};
+
+	// like place_source, but copies the texture once for the whole batch instead of once per call
+	// every stamp reads the copy, so where two of them overlap the last one wins instead of adding up
+	void place_stamps(const Stamp* stamps, int count);
+
+	// zeroes the heights and sources in a rectangle of cells, and sets its obstruction (1 is open water, 0 a wall)
+	void clear_region(int x, int y, int w, int h, float obstruction);
 
 	void imgui_builder(bool* open = nullptr);
 };
\ No newline at end of file
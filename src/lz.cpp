@@ -0,0 +1,175 @@
+#include "lz.h"
+
+#include <string.h>
+#include <bit>
+
+static constexpr int HASH_BITS = 13;
+static constexpr size_t MIN_MATCH = 4;
+static constexpr size_t MAX_OFFSET = 65535;
+
+// the format's end conditions, the last match has to start 12 bytes before the end and the last 5 bytes
+// are always literals, so a decoder can copy in wide chunks without checking every byte
+static constexpr size_t MATCH_START_LIMIT = 12;
+static constexpr size_t END_LITERALS = 5;
+
+static inline uint32_t load32(const uint8_t* p) {
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint64_t load64(const uint8_t* p) {
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t hash(uint32_t sequence) {
+	return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// lengths past 15 continue in extra bytes, 255 at a time
+static inline uint8_t* put_length(uint8_t* out, size_t length) {
+	for (; length >= 255; length -= 255)
+		*out++ = 255;
+	*out++ = static_cast<uint8_t>(length);
+	return out;
+}
+
+static inline uint8_t* put_sequence(uint8_t* out, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength) {
+	const size_t matchCode = matchLength - MIN_MATCH;
+	uint8_t* token = out++;
+	*token = static_cast<uint8_t>(((literalLength < 15 ? literalLength : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+
+	if (literalLength >= 15)
+		out = put_length(out, literalLength - 15);
+	memcpy(out, literals, literalLength);
+	out += literalLength;
+
+	*out++ = static_cast<uint8_t>(offset);
+	*out++ = static_cast<uint8_t>(offset >> 8);
+
+	if (matchCode >= 15)
+		out = put_length(out, matchCode - 15);
+	return out;
+}
+
+size_t lz::bound(size_t n) {
+	return n + (n / 255) + 16;
+}
+
+size_t lz::compress(const uint8_t* in, size_t n, uint8_t* out) {
+	uint8_t* op = out;
+	size_t anchor = 0;
+
+	if (n > MATCH_START_LIMIT) {
+		// positions of the last 4 byte sequence with each hash, 0 just gets rejected by the compare
+		uint32_t table[1 << HASH_BITS] = {};
+
+		const size_t matchLimit = n - END_LITERALS;
+		size_t i = 0;
+
+		while (i < n - MATCH_START_LIMIT) {
+			const uint32_t sequence = load32(in + i);
+			const uint32_t h = hash(sequence);
+			const size_t ref = table[h];
+			table[h] = static_cast<uint32_t>(i);
+
+			if (ref >= i || i - ref > MAX_OFFSET || load32(in + ref) != sequence) {
+				// skip ahead faster the longer nothing has matched, incompressible data goes by quickly
+				i += 1 + ((i - anchor) >> 6);
+				continue;
+			}
+
+			// 8 bytes at a time, the first differing bit says how many of them still match
+			size_t length = MIN_MATCH;
+			bool mismatch = false;
+			while (!mismatch && i + length + 8 <= matchLimit) {
+				uint64_t difference = load64(in + ref + length) ^ load64(in + i + length);
+				if (difference) {
+					length += std::countr_zero(difference) >> 3;
+					mismatch = true;
+				} else {
+					length += 8;
+				}
+			}
+			while (!mismatch && i + length < matchLimit && in[ref + length] == in[i + length])
+				length++;
+
+			op = put_sequence(op, in + anchor, i - anchor, i - ref, length);
+			i += length;
+			anchor = i;
+		}
+	}
+
+	// the rest is literals, in a sequence without a match
+	const size_t literalLength = n - anchor;
+	*op++ = static_cast<uint8_t>((literalLength < 15 ? literalLength : 15) << 4);
+	if (literalLength >= 15)
+		op = put_length(op, literalLength - 15);
+	memcpy(op, in + anchor, literalLength);
+	op += literalLength;
+
+	return static_cast<size_t>(op - out);
+}
+
+// every read and write is checked, so a corrupt file fails instead of running off the end of a buffer
+bool lz::decompress(const uint8_t* in, size_t n, uint8_t* out, size_t outSize) {
+	const uint8_t* ip = in;
+	const uint8_t* end = in + n;
+	uint8_t* op = out;
+	uint8_t* outEnd = out + outSize;
+
+	while (ip < end) {
+		const uint8_t token = *ip++;
+
+		size_t literalLength = token >> 4;
+		if (literalLength == 15) {
+			uint8_t extra;
+			do {
+				if (ip >= end) return false;
+				extra = *ip++;
+				literalLength += extra;
+			} while (extra == 255);
+		}
+
+		if (literalLength > static_cast<size_t>(end - ip) || literalLength > static_cast<size_t>(outEnd - op)) return false;
+		memcpy(op, ip, literalLength);
+		ip += literalLength;
+		op += literalLength;
+
+		// the last sequence has no match
+		if (ip == end) break;
+
+		if (end - ip < 2) return false;
+		const size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+		ip += 2;
+		if (offset == 0 || offset > static_cast<size_t>(op - out)) return false;
+
+		size_t matchLength = (token & 15);
+		if (matchLength == 15) {
+			uint8_t extra;
+			do {
+				if (ip >= end) return false;
+				extra = *ip++;
+				matchLength += extra;
+			} while (extra == 255);
+		}
+		matchLength += MIN_MATCH;
+		if (matchLength > static_cast<size_t>(outEnd - op)) return false;
+
+		// matches can overlap what they're writing, runs of one byte are common enough to special case
+		const uint8_t* match = op - offset;
+		if (offset >= matchLength) {
+			memcpy(op, match, matchLength);
+		} else if (offset == 1) {
+			memset(op, *match, matchLength);
+		} else {
+			for (size_t i = 0; i < matchLength; i++)
+				op[i] = match[i];
+		}
+		op += matchLength;
+	}
+
+	return op == outEnd;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h> // for size_t
+#include <stdint.h>
+
+// a small LZ77 compressor using the LZ4 block format (token, literals, 2 byte offset, match length),
+// greedy with a single hash probe, so it's fast enough to run on every save and doesn't need a library
+// it's meant for data that's been made compressible beforehand (deltas, byte planes), it does nothing clever
+namespace lz {
+	// worst case compressed size of n bytes
+	size_t bound(size_t n);
+
+	// out has to hold bound(n) bytes, returns the compressed size
+	size_t compress(const uint8_t* in, size_t n, uint8_t* out);
+
+	// false if the input is corrupt or doesn't decompress to exactly outSize bytes
+	bool decompress(const uint8_t* in, size_t n, uint8_t* out, size_t outSize);
+}
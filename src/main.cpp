@@ -8,23 +8,37 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <stdint.h>
 
 #include <algorithm>
 
 #include "gl_renderer.h"
 #include "smath.h"
+#include "surface_draw.h"
+#include "water_world.h"
+#include "input_journal.h"
+#include "height_sequence.h"
+#include "baked_loop.h"
 
 //#include "ewave.h"
 //#include "iwave.h"
+//#include "ocean_tiles.h"
+//#include "nested_iwave.h"
 #include "iwave_gpu.h"
 
-#if defined(IWAVESURFACE_GPU)
-#define SurfaceObject IWaveSurfaceGPU
-#elif defined(IWAVESURFACE_CPU)
-#define SurfaceObject IWaveSurface
+// the GPU version is checked last, water_world.h always pulls it in
+#if defined(NESTEDIWAVE_CPU)
+#define SurfaceObject NestedIWave
+#elif defined(OCEANTILES_CPU)
+#define SurfaceObject OceanTiles
 #elif defined(EWAVESURFACE_CPU)
 #define SurfaceObject EWaveSurface
+#define SURFACE_NO_KERNEL // eWave steps in fourier space, it has no kernel radius
+#elif defined(IWAVESURFACE_CPU)
+#define SurfaceObject IWaveSurface
+#elif defined(IWAVESURFACE_GPU)
+#define SurfaceObject IWaveSurfaceGPU
 #endif
 
 // set to 1 to enable vsync
@@ -39,6 +53,12 @@ const int divFactor = 4;
 int simWidth = screenWidth / divFactor;
 int simHeight = screenHeight / divFactor;
 bool guiOpen = true;
+bool view3D = false; // V toggles between the flat texture and the 3D mesh
+bool pondView = false; // P switches to a world of many small ponds, all simulated by one WaterWorld
+
+// the pond demo, a grid of randomly sized ponds with rain falling on them
+constexpr int pondGrid = 16;
+constexpr float pondRain = 0.5f; // drops per frame, across all ponds
 
 float strokeRadius = static_cast<float>(simHeight / 15);
 
@@ -48,6 +68,28 @@ double frameTime = targetFrameTime;
 
 RollingAverageSmoother<double, targetFps> smoothedFrameTime;
 
+// GL state changes from the previous frame
+int lastCallsIssued = 0, lastCallsSkipped = 0;
+
+// F5 saves the simulation's state and F9 loads it back
+const char* quickSavePath = "quicksave.snap";
+double lastSaveTime = 0.0, lastLoadTime = 0.0;
+bool lastSaveFailed = false, lastLoadFailed = false;
+
+// R starts and stops recording everything done to the simulation, which --replay plays back without a window
+InputJournal journal;
+const char* journalPath = "input.journal";
+bool headless = false;
+
+// C starts and stops capturing the heights of every step, encoded and written out in the background
+SequenceWriter capture;
+const char* capturePath = "capture.wseq";
+
+// --bake writes a loop of the simulation to loopPath without a window, L switches to playing it back
+BakedLoop bakedLoop;
+const char* loopPath = "water.loop";
+bool loopView = false;
+
 #define print_err(x) fprintf(stderr, x);
 
 GLFWwindow* window = nullptr;
@@ -55,15 +97,90 @@ GLFWwindow* window = nullptr;
 int do_init();
 void do_cleanup();
 void imgui_builder(bool* open);
+void init_ponds(WaterWorld& ponds);
 
 int main(int argc, char** argv) {
+	// headless benchmark, doesn't need a window
+	if (argc > 1 && 0 == strcmp(argv[1], "--bench-fft")) {
+		smath::init();
+		smath::bench_fft();
+		smath::cleanup();
+		return 0;
+	}
+
+	// headless replay, still needs a GL context for the GPU simulations, just not a visible window
+	const char* replayPath = nullptr;
+	if (argc > 2 && 0 == strcmp(argv[1], "--replay")) {
+		replayPath = argv[2];
+		headless = true;
+	}
+
+	// headless bake, same as a replay
+	const char* bakePath = nullptr;
+	if (argc > 2 && 0 == strcmp(argv[1], "--bake")) {
+		bakePath = argv[2];
+		headless = true;
+	}
+
 	if (0 != do_init())
 		return -1;
 
 	smath::init();
 	Renderer::init();
 
+#ifdef SURFACE_NO_KERNEL
+	SurfaceObject surface(simWidth, simHeight);
+#else
 	SurfaceObject surface(simWidth, simHeight, 12);
+#endif
+
+	if (replayPath) {
+		InputJournal::ReplayStats stats;
+		bool complete = journal.replay(replayPath, surface, simWidth, simHeight, stats);
+
+		printf("Replayed %d steps and %d events%s\n", stats.frames, stats.events, complete ? "" : " (journal unreadable or cut off)");
+		printf("Step time: %.3f ms total, %.4f ms average, %.4f ms min, %.4f ms max\n", stats.totalTime * 1000.0,
+			stats.frames > 0 ? stats.totalTime * 1000.0 / stats.frames : 0.0, stats.minFrame * 1000.0, stats.maxFrame * 1000.0);
+		printf("Checksums: %d of %d matched", stats.checksums - stats.mismatches, stats.checksums);
+		if (stats.mismatches > 0)
+			printf(", first mismatch after step %d", stats.firstMismatch);
+		printf("\nFinal checksum: %016llx\n", static_cast<unsigned long long>(stats.finalChecksum));
+
+		surface.clean();
+		do_cleanup();
+		smath::cleanup();
+		return (complete && stats.mismatches == 0) ? 0 : 1;
+	}
+
+	if (bakePath) {
+		baked::Settings settings;
+		baked::Result result;
+
+		double start = glfwGetTime();
+		bool done = BakedLoop::bake(surface, simWidth, simHeight, static_cast<float>(targetFrameTime), bakePath, settings, result);
+		double bakeTime = glfwGetTime() - start;
+
+		if (done) {
+			printf("Baked %d frames (steps %d to %d) in %.2f s\n", result.length, result.start, result.start + result.length, bakeTime);
+			printf("Seam error: %.4f%s\n", result.seamError, result.faded ? ", cross faded" : "");
+			printf("Range: %f, compression error: %f rms, %.2f MB\n", result.range, result.rmsError,
+				static_cast<double>(result.bytes) / (1024.0 * 1024.0));
+		} else {
+			printf("Baking %s failed\n", bakePath);
+		}
+
+		surface.clean();
+		do_cleanup();
+		smath::cleanup();
+		return done ? 0 : 1;
+	}
+	SurfaceDraw surfaceDraw;
+	surfaceDraw.gen_plane(simWidth, simHeight);
+
+	// the ponds take a 1024x1024 atlas and a few hundred bodies, so they're only made the first time P is pressed
+	WaterWorld ponds;
+
+	const GLint inputTextureLoc = Renderer::shader_loc(Renderer::flippedShader, "inputTexture");
 
 	while (!glfwWindowShouldClose(window)) {
 		double startTime = glfwGetTime();
@@ -74,6 +191,12 @@ int main(int argc, char** argv) {
 			continue;
 		}
 
+		// ImGui's backend touches GL state behind our back, so start every frame from a clean slate
+		Renderer::invalidate_state();
+		lastCallsIssued = Renderer::callsIssued;
+		lastCallsSkipped = Renderer::callsSkipped;
+		Renderer::reset_call_stats();
+
 		// I'm just gonna use ImGui's input because a proper input system isn't really a priority here...
 		ImGuiIO& io = ImGui::GetIO();
 		
@@ -83,11 +206,26 @@ int main(int argc, char** argv) {
 		int simX = static_cast<int>(io.MousePos.x) / divFactor;
 		int simY = static_cast<int>(io.MousePos.y) / divFactor;
 
-		if (!io.WantCaptureMouse) {
+		if (!io.WantCaptureMouse && pondView) {
+			if (io.MouseDown[0]) {
+				ponds.yaw -= io.MouseDelta.x * 0.01f;
+				ponds.pitch = std::clamp(ponds.pitch + io.MouseDelta.y * 0.01f, 0.05f, 1.5f);
+			}
+
+			ponds.distance = std::clamp(ponds.distance * powf(0.9f, io.MouseWheel), 0.5f, 20.0f);
+		} else if (!io.WantCaptureMouse && view3D) {
+			// in 3D the mouse moves the camera instead of painting, since screen positions don't map to cells anymore
 			if (io.MouseDown[0]) {
-				surface.place_source(simX, simY, strokeRadius, 1.0f);
+				surfaceDraw.yaw -= io.MouseDelta.x * 0.01f;
+				surfaceDraw.pitch = std::clamp(surfaceDraw.pitch + io.MouseDelta.y * 0.01f, 0.05f, 1.5f);
+			}
+
+			surfaceDraw.distance = std::clamp(surfaceDraw.distance * powf(0.9f, io.MouseWheel), 0.5f, 20.0f);
+		} else if (!io.WantCaptureMouse && !loopView) {
+			if (io.MouseDown[0]) {
+				journal.place_source(surface, simX, simY, strokeRadius, 1.0f);
 			} else if (io.MouseDown[1]) {
-				surface.set_obstruction(simX, simY, strokeRadius, 1.0f);
+				journal.set_obstruction(surface, simX, simY, strokeRadius, 1.0f);
 			}
 		}
 
@@ -97,11 +235,80 @@ int main(int argc, char** argv) {
 			}
 
 			if (ImGui::IsKeyPressed(ImGuiKey_Space, false)) {
-				surface.reset();
+				if (pondView)
+					ponds.reset();
+				else if (loopView)
+					bakedLoop.reset();
+				else
+					journal.reset(surface);
+			}
+
+			if (ImGui::IsKeyPressed(ImGuiKey_P, false)) {
+				pondView = !pondView;
+				if (pondView && !ponds.get_surface())
+					init_ponds(ponds);
+			}
+
+			if (ImGui::IsKeyPressed(ImGuiKey_V, false)) {
+				view3D = !view3D;
+			}
+
+			// F5, F9, R and C act on surface, which isn't stepped or shown in the pond and loop views
+			if (ImGui::IsKeyPressed(ImGuiKey_F5, false) && !pondView && !loopView) {
+				double start = glfwGetTime();
+				lastSaveFailed = !surface.save_state(quickSavePath);
+				lastSaveTime = glfwGetTime() - start;
+			}
+
+			if (ImGui::IsKeyPressed(ImGuiKey_F9, false) && !pondView && !loopView) {
+				// the journal can't replay past a jump to some other state
+				journal.stop_recording();
+
+				double start = glfwGetTime();
+				lastLoadFailed = !surface.load_state(quickSavePath);
+				lastLoadTime = glfwGetTime() - start;
+			}
+
+			if (ImGui::IsKeyPressed(ImGuiKey_R, false) && !pondView && !loopView) {
+				if (journal.is_recording())
+					journal.stop_recording();
+				else
+					journal.start_recording(journalPath, surface, simWidth, simHeight, static_cast<float>(targetFrameTime));
+			}
+
+			if (ImGui::IsKeyPressed(ImGuiKey_L, false) && !pondView) {
+				// the loop has to be the simulation's size, the 3D view's plane is made for that
+				if (!loopView && !bakedLoop.is_open() && bakedLoop.open(loopPath)
+					&& (bakedLoop.get_width() != simWidth || bakedLoop.get_height() != simHeight))
+					bakedLoop.close();
+
+				loopView = !loopView && bakedLoop.is_open();
+			}
+
+			if (ImGui::IsKeyPressed(ImGuiKey_C, false) && !pondView && !loopView) {
+				if (capture.is_open())
+					capture.close();
+				else
+					capture.open(capturePath, simWidth, simHeight);
 			}
 		}
 
-		surface.sim_frame(static_cast<float>(targetFrameTime));
+		if (pondView) {
+			// rain, a drop lands in a random spot of a random pond every few frames
+			if (static_cast<float>(rand()) / RAND_MAX < pondRain) {
+				int body = rand() % (pondGrid * pondGrid);
+				const WaterWorld::Body* pond = ponds.get_body(body);
+				if (pond)
+					ponds.place_source(body, rand() % pond->width, rand() % pond->height, 3.0f, 1.0f);
+			}
+
+			ponds.sim_frame(static_cast<float>(targetFrameTime));
+		} else if (loopView) {
+			bakedLoop.sim_frame(static_cast<float>(targetFrameTime));
+		} else {
+			journal.sim_frame(surface, static_cast<float>(targetFrameTime));
+			capture.capture(surface);
+		}
 		
 		//if (frameTime > targetFrameTime)
 		//	surface.sim_frame(targetFrameTime);
@@ -113,7 +320,23 @@ int main(int argc, char** argv) {
 		ImGui::NewFrame();
 
 		imgui_builder(&guiOpen);
-		surface.imgui_builder(&guiOpen);
+		if (pondView)
+			ponds.imgui_builder(&guiOpen);
+		else if (loopView)
+			bakedLoop.imgui_builder(&guiOpen);
+		else
+			surface.imgui_builder(&guiOpen);
+
+		if (guiOpen && view3D && !pondView) {
+			if (ImGui::Begin("3D View", nullptr, ImGuiWindowFlags_AlwaysAutoResize)) {
+				ImGui::SliderFloat("Height Scale", &surfaceDraw.heightMultiplier, 0.0f, 10.0f);
+				ImGui::SliderFloat("Distance", &surfaceDraw.distance, 0.5f, 20.0f);
+				ImGui::SliderFloat("LOD Distance", &surfaceDraw.lodDistance, SurfaceDraw::MIN_LOD_DISTANCE, 16.0f);
+				ImGui::LabelText("Patches", "%d (%d triangles)", surfaceDraw.get_node_count(), surfaceDraw.get_triangle_count());
+			}
+
+			ImGui::End();
+		}
 		
 		ImGui::Render();
 
@@ -121,15 +344,20 @@ int main(int argc, char** argv) {
 		//glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
 		glfwGetFramebufferSize(window, &screenWidth, &screenHeight);
-		glViewport(0, 0, screenWidth, screenHeight);
+		Renderer::viewport(0, 0, screenWidth, screenHeight);
 		glClearColor(1.0, 0.0, 1.0, 1.0);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		// shader location could be cached...
-		Renderer::attach_tex(Renderer::flippedShader, Renderer::shader_loc(Renderer::flippedShader, "inputTexture"), surface.get_display(), 0);
-		glUseProgram(Renderer::flippedShader);
-		Renderer::draw_quad();
-		Renderer::bind_tex(0, 0);
+		SurfaceSim& shown = loopView ? static_cast<SurfaceSim&>(bakedLoop) : surface;
+		if (pondView) {
+			ponds.draw();
+		} else if (view3D) {
+			surfaceDraw.draw_tex(shown.get_height_tex(), shown.get_pyramid_tex());
+		} else {
+			Renderer::pass_state();
+			Renderer::attach_tex(Renderer::flippedShader, inputTextureLoc, shown.get_display(), 0);
+			Renderer::draw_quad();
+		}
 
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 		glfwSwapBuffers(window);
@@ -147,6 +375,13 @@ int main(int argc, char** argv) {
 #endif
 	}
 
+	// GL objects have to go before the context does
+	capture.close();
+	bakedLoop.close();
+	surfaceDraw.clean();
+	ponds.clean();
+	surface.clean(); // the destructor runs after glfwTerminate, so it mustn't be what frees the textures
+
 	do_cleanup();
 	smath::cleanup();
 
@@ -166,6 +401,26 @@ static void imgui_builder(bool* open) {
 			ImGui::LabelText("Render FPS", "%f fps", frameTime != 0.0f ? 1.0f / frameTime : 0.0f);
 			ImGui::LabelText("Smooth FPS", "%f fps", smoothTime != 0.0f ? 1.0f / smoothTime : 0.0f);
 			ImGui::LabelText("Target FPS", "%d fps", targetFps);
+			ImGui::LabelText("GL State Calls", "%d issued, %d skipped", lastCallsIssued, lastCallsSkipped);
+			ImGui::LabelText("Texture Pool", "%d hits, %d misses", TexturePool::stats.hits, TexturePool::stats.misses);
+			ImGui::LabelText("Pooled Targets", "%d live, %d idle, %.2f MB", TexturePool::stats.live, TexturePool::stats.idle,
+				static_cast<double>(TexturePool::stats.residentBytes) / (1024.0 * 1024.0));
+			ImGui::LabelText("Quick Save (F5)", "%s %f ms", lastSaveFailed ? "failed," : "", lastSaveTime * 1000.0);
+			ImGui::LabelText("Quick Load (F9)", "%s %f ms", lastLoadFailed ? "failed," : "", lastLoadTime * 1000.0);
+			if (journal.is_recording())
+				ImGui::LabelText("Journal (R)", "%d steps, %d events, %zu bytes", journal.get_frames(), journal.get_events(), journal.get_bytes());
+			else
+				ImGui::LabelText("Journal (R)", "not recording");
+			if (capture.is_open())
+				ImGui::LabelText("Capture (C)", "%d frames, %d dropped, %.2f MB", capture.get_frames(), capture.get_dropped(),
+					static_cast<double>(capture.get_bytes()) / (1024.0 * 1024.0));
+			else
+				ImGui::LabelText("Capture (C)", "not capturing");
+			if (loopView)
+				ImGui::LabelText("Baked Loop (L)", "%d frames from %s", bakedLoop.get_frame_count(), loopPath);
+			else
+				ImGui::LabelText("Baked Loop (L)", "off");
+			ImGui::LabelText("Shader Cache", "%d hits, %d misses (%.0f%%)", Renderer::cacheHits, Renderer::cacheMisses, Renderer::cache_hit_rate() * 100.0f);
 			ImGui::LabelText("Mouse Pos", "%f %f", io.MousePos.x, io.MousePos.y);
 			ImGui::LabelText("LBM Down", io.MouseDown[0] ? "True" : "False");
 			ImGui::LabelText("RBM Down", io.MouseDown[2] ? "True" : "False");
@@ -231,6 +486,7 @@ static inline int do_init() {
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+	glfwWindowHint(GLFW_VISIBLE, headless ? GLFW_FALSE : GLFW_TRUE);
 
 	window = glfwCreateWindow(screenWidth, screenHeight, "water test", nullptr, nullptr);
 	if (window == nullptr) return -1;
@@ -271,6 +527,21 @@ static inline int do_init() {
 	return 0;
 }
 
+void init_ponds(WaterWorld& ponds) {
+	ponds.init(1024, 1024, 6);
+	for (int y = 0; y < pondGrid; y++) {
+		for (int x = 0; x < pondGrid; x++) {
+			// ponds are 16 to 48 cells across, at the same cell size so they line up visually
+			const float cellSize = 2.0f / static_cast<float>(pondGrid * 64);
+			int w = 16 + (rand() % 33);
+			int h = 16 + (rand() % 33);
+			float worldX = (static_cast<float>(x) * 64.0f * cellSize) - 1.0f;
+			float worldZ = (static_cast<float>(y) * 64.0f * cellSize) - 1.0f;
+			ponds.add_body(w, h, worldX, worldZ, cellSize);
+		}
+	}
+}
+
 static inline void do_cleanup() {
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
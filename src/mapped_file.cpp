@@ -0,0 +1,92 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char* path) {
+	close();
+
+	HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart == 0) {
+		CloseHandle(handle);
+		return false;
+	}
+
+	HANDLE mappingHandle = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mappingHandle) {
+		CloseHandle(handle);
+		return false;
+	}
+
+	view = static_cast<const uint8_t*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+	if (!view) {
+		CloseHandle(mappingHandle);
+		CloseHandle(handle);
+		return false;
+	}
+
+	file = handle;
+	mapping = mappingHandle;
+	bytes = static_cast<size_t>(fileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::close() {
+	if (view) UnmapViewOfFile(view);
+	if (mapping) CloseHandle(mapping);
+	if (file) CloseHandle(file);
+
+	view = nullptr;
+	mapping = nullptr;
+	file = nullptr;
+	bytes = 0;
+}
+
+#else
+
+bool MappedFile::open(const char* path) {
+	close();
+
+	int descriptor = ::open(path, O_RDONLY);
+	if (descriptor < 0) return false;
+
+	struct stat info;
+	if (fstat(descriptor, &info) != 0 || info.st_size == 0) {
+		::close(descriptor);
+		return false;
+	}
+
+	void* address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+	::close(descriptor); // the mapping keeps the file alive by itself
+	if (address == MAP_FAILED) return false;
+
+	view = static_cast<const uint8_t*>(address);
+	bytes = static_cast<size_t>(info.st_size);
+	return true;
+}
+
+void MappedFile::close() {
+	if (view) munmap(const_cast<uint8_t*>(view), bytes);
+
+	view = nullptr;
+	bytes = 0;
+}
+
+#endif
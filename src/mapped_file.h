@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h> // for size_t
+#include <stdint.h>
+
+// a read-only view of a whole file, mapped into memory instead of read, so opening a big file is
+// instant and only the pages that get touched are loaded
+class MappedFile {
+	const uint8_t* view = nullptr;
+	size_t bytes = 0;
+
+	// platform handles
+	void* file = nullptr;
+	void* mapping = nullptr;
+
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// false if the file doesn't exist or can't be mapped, empty files can't be mapped either
+	bool open(const char* path);
+	void close();
+
+	const uint8_t* data() const { return view; }
+	size_t size() const { return bytes; }
+	bool is_open() const { return view != nullptr; }
+};
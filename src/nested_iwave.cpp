@@ -0,0 +1,431 @@
+#include "nested_iwave.h"
+
+#include <stdlib.h> // for malloc/free
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include <GL/gl3w.h>
+#include "external/imgui.h"
+#include "gl_renderer.h"
+#include "snapshot.h"
+
+//
+// private
+//
+
+// coarse cell centers sit at (c + 0.5) * ratio in full resolution cells
+float NestedIWave::coarse_at(const float* grid, float x, float y) const {
+	const int coarseWidth = coarse->get_grid_width();
+	const int coarseHeight = coarse->get_grid_height();
+
+	float cx = std::clamp(((x + 0.5f) / static_cast<float>(ratio)) - 0.5f, 0.0f, static_cast<float>(coarseWidth - 1));
+	float cy = std::clamp(((y + 0.5f) / static_cast<float>(ratio)) - 0.5f, 0.0f, static_cast<float>(coarseHeight - 1));
+
+	int x0 = std::min(static_cast<int>(cx), coarseWidth - 2);
+	int y0 = std::min(static_cast<int>(cy), coarseHeight - 2);
+	float fx = cx - static_cast<float>(x0);
+	float fy = cy - static_cast<float>(y0);
+
+	const float* row0 = &grid[y0 * coarseWidth];
+	const float* row1 = row0 + coarseWidth;
+	float top = row0[x0] + ((row0[x0 + 1] - row0[x0]) * fx);
+	float bottom = row1[x0] + ((row1[x0 + 1] - row1[x0]) * fx);
+	return top + ((bottom - top) * fy);
+}
+
+void NestedIWave::prolongate(int i, int inset) {
+	const Fine& f = fine[i];
+	float* current = f.grid->get_grid();
+	float* prev = f.grid->get_prev_grid();
+	const float* coarseCurrent = coarse->get_grid();
+	const float* coarsePrev = coarse->get_prev_grid();
+
+	for (int y = 0; y < fineSize; y++) {
+		const bool edgeRow = y < inset || y >= fineSize - inset;
+
+		for (int x = 0; x < fineSize; x++) {
+			if (!edgeRow && x >= inset && x < fineSize - inset) {
+				x = fineSize - inset - 1; // skip the inside
+				continue;
+			}
+
+			const float fx = static_cast<float>(f.x + x);
+			const float fy = static_cast<float>(f.y + y);
+			current[x + (y * fineSize)] = coarse_at(coarseCurrent, fx, fy);
+			prev[x + (y * fineSize)] = coarse_at(coarsePrev, fx, fy);
+		}
+	}
+}
+
+// box filters the inside of a fine grid (everything but the band) into the coarse cells it fully covers
+void NestedIWave::restrict_fine(int i) {
+	const Fine& f = fine[i];
+	const float* current = f.grid->get_grid();
+	const float* prev = f.grid->get_prev_grid();
+	float* coarseCurrent = coarse->get_grid();
+	float* coarsePrev = coarse->get_prev_grid();
+	const int coarseWidth = coarse->get_grid_width();
+	const int coarseHeight = coarse->get_grid_height();
+
+	// band rounded up to whole coarse cells
+	const int skip = (band + ratio - 1) / ratio;
+	const int cells = fineSize / ratio;
+	const float scale = 1.0f / static_cast<float>(ratio * ratio);
+
+	for (int cy = skip; cy < cells - skip; cy++) {
+		const int coarseY = (f.y / ratio) + cy;
+		if (coarseY >= coarseHeight) break;
+
+		for (int cx = skip; cx < cells - skip; cx++) {
+			const int coarseX = (f.x / ratio) + cx;
+			if (coarseX >= coarseWidth) break;
+
+			float sumCurrent = 0.0f, sumPrev = 0.0f;
+			for (int y = 0; y < ratio; y++) {
+				const int row = ((cy * ratio) + y) * fineSize;
+				for (int x = 0; x < ratio; x++) {
+					sumCurrent += current[row + (cx * ratio) + x];
+					sumPrev += prev[row + (cx * ratio) + x];
+				}
+			}
+
+			coarseCurrent[coarseX + (coarseY * coarseWidth)] = sumCurrent * scale;
+			coarsePrev[coarseX + (coarseY * coarseWidth)] = sumPrev * scale;
+		}
+	}
+}
+
+// coarse everywhere, with the fine grids pasted on top
+void NestedIWave::build_composite() {
+	const float* coarseCurrent = coarse->get_grid();
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++)
+			composite[x + (y * width)] = coarse_at(coarseCurrent, static_cast<float>(x), static_cast<float>(y));
+	}
+
+	for (int i = 0; i < fineCount; i++) {
+		const Fine& f = fine[i];
+		const float* current = f.grid->get_grid();
+
+		const int columns = std::min(fineSize, width - f.x);
+		for (int y = 0; y < fineSize && f.y + y < height; y++)
+			memcpy(&composite[f.x + ((f.y + y) * width)], &current[y * fineSize], sizeof(float) * columns);
+	}
+}
+
+//
+// public
+//
+NestedIWave::NestedIWave(int w, int h, int p, int coarseRatio, int fineGridSize) {
+	width = w;
+	height = h;
+	ratio = std::max(coarseRatio, 1);
+	band = p;
+
+	// a multiple of ratio so it lines up with the coarse cells, and never bigger than the surface
+	fineSize = std::min(std::min(fineGridSize, w), h);
+	fineSize -= fineSize % ratio;
+
+	accelerationTerm = 20.0f;
+	velocityDamping = 1.0f;
+
+	coarse = new IWaveSurface(std::max((w + ratio - 1) / ratio, 2), std::max((h + ratio - 1) / ratio, 2), p);
+
+	composite = static_cast<float*>(malloc(sizeof(float) * width * height));
+	waterPixels = static_cast<uint32_t*>(malloc(sizeof(uint32_t) * width * height));
+	moveScratch = static_cast<float*>(malloc(sizeof(float) * fineSize * fineSize * 3));
+
+	waterTexture = Renderer::create_tex(width, height, GL_RGBA8);
+	glTextureParameteri(waterTexture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTextureParameteri(waterTexture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	heightTexture = Renderer::create_tex(width, height, GL_R32F);
+
+	add_fine((width - fineSize) / 2, (height - fineSize) / 2);
+}
+
+NestedIWave::~NestedIWave() {
+	for (int i = 0; i < fineCount; i++)
+		delete fine[i].grid;
+	delete coarse;
+
+	free(composite);
+	free(waterPixels);
+	free(moveScratch);
+
+	clean();
+}
+
+void NestedIWave::clean() {
+	for (int i = 0; i < fineCount; i++)
+		fine[i].grid->clean();
+	coarse->clean();
+
+	if (heightTexture != 0) {
+		glDeleteTextures(1, &waterTexture);
+		glDeleteTextures(1, &heightTexture);
+		waterTexture = 0;
+		heightTexture = 0;
+	}
+}
+
+int NestedIWave::add_fine(int x, int y) {
+	if (fineCount >= MAX_FINE || fineSize < 2 * band + ratio) return -1;
+
+	Fine& f = fine[fineCount];
+	f.grid = new IWaveSurface(fineSize, fineSize, band);
+	f.x = std::clamp(x - (x % ratio), 0, width - fineSize);
+	f.y = std::clamp(y - (y % ratio), 0, height - fineSize);
+
+	prolongate(fineCount, fineSize / 2);
+	return fineCount++;
+}
+
+void NestedIWave::move_fine(int i, int x, int y) {
+	if (i < 0 || i >= fineCount) return;
+
+	Fine& f = fine[i];
+	int newX = x - (fineSize / 2);
+	int newY = y - (fineSize / 2);
+	newX = std::clamp(newX - (((newX % ratio) + ratio) % ratio), 0, width - fineSize);
+	newY = std::clamp(newY - (((newY % ratio) + ratio) % ratio), 0, height - fineSize);
+	if (newX == f.x && newY == f.y) return;
+
+	const int cells = fineSize * fineSize;
+	float* current = f.grid->get_grid();
+	float* prev = f.grid->get_prev_grid();
+	float* obstruction = f.grid->get_obstruction_grid();
+
+	memcpy(moveScratch, current, sizeof(float) * cells);
+	memcpy(moveScratch + cells, prev, sizeof(float) * cells);
+	memcpy(moveScratch + (cells * 2), obstruction, sizeof(float) * cells);
+
+	const int oldX = f.x, oldY = f.y;
+	f.x = newX;
+	f.y = newY;
+
+	// everything from the coarse grid first, then the part the old position still covers on top
+	prolongate(i, fineSize / 2);
+	const float* coarseObstruction = coarse->get_obstruction_grid();
+	for (int fy = 0; fy < fineSize; fy++) {
+		for (int fx = 0; fx < fineSize; fx++)
+			obstruction[fx + (fy * fineSize)] = coarse_at(coarseObstruction, static_cast<float>(newX + fx), static_cast<float>(newY + fy));
+	}
+
+	const int dx = newX - oldX;
+	const int dy = newY - oldY;
+	for (int fy = std::max(0, -dy); fy < std::min(fineSize, fineSize - dy); fy++) {
+		const int oldRow = (fy + dy) * fineSize;
+		const int newRow = fy * fineSize;
+		const int begin = std::max(0, -dx);
+		const int end = std::min(fineSize, fineSize - dx);
+		if (begin >= end) break;
+
+		memcpy(&current[newRow + begin], &moveScratch[oldRow + begin + dx], sizeof(float) * (end - begin));
+		memcpy(&prev[newRow + begin], &moveScratch[cells + oldRow + begin + dx], sizeof(float) * (end - begin));
+		memcpy(&obstruction[newRow + begin], &moveScratch[(cells * 2) + oldRow + begin + dx], sizeof(float) * (end - begin));
+	}
+}
+
+void NestedIWave::place_source(int x, int y, float r, float strength) {
+	if (followSources && fineCount > 0)
+		move_fine(0, x, y);
+
+	// a coarse cell covers ratio times the distance, so the cone is ratio times flatter without the scale
+	const float coarseR = r / static_cast<float>(ratio);
+	coarse->place_source(x / ratio, y / ratio, coarseR, strength * static_cast<float>(ratio));
+
+	for (int i = 0; i < fineCount; i++)
+		fine[i].grid->place_source(x - fine[i].x, y - fine[i].y, r, strength);
+}
+
+void NestedIWave::set_obstruction(int x, int y, float r, float strength) {
+	coarse->set_obstruction(x / ratio, y / ratio, r / static_cast<float>(ratio), strength);
+
+	for (int i = 0; i < fineCount; i++)
+		fine[i].grid->set_obstruction(x - fine[i].x, y - fine[i].y, r, strength);
+}
+
+void NestedIWave::sim_frame(float delta) {
+	coarse->accelerationTerm = accelerationTerm / static_cast<float>(ratio);
+	coarse->velocityDamping = velocityDamping;
+
+	for (int i = 0; i < fineCount; i++) {
+		fine[i].grid->accelerationTerm = accelerationTerm;
+		fine[i].grid->velocityDamping = velocityDamping;
+		prolongate(i, band);
+	}
+
+	coarse->sim_frame(delta);
+	for (int i = 0; i < fineCount; i++)
+		fine[i].grid->sim_frame(delta);
+
+	for (int i = 0; i < fineCount; i++)
+		restrict_fine(i);
+}
+
+void NestedIWave::reset() {
+	coarse->reset();
+	for (int i = 0; i < fineCount; i++)
+		fine[i].grid->reset();
+}
+
+// the grids get theirs from these at every step
+int NestedIWave::get_params(float* out) const {
+	out[0] = velocityDamping;
+	out[1] = accelerationTerm;
+	return 2;
+}
+
+void NestedIWave::set_params(const float* values, int count) {
+	if (count != 2) return;
+
+	velocityDamping = values[0];
+	accelerationTerm = values[1];
+}
+
+static constexpr uint32_t SNAPSHOT_KIND = snapshot::id("NIWV");
+static constexpr uint32_t FINE_POSITIONS = snapshot::id("FPOS");
+
+// the coarse grid's channels go by the usual ids, fine grid i's have their last character replaced by '0' + i
+static uint32_t fine_id(uint32_t id, int i) {
+	return (id & 0x00ffffff) | (static_cast<uint32_t>('0' + i) << 24);
+}
+
+bool NestedIWave::save_state(const char* path, bool lossy) {
+	const snapshot::Encoding heights = lossy ? snapshot::Encoding::Quantized : snapshot::Encoding::Lossless;
+
+	SnapshotWriter writer;
+	if (!writer.open(path, SNAPSHOT_KIND, 1 + ((fineCount + 1) * 4))) return false;
+
+	// a channel can't be empty, so with no fine grids there's a dummy position that load ignores
+	float positions[MAX_FINE * 2] = {};
+	for (int i = 0; i < fineCount; i++) {
+		positions[(i * 2) + 0] = static_cast<float>(fine[i].x);
+		positions[(i * 2) + 1] = static_cast<float>(fine[i].y);
+	}
+
+	writer.write_channel(FINE_POSITIONS, positions, std::max(fineCount, 1), 1, 2, snapshot::Encoding::Raw);
+
+	for (int i = -1; i < fineCount; i++) {
+		IWaveSurface* grid = i < 0 ? coarse : fine[i].grid;
+		const int w = grid->get_grid_width();
+		const int h = grid->get_grid_height();
+		auto channel = [i](uint32_t id) { return i < 0 ? id : fine_id(id, i); };
+
+		writer.write_channel(channel(snapshot::CURRENT), grid->get_grid(), w, h, 1, heights);
+		writer.write_channel(channel(snapshot::PREVIOUS), grid->get_prev_grid(), w, h, 1, heights, channel(snapshot::CURRENT), grid->get_grid());
+		writer.write_channel(channel(snapshot::OBSTRUCTION), grid->get_obstruction_grid(), w, h, 1, snapshot::Encoding::Lossless);
+		writer.write_channel(channel(snapshot::SOURCE), grid->get_source_grid(), w, h, 1, snapshot::Encoding::Lossless);
+	}
+
+	return writer.close();
+}
+
+bool NestedIWave::load_state(const char* path) {
+	SnapshotReader reader;
+	if (!reader.open(path) || reader.get_kind() != SNAPSHOT_KIND) return false;
+
+	// the number of fine grids comes from the channel count, the positions channel always has at least one
+	const int count = (reader.get_channel_count() - 1) / 4 - 1;
+	const snapshot::Channel* positionChannel = reader.find(FINE_POSITIONS);
+	if (count < 0 || count > MAX_FINE || !positionChannel || positionChannel->width != std::max(count, 1))
+		return false;
+
+	const int coarseWidth = coarse->get_grid_width();
+	const int coarseHeight = coarse->get_grid_height();
+	for (int i = -1; i < count; i++) {
+		const int w = i < 0 ? coarseWidth : fineSize;
+		const int h = i < 0 ? coarseHeight : fineSize;
+		const snapshot::Channel* channel = reader.find(i < 0 ? snapshot::CURRENT : fine_id(snapshot::CURRENT, i));
+		if (!channel || channel->width != w || channel->height != h)
+			return false;
+	}
+
+	float positions[MAX_FINE * 2];
+	if (!reader.read_grid(FINE_POSITIONS, positions, std::max(count, 1), 1, 2))
+		return false;
+
+	while (fineCount > count)
+		delete fine[--fineCount].grid;
+	while (fineCount < count && add_fine(0, 0) >= 0) {}
+	if (fineCount != count)
+		return false;
+
+	bool loaded = true;
+	for (int i = -1; loaded && i < count; i++) {
+		IWaveSurface* grid = i < 0 ? coarse : fine[i].grid;
+		const int w = grid->get_grid_width();
+		const int h = grid->get_grid_height();
+		auto channel = [i](uint32_t id) { return i < 0 ? id : fine_id(id, i); };
+
+		if (i >= 0) {
+			fine[i].x = std::clamp(static_cast<int>(positions[(i * 2) + 0]), 0, width - fineSize);
+			fine[i].y = std::clamp(static_cast<int>(positions[(i * 2) + 1]), 0, height - fineSize);
+		}
+
+		loaded = reader.read_grid(channel(snapshot::CURRENT), grid->get_grid(), w, h)
+			&& reader.read_grid(channel(snapshot::PREVIOUS), grid->get_prev_grid(), w, h, 1, grid->get_grid())
+			&& reader.read_grid(channel(snapshot::OBSTRUCTION), grid->get_obstruction_grid(), w, h)
+			&& reader.read_grid(channel(snapshot::SOURCE), grid->get_source_grid(), w, h);
+	}
+
+	// a corrupt block leaves a mix of old and new state, that resets instead
+	if (!loaded)
+		reset();
+
+	return loaded;
+}
+
+GLuint NestedIWave::get_display() {
+	if (!waterPixels) return { 0 };
+
+	build_composite();
+
+	float extents = 5.0f;
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			uint8_t* pixel = reinterpret_cast<uint8_t*>(&waterPixels[x + (y * width)]);
+			float h = std::clamp(composite[x + (y * width)], -extents, extents);
+
+			// red marks the fine grids instead of obstructions
+			bool inFine = false;
+			for (int i = 0; i < fineCount; i++)
+				inFine |= x >= fine[i].x && x < fine[i].x + fineSize && y >= fine[i].y && y < fine[i].y + fineSize;
+
+			pixel[0] = inFine ? 32 : 0;
+			pixel[1] = 0;
+			pixel[2] = pix_from_normalized((h + extents) / (extents * 2.0f));
+			pixel[3] = 255;
+		}
+	}
+
+	glTextureSubImage2D(waterTexture, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, waterPixels);
+	return waterTexture;
+}
+
+GLuint NestedIWave::get_height_tex() {
+	build_composite();
+	glTextureSubImage2D(heightTexture, 0, 0, 0, width, height, GL_RED, GL_FLOAT, composite);
+	return heightTexture;
+}
+
+void NestedIWave::imgui_builder(bool* open) {
+	if (!open || !*open) return;
+
+	if (ImGui::Begin("NestedIWave", open, ImGuiWindowFlags_AlwaysAutoResize)) {
+		const int coarseCells = coarse->get_grid_width() * coarse->get_grid_height();
+		const int fineCells = fineCount * fineSize * fineSize;
+
+		ImGui::Checkbox("Follow Sources", &followSources);
+		ImGui::LabelText("Coarse", "%dx%d (1:%d)", coarse->get_grid_width(), coarse->get_grid_height(), ratio);
+		ImGui::LabelText("Fine", "%d of %dx%d", fineCount, fineSize, fineSize);
+		ImGui::LabelText("Cells", "%d (%.0f%% of full resolution)", coarseCells + fineCells,
+			100.0f * static_cast<float>(coarseCells + fineCells) / static_cast<float>(width * height));
+
+		if (fineCount < MAX_FINE && ImGui::Button("Add Fine Grid"))
+			add_fine((width - fineSize) / 2, (height - fineSize) / 2);
+	}
+
+	ImGui::End();
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "surface_sim.h"
+#include "iwave.h"
+
+#define NESTEDIWAVE_CPU
+
+// a coarse iWave grid over the whole surface, with a few full resolution grids on top of it that move
+// around with whatever is interesting (the last source by default), so the detail only costs where it's seen
+//
+// every frame:
+// - prolongation, the band of each fine grid that its kernel can reach past the edge is filled in from the
+//   coarse grid, so waves coming from outside flow in
+// - both levels step on their own
+// - restriction, coarse cells under the inside of a fine grid are replaced with the average of the fine
+//   cells, so waves made in the fine grid flow back out through the coarse one
+//
+// the coarse grid's cells are ratio times bigger, so its accelerationTerm is divided by ratio to keep
+// waves moving at the same physical speed (the kernel works in cells, w^2 = g * k with k per cell)
+class NestedIWave : public SurfaceSim {
+public:
+	static constexpr int MAX_FINE = 4;
+
+private:
+	int width = 0, height = 0; // full resolution cells
+	int ratio = 1; // full resolution cells per coarse cell, along each axis
+	int fineSize = 0; // fine grids are fineSize x fineSize full resolution cells
+	int band = 0; // prolongated border of the fine grids, as wide as the kernel
+
+	IWaveSurface* coarse = nullptr;
+
+	struct Fine {
+		IWaveSurface* grid;
+		int x, y; // top left, in full resolution cells, always a multiple of ratio
+	};
+
+	Fine fine[MAX_FINE];
+	int fineCount = 0;
+
+	// scratch for moving a fine grid
+	float* moveScratch = nullptr;
+
+	// the full resolution composite, for display
+	float* composite = nullptr;
+	uint32_t* waterPixels = nullptr;
+	GLuint waterTexture = 0, heightTexture = 0;
+
+	float coarse_at(const float* grid, float x, float y) const; // bilinear, in full resolution cells
+	void prolongate(int i, int inset); // everything within inset cells of the edge, fineSize / 2 fills it all
+	void restrict_fine(int i);
+	void build_composite();
+
+public:
+	// for the fine grids, the coarse grid gets its own scaled copy every frame
+	float velocityDamping;
+	float accelerationTerm;
+
+	// places fine grid 0 on top of every new source
+	bool followSources = true;
+
+	// the same arguments as IWaveSurface, plus the coarse ratio and the size of the fine grids
+	NestedIWave(int w, int h, int p, int coarseRatio = 4, int fineGridSize = 96);
+	~NestedIWave();
+	void clean() override;
+
+	// returns the fine grid's index, or -1 if there are MAX_FINE already
+	int add_fine(int x, int y);
+
+	// x and y are the fine grid's center in full resolution cells, it gets snapped to the coarse grid
+	// the part that's still covered keeps its detail, the rest is filled in from the coarse grid
+	void move_fine(int i, int x, int y);
+
+	void place_source(int x, int y, float r, float strength) override;
+	void set_obstruction(int x, int y, float r, float strength) override;
+	void sim_frame(float delta) override;
+	void reset() override;
+	int get_params(float* out) const override;
+	void set_params(const float* values, int count) override;
+	bool save_state(const char* path, bool lossy = false) override;
+	bool load_state(const char* path) override;
+	GLuint get_display() override;
+	GLuint get_height_tex() override;
+
+	void imgui_builder(bool* open = nullptr) override;
+};
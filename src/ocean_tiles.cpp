@@ -0,0 +1,760 @@
+#define _CRT_SECURE_NO_WARNINGS // for fopen
+#define _USE_MATH_DEFINES
+
+#include "ocean_tiles.h"
+
+#include <stdio.h>
+#include <stdlib.h> // for calloc/free
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <filesystem>
+#include <random>
+
+#include <GL/gl3w.h>
+#include "external/imgui.h"
+#include "gl_renderer.h"
+#include "iwave.h" // for iwave_kernel
+#include "smath.h"
+#include "snapshot.h"
+#include "thread_pool.h"
+#include "varint.h"
+
+const char* OceanTiles::cacheDir = "ocean_cache";
+
+static constexpr uint32_t TILE_MAGIC = 0x4C49544F; // "OTIL"
+
+// on disk a tile is this header, then the obstruction as (run length, value) pairs, then the current and
+// previous heights quantized to 16 bits
+// heights are predicted from their left neighbour (the previous heights from the current ones), and the
+// residuals are zigzag varint coded, which takes about 2 bytes per height instead of 4
+struct TileHeader {
+	uint32_t magic;
+	uint32_t session;
+	int32_t tileX, tileY;
+	int32_t size;
+	float scale; // heights are multiples of this
+	uint32_t bytes; // after the header
+};
+
+static void session_path(char* path, size_t len, uint32_t session) {
+	snprintf(path, len, "%s/%08x", OceanTiles::cacheDir, session);
+}
+
+static void tile_path(char* path, size_t len, uint32_t session, int tileX, int tileY) {
+	snprintf(path, len, "%s/%08x/tile_%d_%d.bin", OceanTiles::cacheDir, session, tileX, tileY);
+}
+
+//
+// private
+//
+
+// creating a directory fails if it already exists, so whoever creates one owns it, even across processes
+// ids start somewhere random so that two instances don't both walk through the same ones
+void OceanTiles::open_session() {
+	std::error_code error;
+	std::filesystem::create_directories(cacheDir, error);
+
+	char path[256];
+	session = static_cast<uint32_t>(std::random_device()()) ^ static_cast<uint32_t>(::time(nullptr));
+	for (int attempt = 0; attempt < 64; attempt++, session++) {
+		session_path(path, sizeof(path), session);
+		if (std::filesystem::create_directory(path, error)) {
+			sessionOpen = true;
+			return;
+		}
+
+		// only an existing directory is worth retrying, anything else (no permission, disk full) fails again
+		if (error) break;
+	}
+
+	// without a directory saving fails, and tiles always start out as the swell again
+	sessionOpen = false;
+}
+
+void OceanTiles::close_session() {
+	if (!sessionOpen) return;
+
+	char path[256];
+	session_path(path, sizeof(path), session);
+
+	std::error_code error;
+	std::filesystem::remove_all(path, error);
+	sessionOpen = false;
+}
+
+int OceanTiles::ring_idx(int x, int y) const {
+	if (x < 0 || x >= width || y < 0 || y >= height)
+		return -1;
+
+	return ((x + ringX) % width) + (((y + ringY) % height) * width);
+}
+
+// copies the ring into window order, every row is two pieces
+void OceanTiles::unroll() {
+	const int startX = (viewX + ringX) % width;
+	const int firstPiece = std::min(viewWidth, width - startX);
+
+	for (int y = 0; y < viewHeight; y++) {
+		const float* row = &currentGrid[((viewY + y + ringY) % height) * width];
+		float* out = &unrolled[y * viewWidth];
+
+		memcpy(out, row + startX, sizeof(float) * firstPiece);
+		memcpy(out + firstPiece, row, sizeof(float) * (viewWidth - firstPiece));
+	}
+}
+
+// a handful of waves around the wind direction, with wavelengths from 8 to 128 cells
+// the random numbers come from a fixed seed, so the swell is the same every run and matches the cache
+void OceanTiles::generate_waves() {
+	uint32_t state = 0x9E3779B9;
+	auto random = [&]() {
+		state = (state * 1664525u) + 1013904223u;
+		return static_cast<float>(state >> 8) / static_cast<float>(1 << 24);
+	};
+
+	const float twoPi = 2.0f * static_cast<float>(M_PI);
+	for (int i = 0; i < WAVE_COUNT; i++) {
+		float wavelength = expf(logf(8.0f) + ((logf(128.0f) - logf(8.0f)) * random()));
+		float angle = windAngle + ((random() - 0.5f) * static_cast<float>(M_PI) * 0.6f);
+		float k = twoPi / wavelength;
+
+		// longer waves carry more of the height, like a real spectrum
+		waves[i].kx = k * cosf(angle);
+		waves[i].ky = k * sinf(angle);
+		waves[i].omega = sqrtf(accelerationTerm * k);
+		waves[i].amplitude = swellHeight * sqrtf(wavelength / 128.0f) / sqrtf(static_cast<float>(WAVE_COUNT));
+		waves[i].phase = twoPi * random();
+	}
+}
+
+// the swell over a rectangle of world cells, at time t
+// cos(a + b) = cos(a)cos(b) - sin(a)sin(b) with a from x and b from y, so it only takes (w + h) sines and
+// cosines per wave instead of w * h
+void OceanTiles::swell_rect(float* out, int worldX, int worldY, int w, int h, float t) {
+	float* cosX = swellTables;
+	float* sinX = cosX + width + height;
+	float* cosY = sinX + width + height;
+	float* sinY = cosY + width + height;
+
+	std::fill_n(out, w * h, 0.0f);
+
+	for (int i = 0; i < WAVE_COUNT; i++) {
+		const Wave& wave = waves[i];
+
+		// in doubles, world coordinates get big enough to eat the precision of the phase
+		for (int x = 0; x < w; x++) {
+			double phase = fmod((static_cast<double>(wave.kx) * (worldX + x)) - (static_cast<double>(wave.omega) * t) + wave.phase, 2.0 * M_PI);
+			cosX[x] = wave.amplitude * static_cast<float>(cos(phase));
+			sinX[x] = wave.amplitude * static_cast<float>(sin(phase));
+		}
+
+		for (int y = 0; y < h; y++) {
+			double phase = fmod(static_cast<double>(wave.ky) * (worldY + y), 2.0 * M_PI);
+			cosY[y] = static_cast<float>(cos(phase));
+			sinY[y] = static_cast<float>(sin(phase));
+		}
+
+		for (int y = 0; y < h; y++) {
+			float* row = &out[y * w];
+			for (int x = 0; x < w; x++)
+				row[x] += (cosX[x] * cosY[y]) - (sinX[x] * sinY[y]);
+		}
+	}
+}
+
+// pulls the band along the window's edges towards the swell, fully at the edge and fading out inwards
+void OceanTiles::apply_sponge() {
+	const int band = std::min(SPONGE_WIDTH, std::min(width, height) / 2);
+	if (band <= 0) return;
+
+	// top and bottom strips over the whole width, left and right strips between them
+	const int strips[4][4] = {
+		{ 0, 0, width, band },
+		{ 0, height - band, width, band },
+		{ 0, band, band, height - (band * 2) },
+		{ width - band, band, band, height - (band * 2) },
+	};
+
+	const int worldX = originX * TILE_SIZE;
+	const int worldY = originY * TILE_SIZE;
+	float* swell = swellScratch;
+	float* swellPrev = swellScratch + (std::max(width, height) * SPONGE_WIDTH);
+
+	for (const int* strip : strips) {
+		const int x0 = strip[0], y0 = strip[1], w = strip[2], h = strip[3];
+		if (w <= 0 || h <= 0) continue;
+
+		swell_rect(swell, worldX + x0, worldY + y0, w, h, time);
+		swell_rect(swellPrev, worldX + x0, worldY + y0, w, h, time - lastDelta);
+
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++) {
+				const int wx = x0 + x, wy = y0 + y;
+				const int edge = std::min(std::min(wx, wy), std::min(width - 1 - wx, height - 1 - wy));
+				const float weight = 1.0f - (static_cast<float>(edge) / static_cast<float>(band));
+
+				const int idx = ring_idx(wx, wy);
+				currentGrid[idx] += weight * (swell[x + (y * w)] - currentGrid[idx]);
+				prevGrid[idx] += weight * (swellPrev[x + (y * w)] - prevGrid[idx]);
+			}
+		}
+	}
+}
+
+void OceanTiles::save_tile(int slotX, int slotY, int tileX, int tileY) {
+	if (!sessionOpen) return;
+
+	const int x0 = slotX * TILE_SIZE;
+	const int y0 = slotY * TILE_SIZE;
+
+	float maxAbs = 0.0f;
+	for (int y = 0; y < TILE_SIZE; y++) {
+		for (int x = 0; x < TILE_SIZE; x++) {
+			const int idx = (x0 + x) + ((y0 + y) * width);
+			maxAbs = std::max(maxAbs, std::max(fabsf(currentGrid[idx]), fabsf(prevGrid[idx])));
+		}
+	}
+
+	TileHeader header = {};
+	header.magic = TILE_MAGIC;
+	header.session = session;
+	header.tileX = tileX;
+	header.tileY = tileY;
+	header.size = TILE_SIZE;
+	header.scale = maxAbs > 0.0f ? maxAbs / 32767.0f : 1.0f;
+
+	auto quantize = [&](float value) {
+		return static_cast<int32_t>(lrintf(std::clamp(value / header.scale, -32767.0f, 32767.0f)));
+	};
+
+	uint8_t* out = tileBuffer;
+
+	// obstruction, mostly one long run of open water
+	int run = 0;
+	uint8_t runValue = 0;
+	for (int y = 0; y < TILE_SIZE; y++) {
+		for (int x = 0; x < TILE_SIZE; x++) {
+			uint8_t value = static_cast<uint8_t>(lrintf(std::clamp(obstruction[(x0 + x) + ((y0 + y) * width)], 0.0f, 1.0f) * 255.0f));
+			if (run > 0 && value != runValue) {
+				out = put_varint(out, static_cast<uint32_t>(run));
+				*out++ = runValue;
+				run = 0;
+			}
+
+			runValue = value;
+			run++;
+		}
+	}
+	out = put_varint(out, static_cast<uint32_t>(run));
+	*out++ = runValue;
+
+	// current heights, predicted from the cell to the left (or above, for the first column)
+	int32_t above = 0;
+	for (int y = 0; y < TILE_SIZE; y++) {
+		int32_t left = above;
+		for (int x = 0; x < TILE_SIZE; x++) {
+			int32_t value = quantize(currentGrid[(x0 + x) + ((y0 + y) * width)]);
+			out = put_varint(out, zigzag(value - left));
+			left = value;
+			if (x == 0) above = value;
+		}
+	}
+
+	// previous heights, predicted from the current ones
+	for (int y = 0; y < TILE_SIZE; y++) {
+		for (int x = 0; x < TILE_SIZE; x++) {
+			const int idx = (x0 + x) + ((y0 + y) * width);
+			out = put_varint(out, zigzag(quantize(prevGrid[idx]) - quantize(currentGrid[idx])));
+		}
+	}
+
+	header.bytes = static_cast<uint32_t>(out - tileBuffer);
+
+	char path[256];
+	tile_path(path, sizeof(path), session, tileX, tileY);
+
+	FILE* file = fopen(path, "wb");
+	if (file) {
+		fwrite(&header, sizeof(header), 1, file);
+		fwrite(tileBuffer, header.bytes, 1, file);
+		fclose(file);
+
+		tilesSaved++;
+		lastTileBytes = sizeof(header) + header.bytes;
+	}
+}
+
+// from the cache if this session has simulated the tile before, otherwise from the swell
+void OceanTiles::load_tile(int slotX, int slotY, int tileX, int tileY) {
+	const int x0 = slotX * TILE_SIZE;
+	const int y0 = slotY * TILE_SIZE;
+
+	for (int y = 0; y < TILE_SIZE; y++) {
+		const int row = x0 + ((y0 + y) * width);
+		std::fill_n(&source[row], TILE_SIZE, 0.0f);
+		std::fill_n(&verticalDerivative[row], TILE_SIZE, 0.0f);
+	}
+
+	char path[256];
+	tile_path(path, sizeof(path), session, tileX, tileY);
+
+	TileHeader header;
+	FILE* file = sessionOpen ? fopen(path, "rb") : nullptr;
+	bool valid = file
+		&& 1 == fread(&header, sizeof(header), 1, file)
+		&& header.magic == TILE_MAGIC
+		&& header.session == session
+		&& header.tileX == tileX && header.tileY == tileY
+		&& header.size == TILE_SIZE
+		&& header.bytes <= tileBufferSize
+		&& 1 == fread(tileBuffer, header.bytes, 1, file);
+
+	if (file)
+		fclose(file);
+
+	if (valid) {
+		const uint8_t* in = tileBuffer;
+		const uint8_t* end = tileBuffer + header.bytes;
+		uint32_t value = 0;
+
+		int cell = 0;
+		while (valid && cell < TILE_SIZE * TILE_SIZE) {
+			in = get_varint(in, end, value);
+			valid = in && in < end && value > 0 && cell + static_cast<int>(value) <= TILE_SIZE * TILE_SIZE;
+			if (!valid) break;
+
+			const float obstructionValue = static_cast<float>(*in++) / 255.0f;
+			for (uint32_t i = 0; i < value; i++, cell++)
+				obstruction[(x0 + (cell % TILE_SIZE)) + ((y0 + (cell / TILE_SIZE)) * width)] = obstructionValue;
+		}
+
+		int32_t above = 0;
+		for (int y = 0; valid && y < TILE_SIZE; y++) {
+			int32_t left = above;
+			for (int x = 0; x < TILE_SIZE; x++) {
+				in = get_varint(in, end, value);
+				if (!in) {
+					valid = false;
+					break;
+				}
+
+				left += unzigzag(value);
+				currentGrid[(x0 + x) + ((y0 + y) * width)] = static_cast<float>(left) * header.scale;
+				if (x == 0) above = left;
+			}
+		}
+
+		for (int y = 0; valid && y < TILE_SIZE; y++) {
+			for (int x = 0; x < TILE_SIZE; x++) {
+				in = get_varint(in, end, value);
+				if (!in) {
+					valid = false;
+					break;
+				}
+
+				const int idx = (x0 + x) + ((y0 + y) * width);
+				prevGrid[idx] = currentGrid[idx] + (static_cast<float>(unzigzag(value)) * header.scale);
+			}
+		}
+	}
+
+	if (valid) {
+		tilesLoaded++;
+		return;
+	}
+
+	// never been here (or the file was bad), start out as the swell
+	float* swell = swellScratch;
+	const float delta = lastDelta > 0.0f ? lastDelta : 1.0f / 60.0f;
+
+	swell_rect(swell, tileX * TILE_SIZE, tileY * TILE_SIZE, TILE_SIZE, TILE_SIZE, time);
+	for (int y = 0; y < TILE_SIZE; y++)
+		memcpy(&currentGrid[x0 + ((y0 + y) * width)], &swell[y * TILE_SIZE], sizeof(float) * TILE_SIZE);
+
+	swell_rect(swell, tileX * TILE_SIZE, tileY * TILE_SIZE, TILE_SIZE, TILE_SIZE, time - delta);
+	for (int y = 0; y < TILE_SIZE; y++)
+		memcpy(&prevGrid[x0 + ((y0 + y) * width)], &swell[y * TILE_SIZE], sizeof(float) * TILE_SIZE);
+
+	for (int y = 0; y < TILE_SIZE; y++)
+		std::fill_n(&obstruction[x0 + ((y0 + y) * width)], TILE_SIZE, 1.0f);
+
+	tilesGenerated++;
+}
+
+// the column of tiles leaving the window and the one coming in share the same slots
+void OceanTiles::shift_x(int direction) {
+	const int slotX = direction > 0 ? ringX / TILE_SIZE : ((ringX / TILE_SIZE) + tilesX - 1) % tilesX;
+	const int leaving = direction > 0 ? originX : originX + tilesX - 1;
+	const int entering = direction > 0 ? originX + tilesX : originX - 1;
+
+	for (int j = 0; j < tilesY; j++) {
+		const int slotY = ((ringY / TILE_SIZE) + j) % tilesY;
+		save_tile(slotX, slotY, leaving, originY + j);
+		load_tile(slotX, slotY, entering, originY + j);
+	}
+
+	originX += direction;
+	ringX = (ringX + (direction * TILE_SIZE) + width) % width;
+}
+
+void OceanTiles::shift_y(int direction) {
+	const int slotY = direction > 0 ? ringY / TILE_SIZE : ((ringY / TILE_SIZE) + tilesY - 1) % tilesY;
+	const int leaving = direction > 0 ? originY : originY + tilesY - 1;
+	const int entering = direction > 0 ? originY + tilesY : originY - 1;
+
+	for (int i = 0; i < tilesX; i++) {
+		const int slotX = ((ringX / TILE_SIZE) + i) % tilesX;
+		save_tile(slotX, slotY, originX + i, leaving);
+		load_tile(slotX, slotY, originX + i, entering);
+	}
+
+	originY += direction;
+	ringY = (ringY + (direction * TILE_SIZE) + height) % height;
+}
+
+//
+// public
+//
+OceanTiles::OceanTiles(int w, int h, int p) {
+	tilesX = std::max((w + TILE_SIZE - 1) / TILE_SIZE, 1);
+	tilesY = std::max((h + TILE_SIZE - 1) / TILE_SIZE, 1);
+	width = tilesX * TILE_SIZE;
+	height = tilesY * TILE_SIZE;
+	bufferCount = width * height;
+
+	viewWidth = std::clamp(w, 1, width);
+	viewHeight = std::clamp(h, 1, height);
+	viewX = (width - viewWidth) / 2;
+	viewY = (height - viewHeight) / 2;
+
+	// same defaults as IWaveSurface
+	accelerationTerm = 20.0f;
+	velocityDamping = 1.0f;
+
+	const size_t bufferSize = sizeof(float) * bufferCount;
+	currentGrid = static_cast<float*>(malloc(bufferSize));
+	prevGrid = static_cast<float*>(malloc(bufferSize));
+	verticalDerivative = static_cast<float*>(malloc(bufferSize));
+	source = static_cast<float*>(malloc(bufferSize));
+	obstruction = static_cast<float*>(malloc(bufferSize));
+	unrolled = static_cast<float*>(malloc(sizeof(float) * viewWidth * viewHeight));
+	waterPixels = static_cast<uint32_t*>(malloc(sizeof(uint32_t) * viewWidth * viewHeight));
+
+	kernelRadius = p;
+	kernelLength = (2 * p) + 1;
+	derivativeKernel = static_cast<float*>(malloc(sizeof(float) * kernelLength * kernelLength));
+	iwave_kernel(derivativeKernel, kernelRadius);
+
+	wrapX = static_cast<int*>(malloc(sizeof(int) * (width + (kernelRadius * 2))));
+	wrapY = static_cast<int*>(malloc(sizeof(int) * (height + (kernelRadius * 2))));
+	for (int i = 0; i < width + (kernelRadius * 2); i++)
+		wrapX[i] = (((i - kernelRadius) % width) + width) % width;
+	for (int i = 0; i < height + (kernelRadius * 2); i++)
+		wrapY[i] = ((((i - kernelRadius) % height) + height) % height) * width;
+
+	// two sponge strips (or a tile), and the per wave tables swell_rect needs
+	swellScratch = static_cast<float*>(malloc(sizeof(float) * std::max(std::max(width, height) * SPONGE_WIDTH * 2, TILE_SIZE * TILE_SIZE)));
+	swellTables = static_cast<float*>(malloc(sizeof(float) * (width + height) * 4));
+
+	// a varint is at most 3 bytes for a 16 bit residual, and the runs are at most one pair per cell
+	tileBufferSize = TILE_SIZE * TILE_SIZE * (3 + 3 + 4);
+	tileBuffer = static_cast<uint8_t*>(malloc(tileBufferSize));
+
+	waterTexture = Renderer::create_tex(viewWidth, viewHeight, GL_RGBA8);
+	glTextureParameteri(waterTexture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTextureParameteri(waterTexture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	heightTexture = Renderer::create_tex(viewWidth, viewHeight, GL_R32F);
+
+	// start out centered on the origin
+	originX = static_cast<int>(floorf((static_cast<float>(-width / 2) / TILE_SIZE) + 0.5f));
+	originY = static_cast<int>(floorf((static_cast<float>(-height / 2) / TILE_SIZE) + 0.5f));
+
+	reset();
+}
+
+OceanTiles::~OceanTiles() {
+	free(currentGrid);
+	free(prevGrid);
+	free(verticalDerivative);
+	free(source);
+	free(obstruction);
+	free(unrolled);
+	free(waterPixels);
+	free(derivativeKernel);
+	free(wrapX);
+	free(wrapY);
+	free(swellScratch);
+	free(swellTables);
+	free(tileBuffer);
+
+	// the cache directory only goes away once every session in it is closed
+	close_session();
+	std::error_code error;
+	std::filesystem::remove(cacheDir, error);
+
+	clean();
+}
+
+void OceanTiles::clean() {
+	if (heightTexture != 0) {
+		glDeleteTextures(1, &waterTexture);
+		glDeleteTextures(1, &heightTexture);
+		waterTexture = 0;
+		heightTexture = 0;
+	}
+}
+
+void OceanTiles::follow(float x, float y) {
+	cameraX = x;
+	cameraY = y;
+
+	// the window moves a whole tile once the camera is half a tile off its middle
+	const int targetX = static_cast<int>(floorf(((x - (static_cast<float>(width) * 0.5f)) / TILE_SIZE) + 0.5f));
+	const int targetY = static_cast<int>(floorf(((y - (static_cast<float>(height) * 0.5f)) / TILE_SIZE) + 0.5f));
+
+	while (originX < targetX) shift_x(1);
+	while (originX > targetX) shift_x(-1);
+	while (originY < targetY) shift_y(1);
+	while (originY > targetY) shift_y(-1);
+}
+
+void OceanTiles::place_source(int x, int y, float r, float strength) {
+	int s = static_cast<int>(r + 0.5f);
+
+	for (int iy = -s; iy <= s; iy++) {
+		for (int ix = -s; ix <= s; ix++) {
+			float ir = r - sqrtf(static_cast<float>((iy * iy) + (ix * ix)));
+			int idx = ring_idx(viewX + x + ix, viewY + y + iy);
+			if (ir > 0.0f && idx >= 0)
+				source[idx] = ir * strength;
+		}
+	}
+}
+
+void OceanTiles::set_obstruction(int x, int y, float r, float strength) {
+	int extent = static_cast<int>(fabsf(r + 0.5f));
+	strength = 1.0f - strength;
+
+	for (int iy = -extent; iy <= extent; iy++) {
+		for (int ix = -extent; ix <= extent; ix++) {
+			int idx = ring_idx(viewX + x + ix, viewY + y + iy);
+			if (idx >= 0 && strength < obstruction[idx])
+				obstruction[idx] = strength;
+		}
+	}
+}
+
+void OceanTiles::sim_frame(float delta) {
+	follow(cameraX + (driftX * delta), cameraY + (driftY * delta));
+
+	// the same steps as IWaveSurface, except every index wraps around the ring
+	for (int i = 0; i < bufferCount; i++) {
+		currentGrid[i] += source[i];
+		currentGrid[i] *= obstruction[i];
+		source[i] = 0.0f;
+	}
+
+	ThreadPool::shared().parallel_for(static_cast<size_t>(height), [&](size_t begin, size_t end) {
+		for (int y = static_cast<int>(begin); y < static_cast<int>(end); y++) {
+			for (int x = 0; x < width; x++) {
+				float sum = 0.0f;
+
+				for (int dy = 0; dy < kernelLength; dy++) {
+					const float* kernelRow = &derivativeKernel[dy * kernelLength];
+					const int row = wrapY[y + dy];
+
+					for (int dx = 0; dx < kernelLength; dx++)
+						sum += currentGrid[row + wrapX[x + dx]] * kernelRow[dx];
+				}
+
+				verticalDerivative[x + (y * width)] = sum;
+			}
+		}
+	}, 8);
+
+	float alphaDt = velocityDamping * delta;
+	float onePlusAlphaDt = 1.0f + alphaDt;
+	for (int i = 0; i < bufferCount; i++) {
+		float temp = currentGrid[i];
+
+		currentGrid[i] = (currentGrid[i] * (2.0f - alphaDt) / onePlusAlphaDt)
+			- (prevGrid[i] / onePlusAlphaDt)
+			- (verticalDerivative[i] * accelerationTerm * delta * delta / onePlusAlphaDt);
+
+		prevGrid[i] = temp;
+	}
+
+	time += delta;
+	lastDelta = delta;
+	apply_sponge();
+}
+
+void OceanTiles::reset() {
+	// anything cached so far belongs to the old swell, so it goes away with the old session
+	close_session();
+	open_session();
+	time = 0.0f;
+	generate_waves();
+
+	for (int j = 0; j < tilesY; j++) {
+		for (int i = 0; i < tilesX; i++)
+			load_tile(((ringX / TILE_SIZE) + i) % tilesX, ((ringY / TILE_SIZE) + j) % tilesY, originX + i, originY + j);
+	}
+}
+
+int OceanTiles::get_params(float* out) const {
+	out[0] = velocityDamping;
+	out[1] = accelerationTerm;
+	out[2] = swellHeight;
+	out[3] = windAngle;
+	out[4] = driftX;
+	out[5] = driftY;
+	return 6;
+}
+
+void OceanTiles::set_params(const float* values, int count) {
+	if (count != 6) return;
+
+	// the same as the sliders in imgui_builder, which only rebuild the waves for these two
+	const bool swellChanged = values[2] != swellHeight || values[3] != windAngle;
+
+	velocityDamping = values[0];
+	accelerationTerm = values[1];
+	swellHeight = values[2];
+	windAngle = values[3];
+	driftX = values[4];
+	driftY = values[5];
+
+	if (swellChanged)
+		generate_waves();
+}
+
+static constexpr uint32_t SNAPSHOT_KIND = snapshot::id("OCEN");
+
+// where the window is in the world and in the ring, and what the swell looks like, as floats
+// tile and cell coordinates stay exact up to 2^24
+static constexpr uint32_t WINDOW = snapshot::id("WNDW");
+static constexpr int WINDOW_VALUES = 9;
+
+bool OceanTiles::save_state(const char* path, bool lossy) {
+	const snapshot::Encoding heights = lossy ? snapshot::Encoding::Quantized : snapshot::Encoding::Lossless;
+
+	const float window[WINDOW_VALUES] = {
+		static_cast<float>(originX), static_cast<float>(originY),
+		static_cast<float>(ringX), static_cast<float>(ringY),
+		cameraX, cameraY, time, swellHeight, windAngle,
+	};
+
+	SnapshotWriter writer;
+	if (!writer.open(path, SNAPSHOT_KIND, 5)) return false;
+
+	// the grids are saved in ring order, the ring offsets come back with the window
+	writer.write_channel(WINDOW, window, WINDOW_VALUES, 1, 1, snapshot::Encoding::Raw);
+	writer.write_channel(snapshot::CURRENT, currentGrid, width, height, 1, heights);
+	writer.write_channel(snapshot::PREVIOUS, prevGrid, width, height, 1, heights, snapshot::CURRENT, currentGrid);
+	writer.write_channel(snapshot::OBSTRUCTION, obstruction, width, height, 1, snapshot::Encoding::Lossless);
+	writer.write_channel(snapshot::SOURCE, source, width, height, 1, snapshot::Encoding::Lossless);
+	return writer.close();
+}
+
+bool OceanTiles::load_state(const char* path) {
+	SnapshotReader reader;
+	if (!reader.open(path) || reader.get_kind() != SNAPSHOT_KIND) return false;
+
+	const uint32_t channels[] = { snapshot::CURRENT, snapshot::PREVIOUS, snapshot::OBSTRUCTION, snapshot::SOURCE };
+	for (uint32_t id : channels) {
+		const snapshot::Channel* channel = reader.find(id);
+		if (!channel || channel->width != width || channel->height != height || channel->components != 1)
+			return false;
+	}
+
+	float window[WINDOW_VALUES];
+	if (!reader.read_grid(WINDOW, window, WINDOW_VALUES, 1)) return false;
+
+	const int savedRingX = static_cast<int>(window[2]);
+	const int savedRingY = static_cast<int>(window[3]);
+	if (savedRingX < 0 || savedRingX >= width || savedRingX % TILE_SIZE != 0
+		|| savedRingY < 0 || savedRingY >= height || savedRingY % TILE_SIZE != 0)
+		return false;
+
+	// same as IWaveSurface, a corrupt block past this point resets instead of leaving half a state
+	bool loaded = reader.read_grid(snapshot::CURRENT, currentGrid, width, height)
+		&& reader.read_grid(snapshot::PREVIOUS, prevGrid, width, height, 1, currentGrid)
+		&& reader.read_grid(snapshot::OBSTRUCTION, obstruction, width, height)
+		&& reader.read_grid(snapshot::SOURCE, source, width, height);
+
+	if (!loaded) {
+		reset();
+		return false;
+	}
+
+	originX = static_cast<int>(window[0]);
+	originY = static_cast<int>(window[1]);
+	ringX = savedRingX;
+	ringY = savedRingY;
+	cameraX = window[4];
+	cameraY = window[5];
+	time = window[6];
+	swellHeight = window[7];
+	windAngle = window[8];
+	generate_waves();
+
+	// the cached tiles are from before the load and don't belong next to the loaded window
+	close_session();
+	open_session();
+	return true;
+}
+
+GLuint OceanTiles::get_display() {
+	if (!waterPixels) return { 0 };
+
+	float extents = 5.0f;
+	for (int y = 0; y < viewHeight; y++) {
+		for (int x = 0; x < viewWidth; x++) {
+			const int idx = ring_idx(viewX + x, viewY + y);
+			uint8_t* pixel = reinterpret_cast<uint8_t*>(&waterPixels[x + (y * viewWidth)]);
+			float h = std::clamp(currentGrid[idx], -extents, extents);
+
+			pixel[0] = pix_from_normalized(1.0f - obstruction[idx]);
+			pixel[1] = 0;
+			pixel[2] = pix_from_normalized((h + extents) / (extents * 2.0f));
+			pixel[3] = 255;
+		}
+	}
+
+	glTextureSubImage2D(waterTexture, 0, 0, 0, viewWidth, viewHeight, GL_RGBA, GL_UNSIGNED_BYTE, waterPixels);
+	return waterTexture;
+}
+
+GLuint OceanTiles::get_height_tex() {
+	unroll();
+	glTextureSubImage2D(heightTexture, 0, 0, 0, viewWidth, viewHeight, GL_RED, GL_FLOAT, unrolled);
+	return heightTexture;
+}
+
+void OceanTiles::imgui_builder(bool* open) {
+	if (!open || !*open) return;
+
+	if (ImGui::Begin("OceanTiles", open, ImGuiWindowFlags_AlwaysAutoResize)) {
+		ImGui::SliderFloat("Drift X", &driftX, -64.0f, 64.0f);
+		ImGui::SliderFloat("Drift Y", &driftY, -64.0f, 64.0f);
+
+		// the waves have to be rebuilt for these, tiles already in the window keep their old swell
+		bool swellChanged = ImGui::SliderFloat("Swell Height", &swellHeight, 0.0f, 2.0f);
+		swellChanged |= ImGui::SliderAngle("Wind Angle", &windAngle);
+		if (swellChanged)
+			generate_waves();
+
+		const size_t rawBytes = sizeof(float) * 3 * TILE_SIZE * TILE_SIZE;
+		ImGui::LabelText("Window", "%dx%d tiles of %d cells, %dx%d shown", tilesX, tilesY, TILE_SIZE, viewWidth, viewHeight);
+		ImGui::LabelText("Origin Tile", "%d %d", originX, originY);
+		ImGui::LabelText("Camera", "%.1f %.1f", cameraX, cameraY);
+		ImGui::LabelText("Tiles", "%d saved, %d loaded, %d generated", tilesSaved, tilesLoaded, tilesGenerated);
+		ImGui::LabelText("Last Tile", "%zu bytes (%.1fx smaller)", lastTileBytes,
+			lastTileBytes > 0 ? static_cast<double>(rawBytes) / static_cast<double>(lastTileBytes) : 0.0);
+	}
+
+	ImGui::End();
+}
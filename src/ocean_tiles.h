@@ -0,0 +1,140 @@
+#pragma once
+
+#include "surface_sim.h"
+
+#include <stddef.h>
+
+#define OCEANTILES_CPU
+
+// an ocean far bigger than any grid, only simulated in a window of tiles around the camera
+//
+// the window is a toroidal ring buffer, when the camera crosses a tile boundary the row/column of tiles
+// falling off the back gets written to a compressed file in cacheDir and the same slots are reused for the
+// tiles coming in, so nothing gets moved around in memory
+// tiles coming in are read back from the cache if they were simulated before, otherwise they start out
+// as an analytic swell (a sum of WAVE_COUNT waves with deep water dispersion, so the iWave step carries
+// them along at about the right speed)
+//
+// the simulation itself is the CPU iWave on the window, with the kernel wrapping around the ring
+// a band along the window's edges is blended towards the analytic swell every step, which keeps waves from
+// wrapping around to the other side and feeds the swell in from the open ocean
+class OceanTiles : public SurfaceSim {
+public:
+	static constexpr int TILE_SIZE = 64;
+	static constexpr int WAVE_COUNT = 32;
+
+	static const char* cacheDir;
+
+private:
+	int tilesX = 0, tilesY = 0;
+	int width = 0, height = 0; // window, in cells
+	int bufferCount = 0;
+
+	// the part of the window that was asked for, centered in it, everything outside sees only this
+	// (textures, and the coordinates of place_source/set_obstruction)
+	int viewWidth = 0, viewHeight = 0;
+	int viewX = 0, viewY = 0;
+
+	// world tile at the window's top left, and where that tile is in the ring
+	// window cell (x, y) is stored at ((x + ringX) % width, (y + ringY) % height)
+	int originX = 0, originY = 0;
+	int ringX = 0, ringY = 0;
+
+	float* currentGrid = nullptr;
+	float* prevGrid = nullptr;
+	float* verticalDerivative = nullptr;
+	float* source = nullptr;
+	float* obstruction = nullptr;
+
+	float* derivativeKernel = nullptr;
+	int kernelRadius = 0, kernelLength = 0;
+	int* wrapX = nullptr; // ring index of every column/row from -kernelRadius to width/height + kernelRadius
+	int* wrapY = nullptr;
+
+	struct Wave {
+		float kx, ky;
+		float omega;
+		float amplitude;
+		float phase;
+	};
+
+	Wave waves[WAVE_COUNT];
+	float time = 0.0f, lastDelta = 0.0f;
+	// every session caches its tiles in its own directory under cacheDir, which nothing else can have claimed
+	// (see open_session), and deletes it again on reset and in the destructor
+	uint32_t session = 0;
+	bool sessionOpen = false;
+
+	// scratch for the analytic swell and for one encoded tile
+	float* swellScratch = nullptr;
+	float* swellTables = nullptr;
+	uint8_t* tileBuffer = nullptr;
+	size_t tileBufferSize = 0;
+
+	// the view in view order, for display
+	float* unrolled = nullptr;
+	uint32_t* waterPixels = nullptr;
+	GLuint waterTexture = 0, heightTexture = 0;
+
+	int ring_idx(int x, int y) const; // window coordinates, -1 outside the window
+	void unroll(); // the view into unrolled
+
+	void generate_waves();
+	void swell_rect(float* out, int worldX, int worldY, int w, int h, float t);
+	void apply_sponge();
+
+	void open_session();
+	void close_session();
+
+	void save_tile(int slotX, int slotY, int tileX, int tileY);
+	void load_tile(int slotX, int slotY, int tileX, int tileY);
+	void shift_x(int direction);
+	void shift_y(int direction);
+
+public:
+	float velocityDamping;
+	float accelerationTerm;
+
+	// height of the analytic swell and the direction it travels in (radians)
+	float swellHeight = 0.4f;
+	float windAngle = 0.5f;
+
+	// width of the band along the window's edges that gets pulled towards the swell
+	static constexpr int SPONGE_WIDTH = 12;
+
+	// the camera drifts by this many cells per second, the window follows it
+	float driftX = 0.0f, driftY = 0.0f;
+	float cameraX = 0.0f, cameraY = 0.0f; // in world cells
+
+	// stats
+	int tilesSaved = 0, tilesLoaded = 0, tilesGenerated = 0;
+	size_t lastTileBytes = 0;
+
+	// the window gets rounded up to whole tiles, but only w x h of it is shown, so the textures have the
+	// size that was asked for like every other SurfaceSim
+	OceanTiles(int w, int h, int p);
+	~OceanTiles();
+	void clean() override;
+
+	// moves the window so the camera is over its middle, saving and loading tiles as needed
+	void follow(float x, float y);
+
+	// coordinates are in view cells, like every other SurfaceSim
+	void place_source(int x, int y, float r, float strength) override;
+	void set_obstruction(int x, int y, float r, float strength) override;
+	void sim_frame(float delta) override;
+	void reset() override;
+
+	// the drift and swell count too, the swell is rebuilt when it changes
+	int get_params(float* out) const override;
+	void set_params(const float* values, int count) override;
+
+	// only the window is saved, tiles cached outside of it start out as the swell again after a load
+	bool save_state(const char* path, bool lossy = false) override;
+	bool load_state(const char* path) override;
+
+	GLuint get_display() override;
+	GLuint get_height_tex() override;
+
+	void imgui_builder(bool* open = nullptr) override;
+};
@@ -1,8 +1,17 @@
 #include "smath.h"
 
+#include <stdlib.h>
+#include <math.h>
+
 #include <type_traits>
 #include <bit>
 
+#include "thread_pool.h"
+
+#if defined(SMATH_SSE2)
+#include <emmintrin.h>
+#endif
+
 //
 // Structures
 //
@@ -76,17 +85,17 @@ Matrix4 Matrix4::perspective(float fovyRadians,
 	r(0, 0) = f / aspect;
 	r(1, 1) = f;
 	r(2, 2) = (zFar + zNear) / (zNear - zFar);
-	r(2, 3) = -1.0f;
-	r(3, 2) = (2.0f * zFar * zNear) / (zNear - zFar);
+	r(2, 3) = (2.0f * zFar * zNear) / (zNear - zFar);
+	r(3, 2) = -1.0f;
 
 	return r;
 }
 
 Matrix4 Matrix4::translation(float x, float y, float z) {
 	Matrix4 r(1.0f);
-	r(3, 0) = x;
-	r(3, 1) = y;
-	r(3, 2) = z;
+	r(0, 3) = x;
+	r(1, 3) = y;
+	r(2, 3) = z;
 	return r;
 }
 
@@ -104,8 +113,8 @@ Matrix4 Matrix4::rotationX(float radians) {
 	float s = sinf(radians);
 
 	r(1, 1) = c;
-	r(2, 1) = -s;
-	r(1, 2) = s;
+	r(1, 2) = -s;
+	r(2, 1) = s;
 	r(2, 2) = c;
 	return r;
 }
@@ -116,8 +125,8 @@ Matrix4 Matrix4::rotationY(float radians) {
 	float s = sinf(radians);
 
 	r(0, 0) = c;
-	r(2, 0) = s;
-	r(0, 2) = -s;
+	r(0, 2) = s;
+	r(2, 0) = -s;
 	r(2, 2) = c;
 	return r;
 }
@@ -128,8 +137,8 @@ Matrix4 Matrix4::rotationZ(float radians) {
 	float s = sinf(radians);
 
 	r(0, 0) = c;
-	r(1, 0) = -s;
-	r(0, 1) = s;
+	r(0, 1) = -s;
+	r(1, 0) = s;
 	r(1, 1) = c;
 	return r;
 }
@@ -145,67 +154,132 @@ Matrix4 Matrix4::transform(float tx, float ty, float tz,
 }
 
 namespace smath {
-	void* intermediateBuffer = nullptr;
-	static constexpr size_t BUFFER_SIZE_COMPLEX = 1 << 16;
-	static constexpr size_t BUFFER_SIZE_FLOAT = BUFFER_SIZE_COMPLEX * 2;
-
 	void init() {
-		intermediateBuffer = malloc(sizeof(Complex) * BUFFER_SIZE_COMPLEX);
+
 	}
 
+	// the transforms allocate their plans (and plan scratch) lazily, this frees all of them
 	void cleanup() {
-		free(intermediateBuffer);
-		intermediateBuffer = nullptr;
+		release_plans();
 	}
 
 	// Transpose functions for 2D float and Complex arrays
-
-	void transpose(size_t x, size_t y, float* matrix) {
-		for (int iy = 0; iy < y; iy++) {
-			for (size_t ix = iy + 1; ix < x; ix++) {
-
+	// done in tiles so that both the reads and the writes stay within a small set of cache lines
+	// and pages, the tiles are walked along the output since the writes are the more expensive side
+	// 32 measured better than 8 or 16 on a 1024x1024 Complex grid, the row stride there is a
+	// power of 2 so small tiles keep hitting the same cache sets
+	// inside a tile, whole 8x8 blocks are transposed in SSE registers
+
+	static constexpr size_t TRANSPOSE_BLOCK = 32;
+	static constexpr size_t SIMD_BLOCK = 8;
+
+	// waking the thread pool costs more than it saves unless each thread gets about this many elements
+	static constexpr size_t PARALLEL_MIN_ELEMENTS = 1 << 14;
+
+	// one 8x8 block, input and output point at its first element, x and y are the row strides
+#if defined(SMATH_SSE2)
+	// four 4x4 transposes
+	static void transpose_block(size_t x, size_t y, float* output, const float* input) {
+		for (size_t qy = 0; qy < SIMD_BLOCK; qy += 4) {
+			for (size_t qx = 0; qx < SIMD_BLOCK; qx += 4) {
+				const float* in = input + qx + (qy * x);
+				__m128 r0 = _mm_loadu_ps(in);
+				__m128 r1 = _mm_loadu_ps(in + x);
+				__m128 r2 = _mm_loadu_ps(in + (x * 2));
+				__m128 r3 = _mm_loadu_ps(in + (x * 3));
+				_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+				float* out = output + qy + (qx * y);
+				_mm_storeu_ps(out, r0);
+				_mm_storeu_ps(out + y, r1);
+				_mm_storeu_ps(out + (y * 2), r2);
+				_mm_storeu_ps(out + (y * 3), r3);
 			}
 		}
 	}
 
-	void transpose(size_t x, size_t y, Complex* matrix) {
-
+	// a Complex is 8 bytes, so a register holds two and the block is sixteen 2x2 transposes
+	static void transpose_block(size_t x, size_t y, Complex* output, const Complex* input) {
+		for (size_t iy = 0; iy < SIMD_BLOCK; iy += 2) {
+			for (size_t ix = 0; ix < SIMD_BLOCK; ix += 2) {
+				__m128d a = _mm_loadu_pd(reinterpret_cast<const double*>(&input[ix + (iy * x)]));
+				__m128d b = _mm_loadu_pd(reinterpret_cast<const double*>(&input[ix + ((iy + 1) * x)]));
+				_mm_storeu_pd(reinterpret_cast<double*>(&output[iy + (ix * y)]), _mm_unpacklo_pd(a, b));
+				_mm_storeu_pd(reinterpret_cast<double*>(&output[iy + ((ix + 1) * y)]), _mm_unpackhi_pd(a, b));
+			}
+		}
+	}
+#else
+	template <typename T>
+	static void transpose_block(size_t x, size_t y, T* output, const T* input) {
+		for (size_t ix = 0; ix < SIMD_BLOCK; ix++) {
+			for (size_t iy = 0; iy < SIMD_BLOCK; iy++)
+				output[iy + (ix * y)] = input[ix + (iy * x)];
+		}
+	}
+#endif
+
+	// the part of a tile that isn't made of whole blocks, only at the right and bottom edges of the matrix
+	template <typename T>
+	static void transpose_scalar(size_t x, size_t y, T* output, const T* input, size_t bx, size_t by, size_t ex, size_t ey) {
+		for (size_t ix = bx; ix < ex; ix++) {
+			for (size_t iy = by; iy < ey; iy++)
+				output[iy + (ix * y)] = input[ix + (iy * x)];
+		}
 	}
 
-	//
-	// Regular Discrete Fourier Transform functions
-	// These only exist because I haven't implemented an FFT yet, but I'd still like to work on 
-	// parts of the project that require some sort of Fourier Transform routine.
-	//
+	// transposes the tile rows in [begin, end), each one TRANSPOSE_BLOCK input rows tall
+	template <typename T>
+	static void transpose_strips(size_t x, size_t y, T* output, const T* input, size_t begin, size_t end) {
+		for (size_t by = begin * TRANSPOSE_BLOCK; by < y && by < end * TRANSPOSE_BLOCK; by += TRANSPOSE_BLOCK) {
+			const size_t ey = by + TRANSPOSE_BLOCK < y ? by + TRANSPOSE_BLOCK : y;
+			const size_t blocksY = by + ((ey - by) / SIMD_BLOCK) * SIMD_BLOCK;
 
-	// 1D Discrete Sine Transform
-	void dst(size_t len, float* output, float* input) {
-		const float invLen = 1.0f / static_cast<float>(len);
+			for (size_t bx = 0; bx < x; bx += TRANSPOSE_BLOCK) {
+				const size_t ex = bx + TRANSPOSE_BLOCK < x ? bx + TRANSPOSE_BLOCK : x;
+				const size_t blocksX = bx + ((ex - bx) / SIMD_BLOCK) * SIMD_BLOCK;
 
-		for (size_t i = 0; i < len; i++) {
-			output[i] = 0;
+				for (size_t ix = bx; ix < blocksX; ix += SIMD_BLOCK) {
+					for (size_t iy = by; iy < blocksY; iy += SIMD_BLOCK)
+						transpose_block(x, y, &output[iy + (ix * y)], &input[ix + (iy * x)]);
+				}
 
-			for (size_t j = 0; j < len; j++) {
-				float angle = -smath::tau * static_cast<float>(i * j) * invLen;
-				output[i] += input[j] * sinf(angle);
+				transpose_scalar(x, y, output, input, blocksX, by, ex, ey);
+				transpose_scalar(x, y, output, input, bx, blocksY, blocksX, ey);
 			}
 		}
 	}
 
-	// 1D Discrete Cosine Transform
-	void dct(size_t len, float* output, float* input) {
-		const float invLen = 1.0f / static_cast<float>(len);
+	template <typename T>
+	static void transpose_tiled(size_t x, size_t y, T* output, const T* input) {
+		// each thread takes a strip of tile rows, the strips write to disjoint parts of the output
+		const size_t stripCount = (y + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK;
+		ThreadPool::shared().parallel_for(stripCount, [&](size_t begin, size_t end) {
+			transpose_strips(x, y, output, input, begin, end);
+		}, PARALLEL_MIN_ELEMENTS / (x * TRANSPOSE_BLOCK) + 1);
+	}
 
-		for (size_t i = 0; i < len; i++) {
-			output[i] = 0;
+	void transpose(size_t x, size_t y, float* output, const float* input) {
+		transpose_tiled(x, y, output, input);
+	}
 
-			for (size_t j = 0; j < len; j++) {
-				float angle = -smath::tau * static_cast<float>(i * j) * invLen;
-				output[i] += input[j] * cosf(angle);
-			}
-		}
+	void transpose(size_t x, size_t y, Complex* output, const Complex* input) {
+		transpose_tiled(x, y, output, input);
+	}
+
+	void transpose_serial(size_t x, size_t y, float* output, const float* input) {
+		transpose_strips(x, y, output, input, 0, (y + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK);
+	}
+
+	void transpose_serial(size_t x, size_t y, Complex* output, const Complex* input) {
+		transpose_strips(x, y, output, input, 0, (y + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK);
 	}
 
+	//
+	// Regular Discrete Fourier Transform functions
+	// These existed before the FFT did, now they're only around to check the FFTs against
+	//
+
 	// 1D Discrete Fourier Transform
 	void dft(size_t len, Complex* output, const Complex* input) {
 		const float invLen = 1.0f / static_cast<float>(len);
@@ -221,85 +295,39 @@ namespace smath {
 		}
 	}
 
-	// 2D Discrete Sine Transform
-	void dst(size_t x, size_t y, float* output, float* input) {
-		float* intermediate = static_cast<float*>(intermediateBuffer);
+	// 2D transforms are separable: transform the rows, transpose so the columns become rows,
+	// transform those, and transpose back
+	// the 1D transforms here are O(n^2), so the grain is in terms of n^2 per row
+	template <typename T, typename Transform>
+	static void separable_2d(size_t x, size_t y, T* output, const T* input, Transform transform) {
+		T* scratch = static_cast<T*>(malloc(sizeof(T) * x * y * 2));
+		if (!scratch) return;
 
-		// Horizontal Pass
-		for (size_t iy = 0; iy < y; iy++) {
-			const size_t start = iy * x;
-			dst(x, intermediate, &input[start]);
-		}
+		T* transposed = scratch + (x * y);
 
-		transpose(x, y, intermediate);
-		
-		// Vertical Pass
-		for (size_t iy = 0; iy < y; iy++) {
-			const size_t start = iy * x;
-			dst(x, &output[start], intermediate);
-		}
+		ThreadPool& pool = ThreadPool::shared();
 
-		transpose(x, y, output);
-	}
+		// Horizontal Pass
+		pool.parallel_for(y, [&](size_t begin, size_t end) {
+			for (size_t iy = begin; iy < end; iy++)
+				transform(x, &scratch[iy * x], &input[iy * x]);
+		}, PARALLEL_MIN_ELEMENTS / (x * x) + 1);
 
-	// 2D Discrete Cosine Transform
-	//void dct(size_t x, size_t y, float* output, float* input) {
-
-	//	for (size_t i = 0; i < len; i++) {
-	//		output[i] = 0;
-
-	//		for (size_t j = 0; j < len; j++) {
-	//			float angle = -2.0f * M_PI * static_cast<float>(i * j) * invLen;
-	//			output[i] += input[j] * cosf(angle);
-	//		}
-	//	}
-	//}
-
-	//// 2D Discrete Fourier Transform
-	//void dft(size_t x, size_t y, Complex* output, const Complex* input) {
-	//	const float invLen = 1.0f / static_cast<float>(len);
-
-	//	for (size_t i = 0; i < len; i++) {
-	//		output[i] = 0;
-
-	//		for (size_t j = 0; j < len; j++) {
-	//			float angle = -2.0f * M_PI * static_cast<float>(i * j) * invLen;
-	//			Complex twiddleFactor(cosf(angle), sinf(angle));
-	//			output[i] += input[j] * twiddleFactor;
-	//		}
-	//	}
-	//}
-
-	template <typename T> requires std::is_integral_v<T>
-	static inline bool is_power_of_2(T val) {
-		return (val >= 0) && (0 == (val & (val - 1)));
-	}
+		transpose(x, y, transposed, scratch);
 
-	template <typename T> requires std::is_integral_v<T>
-	static inline int log2i(T val) {
-		if (val <= 0) return 0;
-		return std::bit_width(val) - 1;
-	}
+		// Vertical Pass
+		pool.parallel_for(x, [&](size_t begin, size_t end) {
+			for (size_t ix = begin; ix < end; ix++)
+				transform(y, &scratch[ix * y], &transposed[ix * y]);
+		}, PARALLEL_MIN_ELEMENTS / (y * y) + 1);
 
-	template <typename T> requires std::is_integral_v<T>
-	static inline T pow2i(T val) {
-		if (val < 0) return 0;
-		if (val == 0) return 1;
+		transpose(y, x, output, scratch);
 
-		return 1 << val;
+		free(scratch);
 	}
 
-	// TODO: need to implement this
-	void fst(size_t len, float* output, const float* input) {
-		int iterations = log2i(len);
-		if (iterations < 0) return;
-
-		float invLen = 1.0f / static_cast<float>(len);
-
-		for (size_t i = 0; i < len; i++) {
-			for (size_t j = 0; j < iterations; j++) {
-
-			}
-		}
+	// 2D Discrete Fourier Transform
+	void dft(size_t x, size_t y, Complex* output, const Complex* input) {
+		separable_2d(x, y, output, input, [](size_t len, Complex* out, const Complex* in) { dft(len, out, in); });
 	}
-}
\ No newline at end of file
+}
@@ -1,5 +1,16 @@
 #pragma once
 
+#include <stddef.h> // for size_t
+#include <stdint.h>
+
+#include <type_traits>
+#include <bit>
+
+// SSE2 is part of x64, so the kernels that use it are picked at compile time without a runtime check
+#if defined(__SSE2__) || defined(_M_X64)
+#define SMATH_SSE2
+#endif
+
 template <typename T = float>
 union Vector3 {
 private:
@@ -21,7 +32,8 @@ public:
 };
 
 struct Matrix4 {
-	// column-major: m[col * 4 + row]
+	// column-major: m[col * 4 + row], so m can go straight to glUniformMatrix4fv without transposing
+	// transforms act on column vectors, A * B applies B first
 	float m[16];
 
 	// constructors
@@ -144,6 +156,22 @@ private:
 	float data[2];
 };
 
+// split-complex buffer, the real and imaginary parts live in separate arrays so that SIMD code can load
+// 8 (AVX2) of either with one instruction, instead of deinterleaving Complex pairs
+// both arrays are 64 byte aligned
+struct SplitComplex {
+	float* re = nullptr;
+	float* im = nullptr;
+	size_t len = 0;
+
+	void init(size_t len);
+	void clean();
+
+	// values has to hold len elements
+	void from_interleaved(const Complex* values);
+	void to_interleaved(Complex* values) const;
+};
+
 namespace smath {
 	static constexpr float pi = 3.1415926535f;
 	static constexpr float tau = pi * 2.0f;
@@ -151,18 +179,286 @@ namespace smath {
 	void init();
 	void cleanup();
 
-	// 1D versions
-	void dst(size_t len, float* output, const float* input);
-	void dct(size_t len, float* output, const float* input);
-	void dft(size_t len, Complex* output, const Complex* input);
+	// input has y rows of x elements, output gets x rows of y elements
+	// they can't overlap
+	void transpose(size_t x, size_t y, float* output, const float* input);
+	void transpose(size_t x, size_t y, Complex* output, const Complex* input);
 
-	// 2D versions O(n^4) time (super duper terrible)
-	void dst(size_t x, size_t y, float* output, const float* input);
-	void dct(size_t x, size_t y, float* output, const float* input);
+	// same, but always on the calling thread, for use inside a ThreadPool job (which can't wake the pool again)
+	void transpose_serial(size_t x, size_t y, float* output, const float* input);
+	void transpose_serial(size_t x, size_t y, Complex* output, const Complex* input);
+
+	template <typename T> requires std::is_integral_v<T>
+	inline bool is_power_of_2(T val) {
+		return (val >= 0) && (0 == (val & (val - 1)));
+	}
+
+	template <typename T> requires std::is_integral_v<T>
+	inline int log2i(T val) {
+		if (val <= 0) return 0;
+		return std::bit_width(static_cast<std::make_unsigned_t<T>>(val)) - 1;
+	}
+
+	template <typename T> requires std::is_integral_v<T>
+	inline T pow2i(T val) {
+		if (val < 0) return 0;
+		if (val == 0) return 1;
+
+		return static_cast<T>(1) << val;
+	}
+
+	// direct O(n^2) DFT, mostly useful for checking the FFTs against
+	void dft(size_t len, Complex* output, const Complex* input);
 	void dft(size_t x, size_t y, Complex* output, const Complex* input);
 	
-	// cooley-tukey algorithm
-	void fst(size_t len, float* output, const float* input);
-	//void fct(size_t len, float* output, const float* input);
+	// precomputed twiddles and tables for transforms of one size
+	// executing a plan doesn't allocate (past a per-thread scratch buffer that only grows), so create
+	// it once and reuse it every frame
+	//
+	// powers of 2 use iterative radix-4, sizes made of 2, 3, 5 and 7 use a recursive mixed radix
+	// cooley-tukey, and anything with a bigger prime factor goes through bluestein's algorithm, which
+	// turns it into a convolution done with power of 2 FFTs
+	class FFTPlan {
+	public:
+		enum class Algorithm {
+			None, // invalid size
+			Radix4,
+			MixedRadix,
+			Bluestein,
+		};
+
+	private:
+		size_t len = 0;
+		Algorithm algorithm = Algorithm::None;
+
+		// radix-4
+		bool oddStage = false; // log2(len) is odd, so there's one radix-2 stage before the radix-4 ones
+		uint32_t* bitReverse = nullptr;
+		Complex* twiddles = nullptr; // w, w^2 and w^3 arrays for every radix-4 stage, or e^(-2 pi i k / len) for mixed radix
+		float* splitTwiddles = nullptr; // the radix-4 twiddles again, as (w re, w im, w^2 re, w^2 im, w^3 re, w^3 im) arrays per stage
+
+		// mixed radix, (radix, remaining length) pairs from the outermost stage in
+		static constexpr int MAX_FACTORS = 32;
+		size_t factors[MAX_FACTORS * 2] = {};
+
+		// bluestein
+		const FFTPlan* convolution = nullptr; // power of 2, at least 2 * len - 1
+		Complex* chirp = nullptr; // e^(-i pi k^2 / len)
+		Complex* chirpSpectrum = nullptr; // FFT of the conjugated chirp, wrapped around to the convolution length
+
+		void init_radix4();
+		bool init_mixed(); // false when len has a prime factor above 7
+		void init_bluestein();
+
+		template <bool Inverse>
+		void execute_radix4(Complex* output, const Complex* input) const;
+		template <bool Inverse>
+		void execute_mixed(Complex* output, const Complex* input) const;
+		template <bool Inverse>
+		void execute_bluestein(Complex* output, const Complex* input) const;
+
+		template <bool Inverse>
+		void execute(Complex* output, const Complex* input) const;
+
+		template <bool Inverse>
+		void execute_split(SplitComplex& output, const SplitComplex& input) const;
+
+	public:
+		explicit FFTPlan(size_t len);
+		~FFTPlan();
+
+		FFTPlan(const FFTPlan&) = delete;
+		FFTPlan& operator=(const FFTPlan&) = delete;
+
+		size_t size() const { return len; }
+		Algorithm get_algorithm() const { return algorithm; }
+
+		// output and input can be the same array
+		// the inverse is scaled by 1/len, so inverse(forward(x)) == x
+		void forward(Complex* output, const Complex* input) const;
+		void inverse(Complex* output, const Complex* input) const;
+
+		// split-complex versions, power of 2 sizes run SIMD butterflies on the split arrays directly
+		// other sizes go through an interleaved copy, so they're only here for convenience
+		// with the AVX2 kernel dispatched at runtime, bench_fft has them about 1.1x faster than the interleaved
+		// transform for 256 to 4096 points, even at 16384 and 0.85x to 0.95x past that (one core, best of 5),
+		// and never faster once converting to and from Complex is counted, so they only pay off for data
+		// that stays split
+		void forward(SplitComplex& output, const SplitComplex& input) const;
+		void inverse(SplitComplex& output, const SplitComplex& input) const;
+	};
+
+	// the instruction set the split-complex butterflies run with on this CPU
+	const char* simd_name();
+
+	// times interleaved and split-complex transforms over a range of sizes and prints a table
+	void bench_fft();
+
+	// the smallest size >= minimum with no prime factors above 5, those take the fastest mixed radix butterflies
+	size_t fft_good_size(size_t minimum);
+
+	// returns a cached plan for this size, creating it the first time
+	const FFTPlan& fft_plan(size_t len);
+
+	// 2D transforms, row-major with x elements per row
+	// the rows are transformed, the matrix is transposed into scratch so the columns can be
+	// transformed as contiguous rows too, and then it's transposed back
+	// the scratch belongs to the calling thread (like FFTPlan's), so different threads can run the same
+	// plan at once, they just take turns on the thread pool
+	//
+	// speed: the goal was a few ms for a 1024x1024 transform, with near linear scaling up to 8 cores from 512^2
+	// on, but only single core numbers have been measured so far (best of 7, AVX2 machine, one core):
+	//   forward, complex: 3.2 ms at 512^2, 22.5 ms at 1024^2, 92.5 ms at 2048^2
+	//   forward, real (RealFFTPlan2D): 1.8 ms, 12.2 ms and 48.1 ms
+	// so one core is nowhere near a few ms at 1024^2. the rows and columns are split across the pool, but
+	// how well that scales, and whether 8 cores get 1024^2 down to a few ms, hasn't been measured
+	class FFTPlan2D {
+		size_t x = 0, y = 0;
+		const FFTPlan* rows = nullptr;
+		const FFTPlan* columns = nullptr;
+
+		template <bool Inverse>
+		void execute(Complex* output, const Complex* input) const;
+
+	public:
+		FFTPlan2D(size_t x, size_t y);
+
+		FFTPlan2D(const FFTPlan2D&) = delete;
+		FFTPlan2D& operator=(const FFTPlan2D&) = delete;
+
+		// output and input can be the same array
+		// these run on the shared thread pool, so they can't be called from inside one of its jobs
+		void forward(Complex* output, const Complex* input) const;
+		void inverse(Complex* output, const Complex* input) const;
+	};
+
+	// real input transforms, done as a complex transform of half the length (or the full length when
+	// len is odd)
+	// the output is hermitian packed, only bins 0 to len/2 (inclusive) are stored since the rest are
+	// their complex conjugates
+	class RealFFTPlan {
+		size_t len = 0;
+		const FFTPlan* half = nullptr;
+		const FFTPlan* full = nullptr; // only for odd lengths
+		Complex* twiddles = nullptr; // e^(-2 pi i k / len) for k < len/2
+
+	public:
+		explicit RealFFTPlan(size_t len);
+		~RealFFTPlan();
+
+		RealFFTPlan(const RealFFTPlan&) = delete;
+		RealFFTPlan& operator=(const RealFFTPlan&) = delete;
+
+		size_t size() const { return len; }
+		size_t complex_size() const { return len / 2 + 1; }
+
+		// output holds len/2 + 1 values, input holds len values (and vice versa for the inverse)
+		// the inverse is scaled by 1/len
+		void forward(Complex* output, const float* input) const;
+		void inverse(float* output, const Complex* input) const;
+	};
+
+	// 2D real transforms, the spectrum is y rows of (x/2 + 1) values
+	// row i of the spectrum is ky = i (wrapping to negative past y/2), column j is kx = j
+	// scratch is per thread, same as FFTPlan2D
+	class RealFFTPlan2D {
+		size_t x = 0, y = 0;
+		const RealFFTPlan* rows = nullptr;
+		const FFTPlan* columns = nullptr;
+
+	public:
+		RealFFTPlan2D(size_t x, size_t y);
+
+		RealFFTPlan2D(const RealFFTPlan2D&) = delete;
+		RealFFTPlan2D& operator=(const RealFFTPlan2D&) = delete;
+
+		size_t complex_width() const { return x / 2 + 1; }
+
+		// these run on the shared thread pool, so they can't be called from inside one of its jobs
+		void forward(Complex* output, const float* input) const;
+		void inverse(float* output, const Complex* input) const;
+	};
+
+	const RealFFTPlan& rfft_plan(size_t len);
+
+	// sine and cosine transforms, for fields with walls instead of periodic edges
+	//   DCT  (DCT-II)  X[k] = 2 sum x[n] cos(pi k (2n + 1) / 2N), even symmetric around the edges (reflecting walls)
+	//   DST  (DST-II)  X[k] = 2 sum x[n] sin(pi (k + 1)(2n + 1) / 2N), odd symmetric around the edges
+	//   DST1 (DST-I)   X[k] = 2 sum x[n] sin(pi (k + 1)(n + 1) / (N + 1)), zero just outside the edges (fixed walls)
+	// the inverses are DCT-III, DST-III and DST-I again, scaled so that they undo the forward ones exactly
+	enum class TrigType {
+		DCT, IDCT,
+		DST, IDST,
+		DST1, IDST1,
+	};
+
+	// the DCT/DST run through a real FFT of length len, and DST-I through one of length 2(len + 1)
+	class TrigPlan {
+		size_t len = 0;
+		TrigType type = TrigType::DCT;
+		const RealFFTPlan* fft = nullptr;
+		Complex* twiddles = nullptr; // e^(-i pi k / 2len), only for the DCT/DST
+
+	public:
+		TrigPlan(size_t len, TrigType type);
+		~TrigPlan();
+
+		TrigPlan(const TrigPlan&) = delete;
+		TrigPlan& operator=(const TrigPlan&) = delete;
+
+		size_t size() const { return len; }
+
+		// how many Complex values of scratch execute needs
+		size_t scratch_size() const;
+
+		// output and input can be the same array
+		void execute(float* output, const float* input, Complex* scratch) const;
+	};
+
+	const TrigPlan& trig_plan(size_t len, TrigType type);
+
+	// frees every cached plan, nothing returned by the *_plan functions can be used after this
+	void release_plans();
+
+	// these go through fft_plan, so any len works, but sizes with only 2, 3, 5 and 7 as factors are the fastest
 	void fft(size_t len, Complex* output, const Complex* input);
+	void ifft(size_t len, Complex* output, const Complex* input);
+
+	// 2D versions, row-major with x elements per row
+	void fft(size_t x, size_t y, Complex* output, const Complex* input);
+	void ifft(size_t x, size_t y, Complex* output, const Complex* input);
+
+	// real input versions, see RealFFTPlan/RealFFTPlan2D for the layout
+	void rfft(size_t len, Complex* output, const float* input);
+	void irfft(size_t len, float* output, const Complex* input);
+	void rfft(size_t x, size_t y, Complex* output, const float* input);
+	void irfft(size_t x, size_t y, float* output, const Complex* input);
+
+	// batched versions, for lots of small transforms of the same size (like one per pond)
+	// the count transforms are stored back to back, len (or x * y) elements apart, and the real 2D
+	// spectra (x/2 + 1) * y apart
+	// each transform runs start to finish on one thread, so its transposes stay in cache and the pool is only
+	// woken once per call instead of four times per transform
+	void fft_batch(size_t len, size_t count, Complex* output, const Complex* input);
+	void ifft_batch(size_t len, size_t count, Complex* output, const Complex* input);
+	void fft_batch(size_t x, size_t y, size_t count, Complex* output, const Complex* input);
+	void ifft_batch(size_t x, size_t y, size_t count, Complex* output, const Complex* input);
+	void rfft_batch(size_t x, size_t y, size_t count, Complex* output, const float* input);
+	void irfft_batch(size_t x, size_t y, size_t count, float* output, const Complex* input);
+
+	// sine and cosine transforms, see TrigType for the definitions
+	void dct(size_t len, float* output, const float* input);
+	void idct(size_t len, float* output, const float* input);
+	void dst(size_t len, float* output, const float* input);
+	void idst(size_t len, float* output, const float* input);
+	void dst1(size_t len, float* output, const float* input);
+	void idst1(size_t len, float* output, const float* input);
+
+	// 2D versions, the same transform along both axes
+	void dct(size_t x, size_t y, float* output, const float* input);
+	void idct(size_t x, size_t y, float* output, const float* input);
+	void dst(size_t x, size_t y, float* output, const float* input);
+	void idst(size_t x, size_t y, float* output, const float* input);
+	void dst1(size_t x, size_t y, float* output, const float* input);
+	void idst1(size_t x, size_t y, float* output, const float* input);
 }
\ No newline at end of file
@@ -0,0 +1,154 @@
+#include "smath.h"
+
+#include <stdlib.h>
+
+#include "thread_pool.h"
+
+//
+// batched transforms
+// the regular 2D transforms split each pass across the thread pool, which is the right call for one
+// big grid but means four pool wakeups (and four trips through memory) per transform
+// with many small grids it's cheaper to hand out whole transforms instead, a 64x64 grid and its
+// scratch fit in L1/L2, so every pass after the first one runs out of cache
+//
+namespace smath {
+	// waking the thread pool costs more than it saves unless each thread gets about this many elements
+	static constexpr size_t PARALLEL_MIN_ELEMENTS = 1 << 14;
+
+	// transforms per thread for transforms of this many elements
+	static size_t grain_for(size_t elements) {
+		return PARALLEL_MIN_ELEMENTS / elements + 1;
+	}
+
+	template <bool Inverse>
+	static void fft_batch_1d(size_t len, size_t count, Complex* output, const Complex* input) {
+		if (len == 0) return;
+		const FFTPlan& plan = fft_plan(len);
+
+		ThreadPool::shared().parallel_for(count, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				if constexpr (Inverse)
+					plan.inverse(&output[i * len], &input[i * len]);
+				else
+					plan.forward(&output[i * len], &input[i * len]);
+			}
+		}, grain_for(len));
+	}
+
+	// the same steps as FFTPlan2D, rows, transpose, rows, transpose back, but all on one thread
+	template <bool Inverse>
+	static void fft_batch_2d(size_t x, size_t y, size_t count, Complex* output, const Complex* input) {
+		if (x == 0 || y == 0) return;
+		const FFTPlan& rows = fft_plan(x);
+		const FFTPlan& columns = fft_plan(y);
+		const size_t size = x * y;
+
+		ThreadPool::shared().parallel_for(count, [&](size_t begin, size_t end) {
+			Complex* scratch = static_cast<Complex*>(malloc(sizeof(Complex) * size));
+			if (!scratch) return;
+
+			for (size_t i = begin; i < end; i++) {
+				Complex* out = &output[i * size];
+				const Complex* in = &input[i * size];
+
+				for (size_t iy = 0; iy < y; iy++) {
+					if constexpr (Inverse)
+						rows.inverse(&out[iy * x], &in[iy * x]);
+					else
+						rows.forward(&out[iy * x], &in[iy * x]);
+				}
+
+				transpose_serial(x, y, scratch, out);
+
+				for (size_t ix = 0; ix < x; ix++) {
+					if constexpr (Inverse)
+						columns.inverse(&scratch[ix * y], &scratch[ix * y]);
+					else
+						columns.forward(&scratch[ix * y], &scratch[ix * y]);
+				}
+
+				transpose_serial(y, x, out, scratch);
+			}
+
+			free(scratch);
+		}, grain_for(size));
+	}
+
+	void fft_batch(size_t len, size_t count, Complex* output, const Complex* input) {
+		fft_batch_1d<false>(len, count, output, input);
+	}
+
+	void ifft_batch(size_t len, size_t count, Complex* output, const Complex* input) {
+		fft_batch_1d<true>(len, count, output, input);
+	}
+
+	void fft_batch(size_t x, size_t y, size_t count, Complex* output, const Complex* input) {
+		fft_batch_2d<false>(x, y, count, output, input);
+	}
+
+	void ifft_batch(size_t x, size_t y, size_t count, Complex* output, const Complex* input) {
+		fft_batch_2d<true>(x, y, count, output, input);
+	}
+
+	// same layout as RealFFTPlan2D
+	void rfft_batch(size_t x, size_t y, size_t count, Complex* output, const float* input) {
+		if (x == 0 || y == 0) return;
+		const RealFFTPlan& rows = rfft_plan(x);
+		const FFTPlan& columns = fft_plan(y);
+		const size_t cx = rows.complex_size();
+
+		ThreadPool::shared().parallel_for(count, [&](size_t begin, size_t end) {
+			Complex* scratch = static_cast<Complex*>(malloc(sizeof(Complex) * cx * y));
+			if (!scratch) return;
+
+			for (size_t i = begin; i < end; i++) {
+				Complex* out = &output[i * cx * y];
+				const float* in = &input[i * x * y];
+
+				for (size_t iy = 0; iy < y; iy++)
+					rows.forward(&out[iy * cx], &in[iy * x]);
+
+				transpose_serial(cx, y, scratch, out);
+
+				for (size_t ix = 0; ix < cx; ix++)
+					columns.forward(&scratch[ix * y], &scratch[ix * y]);
+
+				transpose_serial(y, cx, out, scratch);
+			}
+
+			free(scratch);
+		}, grain_for(x * y));
+	}
+
+	// the input is left alone, so this needs room for two spectra
+	void irfft_batch(size_t x, size_t y, size_t count, float* output, const Complex* input) {
+		if (x == 0 || y == 0) return;
+		const RealFFTPlan& rows = rfft_plan(x);
+		const FFTPlan& columns = fft_plan(y);
+		const size_t cx = rows.complex_size();
+
+		ThreadPool::shared().parallel_for(count, [&](size_t begin, size_t end) {
+			Complex* scratch = static_cast<Complex*>(malloc(sizeof(Complex) * cx * y * 2));
+			if (!scratch) return;
+
+			Complex* spectrum = scratch + (cx * y);
+
+			for (size_t i = begin; i < end; i++) {
+				float* out = &output[i * x * y];
+				const Complex* in = &input[i * cx * y];
+
+				transpose_serial(cx, y, scratch, in);
+
+				for (size_t ix = 0; ix < cx; ix++)
+					columns.inverse(&scratch[ix * y], &scratch[ix * y]);
+
+				transpose_serial(y, cx, spectrum, scratch);
+
+				for (size_t iy = 0; iy < y; iy++)
+					rows.inverse(&out[iy * x], &spectrum[iy * cx]);
+			}
+
+			free(scratch);
+		}, grain_for(x * y));
+	}
+}
@@ -0,0 +1,125 @@
+#include "smath.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+
+// run with --bench-fft
+namespace smath {
+	// runs fn enough times to take about 50ms and returns the average in microseconds
+	template <typename Fn>
+	static double time_us(Fn fn) {
+		using Clock = std::chrono::high_resolution_clock;
+
+		fn(); // warm up the plan cache and the data
+
+		int iterations = 1;
+		while (true) {
+			auto start = Clock::now();
+			for (int i = 0; i < iterations; i++)
+				fn();
+			double elapsed = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+
+			if (elapsed > 50000.0 || iterations >= (1 << 20))
+				return elapsed / static_cast<double>(iterations);
+
+			iterations *= 2;
+		}
+	}
+
+	void bench_fft() {
+		printf("FFT benchmark, split-complex butterflies use %s\n", simd_name());
+		printf("%8s %14s %14s %9s %14s\n", "size", "interleaved", "split", "speedup", "split + conv");
+
+		for (size_t len = 16; len <= (1 << 20); len *= 4) {
+			const FFTPlan& plan = fft_plan(len);
+
+			Complex* interleaved = static_cast<Complex*>(malloc(sizeof(Complex) * len));
+			if (!interleaved) return;
+
+			for (size_t i = 0; i < len; i++)
+				interleaved[i] = Complex(static_cast<float>(rand()) / RAND_MAX, static_cast<float>(rand()) / RAND_MAX);
+
+			SplitComplex split;
+			split.init(len);
+			split.from_interleaved(interleaved);
+
+			// forward + inverse so the values stay bounded
+			double interleavedTime = time_us([&] {
+				plan.forward(interleaved, interleaved);
+				plan.inverse(interleaved, interleaved);
+			});
+
+			double splitTime = time_us([&] {
+				plan.forward(split, split);
+				plan.inverse(split, split);
+			});
+
+			// what a caller holding interleaved data would see
+			double convertedTime = time_us([&] {
+				split.from_interleaved(interleaved);
+				plan.forward(split, split);
+				plan.inverse(split, split);
+				split.to_interleaved(interleaved);
+			});
+
+			printf("%8zu %12.2fus %12.2fus %8.2fx %12.2fus\n", len, interleavedTime, splitTime,
+				interleavedTime / splitTime, convertedTime);
+
+			split.clean();
+			free(interleaved);
+		}
+
+		// the same number of elements either as one big grid or as a batch of small ones
+		printf("\n%16s %14s %14s\n", "2D", "complex", "real");
+
+		struct Shape { size_t x, y, count; };
+		static constexpr Shape shapes[] = { { 1024, 1024, 1 }, { 64, 64, 256 }, { 32, 32, 1024 } };
+
+		for (const Shape& shape : shapes) {
+			const size_t size = shape.x * shape.y * shape.count;
+
+			Complex* values = static_cast<Complex*>(malloc(sizeof(Complex) * size));
+			float* heights = static_cast<float*>(malloc(sizeof(float) * size));
+			if (!values || !heights) {
+				free(values);
+				free(heights);
+				return;
+			}
+
+			for (size_t i = 0; i < size; i++) {
+				heights[i] = static_cast<float>(rand()) / RAND_MAX;
+				values[i] = Complex(heights[i], 0.0f);
+			}
+
+			double complexTime = time_us([&] {
+				if (shape.count == 1) {
+					fft(shape.x, shape.y, values, values);
+					ifft(shape.x, shape.y, values, values);
+				} else {
+					fft_batch(shape.x, shape.y, shape.count, values, values);
+					ifft_batch(shape.x, shape.y, shape.count, values, values);
+				}
+			});
+
+			// the spectra take less room than the complex values, so they can reuse that buffer
+			double realTime = time_us([&] {
+				if (shape.count == 1) {
+					rfft(shape.x, shape.y, values, heights);
+					irfft(shape.x, shape.y, heights, values);
+				} else {
+					rfft_batch(shape.x, shape.y, shape.count, values, heights);
+					irfft_batch(shape.x, shape.y, shape.count, heights, values);
+				}
+			});
+
+			char name[32];
+			snprintf(name, sizeof(name), "%zux%zu x%zu", shape.x, shape.y, shape.count);
+			printf("%16s %12.2fus %12.2fus\n", name, complexTime, realTime);
+
+			free(values);
+			free(heights);
+		}
+	}
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stddef.h> // for size_t
+
+// the split-complex radix-4 butterfly, shared by smath_split.cpp and smath_split_avx2.cpp
+// those two are built for different instruction sets, so everything in here has internal linkage, otherwise
+// the linker could keep the AVX2 copy of a function and hand it to code that runs on any CPU
+namespace smath {
+	namespace {
+		struct ScalarLanes {
+			using V = float;
+			static constexpr size_t LANES = 1;
+
+			static V load(const float* p) { return *p; }
+			static void store(float* p, V v) { *p = v; }
+			static V add(V a, V b) { return a + b; }
+			static V sub(V a, V b) { return a - b; }
+			static V mul(V a, V b) { return a * b; }
+		};
+
+		// one radix-4 butterfly (or LANES of them) at j within the block at start
+		// twiddles points at this stage's (w re, w im, w^2 re, w^2 im, w^3 re, w^3 im) arrays, each h long
+		template <typename L, bool Inverse>
+		inline void radix4_butterfly(float* re, float* im, size_t start, size_t j, size_t h, const float* twiddles) {
+			using V = typename L::V;
+
+			const size_t i0 = start + j;
+			const size_t i1 = i0 + h;
+			const size_t i2 = i1 + h;
+			const size_t i3 = i2 + h;
+
+			V w1r = L::load(&twiddles[j]);
+			V w1i = L::load(&twiddles[h + j]);
+			V w2r = L::load(&twiddles[(h * 2) + j]);
+			V w2i = L::load(&twiddles[(h * 3) + j]);
+			V w3r = L::load(&twiddles[(h * 4) + j]);
+			V w3i = L::load(&twiddles[(h * 5) + j]);
+
+			// x * w, or x * conj(w) for the inverse
+			auto twiddle = [](V xr, V xi, V wr, V wi, V& outR, V& outI) {
+				if constexpr (Inverse) {
+					outR = L::add(L::mul(xr, wr), L::mul(xi, wi));
+					outI = L::sub(L::mul(xi, wr), L::mul(xr, wi));
+				} else {
+					outR = L::sub(L::mul(xr, wr), L::mul(xi, wi));
+					outI = L::add(L::mul(xr, wi), L::mul(xi, wr));
+				}
+			};
+
+			V t0r = L::load(&re[i0]), t0i = L::load(&im[i0]);
+			V t1r, t1i, t2r, t2i, t3r, t3i;
+			twiddle(L::load(&re[i1]), L::load(&im[i1]), w2r, w2i, t1r, t1i);
+			twiddle(L::load(&re[i2]), L::load(&im[i2]), w1r, w1i, t2r, t2i);
+			twiddle(L::load(&re[i3]), L::load(&im[i3]), w3r, w3i, t3r, t3i);
+
+			V ar = L::add(t0r, t1r), ai = L::add(t0i, t1i);
+			V br = L::sub(t0r, t1r), bi = L::sub(t0i, t1i);
+			V cr = L::add(t2r, t3r), ci = L::add(t2i, t3i);
+			V dr = L::sub(t2r, t3r), di = L::sub(t2i, t3i);
+
+			// x1 = b + rd, x3 = b - rd, with d rotated by -i (forward) or +i (inverse)
+			L::store(&re[i0], L::add(ar, cr));
+			L::store(&im[i0], L::add(ai, ci));
+			if constexpr (Inverse) {
+				L::store(&re[i1], L::sub(br, di));
+				L::store(&im[i1], L::add(bi, dr));
+				L::store(&re[i3], L::add(br, di));
+				L::store(&im[i3], L::sub(bi, dr));
+			} else {
+				L::store(&re[i1], L::add(br, di));
+				L::store(&im[i1], L::sub(bi, dr));
+				L::store(&re[i3], L::sub(br, di));
+				L::store(&im[i3], L::add(bi, dr));
+			}
+			L::store(&re[i2], L::sub(ar, cr));
+			L::store(&im[i2], L::sub(ai, ci));
+		}
+
+		// every radix-4 stage from quarter length h up, stages with fewer than LANES butterflies per block
+		// (the first one or two) fall back to scalar
+		template <typename L, bool Inverse>
+		inline void radix4_stages(float* re, float* im, size_t len, size_t h, const float* twiddles) {
+			for (; h < len; h *= 4) {
+				for (size_t start = 0; start < len; start += h * 4) {
+					if (h >= L::LANES) {
+						for (size_t j = 0; j < h; j += L::LANES)
+							radix4_butterfly<L, Inverse>(re, im, start, j, h, twiddles);
+					} else {
+						for (size_t j = 0; j < h; j++)
+							radix4_butterfly<ScalarLanes, Inverse>(re, im, start, j, h, twiddles);
+					}
+				}
+
+				twiddles += h * 6;
+			}
+		}
+	}
+}
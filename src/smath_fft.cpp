@@ -0,0 +1,1067 @@
+#include "smath.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "thread_pool.h"
+
+#if defined(SMATH_SSE2)
+#include <emmintrin.h>
+#endif
+
+//
+// FFT plans
+// powers of 2 use iterative decimation-in-time cooley-tukey. the input gets bit reversed, then it's
+// combined with radix-4 butterflies (plus one radix-2 stage first when log2(len) is odd)
+// other sizes are split into radix 4, 2, 3, 5 and 7 stages recursively, or go through bluestein
+//
+namespace smath {
+	// every plan cache shares one lock, plans are only created on first use so it's rarely contended
+	// it's recursive since the 2D plans get their 1D plans while it's held
+	static std::recursive_mutex planMutex;
+	static std::unordered_map<size_t, std::unique_ptr<FFTPlan>> plans;
+	static std::unordered_map<uint64_t, std::unique_ptr<FFTPlan2D>> plans2D;
+	static std::unordered_map<size_t, std::unique_ptr<RealFFTPlan>> realPlans;
+	static std::unordered_map<uint64_t, std::unique_ptr<RealFFTPlan2D>> realPlans2D;
+	static std::unordered_map<uint64_t, std::unique_ptr<TrigPlan>> trigPlans;
+
+	static constexpr double PI_D = 3.14159265358979323846;
+
+	// scratch for plans that can't work in place, the plans are shared between threads so they can't own it
+	// the complex plans, the real ones and the 2D ones each get a slot, since a real plan runs a complex one
+	// on its own scratch and a 2D plan's calling thread also runs a share of the rows
+	static constexpr int SCRATCH_1D = 0, SCRATCH_REAL = 1, SCRATCH_2D = 2;
+
+	struct ThreadScratch {
+		Complex* buffers[3] = {};
+		size_t sizes[3] = {};
+
+		void release() {
+			for (int i = 0; i < 3; i++) {
+				free(buffers[i]);
+				buffers[i] = nullptr;
+				sizes[i] = 0;
+			}
+		}
+
+		~ThreadScratch() {
+			release();
+		}
+	};
+
+	static thread_local ThreadScratch threadScratch;
+
+	static Complex* thread_scratch(int slot, size_t count) {
+		ThreadScratch& scratch = threadScratch;
+		if (scratch.sizes[slot] < count) {
+			free(scratch.buffers[slot]);
+			scratch.buffers[slot] = static_cast<Complex*>(malloc(sizeof(Complex) * count));
+			scratch.sizes[slot] = scratch.buffers[slot] ? count : 0;
+		}
+
+		return scratch.buffers[slot];
+	}
+
+	FFTPlan::FFTPlan(size_t length) {
+		if (length == 0) return;
+
+		len = length;
+
+		if (is_power_of_2(len))
+			init_radix4();
+		else if (!init_mixed())
+			init_bluestein();
+	}
+
+	void FFTPlan::init_radix4() {
+		algorithm = Algorithm::Radix4;
+
+		const int bits = log2i(len);
+		oddStage = (bits % 2) == 1;
+
+		bitReverse = static_cast<uint32_t*>(malloc(sizeof(uint32_t) * len));
+		for (size_t i = 0; i < len; i++) {
+			uint32_t reversed = 0;
+			size_t val = i;
+			for (int b = 0; b < bits; b++) {
+				reversed = (reversed << 1) | static_cast<uint32_t>(val & 1);
+				val >>= 1;
+			}
+
+			bitReverse[i] = reversed;
+		}
+
+		// each radix-4 stage with quarter length h needs h each of w, w^2 and w^3, where w = e^(-2 pi i j / 4h)
+		// they're stored as three arrays per stage so that consecutive butterflies read consecutive twiddles
+		size_t twiddleCount = 0;
+		for (size_t h = oddStage ? 2 : 1; h < len; h *= 4)
+			twiddleCount += h * 3;
+
+		twiddles = static_cast<Complex*>(malloc(sizeof(Complex) * (twiddleCount > 0 ? twiddleCount : 1)));
+
+		// computed in double so that the error doesn't grow with the stage count
+		Complex* w = twiddles;
+		for (size_t h = oddStage ? 2 : 1; h < len; h *= 4) {
+			for (size_t j = 0; j < h; j++) {
+				double angle = -2.0 * PI_D * static_cast<double>(j) / static_cast<double>(h * 4);
+				for (int m = 1; m <= 3; m++) {
+					w[(h * (m - 1)) + j] = Complex(static_cast<float>(cos(angle * m)), static_cast<float>(sin(angle * m)));
+				}
+			}
+
+			w += h * 3;
+		}
+
+		// the same values split into arrays for the split-complex path
+		splitTwiddles = static_cast<float*>(malloc(sizeof(float) * 2 * (twiddleCount > 0 ? twiddleCount : 1)));
+		w = twiddles;
+		float* split = splitTwiddles;
+		for (size_t h = oddStage ? 2 : 1; h < len; h *= 4) {
+			for (size_t j = 0; j < h; j++) {
+				for (int m = 0; m < 3; m++) {
+					split[(h * m * 2) + j] = w[(h * m) + j].re;
+					split[(h * m * 2) + h + j] = w[(h * m) + j].im;
+				}
+			}
+
+			w += h * 3;
+			split += h * 6;
+		}
+	}
+
+	bool FFTPlan::init_mixed() {
+		static constexpr size_t radices[] = { 4, 2, 3, 5, 7 };
+
+		size_t remaining = len;
+		int count = 0;
+		for (size_t radix : radices) {
+			while (remaining % radix == 0 && count < MAX_FACTORS) {
+				remaining /= radix;
+				factors[count * 2] = radix;
+				factors[count * 2 + 1] = remaining;
+				count++;
+			}
+		}
+
+		if (remaining != 1) return false;
+
+		algorithm = Algorithm::MixedRadix;
+
+		twiddles = static_cast<Complex*>(malloc(sizeof(Complex) * len));
+		for (size_t k = 0; k < len; k++) {
+			double angle = -2.0 * PI_D * static_cast<double>(k) / static_cast<double>(len);
+			twiddles[k] = Complex(static_cast<float>(cos(angle)), static_cast<float>(sin(angle)));
+		}
+
+		return true;
+	}
+
+	// X[k] = conj(c[k]) sum x[n] c[n] conj(c[k - n]) where c[n] = e^(i pi n^2 / len), since 2nk = n^2 + k^2 - (k - n)^2
+	// that sum is a convolution, done with FFTs of a power of 2 length that's big enough to not wrap
+	void FFTPlan::init_bluestein() {
+		algorithm = Algorithm::Bluestein;
+
+		const size_t convolutionLen = std::bit_ceil(len * 2 - 1);
+		convolution = &fft_plan(convolutionLen);
+
+		// n^2 is taken mod 2 len first so the angle stays accurate for big n
+		chirp = static_cast<Complex*>(malloc(sizeof(Complex) * len));
+		for (size_t k = 0; k < len; k++) {
+			uint64_t square = (static_cast<uint64_t>(k) * k) % (static_cast<uint64_t>(len) * 2);
+			double angle = -PI_D * static_cast<double>(square) / static_cast<double>(len);
+			chirp[k] = Complex(static_cast<float>(cos(angle)), static_cast<float>(sin(angle)));
+		}
+
+		chirpSpectrum = static_cast<Complex*>(malloc(sizeof(Complex) * convolutionLen));
+		for (size_t k = 0; k < convolutionLen; k++)
+			chirpSpectrum[k] = Complex(0.0f, 0.0f);
+
+		for (size_t k = 0; k < len; k++) {
+			Complex c(chirp[k].re, -chirp[k].im);
+			chirpSpectrum[k] = c;
+			if (k != 0)
+				chirpSpectrum[convolutionLen - k] = c;
+		}
+
+		convolution->forward(chirpSpectrum, chirpSpectrum);
+	}
+
+	FFTPlan::~FFTPlan() {
+		free(bitReverse);
+		free(twiddles);
+		free(splitTwiddles);
+		free(chirp);
+		free(chirpSpectrum);
+	}
+
+#if defined(SMATH_SSE2)
+	// a register holds two Complex values, so this is two neighbouring radix-4 butterflies at once
+	// (a + bi)(c + di) = (ac - bd) + (ad + bc)i, with the swapped (b, a) times d added with alternating signs
+	static inline __m128 complex_mul(__m128 a, __m128 w, __m128 sign) {
+		__m128 wr = _mm_shuffle_ps(w, w, _MM_SHUFFLE(2, 2, 0, 0));
+		__m128 wi = _mm_shuffle_ps(w, w, _MM_SHUFFLE(3, 3, 1, 1));
+		__m128 swapped = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+		return _mm_add_ps(_mm_mul_ps(a, wr), _mm_xor_ps(_mm_mul_ps(swapped, wi), sign));
+	}
+
+	// same math as the scalar loop in execute_radix4, the inverse conjugates the twiddles by flipping
+	// which lanes get negated
+	template <bool Inverse>
+	static inline void radix4_sse2(Complex* x0, Complex* x1, Complex* x2, Complex* x3, const Complex* w1, const Complex* w2, const Complex* w3) {
+		const __m128 negReal = _mm_castsi128_ps(_mm_set_epi32(0, static_cast<int>(0x80000000), 0, static_cast<int>(0x80000000)));
+		const __m128 negImag = _mm_castsi128_ps(_mm_set_epi32(static_cast<int>(0x80000000), 0, static_cast<int>(0x80000000), 0));
+		const __m128 mulSign = Inverse ? negImag : negReal;
+
+		__m128 t0 = _mm_loadu_ps(&x0->re);
+		__m128 t1 = complex_mul(_mm_loadu_ps(&x1->re), _mm_loadu_ps(&w2->re), mulSign);
+		__m128 t2 = complex_mul(_mm_loadu_ps(&x2->re), _mm_loadu_ps(&w1->re), mulSign);
+		__m128 t3 = complex_mul(_mm_loadu_ps(&x3->re), _mm_loadu_ps(&w3->re), mulSign);
+
+		__m128 a = _mm_add_ps(t0, t1);
+		__m128 b = _mm_sub_ps(t0, t1);
+		__m128 c = _mm_add_ps(t2, t3);
+		__m128 d = _mm_sub_ps(t2, t3);
+
+		// d rotated by -i (forward) or +i (inverse)
+		__m128 rd = _mm_xor_ps(_mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 3, 0, 1)), Inverse ? negReal : negImag);
+
+		_mm_storeu_ps(&x0->re, _mm_add_ps(a, c));
+		_mm_storeu_ps(&x1->re, _mm_add_ps(b, rd));
+		_mm_storeu_ps(&x2->re, _mm_sub_ps(a, c));
+		_mm_storeu_ps(&x3->re, _mm_sub_ps(b, rd));
+	}
+#endif
+
+	template <bool Inverse>
+	void FFTPlan::execute_radix4(Complex* output, const Complex* input) const {
+		// bit reversal permutation, done with swaps when working in place
+		if (output == input) {
+			for (size_t i = 0; i < len; i++) {
+				size_t j = bitReverse[i];
+				if (j > i) {
+					Complex temp = output[i];
+					output[i] = output[j];
+					output[j] = temp;
+				}
+			}
+		} else {
+			for (size_t i = 0; i < len; i++)
+				output[bitReverse[i]] = input[i];
+		}
+
+		size_t h = 1;
+
+		// the radix-2 stage doesn't need any twiddles since they're all 1
+		if (oddStage) {
+			for (size_t i = 0; i < len; i += 2) {
+				Complex a = output[i];
+				Complex b = output[i + 1];
+				output[i] = a + b;
+				output[i + 1] = a - b;
+			}
+
+			h = 2;
+		}
+
+		// after bit reversal, a block of 4h holds the DFTs of the elements that are 0, 2, 1, 3 mod 4 (in that order)
+		// X[j]      = A + w^2 B + w C + w^3 D
+		// X[j + h]  = A - w^2 B - i(w C - w^3 D)
+		// X[j + 2h] = A + w^2 B - (w C + w^3 D)
+		// X[j + 3h] = A - w^2 B + i(w C - w^3 D)
+		// the inverse uses conjugated twiddles and flips the sign on i
+		const Complex* w = twiddles;
+		for (; h < len; h *= 4) {
+			for (size_t start = 0; start < len; start += h * 4) {
+				Complex* x0 = &output[start];
+				Complex* x1 = x0 + h;
+				Complex* x2 = x1 + h;
+				Complex* x3 = x2 + h;
+
+				size_t j = 0;
+#if defined(SMATH_SSE2)
+				for (; j + 2 <= h; j += 2)
+					radix4_sse2<Inverse>(x0 + j, x1 + j, x2 + j, x3 + j, w + j, w + h + j, w + (h * 2) + j);
+#endif
+
+				for (; j < h; j++) {
+					Complex w1 = w[j];
+					Complex w2 = w[h + j];
+					Complex w3 = w[(h * 2) + j];
+					if constexpr (Inverse) {
+						w1.im = -w1.im;
+						w2.im = -w2.im;
+						w3.im = -w3.im;
+					}
+
+					Complex t0 = x0[j];
+					Complex t1 = x1[j] * w2;
+					Complex t2 = x2[j] * w1;
+					Complex t3 = x3[j] * w3;
+
+					Complex a = t0 + t1;
+					Complex b = t0 - t1;
+					Complex c = t2 + t3;
+					Complex d = t2 - t3;
+
+					// d rotated by -i (forward) or +i (inverse)
+					Complex rd = Inverse ? Complex(-d.im, d.re) : Complex(d.im, -d.re);
+
+					x0[j] = a + c;
+					x1[j] = b + rd;
+					x2[j] = a - c;
+					x3[j] = b - rd;
+				}
+			}
+
+			w += h * 3;
+		}
+
+		if constexpr (Inverse) {
+			const float invLen = 1.0f / static_cast<float>(len);
+			for (size_t i = 0; i < len; i++) {
+				output[i].re *= invLen;
+				output[i].im *= invLen;
+			}
+		}
+	}
+
+	template <bool Inverse>
+	static Complex get_twiddle(const Complex* twiddles, size_t i) {
+		Complex w = twiddles[i];
+		if constexpr (Inverse) w.im = -w.im;
+		return w;
+	}
+
+	// one level of the recursion: p sub-transforms of length m are done on every p-th input, written
+	// next to each other in output, and then combined with radix p butterflies
+	// twiddles are for the full length, which is p * m * stride at every level
+	template <bool Inverse>
+	static void mixed_radix_stage(Complex* output, const Complex* input, size_t stride, const size_t* factors, const Complex* twiddles) {
+		const size_t p = factors[0];
+		const size_t m = factors[1];
+
+		if (m == 1) {
+			for (size_t j = 0; j < p; j++)
+				output[j] = input[j * stride];
+		} else {
+			for (size_t j = 0; j < p; j++)
+				mixed_radix_stage<Inverse>(output + (j * m), input + (j * stride), stride * p, factors + 2, twiddles);
+		}
+
+		if (p == 2) {
+			for (size_t k = 0; k < m; k++) {
+				Complex t0 = output[k];
+				Complex t1 = output[k + m] * get_twiddle<Inverse>(twiddles, k * stride);
+				output[k] = t0 + t1;
+				output[k + m] = t0 - t1;
+			}
+		} else if (p == 4) {
+			// same butterfly as the radix-4 plans
+			for (size_t k = 0; k < m; k++) {
+				Complex t0 = output[k];
+				Complex t1 = output[k + m] * get_twiddle<Inverse>(twiddles, k * stride);
+				Complex t2 = output[k + (m * 2)] * get_twiddle<Inverse>(twiddles, k * stride * 2);
+				Complex t3 = output[k + (m * 3)] * get_twiddle<Inverse>(twiddles, k * stride * 3);
+
+				Complex a = t0 + t2;
+				Complex b = t0 - t2;
+				Complex c = t1 + t3;
+				Complex d = t1 - t3;
+				Complex rd = Inverse ? Complex(-d.im, d.re) : Complex(d.im, -d.re);
+
+				output[k] = a + c;
+				output[k + m] = b + rd;
+				output[k + (m * 2)] = a - c;
+				output[k + (m * 3)] = b - rd;
+			}
+		} else if (p == 3) {
+			// w^1 = -1/2 - i sqrt(3)/2 and w^2 is its conjugate
+			const float sinW = Inverse ? -0.86602540378f : 0.86602540378f;
+
+			for (size_t k = 0; k < m; k++) {
+				Complex t0 = output[k];
+				Complex t1 = output[k + m] * get_twiddle<Inverse>(twiddles, k * stride);
+				Complex t2 = output[k + (m * 2)] * get_twiddle<Inverse>(twiddles, k * stride * 2);
+
+				Complex sum = t1 + t2;
+				Complex diff = t1 - t2;
+				Complex mid(t0.re - sum.re * 0.5f, t0.im - sum.im * 0.5f);
+				Complex rd(diff.im * sinW, -diff.re * sinW); // -i sin(2 pi / 3) diff
+
+				output[k] = t0 + sum;
+				output[k + m] = mid + rd;
+				output[k + (m * 2)] = mid - rd;
+			}
+		} else if (p == 5) {
+			// pairs (1, 4) and (2, 3) share cosines and have opposite sines
+			const float cos1 = 0.30901699437f, cos2 = -0.80901699437f;
+			const float sin1 = Inverse ? -0.95105651630f : 0.95105651630f;
+			const float sin2 = Inverse ? -0.58778525229f : 0.58778525229f;
+
+			for (size_t k = 0; k < m; k++) {
+				Complex t0 = output[k];
+				Complex t1 = output[k + m] * get_twiddle<Inverse>(twiddles, k * stride);
+				Complex t2 = output[k + (m * 2)] * get_twiddle<Inverse>(twiddles, k * stride * 2);
+				Complex t3 = output[k + (m * 3)] * get_twiddle<Inverse>(twiddles, k * stride * 3);
+				Complex t4 = output[k + (m * 4)] * get_twiddle<Inverse>(twiddles, k * stride * 4);
+
+				Complex a1 = t1 + t4, b1 = t1 - t4;
+				Complex a2 = t2 + t3, b2 = t2 - t3;
+
+				Complex m1(t0.re + cos1 * a1.re + cos2 * a2.re, t0.im + cos1 * a1.im + cos2 * a2.im);
+				Complex m2(t0.re + cos2 * a1.re + cos1 * a2.re, t0.im + cos2 * a1.im + cos1 * a2.im);
+
+				// -i (sin1 b1 + sin2 b2) and -i (sin2 b1 - sin1 b2)
+				Complex r1(sin1 * b1.im + sin2 * b2.im, -(sin1 * b1.re + sin2 * b2.re));
+				Complex r2(sin2 * b1.im - sin1 * b2.im, -(sin2 * b1.re - sin1 * b2.re));
+
+				output[k] = t0 + a1 + a2;
+				output[k + m] = m1 + r1;
+				output[k + (m * 2)] = m2 + r2;
+				output[k + (m * 3)] = m2 - r2;
+				output[k + (m * 4)] = m1 - r1;
+			}
+		} else {
+			// generic O(p^2) butterfly, only 7 ends up here
+			// the p-th roots of unity are every (m * stride)-th twiddle
+			Complex roots[7];
+			Complex t[7];
+			for (size_t u = 0; u < p; u++)
+				roots[u] = get_twiddle<Inverse>(twiddles, u * m * stride);
+
+			for (size_t k = 0; k < m; k++) {
+				t[0] = output[k];
+				for (size_t q = 1; q < p; q++)
+					t[q] = output[k + (q * m)] * get_twiddle<Inverse>(twiddles, q * k * stride);
+
+				for (size_t u = 0; u < p; u++) {
+					Complex sum = t[0];
+					size_t root = 0;
+					for (size_t q = 1; q < p; q++) {
+						root += u;
+						if (root >= p) root -= p;
+						sum += t[q] * roots[root];
+					}
+
+					output[k + (u * m)] = sum;
+				}
+			}
+		}
+	}
+
+	template <bool Inverse>
+	void FFTPlan::execute_mixed(Complex* output, const Complex* input) const {
+		// the recursion reads the input with strides while writing the output, so it can't be in place
+		if (output == input) {
+			Complex* copy = thread_scratch(SCRATCH_1D, len);
+			if (!copy) return;
+
+			memcpy(copy, input, sizeof(Complex) * len);
+			input = copy;
+		}
+
+		mixed_radix_stage<Inverse>(output, input, 1, factors, twiddles);
+
+		if constexpr (Inverse) {
+			const float invLen = 1.0f / static_cast<float>(len);
+			for (size_t i = 0; i < len; i++) {
+				output[i].re *= invLen;
+				output[i].im *= invLen;
+			}
+		}
+	}
+
+	// the inverse is conj(forward(conj(x))) / len
+	template <bool Inverse>
+	void FFTPlan::execute_bluestein(Complex* output, const Complex* input) const {
+		const size_t convolutionLen = convolution->size();
+		Complex* a = thread_scratch(SCRATCH_1D, convolutionLen);
+		if (!a) return;
+
+		for (size_t k = 0; k < len; k++) {
+			Complex value = input[k];
+			if constexpr (Inverse) value.im = -value.im;
+			a[k] = value * chirp[k];
+		}
+
+		for (size_t k = len; k < convolutionLen; k++)
+			a[k] = Complex(0.0f, 0.0f);
+
+		convolution->forward(a, a);
+		for (size_t k = 0; k < convolutionLen; k++)
+			a[k] *= chirpSpectrum[k];
+		convolution->inverse(a, a);
+
+		const float invLen = 1.0f / static_cast<float>(len);
+		for (size_t k = 0; k < len; k++) {
+			Complex value = a[k] * chirp[k];
+			if constexpr (Inverse) value = Complex(value.re * invLen, -value.im * invLen);
+			output[k] = value;
+		}
+	}
+
+	template <bool Inverse>
+	void FFTPlan::execute(Complex* output, const Complex* input) const {
+		switch (algorithm) {
+		case Algorithm::Radix4: execute_radix4<Inverse>(output, input); break;
+		case Algorithm::MixedRadix: execute_mixed<Inverse>(output, input); break;
+		case Algorithm::Bluestein: execute_bluestein<Inverse>(output, input); break;
+		default: break;
+		}
+	}
+
+	void FFTPlan::forward(Complex* output, const Complex* input) const {
+		execute<false>(output, input);
+	}
+
+	void FFTPlan::inverse(Complex* output, const Complex* input) const {
+		execute<true>(output, input);
+	}
+
+	size_t fft_good_size(size_t minimum) {
+		for (size_t n = minimum > 1 ? minimum : 1;; n++) {
+			size_t remaining = n;
+			static constexpr size_t radices[] = { 2, 3, 5 };
+			for (size_t radix : radices) {
+				while (remaining % radix == 0)
+					remaining /= radix;
+			}
+
+			if (remaining == 1) return n;
+		}
+	}
+
+	const FFTPlan& fft_plan(size_t len) {
+		std::lock_guard<std::recursive_mutex> lock(planMutex);
+		std::unique_ptr<FFTPlan>& plan = plans[len];
+		if (!plan)
+			plan = std::make_unique<FFTPlan>(len);
+
+		return *plan;
+	}
+
+	void fft(size_t len, Complex* output, const Complex* input) {
+		fft_plan(len).forward(output, input);
+	}
+
+	void ifft(size_t len, Complex* output, const Complex* input) {
+		fft_plan(len).inverse(output, input);
+	}
+
+	FFTPlan2D::FFTPlan2D(size_t sizeX, size_t sizeY) {
+		x = sizeX;
+		y = sizeY;
+		rows = &fft_plan(x);
+		columns = &fft_plan(y);
+	}
+
+	// waking the thread pool costs more than it saves unless each thread gets about this many elements
+	static constexpr size_t PARALLEL_MIN_ELEMENTS = 1 << 14;
+
+	// rows per thread for transforms of this length
+	static size_t grain_for(size_t len) {
+		return PARALLEL_MIN_ELEMENTS / len + 1;
+	}
+
+	// row and column batches are split across the shared thread pool, every parallel_for returns
+	// only once all of its batches are done, so the transposes always see finished passes
+	template <bool Inverse>
+	void FFTPlan2D::execute(Complex* output, const Complex* input) const {
+		Complex* scratch = thread_scratch(SCRATCH_2D, x * y);
+		if (!scratch) return;
+
+		ThreadPool& pool = ThreadPool::shared();
+
+		pool.parallel_for(y, [&](size_t begin, size_t end) {
+			for (size_t iy = begin; iy < end; iy++) {
+				if constexpr (Inverse)
+					rows->inverse(&output[iy * x], &input[iy * x]);
+				else
+					rows->forward(&output[iy * x], &input[iy * x]);
+			}
+		}, grain_for(x));
+
+		transpose(x, y, scratch, output);
+
+		pool.parallel_for(x, [&](size_t begin, size_t end) {
+			for (size_t ix = begin; ix < end; ix++) {
+				if constexpr (Inverse)
+					columns->inverse(&scratch[ix * y], &scratch[ix * y]);
+				else
+					columns->forward(&scratch[ix * y], &scratch[ix * y]);
+			}
+		}, grain_for(y));
+
+		transpose(y, x, output, scratch);
+	}
+
+	void FFTPlan2D::forward(Complex* output, const Complex* input) const {
+		execute<false>(output, input);
+	}
+
+	void FFTPlan2D::inverse(Complex* output, const Complex* input) const {
+		execute<true>(output, input);
+	}
+
+	static FFTPlan2D& fft_plan_2d(size_t x, size_t y) {
+		std::lock_guard<std::recursive_mutex> lock(planMutex);
+		std::unique_ptr<FFTPlan2D>& plan = plans2D[(static_cast<uint64_t>(x) << 32) | y];
+		if (!plan)
+			plan = std::make_unique<FFTPlan2D>(x, y);
+
+		return *plan;
+	}
+
+	void fft(size_t x, size_t y, Complex* output, const Complex* input) {
+		fft_plan_2d(x, y).forward(output, input);
+	}
+
+	void ifft(size_t x, size_t y, Complex* output, const Complex* input) {
+		fft_plan_2d(x, y).inverse(output, input);
+	}
+}
+
+//
+// real FFTs
+// the even and odd samples are packed into the real and imaginary parts of a half length complex
+// transform Z, and then separated again using the symmetry of real spectra:
+//   E[k] = (Z[k] + conj(Z[n/2 - k])) / 2
+//   O[k] = (Z[k] - conj(Z[n/2 - k])) / 2i
+//   X[k] = E[k] + w^k O[k], where w = e^(-2 pi i / n)
+// odd lengths can't be packed like that, so they just run a full length complex transform
+//
+namespace smath {
+	RealFFTPlan::RealFFTPlan(size_t length) {
+		if (length == 0) return;
+
+		len = length;
+		if (len % 2 == 1) {
+			full = &fft_plan(len);
+			return;
+		}
+
+		half = &fft_plan(len / 2);
+
+		twiddles = static_cast<Complex*>(malloc(sizeof(Complex) * (len / 2)));
+		for (size_t k = 0; k < len / 2; k++) {
+			double angle = -2.0 * PI_D * static_cast<double>(k) / static_cast<double>(len);
+			twiddles[k] = Complex(static_cast<float>(cos(angle)), static_cast<float>(sin(angle)));
+		}
+	}
+
+	RealFFTPlan::~RealFFTPlan() {
+		free(twiddles);
+	}
+
+	void RealFFTPlan::forward(Complex* output, const float* input) const {
+		if (len == 0) return;
+		const size_t h = len / 2;
+
+		if (full) {
+			Complex* buffer = thread_scratch(SCRATCH_REAL, len);
+			if (!buffer) return;
+
+			for (size_t i = 0; i < len; i++)
+				buffer[i] = Complex(input[i], 0.0f);
+
+			full->forward(buffer, buffer);
+			memcpy(output, buffer, sizeof(Complex) * (h + 1));
+			return;
+		}
+
+		// the real input is reinterpreted as h complex values, which is exactly the packing we want
+		for (size_t m = 0; m < h; m++)
+			output[m] = Complex(input[m * 2], input[m * 2 + 1]);
+
+		half->forward(output, output);
+
+		Complex z0 = output[0];
+		output[0] = Complex(z0.re + z0.im, 0.0f);
+		output[h] = Complex(z0.re - z0.im, 0.0f);
+
+		// k and h - k depend on each other, so they're done together
+		// X[h - k] works out to conj(E - w^k O)
+		for (size_t k = 1; k <= h / 2; k++) {
+			Complex a = output[k];
+			Complex b = output[h - k];
+			b.im = -b.im;
+
+			Complex even((a.re + b.re) * 0.5f, (a.im + b.im) * 0.5f);
+			Complex odd((a.im - b.im) * 0.5f, (b.re - a.re) * 0.5f); // (a - b) / 2i
+			Complex rotated = odd * twiddles[k];
+
+			output[k] = even + rotated;
+
+			Complex mirrored = even - rotated;
+			output[h - k] = Complex(mirrored.re, -mirrored.im);
+		}
+	}
+
+	void RealFFTPlan::inverse(float* output, const Complex* input) const {
+		if (len == 0) return;
+		const size_t h = len / 2;
+
+		// rebuild the whole spectrum from its conjugate symmetry
+		if (full) {
+			Complex* buffer = thread_scratch(SCRATCH_REAL, len);
+			if (!buffer) return;
+
+			buffer[0] = input[0];
+			for (size_t k = 1; k <= h; k++) {
+				buffer[k] = input[k];
+				buffer[len - k] = Complex(input[k].re, -input[k].im);
+			}
+
+			full->inverse(buffer, buffer);
+
+			for (size_t i = 0; i < len; i++)
+				output[i] = buffer[i].re;
+			return;
+		}
+
+		// the output has room for exactly h complex values
+		Complex* z = reinterpret_cast<Complex*>(output);
+
+		// undo the separation above: Z[k] = E[k] + i O[k]
+		// E = (X[k] + conj(X[h - k])) / 2, O = (X[k] - conj(X[h - k])) conj(w^k) / 2
+		// and Z[h - k] works out to conj(E) + i conj(O)
+		for (size_t k = 0; k <= h / 2; k++) {
+			Complex a = input[k];
+			Complex b = input[h - k];
+			b.im = -b.im;
+
+			Complex twiddle = twiddles[k];
+			twiddle.im = -twiddle.im;
+
+			Complex even((a.re + b.re) * 0.5f, (a.im + b.im) * 0.5f);
+			Complex odd = Complex((a.re - b.re) * 0.5f, (a.im - b.im) * 0.5f) * twiddle;
+
+			z[k] = Complex(even.re - odd.im, even.im + odd.re);
+			if (k != 0 && k != h - k)
+				z[h - k] = Complex(even.re + odd.im, -even.im + odd.re);
+		}
+
+		half->inverse(z, z);
+
+		// half->inverse scales by 2/len, but the even/odd split already halves everything
+	}
+
+	const RealFFTPlan& rfft_plan(size_t len) {
+		std::lock_guard<std::recursive_mutex> lock(planMutex);
+		std::unique_ptr<RealFFTPlan>& plan = realPlans[len];
+		if (!plan)
+			plan = std::make_unique<RealFFTPlan>(len);
+
+		return *plan;
+	}
+
+	RealFFTPlan2D::RealFFTPlan2D(size_t sizeX, size_t sizeY) {
+		x = sizeX;
+		y = sizeY;
+		rows = &rfft_plan(x);
+		columns = &fft_plan(y);
+	}
+
+	void RealFFTPlan2D::forward(Complex* output, const float* input) const {
+		const size_t cx = complex_width();
+		Complex* scratch = thread_scratch(SCRATCH_2D, cx * y);
+		if (!scratch) return;
+
+		ThreadPool& pool = ThreadPool::shared();
+
+		pool.parallel_for(y, [&](size_t begin, size_t end) {
+			for (size_t iy = begin; iy < end; iy++)
+				rows->forward(&output[iy * cx], &input[iy * x]);
+		}, grain_for(x));
+
+		transpose(cx, y, scratch, output);
+
+		pool.parallel_for(cx, [&](size_t begin, size_t end) {
+			for (size_t ix = begin; ix < end; ix++)
+				columns->forward(&scratch[ix * y], &scratch[ix * y]);
+		}, grain_for(y));
+
+		transpose(y, cx, output, scratch);
+	}
+
+	void RealFFTPlan2D::inverse(float* output, const Complex* input) const {
+		const size_t cx = complex_width();
+		Complex* scratch = thread_scratch(SCRATCH_2D, cx * y * 2);
+		if (!scratch) return;
+		Complex* spectrum = scratch + (cx * y);
+
+		ThreadPool& pool = ThreadPool::shared();
+
+		// the input is left alone, so the rows go through the second half of scratch
+		transpose(cx, y, scratch, input);
+
+		pool.parallel_for(cx, [&](size_t begin, size_t end) {
+			for (size_t ix = begin; ix < end; ix++)
+				columns->inverse(&scratch[ix * y], &scratch[ix * y]);
+		}, grain_for(y));
+
+		transpose(y, cx, spectrum, scratch);
+
+		pool.parallel_for(y, [&](size_t begin, size_t end) {
+			for (size_t iy = begin; iy < end; iy++)
+				rows->inverse(&output[iy * x], &spectrum[iy * cx]);
+		}, grain_for(x));
+	}
+
+	static RealFFTPlan2D& rfft_plan_2d(size_t x, size_t y) {
+		std::lock_guard<std::recursive_mutex> lock(planMutex);
+		std::unique_ptr<RealFFTPlan2D>& plan = realPlans2D[(static_cast<uint64_t>(x) << 32) | y];
+		if (!plan)
+			plan = std::make_unique<RealFFTPlan2D>(x, y);
+
+		return *plan;
+	}
+
+	void rfft(size_t len, Complex* output, const float* input) {
+		rfft_plan(len).forward(output, input);
+	}
+
+	void irfft(size_t len, float* output, const Complex* input) {
+		rfft_plan(len).inverse(output, input);
+	}
+
+	void rfft(size_t x, size_t y, Complex* output, const float* input) {
+		rfft_plan_2d(x, y).forward(output, input);
+	}
+
+	void irfft(size_t x, size_t y, float* output, const Complex* input) {
+		rfft_plan_2d(x, y).inverse(output, input);
+	}
+}
+
+//
+// sine and cosine transforms
+// the DCT-II uses makhoul's reordering: v = (x0, x2, x4, ..., x5, x3, x1) has the same N point DFT V
+// as the DCT up to a twiddle, X[k] = 2 Re(e^(-i pi k / 2N) V[k]), and v is real so V can come from a real FFT
+// the DST-II is the DCT-II of (-1)^n x[n], read backwards
+// the DST-I is the DFT of the odd extension (0, x, 0, -reversed x), which is purely imaginary
+//
+namespace smath {
+	static bool is_dst1(TrigType type) {
+		return type == TrigType::DST1 || type == TrigType::IDST1;
+	}
+
+	TrigPlan::TrigPlan(size_t length, TrigType trigType) {
+		if (length == 0) return;
+
+		len = length;
+		type = trigType;
+
+		if (is_dst1(type)) {
+			fft = &rfft_plan((len + 1) * 2);
+			return;
+		}
+
+		fft = &rfft_plan(len);
+
+		twiddles = static_cast<Complex*>(malloc(sizeof(Complex) * len));
+		for (size_t k = 0; k < len; k++) {
+			double angle = -PI_D * static_cast<double>(k) / static_cast<double>(len * 2);
+			twiddles[k] = Complex(static_cast<float>(cos(angle)), static_cast<float>(sin(angle)));
+		}
+	}
+
+	TrigPlan::~TrigPlan() {
+		free(twiddles);
+	}
+
+	size_t TrigPlan::scratch_size() const {
+		// the real FFT input (as floats) followed by its half spectrum
+		if (is_dst1(type))
+			return (len + 1) + (len + 2);
+
+		return ((len + 1) / 2) + (len / 2 + 1);
+	}
+
+	// Sine flips the sign of every odd input and reverses the output
+	template <bool Sine>
+	static void dct2(size_t len, const RealFFTPlan& fft, const Complex* twiddles, float* output, const float* input, Complex* scratch) {
+		float* v = reinterpret_cast<float*>(scratch);
+		Complex* spectrum = scratch + ((len + 1) / 2);
+
+		// with an odd len the last even sample lands in the middle
+		for (size_t n = 0; n * 2 < len; n++) {
+			v[n] = input[n * 2];
+			if (n * 2 + 1 < len)
+				v[len - 1 - n] = Sine ? -input[n * 2 + 1] : input[n * 2 + 1];
+		}
+
+		fft.forward(spectrum, v);
+
+		// the upper half of V is the conjugate of the lower half
+		for (size_t k = 0; k < len; k++) {
+			Complex vk = spectrum[k <= len / 2 ? k : len - k];
+			if (k > len / 2) vk.im = -vk.im;
+
+			float value = 2.0f * (twiddles[k].re * vk.re - twiddles[k].im * vk.im);
+			output[Sine ? len - 1 - k : k] = value;
+		}
+	}
+
+	// inverse of the above, V[k] = conj(e^(-i pi k / 2N)) (X[k] - i X[N - k]) / 2 with X[N] = 0
+	template <bool Sine>
+	static void dct3(size_t len, const RealFFTPlan& fft, const Complex* twiddles, float* output, const float* input, Complex* scratch) {
+		float* v = reinterpret_cast<float*>(scratch);
+		Complex* spectrum = scratch + ((len + 1) / 2);
+
+		auto coeff = [&](size_t k) {
+			return Sine ? input[len - 1 - k] : input[k];
+		};
+
+		for (size_t k = 0; k <= len / 2; k++) {
+			float xk = coeff(k);
+			float xnk = k == 0 ? 0.0f : coeff(len - k);
+
+			Complex twiddle = twiddles[k];
+			twiddle.im = -twiddle.im;
+
+			spectrum[k] = twiddle * Complex(xk * 0.5f, -xnk * 0.5f);
+		}
+
+		fft.inverse(v, spectrum);
+
+		for (size_t n = 0; n * 2 < len; n++) {
+			output[n * 2] = v[n];
+			if (n * 2 + 1 < len)
+				output[n * 2 + 1] = Sine ? -v[len - 1 - n] : v[len - 1 - n];
+		}
+	}
+
+	static void dst1_extended(size_t len, const RealFFTPlan& fft, float* output, const float* input, Complex* scratch, float scale) {
+		const size_t extended = (len + 1) * 2;
+		float* z = reinterpret_cast<float*>(scratch);
+		Complex* spectrum = scratch + (len + 1);
+
+		z[0] = 0.0f;
+		z[len + 1] = 0.0f;
+		for (size_t n = 0; n < len; n++) {
+			z[n + 1] = input[n];
+			z[extended - 1 - n] = -input[n];
+		}
+
+		fft.forward(spectrum, z);
+
+		for (size_t k = 0; k < len; k++)
+			output[k] = -spectrum[k + 1].im * scale;
+	}
+
+	void TrigPlan::execute(float* output, const float* input, Complex* scratch) const {
+		if (len == 0) return;
+
+		if (is_dst1(type)) {
+			if (fft->size() == 0) return;
+
+			const float scale = type == TrigType::IDST1 ? 1.0f / static_cast<float>((len + 1) * 2) : 1.0f;
+			dst1_extended(len, *fft, output, input, scratch, scale);
+			return;
+		}
+
+		if (len == 1) {
+			const bool inverse = type == TrigType::IDCT || type == TrigType::IDST;
+			output[0] = inverse ? input[0] * 0.5f : input[0] * 2.0f;
+			return;
+		}
+
+		if (fft->size() == 0) return;
+
+		switch (type) {
+		case TrigType::DCT: dct2<false>(len, *fft, twiddles, output, input, scratch); break;
+		case TrigType::IDCT: dct3<false>(len, *fft, twiddles, output, input, scratch); break;
+		case TrigType::DST: dct2<true>(len, *fft, twiddles, output, input, scratch); break;
+		case TrigType::IDST: dct3<true>(len, *fft, twiddles, output, input, scratch); break;
+		default: break;
+		}
+	}
+
+	const TrigPlan& trig_plan(size_t len, TrigType type) {
+		std::lock_guard<std::recursive_mutex> lock(planMutex);
+		std::unique_ptr<TrigPlan>& plan = trigPlans[(static_cast<uint64_t>(len) << 8) | static_cast<uint64_t>(type)];
+		if (!plan)
+			plan = std::make_unique<TrigPlan>(len, type);
+
+		return *plan;
+	}
+
+	static void trig_1d(size_t len, float* output, const float* input, TrigType type) {
+		const TrigPlan& plan = trig_plan(len, type);
+
+		Complex* scratch = static_cast<Complex*>(malloc(sizeof(Complex) * plan.scratch_size()));
+		if (!scratch) return;
+
+		plan.execute(output, input, scratch);
+		free(scratch);
+	}
+
+	// same shape as the 2D FFT, rows, transpose, rows, transpose back
+	// every batch gets its own plan scratch
+	static void trig_2d(size_t x, size_t y, float* output, const float* input, TrigType type) {
+		const TrigPlan& rowPlan = trig_plan(x, type);
+		const TrigPlan& columnPlan = trig_plan(y, type);
+
+		float* buffer = static_cast<float*>(malloc(sizeof(float) * x * y * 2));
+		if (!buffer) return;
+
+		float* transposed = buffer + (x * y);
+
+		auto pass = [](ThreadPool& pool, const TrigPlan& plan, size_t count, float* out, const float* in) {
+			const size_t len = plan.size();
+
+			pool.parallel_for(count, [&](size_t begin, size_t end) {
+				Complex* scratch = static_cast<Complex*>(malloc(sizeof(Complex) * plan.scratch_size()));
+				if (!scratch) return;
+
+				for (size_t i = begin; i < end; i++)
+					plan.execute(&out[i * len], &in[i * len], scratch);
+
+				free(scratch);
+			}, grain_for(len));
+		};
+
+		ThreadPool& pool = ThreadPool::shared();
+
+		pass(pool, rowPlan, y, buffer, input);
+		transpose(x, y, transposed, buffer);
+		pass(pool, columnPlan, x, buffer, transposed);
+		transpose(y, x, output, buffer);
+
+		free(buffer);
+	}
+
+	void dct(size_t len, float* output, const float* input) { trig_1d(len, output, input, TrigType::DCT); }
+	void idct(size_t len, float* output, const float* input) { trig_1d(len, output, input, TrigType::IDCT); }
+	void dst(size_t len, float* output, const float* input) { trig_1d(len, output, input, TrigType::DST); }
+	void idst(size_t len, float* output, const float* input) { trig_1d(len, output, input, TrigType::IDST); }
+	void dst1(size_t len, float* output, const float* input) { trig_1d(len, output, input, TrigType::DST1); }
+	void idst1(size_t len, float* output, const float* input) { trig_1d(len, output, input, TrigType::IDST1); }
+
+	void dct(size_t x, size_t y, float* output, const float* input) { trig_2d(x, y, output, input, TrigType::DCT); }
+	void idct(size_t x, size_t y, float* output, const float* input) { trig_2d(x, y, output, input, TrigType::IDCT); }
+	void dst(size_t x, size_t y, float* output, const float* input) { trig_2d(x, y, output, input, TrigType::DST); }
+	void idst(size_t x, size_t y, float* output, const float* input) { trig_2d(x, y, output, input, TrigType::IDST); }
+	void dst1(size_t x, size_t y, float* output, const float* input) { trig_2d(x, y, output, input, TrigType::DST1); }
+	void idst1(size_t x, size_t y, float* output, const float* input) { trig_2d(x, y, output, input, TrigType::IDST1); }
+
+	void release_plans() {
+		std::lock_guard<std::recursive_mutex> lock(planMutex);
+
+		// 2D and trig plans point at the 1D ones, so they go first
+		trigPlans.clear();
+		realPlans2D.clear();
+		plans2D.clear();
+		realPlans.clear();
+		plans.clear();
+
+		// other threads free theirs when they exit
+		threadScratch.release();
+	}
+}
@@ -0,0 +1,170 @@
+#include "smath.h"
+
+#include <stdlib.h>
+
+#include <new>
+
+#include "smath_butterfly.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//
+// split-complex buffers
+//
+static constexpr size_t SPLIT_ALIGNMENT = 64;
+
+void SplitComplex::init(size_t length) {
+	clean();
+	if (length == 0) return;
+
+	// one allocation for both arrays, im starts on the next aligned boundary after re
+	const size_t stride = ((length * sizeof(float)) + SPLIT_ALIGNMENT - 1) & ~(SPLIT_ALIGNMENT - 1);
+	re = static_cast<float*>(::operator new(stride * 2, std::align_val_t(SPLIT_ALIGNMENT)));
+	im = re + (stride / sizeof(float));
+	len = length;
+}
+
+void SplitComplex::clean() {
+	if (re)
+		::operator delete(re, std::align_val_t(SPLIT_ALIGNMENT));
+
+	re = nullptr;
+	im = nullptr;
+	len = 0;
+}
+
+void SplitComplex::from_interleaved(const Complex* values) {
+	for (size_t i = 0; i < len; i++) {
+		re[i] = values[i].re;
+		im[i] = values[i].im;
+	}
+}
+
+void SplitComplex::to_interleaved(Complex* values) const {
+	for (size_t i = 0; i < len; i++)
+		values[i] = Complex(re[i], im[i]);
+}
+
+//
+// SIMD butterflies
+// every radix-4 stage runs the same butterfly as the interleaved plan, just on several consecutive j at once
+// the wide kernels live in smath_split_avx2.cpp, the only file built with AVX2, and are picked at runtime
+//
+namespace smath {
+	// from smath_split_avx2.cpp, the isa is null when that file was built without AVX2
+	const char* radix4_simd_isa();
+	void radix4_stages_simd(float* re, float* im, size_t len, size_t h, const float* twiddles, bool inverse);
+
+	// AVX2 needs the CPU to have it and the OS to save the upper halves of the registers
+	static bool cpu_has_avx2() {
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) return false;
+
+		__cpuid(info, 1);
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool avx = (info[2] & (1 << 28)) != 0;
+		const bool fma = (info[2] & (1 << 12)) != 0;
+		if (!osxsave || !avx || !fma) return false;
+		if ((_xgetbv(0) & 6) != 6) return false;
+
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+		return false;
+#endif
+	}
+
+	static bool use_simd_kernels() {
+		static const bool supported = radix4_simd_isa() != nullptr && cpu_has_avx2();
+		return supported;
+	}
+
+	const char* simd_name() {
+		return use_simd_kernels() ? radix4_simd_isa() : "scalar";
+	}
+
+	template <bool Inverse>
+	void FFTPlan::execute_split(SplitComplex& output, const SplitComplex& input) const {
+		if (len == 0 || output.len < len || input.len < len) return;
+
+		// everything but the radix-4 plans goes through the interleaved code
+		if (algorithm != Algorithm::Radix4) {
+			Complex* buffer = static_cast<Complex*>(malloc(sizeof(Complex) * len));
+			if (!buffer) return;
+
+			input.to_interleaved(buffer);
+			if constexpr (Inverse)
+				inverse(buffer, buffer);
+			else
+				forward(buffer, buffer);
+			output.from_interleaved(buffer);
+
+			free(buffer);
+			return;
+		}
+
+		float* re = output.re;
+		float* im = output.im;
+
+		// bit reversal permutation, done with swaps when working in place
+		if (output.re == input.re) {
+			for (size_t i = 0; i < len; i++) {
+				size_t j = bitReverse[i];
+				if (j > i) {
+					float tr = re[i], ti = im[i];
+					re[i] = re[j];
+					im[i] = im[j];
+					re[j] = tr;
+					im[j] = ti;
+				}
+			}
+		} else {
+			for (size_t i = 0; i < len; i++) {
+				re[bitReverse[i]] = input.re[i];
+				im[bitReverse[i]] = input.im[i];
+			}
+		}
+
+		size_t h = 1;
+
+		if (oddStage) {
+			for (size_t i = 0; i < len; i += 2) {
+				float ar = re[i], ai = im[i];
+				float br = re[i + 1], bi = im[i + 1];
+				re[i] = ar + br;
+				im[i] = ai + bi;
+				re[i + 1] = ar - br;
+				im[i + 1] = ai - bi;
+			}
+
+			h = 2;
+		}
+
+		if (use_simd_kernels())
+			radix4_stages_simd(re, im, len, h, splitTwiddles, Inverse);
+		else
+			radix4_stages<ScalarLanes, Inverse>(re, im, len, h, splitTwiddles);
+
+		if constexpr (Inverse) {
+			const float invLen = 1.0f / static_cast<float>(len);
+			for (size_t i = 0; i < len; i++) {
+				re[i] *= invLen;
+				im[i] *= invLen;
+			}
+		}
+	}
+
+	void FFTPlan::forward(SplitComplex& output, const SplitComplex& input) const {
+		execute_split<false>(output, input);
+	}
+
+	void FFTPlan::inverse(SplitComplex& output, const SplitComplex& input) const {
+		execute_split<true>(output, input);
+	}
+}
@@ -0,0 +1,46 @@
+// this is the only file built with AVX2 (see water_test.vcxproj), smath_split.cpp only calls into it
+// after checking that the CPU has it, so the rest of the program still runs on any x64 CPU
+// it can't include anything with inline functions that other files use, the linker could pick these copies
+
+#include <stddef.h> // for size_t
+
+#include "smath_butterfly.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace smath {
+	namespace {
+#if defined(__AVX2__)
+		struct SimdLanes {
+			using V = __m256;
+			static constexpr size_t LANES = 8;
+
+			static V load(const float* p) { return _mm256_loadu_ps(p); }
+			static void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+			static V add(V a, V b) { return _mm256_add_ps(a, b); }
+			static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+			static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+		};
+#endif
+	}
+
+	const char* radix4_simd_isa() {
+#if defined(__AVX2__)
+		return "AVX2";
+#else
+		return nullptr;
+#endif
+	}
+
+	// only called when radix4_simd_isa() isn't null and the CPU supports it
+	void radix4_stages_simd(float* re, float* im, size_t len, size_t h, const float* twiddles, bool inverse) {
+#if defined(__AVX2__)
+		if (inverse)
+			radix4_stages<SimdLanes, true>(re, im, len, h, twiddles);
+		else
+			radix4_stages<SimdLanes, false>(re, im, len, h, twiddles);
+#endif
+	}
+}
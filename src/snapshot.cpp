@@ -0,0 +1,586 @@
+#define _CRT_SECURE_NO_WARNINGS // for fopen
+#include "snapshot.h"
+
+#include <stdlib.h> // for malloc/free
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <filesystem>
+
+#include "lz.h"
+#include "thread_pool.h"
+#include "varint.h"
+
+using namespace snapshot;
+
+static constexpr uint32_t SNAPSHOT_MAGIC = id("WSNP");
+static constexpr uint32_t SNAPSHOT_VERSION = 1;
+static constexpr uint64_t ALIGNMENT = 64;
+
+// big enough that lz finds plenty of matches in a block, small enough that there are a lot of blocks to split
+// across threads even for small grids
+static constexpr size_t BLOCK_TARGET_BYTES = 64 * 1024;
+
+struct Header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t kind;
+	uint32_t channelCount;
+};
+
+static_assert(sizeof(Header) == 16, "snapshot header layout");
+static_assert(sizeof(Channel) == 48, "snapshot channel layout");
+static_assert(sizeof(Block) == 16, "snapshot block layout");
+
+//
+// block encoding
+//
+
+// per thread scratch that only grows, so blocks don't allocate (and fault in fresh pages) every time
+// slot 0 holds the byte planes, 1 a dequantized reference, 2 the quantized rows
+struct ThreadScratch {
+	uint8_t* buffers[3] = {};
+	size_t sizes[3] = {};
+
+	~ThreadScratch() {
+		for (uint8_t* buffer : buffers)
+			free(buffer);
+	}
+};
+
+static void* thread_scratch(int slot, size_t bytes) {
+	static thread_local ThreadScratch scratch;
+
+	if (scratch.sizes[slot] < bytes) {
+		free(scratch.buffers[slot]);
+		scratch.buffers[slot] = static_cast<uint8_t*>(malloc(bytes));
+		scratch.sizes[slot] = scratch.buffers[slot] ? bytes : 0;
+	}
+
+	return scratch.buffers[slot];
+}
+
+static size_t element_size(Encoding encoding) {
+	return encoding == Encoding::Quantized ? sizeof(uint16_t) : sizeof(float);
+}
+
+// rounds half away from zero by hand, lrintf is a library call on some compilers and this runs for every cell
+static inline int16_t quantize(float value, float inverseScale) {
+	const float scaled = std::clamp(value * inverseScale, -32767.0f, 32767.0f);
+	return static_cast<int16_t>(scaled + (scaled >= 0.0f ? 0.5f : -0.5f));
+}
+
+static inline float dequantize(int16_t value, float scale) {
+	return static_cast<float>(value) * scale;
+}
+
+// predictions come from the same cell of the reference, or else the cell to the left, or else the one above
+// for the first cells of a row, the first row of a block has nothing above it, so blocks don't depend on each other
+// the loops are split up by prediction so the inner ones have no branches and vectorize
+//
+// planes is the encoded block before lz, element i's byte p goes to planes[p * count + i]
+static inline void put_residual(uint8_t* planes, size_t count, size_t i, uint32_t residual) {
+	planes[i] = static_cast<uint8_t>(residual);
+	planes[count + i] = static_cast<uint8_t>(residual >> 8);
+	planes[(count * 2) + i] = static_cast<uint8_t>(residual >> 16);
+	planes[(count * 3) + i] = static_cast<uint8_t>(residual >> 24);
+}
+
+static inline uint32_t get_residual(const uint8_t* planes, size_t count, size_t i) {
+	return static_cast<uint32_t>(planes[i]) | (static_cast<uint32_t>(planes[count + i]) << 8)
+		| (static_cast<uint32_t>(planes[(count * 2) + i]) << 16) | (static_cast<uint32_t>(planes[(count * 3) + i]) << 24);
+}
+
+static inline uint32_t bits(float value) {
+	return std::bit_cast<uint32_t>(value);
+}
+
+static void encode_lossless(const float* data, const float* reference, int rows, int rowFloats, int components, uint8_t* planes) {
+	const size_t count = static_cast<size_t>(rows) * rowFloats;
+
+	if (reference) {
+		for (size_t i = 0; i < count; i++)
+			put_residual(planes, count, i, bits(data[i]) ^ bits(reference[i]));
+		return;
+	}
+
+	for (int y = 0; y < rows; y++) {
+		const size_t row = static_cast<size_t>(y) * rowFloats;
+
+		for (int x = 0; x < components; x++)
+			put_residual(planes, count, row + x, bits(data[row + x]) ^ (y > 0 ? bits(data[row + x - rowFloats]) : 0));
+		for (size_t i = row + components; i < row + rowFloats; i++)
+			put_residual(planes, count, i, bits(data[i]) ^ bits(data[i - components]));
+	}
+}
+
+static void decode_lossless(const uint8_t* planes, const float* reference, int rows, int rowFloats, int components, float* out) {
+	const size_t count = static_cast<size_t>(rows) * rowFloats;
+
+	if (reference) {
+		for (size_t i = 0; i < count; i++)
+			out[i] = std::bit_cast<float>(get_residual(planes, count, i) ^ bits(reference[i]));
+		return;
+	}
+
+	for (int y = 0; y < rows; y++) {
+		const size_t row = static_cast<size_t>(y) * rowFloats;
+
+		for (int x = 0; x < components; x++)
+			out[row + x] = std::bit_cast<float>(get_residual(planes, count, row + x) ^ (y > 0 ? bits(out[row + x - rowFloats]) : 0));
+		for (size_t i = row + components; i < row + rowFloats; i++)
+			out[i] = std::bit_cast<float>(get_residual(planes, count, i) ^ bits(out[i - components]));
+	}
+}
+
+// each row is quantized up front into values, so the predictions don't quantize anything twice
+// the differences wrap around in 16 bits, so they're exact even when the prediction is way off
+static void encode_quantized(const float* data, const float* reference, int rows, int rowFloats, int components, float scale, uint8_t* planes) {
+	const size_t count = static_cast<size_t>(rows) * rowFloats;
+	const float inverseScale = 1.0f / scale;
+
+	// this row's and the last row's quantized values
+	int16_t* values = static_cast<int16_t*>(thread_scratch(2, sizeof(int16_t) * rowFloats * 2));
+	int16_t* above = values + rowFloats;
+
+	for (int y = 0; y < rows; y++) {
+		const size_t row = static_cast<size_t>(y) * rowFloats;
+		std::swap(values, above);
+
+		for (int x = 0; x < rowFloats; x++)
+			values[x] = quantize(data[row + x], inverseScale);
+
+		auto put = [&](int x, int16_t prediction) {
+			const uint16_t residual = zigzag16(static_cast<int16_t>(values[x] - prediction));
+			planes[row + x] = static_cast<uint8_t>(residual);
+			planes[count + row + x] = static_cast<uint8_t>(residual >> 8);
+		};
+
+		if (reference) {
+			for (int x = 0; x < rowFloats; x++)
+				put(x, quantize(reference[row + x], inverseScale));
+		} else {
+			for (int x = 0; x < components; x++)
+				put(x, y > 0 ? above[x] : 0);
+			for (int x = components; x < rowFloats; x++)
+				put(x, values[x - components]);
+		}
+	}
+}
+
+static void decode_quantized(const uint8_t* planes, const float* reference, int rows, int rowFloats, int components, float scale, float* out) {
+	const size_t count = static_cast<size_t>(rows) * rowFloats;
+	const float inverseScale = 1.0f / scale;
+
+	int16_t* values = static_cast<int16_t*>(thread_scratch(2, sizeof(int16_t) * rowFloats * 2));
+	int16_t* above = values + rowFloats;
+
+	for (int y = 0; y < rows; y++) {
+		const size_t row = static_cast<size_t>(y) * rowFloats;
+		std::swap(values, above);
+
+		auto get = [&](int x) {
+			return unzigzag16(static_cast<uint16_t>(planes[row + x] | (planes[count + row + x] << 8)));
+		};
+
+		if (reference) {
+			for (int x = 0; x < rowFloats; x++)
+				values[x] = static_cast<int16_t>(quantize(reference[row + x], inverseScale) + get(x));
+		} else {
+			for (int x = 0; x < components; x++)
+				values[x] = static_cast<int16_t>((y > 0 ? above[x] : 0) + get(x));
+			for (int x = components; x < rowFloats; x++)
+				values[x] = static_cast<int16_t>(values[x - components] + get(x));
+		}
+
+		for (int x = 0; x < rowFloats; x++)
+			out[row + x] = dequantize(values[x], scale);
+	}
+}
+
+//
+// SnapshotWriter
+//
+
+void SnapshotWriter::write(const void* data, size_t bytes) {
+	if (failed || bytes == 0) return;
+
+	if (fwrite(data, 1, bytes, file) != bytes)
+		failed = true;
+	position += bytes;
+}
+
+void SnapshotWriter::pad_to_alignment() {
+	static const uint8_t zeros[ALIGNMENT] = {};
+
+	const uint64_t padding = (ALIGNMENT - (position % ALIGNMENT)) % ALIGNMENT;
+	write(zeros, static_cast<size_t>(padding));
+}
+
+SnapshotWriter::~SnapshotWriter() {
+	if (file)
+		close();
+
+	free(batchBuffer);
+}
+
+bool SnapshotWriter::open(const char* targetPath, uint32_t snapshotKind, int count) {
+	if (file || count <= 0) return false;
+
+	// a save that fails halfway (full disk, crash) mustn't take the previous snapshot with it
+	path = targetPath;
+	tempPath = path + ".tmp";
+	file = fopen(tempPath.c_str(), "wb");
+	if (!file) return false;
+
+	failed = false;
+	kind = snapshotKind;
+	channelCount = count;
+	channelsWritten = 0;
+	position = 0;
+
+	// the header and channel table get filled in by close, once the channels are known
+	channels = static_cast<Channel*>(calloc(channelCount, sizeof(Channel)));
+	if (!channels) {
+		fclose(file);
+		file = nullptr;
+		remove(tempPath.c_str());
+		return false;
+	}
+
+	Header header = {};
+	write(&header, sizeof(header));
+	write(channels, sizeof(Channel) * channelCount);
+
+	return !failed;
+}
+
+bool SnapshotWriter::write_channel(uint32_t channelId, const float* data, int width, int height, int components, Encoding encoding,
+	uint32_t referenceId, const float* referenceData) {
+	if (!file || failed || channelsWritten >= channelCount || width <= 0 || height <= 0 || components <= 0) {
+		failed = true;
+		return false;
+	}
+
+	const Channel* reference = nullptr;
+	for (int i = 0; referenceId && i < channelsWritten; i++) {
+		if (channels[i].id == referenceId)
+			reference = &channels[i];
+	}
+
+	// the reference has to be written already and be the same shape
+	if (referenceId && (!reference || !referenceData || reference->width != width || reference->height != height || reference->components != components)) {
+		failed = true;
+		return false;
+	}
+
+	const int rowFloats = width * components;
+	const size_t rowBytes = sizeof(float) * rowFloats;
+
+	Channel channel = {};
+	channel.id = channelId;
+	channel.encoding = encoding;
+	channel.width = width;
+	channel.height = height;
+	channel.components = components;
+	channel.blockRows = std::clamp(static_cast<int>(BLOCK_TARGET_BYTES / rowBytes), 1, height);
+	channel.blockCount = static_cast<uint32_t>((height + channel.blockRows - 1) / channel.blockRows);
+	channel.referenceId = encoding == Encoding::Raw ? 0 : referenceId;
+	channel.scale = 1.0f;
+
+	if (encoding == Encoding::Quantized) {
+		float largest = 0.0f;
+		for (size_t i = 0; i < static_cast<size_t>(rowFloats) * height; i++)
+			largest = std::max(largest, fabsf(data[i]));
+
+		if (largest > 0.0f)
+			channel.scale = largest / 32767.0f;
+	}
+
+	Block* blocks = static_cast<Block*>(malloc(sizeof(Block) * channel.blockCount));
+	if (!blocks) {
+		failed = true;
+		return false;
+	}
+
+	pad_to_alignment();
+
+	if (encoding == Encoding::Raw) {
+		// one contiguous run, so it can be mapped as a whole
+		for (uint32_t b = 0; b < channel.blockCount; b++) {
+			const int rows = std::min(channel.blockRows, height - static_cast<int>(b) * channel.blockRows);
+			blocks[b].offset = position + (static_cast<uint64_t>(b) * channel.blockRows * rowBytes);
+			blocks[b].bytes = blocks[b].rawBytes = static_cast<uint32_t>(rows * rowBytes);
+		}
+
+		write(data, rowBytes * height);
+	} else {
+		const size_t blockFloats = static_cast<size_t>(channel.blockRows) * rowFloats;
+		const size_t planeBytes = blockFloats * element_size(encoding);
+		const size_t slotSize = lz::bound(planeBytes);
+		const int slots = ThreadPool::shared().size() * 2;
+
+		if (slotSize * slots > batchSlotSize * batchSlots) {
+			free(batchBuffer);
+			batchBuffer = static_cast<uint8_t*>(malloc(slotSize * slots));
+		}
+
+		// out of memory fails the whole snapshot, close reports it
+		if (!batchBuffer) {
+			batchSlotSize = 0;
+			batchSlots = 0;
+			free(blocks);
+			failed = true;
+			return false;
+		}
+		batchSlotSize = slotSize;
+		batchSlots = slots;
+
+		// set by any job whose thread couldn't grow its scratch
+		std::atomic<bool> outOfMemory = false;
+
+		// a quantized reference gets predicted from what the reader will have, not the original values
+		const bool dequantizeReference = reference && reference->encoding == Encoding::Quantized;
+		const float referenceScale = reference ? reference->scale : 1.0f;
+
+		for (uint32_t first = 0; first < channel.blockCount; first += slots) {
+			const uint32_t batchCount = std::min(static_cast<uint32_t>(slots), channel.blockCount - first);
+
+			ThreadPool::shared().parallel_for(batchCount, [&](size_t begin, size_t end) {
+				uint8_t* planes = static_cast<uint8_t*>(thread_scratch(0, planeBytes));
+				float* dequantized = dequantizeReference ? static_cast<float*>(thread_scratch(1, sizeof(float) * blockFloats)) : nullptr;
+				// encode_quantized's rows come out of slot 2, growing it here lets a failure show up before encoding
+				const bool rowsFailed = encoding == Encoding::Quantized && !thread_scratch(2, sizeof(int16_t) * rowFloats * 2);
+				if (!planes || (dequantizeReference && !dequantized) || rowsFailed) {
+					outOfMemory = true;
+					return;
+				}
+
+				for (size_t slot = begin; slot < end; slot++) {
+					const uint32_t b = first + static_cast<uint32_t>(slot);
+					const int rows = std::min(channel.blockRows, channel.height - static_cast<int>(b) * channel.blockRows);
+					const size_t start = static_cast<size_t>(b) * channel.blockRows * rowFloats;
+					const size_t floats = static_cast<size_t>(rows) * rowFloats;
+
+					const float* blockReference = referenceData ? referenceData + start : nullptr;
+					if (dequantizeReference) {
+						const float inverseScale = 1.0f / referenceScale;
+						for (size_t i = 0; i < floats; i++)
+							dequantized[i] = dequantize(quantize(blockReference[i], inverseScale), referenceScale);
+						blockReference = dequantized;
+					}
+
+					if (channel.encoding == Encoding::Lossless)
+						encode_lossless(data + start, blockReference, rows, rowFloats, components, planes);
+					else
+						encode_quantized(data + start, blockReference, rows, rowFloats, components, channel.scale, planes);
+
+					const size_t rawBytes = floats * element_size(channel.encoding);
+					blocks[b].bytes = static_cast<uint32_t>(lz::compress(planes, rawBytes, batchBuffer + (slot * slotSize)));
+					blocks[b].rawBytes = static_cast<uint32_t>(rawBytes);
+				}
+			});
+
+			if (outOfMemory) {
+				free(blocks);
+				failed = true;
+				return false;
+			}
+
+			// written in order as each batch finishes, so the file streams out while the next batch encodes
+			for (uint32_t slot = 0; slot < batchCount; slot++) {
+				blocks[first + slot].offset = position;
+				write(batchBuffer + (slot * slotSize), blocks[first + slot].bytes);
+			}
+		}
+	}
+
+	pad_to_alignment();
+	channel.blockTable = position;
+	write(blocks, sizeof(Block) * channel.blockCount);
+	free(blocks);
+
+	channels[channelsWritten++] = channel;
+	return !failed;
+}
+
+bool SnapshotWriter::close() {
+	if (!file) return false;
+
+	if (channelsWritten != channelCount)
+		failed = true;
+
+	Header header = { SNAPSHOT_MAGIC, SNAPSHOT_VERSION, kind, static_cast<uint32_t>(channelCount) };
+	if (fseek(file, 0, SEEK_SET) != 0)
+		failed = true;
+
+	write(&header, sizeof(header));
+	write(channels, sizeof(Channel) * channelCount);
+
+	if (fclose(file) != 0)
+		failed = true;
+
+	file = nullptr;
+	free(channels);
+	channels = nullptr;
+
+	// std::filesystem::rename replaces the target on windows too, where rename() fails if it exists
+	std::error_code error;
+	if (!failed)
+		std::filesystem::rename(tempPath, path, error);
+
+	if (failed || error) {
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+
+	return true;
+}
+
+//
+// SnapshotReader
+//
+
+bool SnapshotReader::open(const char* path) {
+	close();
+	if (!mapped.open(path)) return false;
+
+	const uint8_t* data = mapped.data();
+	const size_t size = mapped.size();
+
+	Header header;
+	if (size < sizeof(header)) {
+		close();
+		return false;
+	}
+
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION || header.channelCount == 0
+		|| header.channelCount > (size - sizeof(header)) / sizeof(Channel)) {
+		close();
+		return false;
+	}
+
+	const Channel* table = reinterpret_cast<const Channel*>(data + sizeof(header));
+	for (uint32_t i = 0; i < header.channelCount; i++) {
+		const Channel& channel = table[i];
+		bool valid = channel.width > 0 && channel.height > 0 && channel.components > 0 && channel.blockRows > 0
+			&& channel.encoding <= Encoding::Quantized
+			&& channel.blockCount == static_cast<uint32_t>((channel.height + channel.blockRows - 1) / channel.blockRows)
+			&& channel.blockTable <= size
+			&& channel.blockCount <= (size - channel.blockTable) / sizeof(Block)
+			&& (channel.encoding != Encoding::Quantized || channel.scale > 0.0f);
+
+		if (!valid) {
+			close();
+			return false;
+		}
+	}
+
+	kind = header.kind;
+	channels = table;
+	channelCount = static_cast<int>(header.channelCount);
+	return true;
+}
+
+void SnapshotReader::close() {
+	mapped.close();
+	kind = 0;
+	channels = nullptr;
+	channelCount = 0;
+}
+
+const Channel* SnapshotReader::find(uint32_t channelId) const {
+	for (int i = 0; i < channelCount; i++) {
+		if (channels[i].id == channelId)
+			return &channels[i];
+	}
+
+	return nullptr;
+}
+
+bool SnapshotReader::read_channel(uint32_t channelId, float* out, const float* referenceData) const {
+	const Channel* found = find(channelId);
+	if (!found || (found->referenceId && !referenceData)) return false;
+
+	const Channel& channel = *found;
+	const Block* blocks = reinterpret_cast<const Block*>(mapped.data() + channel.blockTable);
+	const uint8_t* data = mapped.data();
+	const size_t size = mapped.size();
+
+	const int rowFloats = channel.width * channel.components;
+	const size_t blockFloats = static_cast<size_t>(channel.blockRows) * rowFloats;
+	const size_t elementSize = element_size(channel.encoding);
+	const float* reference = channel.referenceId ? referenceData : nullptr;
+
+	std::atomic<bool> valid = true;
+	ThreadPool::shared().parallel_for(channel.blockCount, [&](size_t begin, size_t end) {
+		uint8_t* planes = channel.encoding == Encoding::Raw ? nullptr : static_cast<uint8_t*>(thread_scratch(0, blockFloats * elementSize));
+
+		// out of memory for the scratch fails the read like a corrupt block would
+		const bool rowsFailed = channel.encoding == Encoding::Quantized && !thread_scratch(2, sizeof(int16_t) * rowFloats * 2);
+		if ((channel.encoding != Encoding::Raw && !planes) || rowsFailed) {
+			valid = false;
+			return;
+		}
+
+		for (size_t b = begin; b < end && valid; b++) {
+			const int rows = std::min(channel.blockRows, channel.height - static_cast<int>(b) * channel.blockRows);
+			const size_t start = b * blockFloats;
+			const size_t rawBytes = static_cast<size_t>(rows) * rowFloats * elementSize;
+			const Block& block = blocks[b];
+
+			if (block.rawBytes != rawBytes || block.offset > size || block.bytes > size - block.offset) {
+				valid = false;
+				break;
+			}
+
+			const uint8_t* encoded = data + block.offset;
+			if (channel.encoding == Encoding::Raw) {
+				if (block.bytes != rawBytes) {
+					valid = false;
+					break;
+				}
+
+				memcpy(out + start, encoded, rawBytes);
+			} else if (!lz::decompress(encoded, block.bytes, planes, rawBytes)) {
+				valid = false;
+			} else if (channel.encoding == Encoding::Lossless) {
+				decode_lossless(planes, reference ? reference + start : nullptr, rows, rowFloats, channel.components, out + start);
+			} else {
+				decode_quantized(planes, reference ? reference + start : nullptr, rows, rowFloats, channel.components, channel.scale, out + start);
+			}
+		}
+	});
+
+	return valid;
+}
+
+const float* SnapshotReader::map_channel(uint32_t channelId) const {
+	const Channel* channel = find(channelId);
+	if (!channel || channel->encoding != Encoding::Raw) return nullptr;
+
+	// the writer puts raw blocks back to back, but check, since the pointer gets handed out as one array
+	const Block* blocks = reinterpret_cast<const Block*>(mapped.data() + channel->blockTable);
+	const size_t bytes = sizeof(float) * channel->width * channel->height * channel->components;
+	if (blocks[0].offset % alignof(float) != 0 || blocks[0].offset > mapped.size() || bytes > mapped.size() - blocks[0].offset)
+		return nullptr;
+
+	uint64_t expected = blocks[0].offset;
+	for (uint32_t b = 0; b < channel->blockCount; b++) {
+		if (blocks[b].offset != expected) return nullptr;
+		expected += blocks[b].bytes;
+	}
+
+	return reinterpret_cast<const float*>(mapped.data() + blocks[0].offset);
+}
+
+bool SnapshotReader::read_grid(uint32_t channelId, float* out, int width, int height, int components, const float* referenceData) const {
+	const Channel* channel = find(channelId);
+	if (!channel || channel->width != width || channel->height != height || channel->components != components)
+		return false;
+
+	return read_channel(channelId, out, referenceData);
+}
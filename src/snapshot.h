@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stddef.h> // for size_t
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "mapped_file.h"
+
+// snapshots are files holding a few named float grids (channels), for saving and restoring simulation state
+//
+// layout, everything little endian:
+//   header                        magic, version, kind, channel count
+//   channel table                 one snapshot::Channel per channel, in the order they were written
+//   per channel: blocks, then a block table with the offset and size of every block
+// every block is a band of whole rows that's encoded on its own, so blocks can be encoded and decoded on
+// every core at once, and a reader can decode only the rows it wants
+// each channel's blocks start on a 64 byte boundary and follow each other, so raw channels can be used
+// straight out of the mapped file
+//
+// encodings:
+//   Raw        the floats as they are
+//   Lossless   every float's bits are XORed with a prediction (the cell to the left, or the same cell of a
+//              reference channel), the results are split into byte planes and compressed with lz, smooth
+//              grids come out with mostly zero high bytes that compress well, and nothing is lost
+//   Quantized  16 bit fixed point with a per channel scale, predicted the same way, about half the size
+//              of Lossless again but not exact, for level streaming where the last few bits don't matter
+namespace snapshot {
+	enum class Encoding : uint32_t {
+		Raw,
+		Lossless,
+		Quantized,
+	};
+
+	struct Channel {
+		uint32_t id;
+		Encoding encoding;
+		int32_t width, height, components; // components are floats per cell, interleaved
+		int32_t blockRows; // rows per block, the last block can have fewer
+		uint32_t blockCount;
+		uint32_t referenceId; // channel this one is predicted from, 0 for none
+		float scale; // quantization step, Quantized only
+		uint32_t reserved;
+		uint64_t blockTable; // file offset of blockCount Block entries
+	};
+
+	struct Block {
+		uint64_t offset;
+		uint32_t bytes; // encoded size
+		uint32_t rawBytes;
+	};
+
+	// channel ids are 4 characters, so they're readable in a hex dump
+	constexpr uint32_t id(const char (&name)[5]) {
+		return static_cast<uint32_t>(name[0]) | (static_cast<uint32_t>(name[1]) << 8)
+			| (static_cast<uint32_t>(name[2]) << 16) | (static_cast<uint32_t>(name[3]) << 24);
+	}
+
+	// ids every simulation uses for the same kind of grid
+	constexpr uint32_t CURRENT = id("CURR");
+	constexpr uint32_t PREVIOUS = id("PREV");
+	constexpr uint32_t OBSTRUCTION = id("OBST");
+	constexpr uint32_t SOURCE = id("SRCE");
+}
+
+// writes channels to the file as they're handed in, encoding a batch of blocks at a time across the
+// shared thread pool, so memory use doesn't depend on the size of the grids
+class SnapshotWriter {
+	FILE* file = nullptr;
+	std::string path, tempPath; // written to tempPath, which only replaces path once it's complete
+	bool failed = false;
+	uint32_t kind = 0;
+
+	snapshot::Channel* channels = nullptr;
+	int channelCount = 0, channelsWritten = 0;
+	uint64_t position = 0; // where the next write goes
+
+	// encoded blocks of the current batch, each gets lz::bound of the largest block
+	uint8_t* batchBuffer = nullptr;
+	size_t batchSlotSize = 0;
+	int batchSlots = 0;
+
+	void write(const void* data, size_t bytes);
+	void pad_to_alignment();
+
+public:
+	SnapshotWriter() = default;
+	~SnapshotWriter();
+
+	// kind identifies what wrote the snapshot, so a simulation can refuse a snapshot of another kind
+	// channelCount has to be the number of write_channel calls that follow
+	bool open(const char* path, uint32_t kind, int channelCount);
+
+	// reference (optional) is a channel written before this one, and referenceData its original values,
+	// a grid that's close to another one (the previous heights to the current ones) shrinks to almost nothing
+	bool write_channel(uint32_t id, const float* data, int width, int height, int components, snapshot::Encoding encoding,
+		uint32_t referenceId = 0, const float* referenceData = nullptr);
+
+	// false if any write failed along the way, the file at path is left as it was then
+	bool close();
+};
+
+// decodes channels out of a mapped snapshot, across the shared thread pool
+class SnapshotReader {
+	MappedFile mapped;
+	uint32_t kind = 0;
+	const snapshot::Channel* channels = nullptr;
+	int channelCount = 0;
+
+public:
+	// checks the header and channel table, but doesn't decode anything yet
+	bool open(const char* path);
+	void close();
+
+	uint32_t get_kind() const { return kind; }
+	int get_channel_count() const { return channelCount; }
+
+	// nullptr if there's no channel with that id
+	const snapshot::Channel* find(uint32_t id) const;
+
+	// out has to hold width * height * components floats
+	// a channel written with a reference needs the reference's decoded values (read it first)
+	bool read_channel(uint32_t id, float* out, const float* referenceData = nullptr) const;
+
+	// the channel's floats straight out of the mapped file, without a copy
+	// only Raw channels have them, nullptr for anything else
+	const float* map_channel(uint32_t id) const;
+
+	// reads a channel that has to have the given size, the usual way of restoring a grid
+	bool read_grid(uint32_t id, float* out, int width, int height, int components = 1, const float* referenceData = nullptr) const;
+};
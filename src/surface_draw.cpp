@@ -3,29 +3,95 @@
 #include "surface_draw.h"
 
 #include "gl_renderer.h"
+#include "smath.h"
 
 #include <math.h>
 #include <stdlib.h>
+#include <stdint.h>
+
+#include <algorithm>
 
 const char* surfaceVertexShader = /* vertex shader */ R"(
 #version 460 core
 
-layout (location = 0) in vec2 inPos;
-layout (location = 1) in vec2 inUv;
+// has to match SurfaceDraw::PATCH_QUADS
+const int PATCH_QUADS = 32;
+
+// vertices start sliding onto the coarser grid at this fraction of their level's range, SurfaceDraw::MIN_LOD_DISTANCE depends on it
+const float MORPH_START = 0.85;
+
+struct Node {
+	vec2 corner;
+	float size;
+	float level;
+};
 
-out vec4 outPos;
-out vec3 outNormal;
+layout (std430, binding = 0) readonly buffer Nodes {
+	Node nodes[];
+};
 
+out vec3 worldPos;
+out vec3 worldNormal;
+out float foam;
+
+// everything here is in cells, x and z along the grid and y up, transform takes that to clip space
 uniform mat4 transform;
 uniform float heightMultiplier;
-uniform vec2 texelSize;
+uniform ivec2 gridSize;
+uniform vec3 cameraPos;
+uniform float lodRange; // range of level 0, doubling every level
 uniform sampler2D surfaceTex;
 
-void main() {
-	float surfaceValue = texture(surfaceTex, inUv).r * heightMultiplier;
+// r = height, gb = slope, a = foam, see SurfaceSim::get_pyramid_tex
+uniform bool usePyramid;
+uniform sampler2D pyramidTex;
+
+float height_at(vec2 cell) {
+	return textureLod(surfaceTex, (cell + 0.5) / vec2(gridSize), 0.0).r * heightMultiplier;
+}
 
+void main() {
+	Node node = nodes[gl_InstanceID];
+	vec2 patchPos = vec2(gl_VertexID % (PATCH_QUADS + 1), gl_VertexID / (PATCH_QUADS + 1));
+	vec2 cell = node.corner + (patchPos * node.size);
+
+	// the distance is measured to the flat plane so that neighbouring patches agree on it exactly
+	float range = lodRange * exp2(node.level);
+	float dist = length(vec3(cell.x - cameraPos.x, cameraPos.y, cell.y - cameraPos.z));
+	float morph = clamp((dist - (range * MORPH_START)) / (range * (1.0 - MORPH_START)), 0.0, 1.0);
+
+	// odd vertices move onto their even neighbour, at morph = 1 the patch is the next level's grid
+	patchPos -= fract(patchPos * 0.5) * 2.0 * morph;
+	cell = min(node.corner + (patchPos * node.size), vec2(gridSize - 1));
+
+	if(usePyramid) {
+		// the level whose texels are as far apart as this patch's vertices, one sample gets the height,
+		// slope and foam already averaged over the area the vertex stands for
+		// morph blends towards the next level along with the geometry, so patch edges read the same lod
+		// the pyramid is rounded up to a power of 2, so it's addressed by its own size
+		float lod = node.level + morph;
+		vec2 pyramidUv = (cell + 0.5) / vec2(textureSize(pyramidTex, 0));
+		vec4 texel = textureLod(pyramidTex, pyramidUv, lod);
+
+		// half floats are too coarse for heights up close, level 0 comes from the grid itself
+		float h = texel.r;
+		if(lod < 1.0)
+			h = mix(textureLod(surfaceTex, (cell + 0.5) / vec2(gridSize), 0.0).r, textureLod(pyramidTex, pyramidUv, 1.0).r, lod);
+
+		worldNormal = normalize(vec3(-texel.g * heightMultiplier, 1.0, -texel.b * heightMultiplier));
+		worldPos = vec3(cell.x, h * heightMultiplier, cell.y);
+		foam = texel.a;
+	} else {
+		// central differences over the node's vertex spacing, so far away patches don't pick up single cell noise
+		float s = node.size;
+		float dx = height_at(cell + vec2(s, 0.0)) - height_at(cell - vec2(s, 0.0));
+		float dz = height_at(cell + vec2(0.0, s)) - height_at(cell - vec2(0.0, s));
+		worldNormal = normalize(vec3(-dx / (2.0 * s), 1.0, -dz / (2.0 * s)));
+		worldPos = vec3(cell.x, height_at(cell), cell.y);
+		foam = 0.0;
+	}
 
-	outPos = transform * vec4(inPos, surfaceValue, 1.0);
+	gl_Position = transform * vec4(worldPos, 1.0);
 }
 
 )";
@@ -33,13 +99,33 @@ void main() {
 const char* surfaceFragShader = /* fragment shader */ R"(
 #version 460 core
 
-in vec4 inNormal;
+in vec3 worldPos;
+in vec3 worldNormal;
+in float foam;
 
 out vec4 outColor;
 
+uniform vec3 cameraPos;
+
+const vec3 lightDir = normalize(vec3(0.4, 1.0, 0.3));
+const vec3 deepColor = vec3(0.02, 0.12, 0.22);
+const vec3 shallowColor = vec3(0.1, 0.45, 0.6);
+const vec3 skyColor = vec3(0.65, 0.8, 0.95);
+const vec3 foamColor = vec3(0.9, 0.93, 0.95);
 
 void main() {
-	outColor = vec4(1.0, 0.5, 0.5, 1.0);
+	vec3 n = normalize(worldNormal);
+	vec3 v = normalize(cameraPos - worldPos);
+
+	float diffuse = max(dot(n, lightDir), 0.0);
+	float specular = pow(max(dot(n, normalize(lightDir + v)), 0.0), 64.0);
+
+	// schlick's approximation with water's reflectance at normal incidence
+	float fresnel = 0.02 + 0.98 * pow(1.0 - max(dot(n, v), 0.0), 5.0);
+
+	vec3 color = mix(mix(deepColor, shallowColor, diffuse), skyColor, fresnel) + vec3(specular);
+	color = mix(color, foamColor * (0.5 + (0.5 * diffuse)), foam);
+	outColor = vec4(color, 1.0);
 }
 
 )";
@@ -49,59 +135,206 @@ SurfaceDraw::SurfaceDraw() {
 
 	transformLoc = Renderer::shader_loc(shader, "transform");
 	heightLoc = Renderer::shader_loc(shader, "heightMultiplier");
+	gridSizeLoc = Renderer::shader_loc(shader, "gridSize");
+	cameraLoc = Renderer::shader_loc(shader, "cameraPos");
+	lodRangeLoc = Renderer::shader_loc(shader, "lodRange");
 	surfaceLoc = Renderer::shader_loc(shader, "surfaceTex");
-
-	planeVao = 0;
-	planeVbo = 0;
+	usePyramidLoc = Renderer::shader_loc(shader, "usePyramid");
+	pyramidLoc = Renderer::shader_loc(shader, "pyramidTex");
 }
 
 SurfaceDraw::~SurfaceDraw() {
+	clean();
+}
 
+// distance from the camera to the closest point of a node, on the flat plane like the morph in the shader
+static float node_distance(const float* camera, float minX, float minY, float maxX, float maxY) {
+	float dx = std::max(std::max(minX - camera[0], camera[0] - maxX), 0.0f);
+	float dy = std::max(std::max(minY - camera[2], camera[2] - maxY), 0.0f);
+	return sqrtf((dx * dx) + (camera[1] * camera[1]) + (dy * dy));
 }
 
-void SurfaceDraw::draw_tex(GLuint texture) {
-	glUseProgram(shader);
-	Renderer::attach_tex(texture, surfaceLoc, texture, 0);
+void SurfaceDraw::select(const Selection& selection, float x, float y, int level) {
+	if (nodeCount >= MAX_NODES) return;
+
+	const float fieldX = static_cast<float>(gridX - 1);
+	const float fieldY = static_cast<float>(gridY - 1);
+	if (x >= fieldX || y >= fieldY) return; // the root is a power of 2, so some nodes miss the field entirely
+
+	const float size = static_cast<float>(PATCH_QUADS << level);
+	const float maxX = std::min(x + size, fieldX);
+	const float maxY = std::min(y + size, fieldY);
+
+	// the box is outside if its corner furthest along a plane's normal is still behind it
+	for (const float* plane : selection.frustum) {
+		float px = plane[0] >= 0.0f ? maxX : x;
+		float py = plane[1] >= 0.0f ? selection.heightBound : -selection.heightBound;
+		float pz = plane[2] >= 0.0f ? maxY : y;
+
+		if ((plane[0] * px) + (plane[1] * py) + (plane[2] * pz) + plane[3] < 0.0f)
+			return;
+	}
+
+	// the next level down takes over for anything within its range
+	if (level > 0 && node_distance(selection.camera, x, y, maxX, maxY) < selection.ranges[level - 1]) {
+		const float half = size * 0.5f;
+		select(selection, x, y, level - 1);
+		select(selection, x + half, y, level - 1);
+		select(selection, x, y + half, level - 1);
+		select(selection, x + half, y + half, level - 1);
+		return;
+	}
+
+	nodes[nodeCount++] = { x, y, static_cast<float>(1 << level), static_cast<float>(level) };
+}
+
+void SurfaceDraw::draw_tex(GLuint texture, GLuint pyramid) {
+	nodeCount = 0;
+	if (patchVao == 0) return;
 
 	int viewSize[4];
 	glGetIntegerv(GL_VIEWPORT, viewSize);
-	float width = static_cast<float>(viewSize[2] - viewSize[0]);
-	float height = static_cast<float>(viewSize[3] - viewSize[1]);
+	float width = static_cast<float>(viewSize[2]);
+	float height = static_cast<float>(viewSize[3]);
+
+	// the camera sits on a sphere around the origin, the view matrix undoes its rotation and distance
+	float cameraPos[3] = {
+		distance * cosf(pitch) * sinf(yaw),
+		distance * sinf(pitch),
+		distance * cosf(pitch) * cosf(yaw),
+	};
+
+	// the mesh is built in cells, the model matrix scales it to 2 units wide and centers it
+	const float cellSize = 2.0f / static_cast<float>(gridX - 1);
+	const float offsetX = static_cast<float>(gridX - 1) * cellSize * 0.5f;
+	const float offsetY = static_cast<float>(gridY - 1) * cellSize * 0.5f;
+
+	Matrix4 model = Matrix4::translation(-offsetX, 0.0f, -offsetY) * Matrix4::scale(cellSize, cellSize, cellSize);
+	Matrix4 view = Matrix4::translation(0.0f, 0.0f, -distance) * Matrix4::rotationX(pitch) * Matrix4::rotationY(-yaw);
+	Matrix4 mvp = Matrix4::perspective(static_cast<float>(M_PI) / 3.0f, width / height, 0.01f, 100.0f) * view * model;
+
+	Selection selection;
+	selection.camera[0] = (cameraPos[0] + offsetX) / cellSize;
+	selection.camera[1] = cameraPos[1] / cellSize;
+	selection.camera[2] = (cameraPos[2] + offsetY) / cellSize;
+	selection.heightBound = heightBound * heightMultiplier;
+
+	for (int i = 0; i < 32; i++)
+		selection.ranges[i] = std::max(lodDistance, MIN_LOD_DISTANCE) * static_cast<float>(PATCH_QUADS) * powf(2.0f, static_cast<float>(i));
+
+	// gribb/hartmann, the clip planes are sums and differences of the matrix rows
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 4; j++) {
+			selection.frustum[i * 2][j] = mvp(3, j) + mvp(i, j);
+			selection.frustum[(i * 2) + 1][j] = mvp(3, j) - mvp(i, j);
+		}
+	}
+
+	select(selection, 0.0f, 0.0f, rootLevel);
+	if (nodeCount == 0) return;
+
+	glNamedBufferSubData(nodeBuffer, 0, sizeof(Node) * nodeCount, nodes);
+
+	Renderer::use_program(shader);
+	Renderer::attach_tex(shader, surfaceLoc, texture, 0);
+	if (pyramid)
+		Renderer::attach_tex(shader, pyramidLoc, pyramid, 1);
+	glUniform1i(usePyramidLoc, pyramid != 0);
 
-	//mvp = Matrix4::perspective(M_PI, width / height, 0.001f, 1000.0f) * Matrix4::transform(0.0f);
-	//glUniformMatrix4fv(transformLoc, 1, GL_FALSE, mvp.m);
+	glUniformMatrix4fv(transformLoc, 1, GL_FALSE, mvp.m);
+	glUniform1f(heightLoc, heightMultiplier);
+	glUniform2i(gridSizeLoc, gridX, gridY);
+	glUniform3fv(cameraLoc, 1, selection.camera);
+	glUniform1f(lodRangeLoc, selection.ranges[0]);
 
-	glBindVertexArray(planeVao);
-	glDrawArrays(GL_TRIANGLES, 0, numQuads * 6);
+	Renderer::set_capability(GL_DEPTH_TEST, true);
+	Renderer::set_capability(GL_BLEND, false);
+	Renderer::set_capability(GL_CULL_FACE, false);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, nodeBuffer);
+	Renderer::bind_vertex_array(patchVao);
+	glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, nullptr, nodeCount);
 }
 
 void SurfaceDraw::gen_plane(int nx, int ny) {
-	constexpr size_t sizeVertex = 4; // number of floats in 1 vertex
-	constexpr size_t sizeQuad = sizeVertex * 6;
-	const size_t numQuads = nx * ny;
-	const size_t numVertices = sizeQuad * numQuads;
-
 	clean();
-	planeVertices = static_cast<float*>(malloc(numVertices * sizeof(float)));
+	if (nx < 2 || ny < 2) return;
+
+	nodes = static_cast<Node*>(malloc(sizeof(Node) * MAX_NODES));
+	indexCount = gen_patch_mesh(PATCH_QUADS, patchVao, patchIbo);
+	if (!nodes || indexCount == 0) {
+		clean();
+		return;
+	}
+
+	glCreateBuffers(1, &nodeBuffer);
+	glNamedBufferStorage(nodeBuffer, sizeof(Node) * MAX_NODES, nullptr, GL_DYNAMIC_STORAGE_BIT);
 
+	gridX = nx;
+	gridY = ny;
 
-	for (int i = 0; i < numVertices; i += sizeQuad) {
+	// the root is the smallest power of 2 number of patches that covers the field
+	const int fieldSize = std::max(nx, ny) - 1;
+	rootLevel = 0;
+	while ((PATCH_QUADS << rootLevel) < fieldSize)
+		rootLevel++;
+}
+
+GLsizei SurfaceDraw::gen_patch_mesh(int quads, GLuint& vao, GLuint& ibo) {
+	const int patchVertices = quads + 1;
+	const size_t numIndices = static_cast<size_t>(quads) * quads * 6;
+
+	uint32_t* indices = static_cast<uint32_t*>(malloc(numIndices * sizeof(uint32_t)));
+	if (!indices) return 0;
+
+	size_t i = 0;
+	for (int y = 0; y < quads; y++) {
+		for (int x = 0; x < quads; x++) {
+			uint32_t topLeft = static_cast<uint32_t>(x + (y * patchVertices));
+			uint32_t bottomLeft = topLeft + static_cast<uint32_t>(patchVertices);
+
+			indices[i++] = topLeft;
+			indices[i++] = bottomLeft;
+			indices[i++] = topLeft + 1;
+
+			indices[i++] = topLeft + 1;
+			indices[i++] = bottomLeft;
+			indices[i++] = bottomLeft + 1;
+		}
 	}
+
+	glCreateBuffers(1, &ibo);
+	glNamedBufferStorage(ibo, numIndices * sizeof(uint32_t), indices, 0);
+	free(indices);
+
+	glCreateVertexArrays(1, &vao);
+	glVertexArrayElementBuffer(vao, ibo);
+
+	return static_cast<GLsizei>(numIndices);
 }
 
 void SurfaceDraw::clean() {
-	if (planeVertices) {
-		free(planeVertices);
-		planeVertices = nullptr;
+	if (patchVao != 0) {
+		glDeleteVertexArrays(1, &patchVao);
+		patchVao = 0;
 	}
 
-	if (planeVao != 0) {
-		glDeleteVertexArrays(1, &planeVao);
-		planeVao = 0;
+	if (patchIbo != 0) {
+		glDeleteBuffers(1, &patchIbo);
+		patchIbo = 0;
 	}
 
-	if (planeVbo != 0) {
-		glDeleteBuffers(1, &planeVbo);
-		planeVbo = 0;
+	if (nodeBuffer != 0) {
+		glDeleteBuffers(1, &nodeBuffer);
+		nodeBuffer = 0;
 	}
-}
\ No newline at end of file
+
+	free(nodes);
+	nodes = nullptr;
+	nodeCount = 0;
+
+	gridX = 0;
+	gridY = 0;
+	rootLevel = 0;
+	indexCount = 0;
+}
@@ -3,22 +3,102 @@
 #include <GL/gl3w.h>
 #include "gl_renderer.h"
 
+// draws a height field texture as a 3D mesh, with a quadtree LOD so the triangle count depends on the
+// view instead of the size of the field (CDLOD, https://github.com/fstrugar/CDLOD)
+//
+// every quadtree node is drawn with the same static patch mesh, scaled to the node's size, so a node one
+// level up has half the vertex density. the nodes are picked on the CPU every frame by distance to the camera
+// and culled against the view frustum, and the list goes to the GPU as instance data
+// near the distance where a level hands over to the next one, the vertex shader slides every odd vertex onto
+// its even neighbour, so a patch has the coarser level's shape by the time it meets it and there are no cracks
+//
+// vertex positions come from gl_VertexID and gl_InstanceID, heights and normals are read from the texture,
+// so nothing but the node list is uploaded per frame
+// the lighting, shared with WaterWorld, takes worldPos, worldNormal and foam from the vertex shader and a
+// cameraPos uniform in the same space as worldPos
+extern const char* surfaceFragShader;
+
 class SurfaceDraw {
-	size_t numQuads;
-	float* planeVertices = nullptr;
+public:
+	// quads along one side of the patch mesh, a level 0 node covers this many cells
+	static constexpr int PATCH_QUADS = 32;
+	static constexpr int MAX_NODES = 2048;
+
+	struct Node {
+		float x, y; // corner, in cells
+		float size; // cells per quad
+		float level;
+	};
+
+private:
+	int gridX = 0, gridY = 0;
+	int rootLevel = 0; // level of the node that covers the whole field
+	GLsizei indexCount = 0;
 
-	GLuint planeVao, planeVbo;
+	// the vao has no vertex attributes, only the patch's index buffer
+	GLuint patchVao = 0, patchIbo = 0;
+	GLuint nodeBuffer = 0; // MAX_NODES Nodes, as an SSBO
+
+	Node* nodes = nullptr;
+	int nodeCount = 0;
 
 	GLuint shader;
-	GLint transformLoc, heightLoc, surfaceLoc;
+	GLint transformLoc, heightLoc, gridSizeLoc, cameraLoc, lodRangeLoc, surfaceLoc;
+	GLint usePyramidLoc, pyramidLoc;
+
+	struct Selection {
+		float camera[3]; // in cells, with heights scaled the same way as the mesh
+		float frustum[6][4]; // planes in cell space, (a, b, c, d) with ax + by + cz + d >= 0 inside
+		float ranges[32]; // distance at which each level hands over to the next one, in cells
+		float heightBound; // in cells
+	};
+
+	void select(const Selection& selection, float x, float y, int level);
 
-	//Matrix4 mvp;
 public:
+	// orbit camera around the center of the plane, angles in radians
+	float yaw = 0.6f, pitch = 0.6f, distance = 2.5f;
+
+	// heights are in cells, this scales them relative to the cell size
+	float heightMultiplier = 1.0f;
+
+	// level 0 nodes are used up to lodDistance * PATCH_QUADS cells away, every level after that doubles it
+	// below MIN_LOD_DISTANCE a patch can be next to a coarser one that has already started morphing, which
+	// opens up cracks, so it gets clamped to that
+	// with D = lodDistance, P = PATCH_QUADS and r = D * P * 2^L the range of level L, for a level L patch next
+	// to a level L + 1 one:
+	// - the coarse one wasn't split, so every point on the shared edge is at least r away and the fine side is
+	//   fully morphed there, for any D
+	// - the fine one's parent was split, so it's closer than r, and its side is 2 * P * 2^L, so the edge is
+	//   closer than r + 2 * sqrt(2) * P * 2^L. the coarse side starts morphing at MORPH_START * 2r, so it's
+	//   still flat as long as D + 2 * sqrt(2) <= 2 * MORPH_START * D, which is D >= 4.04 with MORPH_START 0.85
+	// the same two bounds also rule out neighbours two levels apart (D >= 2 * sqrt(2)), 5 leaves some slack
+	static constexpr float MIN_LOD_DISTANCE = 5.0f;
+	float lodDistance = MIN_LOD_DISTANCE;
+
+	// the largest height (in cells, before heightMultiplier) the field is expected to reach
+	// only used for culling, anything above it can get culled at the edges of the screen
+	float heightBound = 32.0f;
+
 	SurfaceDraw();
 	~SurfaceDraw();
 
-	void draw_tex(GLuint texture);
+	// texture has to be a single channel float texture of gen_plane's size, like SurfaceSim::get_height_tex
+	// with a pyramid (SurfaceSim::get_pyramid_tex) coarse patches sample coarse levels of it, and it adds foam
+	// draws into the current framebuffer with depth testing
+	void draw_tex(GLuint texture, GLuint pyramid = 0);
+
+	// sets up the quadtree for an nx by ny field, the plane is 2 units wide and keeps the field's aspect ratio
 	void gen_plane(int nx, int ny);
 
 	void clean();
-};
\ No newline at end of file
+
+	// the static patch mesh, a (quads + 1)^2 vertex grid with two triangles per quad and vertex (x, y) at
+	// x + y * (quads + 1), so it's addressed by gl_VertexID. vao only has ibo as its element buffer
+	// returns the number of indices, 0 if it couldn't be made
+	static GLsizei gen_patch_mesh(int quads, GLuint& vao, GLuint& ibo);
+
+	// from the last draw_tex
+	int get_node_count() const { return nodeCount; }
+	int get_triangle_count() const { return nodeCount * PATCH_QUADS * PATCH_QUADS * 2; }
+};
@@ -5,6 +5,12 @@
 
 class SurfaceSim {
 public:
+	virtual ~SurfaceSim() {}
+
+	// releases the GL objects, has to run while the context is still alive, so before glfwTerminate
+	// the destructors call it too, it does nothing the second time
+	virtual void clean() {}
+
 	// places source circle at (x, y) with radius r
 	virtual void place_source(int x, int y, float r, float strength) = 0;
 
@@ -17,9 +23,31 @@ public:
 	// reset simulation state
 	virtual void reset() = 0;
 
+	// the tunables that change how the simulation steps (damping, wave speed, ...), so an InputJournal can
+	// record them being changed between steps and replay that too
+	// get_params fills out (room for MAX_PARAMS) and returns how many there are, set_params takes them back
+	static constexpr int MAX_PARAMS = 8;
+	virtual int get_params(float* out) const { return 0; }
+	virtual void set_params(const float* values, int count) {}
+
+	// writes the whole simulation state to a snapshot file (see snapshot.h), lossy stores heights as 16 bits
+	// false if writing failed, or if the simulation can't save its state
+	virtual bool save_state(const char* path, bool lossy = false) { return false; }
+
+	// restores a snapshot that save_state wrote from the same kind of simulation with the same size
+	// false if it couldn't, the state is only left alone if the file was rejected before decoding
+	virtual bool load_state(const char* path) { return false; }
+
 	// uses internal variables to get a texture that can be presented to the screen
 	virtual GLuint get_display() = 0;
 
+	// single channel float texture with the raw heights, one texel per cell, for displacing geometry with
+	virtual GLuint get_height_tex() = 0;
+
+	// full mip chain of the heights, r = height, gb = slope (dh/dx, dh/dy), a = foam
+	// 0 if the simulation doesn't build one
+	virtual GLuint get_pyramid_tex() { return 0; }
+
 	// if the simulation wants to display any data in a UI
 	virtual void imgui_builder(bool* open = nullptr) {}
 };
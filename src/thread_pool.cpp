@@ -0,0 +1,117 @@
+#include "thread_pool.h"
+
+#include <assert.h>
+
+// the pool whose job this thread is running, if any, only used to catch parallel_for being reentered
+static thread_local const ThreadPool* runningPool = nullptr;
+
+//
+// private
+//
+void ThreadPool::worker_loop(size_t index) {
+	uint64_t seen = 0;
+	runningPool = this;
+
+	while (true) {
+		JobFn currentJob = nullptr;
+		void* currentContext = nullptr;
+		size_t begin = 0, end = 0;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return stopping || generation != seen; });
+			if (stopping) return;
+
+			seen = generation;
+			currentJob = job;
+			currentContext = context;
+
+			// range 0 belongs to the calling thread
+			if (index + 1 < parts) {
+				begin = (count * (index + 1)) / parts;
+				end = (count * (index + 2)) / parts;
+			}
+		}
+
+		if (begin < end)
+			currentJob(currentContext, begin, end);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--remaining == 0)
+				done.notify_one();
+		}
+	}
+}
+
+// every worker has to check in for every generation before run returns, so a worker can never
+// pick up a stale job
+void ThreadPool::run(size_t jobCount, size_t grain, JobFn jobFn, void* jobContext) {
+	assert(runningPool != this && "parallel_for called from inside one of its own jobs");
+	if (jobCount == 0) return;
+
+	const ThreadPool* outerPool = runningPool;
+
+	size_t jobParts = grain > 0 ? jobCount / grain : jobCount;
+	if (jobParts > workerCount + 1)
+		jobParts = workerCount + 1;
+
+	if (jobParts <= 1) {
+		runningPool = this;
+		jobFn(jobContext, 0, jobCount);
+		runningPool = outerPool;
+		return;
+	}
+
+	std::lock_guard<std::mutex> submitLock(submitMutex);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = jobFn;
+		context = jobContext;
+		count = jobCount;
+		parts = jobParts;
+		remaining = workerCount;
+		generation++;
+	}
+
+	wake.notify_all();
+
+	const size_t end = jobCount / jobParts;
+	if (end > 0) {
+		runningPool = this;
+		jobFn(jobContext, 0, end);
+		runningPool = outerPool;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [&] { return remaining == 0; });
+}
+
+//
+// public
+//
+ThreadPool::ThreadPool(int threadCount) {
+	workerCount = threadCount > 1 ? static_cast<size_t>(threadCount - 1) : 0;
+	workers.reserve(workerCount);
+
+	for (size_t i = 0; i < workerCount; i++)
+		workers.emplace_back(&ThreadPool::worker_loop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+
+	wake.notify_all();
+
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+ThreadPool& ThreadPool::shared() {
+	static ThreadPool pool(static_cast<int>(std::thread::hardware_concurrency()));
+	return pool;
+}
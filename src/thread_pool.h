@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h> // for size_t
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// a fixed set of worker threads that are kept alive between jobs, so splitting work across them
+// only costs a wakeup instead of a thread creation
+// the thread calling parallel_for always takes a share of the work too
+class ThreadPool {
+	using JobFn = void (*)(void* context, size_t begin, size_t end);
+
+	std::vector<std::thread> workers;
+	size_t workerCount = 0; // fixed before the workers start, so they don't read the vector while it grows
+
+	std::mutex submitMutex; // only one job at a time
+	std::mutex mutex;
+	std::condition_variable wake, done;
+
+	// the current job, only touched while holding mutex
+	JobFn job = nullptr;
+	void* context = nullptr;
+	size_t count = 0;
+	size_t parts = 0; // how many ranges count is split into, at most workerCount + 1
+	uint64_t generation = 0;
+	size_t remaining = 0; // workers that haven't finished the current generation yet
+	bool stopping = false;
+
+	void worker_loop(size_t index);
+	void run(size_t count, size_t grain, JobFn job, void* context);
+
+public:
+	// threadCount includes the calling thread, so 1 means everything runs inline
+	explicit ThreadPool(int threadCount);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int size() const { return static_cast<int>(workerCount) + 1; }
+
+	// splits [0, count) into one contiguous range per thread and calls job(begin, end) on each,
+	// returning once every range is done, so consecutive calls act as a barrier
+	// ranges are kept at least grain long, so small jobs use fewer threads (or just run inline)
+	// it isn't reentrant, a job calling parallel_for on the same pool would deadlock, so that asserts
+	// (even when both would have run inline), jobs have to use the serial versions of things instead
+	// different threads can call it at the same time, the jobs just run one after the other
+	template <typename Job>
+	void parallel_for(size_t count, Job&& job, size_t grain = 1) {
+		using JobType = std::remove_reference_t<Job>;
+
+		run(count, grain, [](void* context, size_t begin, size_t end) {
+			(*static_cast<JobType*>(context))(begin, end);
+		}, const_cast<std::remove_const_t<JobType>*>(&job));
+	}
+
+	// shared by everything that doesn't need its own pool, one thread per core
+	static ThreadPool& shared();
+};
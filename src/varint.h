@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+// zigzag maps signed values to unsigned ones with small magnitudes staying small (0, -1, 1, -2 -> 0, 1, 2, 3),
+// so residuals that hover around 0 go into few bytes as varints, or compress well as byte planes
+inline uint32_t zigzag(int32_t value) {
+	return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+inline int32_t unzigzag(uint32_t value) {
+	return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+// the same for 16 bit values, named apart so an int16_t never picks the wrong one by accident
+inline uint16_t zigzag16(int16_t value) {
+	return static_cast<uint16_t>((static_cast<uint16_t>(value) << 1) ^ static_cast<uint16_t>(value >> 15));
+}
+
+inline int16_t unzigzag16(uint16_t value) {
+	return static_cast<int16_t>((value >> 1) ^ (0 - (value & 1)));
+}
+
+// 7 bits per byte, low bits first, the top bit is set on every byte but the last, so at most 5 bytes
+inline uint8_t* put_varint(uint8_t* out, uint32_t value) {
+	while (value >= 0x80) {
+		*out++ = static_cast<uint8_t>(value | 0x80);
+		value >>= 7;
+	}
+
+	*out++ = static_cast<uint8_t>(value);
+	return out;
+}
+
+// returns nullptr if the data ends before the value does, or it's longer than 5 bytes
+inline const uint8_t* get_varint(const uint8_t* in, const uint8_t* end, uint32_t& value) {
+	value = 0;
+	for (int shift = 0; in < end && shift < 32; shift += 7) {
+		uint8_t byte = *in++;
+		value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+		if (0 == (byte & 0x80))
+			return in;
+	}
+
+	return nullptr;
+}
@@ -0,0 +1,393 @@
+#define _USE_MATH_DEFINES
+
+#include "water_world.h"
+#include "surface_draw.h"
+
+#include "external/imgui.h"
+#include "smath.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <algorithm>
+
+const char* waterWorldVertexShader = /* vertex shader */ R"(
+#version 460 core
+
+// has to match WaterWorld::PATCH_QUADS
+const int PATCH_QUADS = 16;
+
+struct Patch {
+	vec2 corner;
+	vec2 last;
+	vec2 first;
+	vec2 world;
+	float cellSize;
+	float pad0, pad1, pad2;
+};
+
+layout (std430, binding = 0) readonly buffer Patches {
+	Patch patches[];
+};
+
+// the same outputs as SurfaceDraw's vertex shader, so its fragment shader lights the ponds too
+out vec3 worldPos;
+out vec3 worldNormal;
+out float foam;
+
+uniform mat4 transform;
+uniform float heightMultiplier;
+uniform sampler2D atlasTex;
+
+float height_at(vec2 cell) {
+	return texelFetch(atlasTex, ivec2(cell), 0).r * heightMultiplier;
+}
+
+void main() {
+	Patch p = patches[gl_InstanceID];
+	vec2 patchPos = vec2(gl_VertexID % (PATCH_QUADS + 1), gl_VertexID / (PATCH_QUADS + 1));
+
+	// patches hanging over the edge of their body fold their extra vertices onto the last row/column
+	vec2 cell = min(p.corner + patchPos, p.last);
+
+	// neighbours are clamped to the body as well, the gutter around it is walls with no height
+	float dx = height_at(min(cell + vec2(1.0, 0.0), p.last)) - height_at(max(cell - vec2(1.0, 0.0), p.first));
+	float dz = height_at(min(cell + vec2(0.0, 1.0), p.last)) - height_at(max(cell - vec2(0.0, 1.0), p.first));
+	worldNormal = normalize(vec3(-dx * 0.5, 1.0, -dz * 0.5));
+
+	vec2 local = (cell - p.first) * p.cellSize;
+	worldPos = vec3(p.world.x + local.x, height_at(cell) * p.cellSize, p.world.y + local.y);
+	foam = 0.0;
+	gl_Position = transform * vec4(worldPos, 1.0);
+}
+
+)";
+
+void WaterWorld::init(int w, int h, int kernelRadius) {
+	clean();
+
+	bodies = static_cast<Body*>(calloc(MAX_BODIES, sizeof(Body)));
+	stamps = static_cast<IWaveSurfaceGPU::Stamp*>(malloc(sizeof(IWaveSurfaceGPU::Stamp) * MAX_STAMPS));
+	if (!bodies || !stamps) {
+		clean();
+		return;
+	}
+
+	atlasWidth = w;
+	atlasHeight = h;
+	gutter = kernelRadius;
+	surface = new IWaveSurfaceGPU(w, h, kernelRadius);
+
+	shader = Renderer::compile_shader(waterWorldVertexShader, surfaceFragShader);
+	transformLoc = Renderer::shader_loc(shader, "transform");
+	heightLoc = Renderer::shader_loc(shader, "heightMultiplier");
+	cameraLoc = Renderer::shader_loc(shader, "cameraPos");
+	atlasLoc = Renderer::shader_loc(shader, "atlasTex");
+
+	// the same patch mesh as SurfaceDraw, with smaller patches since bodies are small
+	indexCount = SurfaceDraw::gen_patch_mesh(PATCH_QUADS, patchVao, patchIbo);
+	if (indexCount == 0) {
+		clean();
+		return;
+	}
+
+	// everything starts out as walls, add_body opens up its own rectangle
+	reset();
+}
+
+void WaterWorld::clean() {
+	if (surface) {
+		delete surface;
+		surface = nullptr;
+	}
+
+	if (shader != 0) {
+		Renderer::delete_program(shader);
+		shader = 0;
+	}
+
+	if (patchVao != 0) {
+		glDeleteVertexArrays(1, &patchVao);
+		patchVao = 0;
+	}
+
+	if (patchIbo != 0) {
+		glDeleteBuffers(1, &patchIbo);
+		patchIbo = 0;
+	}
+
+	if (patchBuffer != 0) {
+		glDeleteBuffers(1, &patchBuffer);
+		patchBuffer = 0;
+	}
+
+	free(bodies);
+	free(stamps);
+	free(patches);
+	bodies = nullptr;
+	stamps = nullptr;
+	patches = nullptr;
+
+	bodyCount = 0;
+	liveCount = 0;
+	stampCount = 0;
+	patchCount = 0;
+	patchCapacity = 0;
+	patchesDirty = false;
+	shelfX = 0;
+	shelfY = 0;
+	shelfHeight = 0;
+	atlasWidth = 0;
+	atlasHeight = 0;
+	indexCount = 0;
+}
+
+// a slot is the body plus the gutter on its left and top, the atlas keeps one more gutter along its right
+// and bottom edges so the last bodies are walled in too
+bool WaterWorld::find_slot(int w, int h, int& x, int& y) {
+	int nextX = shelfX, nextY = shelfY, nextHeight = shelfHeight;
+
+	// doesn't fit next to the others, start a new shelf under the current one
+	if (nextX + w + (gutter * 2) > atlasWidth) {
+		nextX = 0;
+		nextY += nextHeight;
+		nextHeight = 0;
+	}
+
+	if (nextX + w + (gutter * 2) > atlasWidth || nextY + h + (gutter * 2) > atlasHeight)
+		return false;
+
+	x = nextX + gutter;
+	y = nextY + gutter;
+
+	shelfX = nextX + w + gutter;
+	shelfY = nextY;
+	shelfHeight = std::max(nextHeight, h + gutter);
+	return true;
+}
+
+int WaterWorld::add_body(int w, int h, float worldX, float worldZ, float cellSize) {
+	if (!surface || w < 2 || h < 2) return -1;
+
+	// the smallest free slot that fits, before taking new space from the shelves
+	int id = -1;
+	for (int i = 0; i < bodyCount; i++) {
+		const Body& slot = bodies[i];
+		if (slot.alive || slot.slotWidth < w || slot.slotHeight < h) continue;
+
+		if (id < 0 || (slot.slotWidth * slot.slotHeight) < (bodies[id].slotWidth * bodies[id].slotHeight))
+			id = i;
+	}
+
+	if (id < 0) {
+		int x, y;
+		if (bodyCount >= MAX_BODIES || !find_slot(w, h, x, y))
+			return -1;
+
+		id = bodyCount++;
+		bodies[id].atlasX = x;
+		bodies[id].atlasY = y;
+		bodies[id].slotWidth = w;
+		bodies[id].slotHeight = h;
+	}
+
+	Body& body = bodies[id];
+	body.width = w;
+	body.height = h;
+	body.worldX = worldX;
+	body.worldZ = worldZ;
+	body.cellSize = cellSize;
+	body.alive = true;
+	liveCount++;
+
+	// the rest of a reused slot stays walled off
+	surface->clear_region(body.atlasX, body.atlasY, w, h, 1.0f);
+	patchesDirty = true;
+	return id;
+}
+
+void WaterWorld::remove_body(int body) {
+	if (body < 0 || body >= bodyCount || !bodies[body].alive) return;
+
+	Body& removed = bodies[body];
+	surface->clear_region(removed.atlasX, removed.atlasY, removed.slotWidth, removed.slotHeight, 0.0f);
+	removed.alive = false;
+	liveCount--;
+	patchesDirty = true;
+}
+
+const WaterWorld::Body* WaterWorld::get_body(int body) const {
+	if (body < 0 || body >= bodyCount || !bodies[body].alive) return nullptr;
+	return &bodies[body];
+}
+
+float WaterWorld::get_atlas_usage() const {
+	if (atlasWidth == 0 || atlasHeight == 0) return 0.0f;
+
+	int64_t cells = 0;
+	for (int i = 0; i < bodyCount; i++) {
+		if (bodies[i].alive)
+			cells += static_cast<int64_t>(bodies[i].width) * bodies[i].height;
+	}
+
+	return static_cast<float>(cells) / static_cast<float>(static_cast<int64_t>(atlasWidth) * atlasHeight);
+}
+
+void WaterWorld::add_stamp(int body, int x, int y, float r, float source, float obstruction) {
+	if (body < 0 || body >= bodyCount || !bodies[body].alive || stampCount >= MAX_STAMPS) return;
+
+	const Body& b = bodies[body];
+	stamps[stampCount++] = {
+		static_cast<float>(b.atlasX + x), static_cast<float>(b.atlasY + y), r,
+		source, obstruction,
+		b.atlasX, b.atlasY, b.width, b.height
+	};
+}
+
+void WaterWorld::place_source(int body, int x, int y, float r, float strength) {
+	add_stamp(body, x, y, r, strength, 0.0f);
+}
+
+void WaterWorld::set_obstruction(int body, int x, int y, float r, float strength) {
+	add_stamp(body, x, y, r, 0.0f, strength);
+}
+
+void WaterWorld::sim_frame(float delta) {
+	if (!surface) return;
+
+	surface->place_stamps(stamps, stampCount);
+	stampCount = 0;
+
+	surface->sim_frame(delta);
+}
+
+void WaterWorld::reset() {
+	if (!surface) return;
+
+	surface->reset();
+	surface->clear_region(0, 0, atlasWidth, atlasHeight, 0.0f);
+	for (int i = 0; i < bodyCount; i++) {
+		if (bodies[i].alive)
+			surface->clear_region(bodies[i].atlasX, bodies[i].atlasY, bodies[i].width, bodies[i].height, 1.0f);
+	}
+
+	stampCount = 0;
+}
+
+void WaterWorld::build_patches() {
+	patchesDirty = false;
+
+	int count = 0;
+	for (int i = 0; i < bodyCount; i++) {
+		const Body& body = bodies[i];
+		if (body.alive)
+			count += ((body.width + PATCH_QUADS - 2) / PATCH_QUADS) * ((body.height + PATCH_QUADS - 2) / PATCH_QUADS);
+	}
+
+	// grows to the next power of 2, the buffer gets recreated since its storage is immutable
+	if (count > patchCapacity) {
+		int capacity = std::max(patchCapacity, 256);
+		while (capacity < count)
+			capacity *= 2;
+
+		Patch* grown = static_cast<Patch*>(realloc(patches, sizeof(Patch) * capacity));
+		if (!grown) {
+			patchCount = 0;
+			return;
+		}
+
+		patches = grown;
+		patchCapacity = capacity;
+
+		if (patchBuffer != 0)
+			glDeleteBuffers(1, &patchBuffer);
+		glCreateBuffers(1, &patchBuffer);
+		glNamedBufferStorage(patchBuffer, sizeof(Patch) * capacity, nullptr, GL_DYNAMIC_STORAGE_BIT);
+	}
+
+	patchCount = 0;
+	for (int i = 0; i < bodyCount; i++) {
+		const Body& body = bodies[i];
+		if (!body.alive) continue;
+
+		const float firstX = static_cast<float>(body.atlasX);
+		const float firstY = static_cast<float>(body.atlasY);
+		const float lastX = static_cast<float>(body.atlasX + body.width - 1);
+		const float lastY = static_cast<float>(body.atlasY + body.height - 1);
+
+		// a body of n cells has n - 1 quads between them
+		for (int y = 0; y < body.height - 1; y += PATCH_QUADS) {
+			for (int x = 0; x < body.width - 1; x += PATCH_QUADS) {
+				Patch& patch = patches[patchCount++];
+				patch.corner[0] = firstX + static_cast<float>(x);
+				patch.corner[1] = firstY + static_cast<float>(y);
+				patch.last[0] = lastX;
+				patch.last[1] = lastY;
+				patch.first[0] = firstX;
+				patch.first[1] = firstY;
+				patch.world[0] = body.worldX;
+				patch.world[1] = body.worldZ;
+				patch.cellSize = body.cellSize;
+			}
+		}
+	}
+
+	if (patchCount > 0)
+		glNamedBufferSubData(patchBuffer, 0, sizeof(Patch) * patchCount, patches);
+}
+
+void WaterWorld::draw() {
+	if (!surface || patchVao == 0) return;
+
+	if (patchesDirty)
+		build_patches();
+	if (patchCount == 0) return;
+
+	int viewSize[4];
+	glGetIntegerv(GL_VIEWPORT, viewSize);
+	float width = static_cast<float>(viewSize[2]);
+	float height = static_cast<float>(viewSize[3]);
+
+	float cameraPos[3] = {
+		distance * cosf(pitch) * sinf(yaw),
+		distance * sinf(pitch),
+		distance * cosf(pitch) * cosf(yaw),
+	};
+
+	Matrix4 view = Matrix4::translation(0.0f, 0.0f, -distance) * Matrix4::rotationX(pitch) * Matrix4::rotationY(-yaw);
+	Matrix4 transform = Matrix4::perspective(static_cast<float>(M_PI) / 3.0f, width / height, 0.01f, 100.0f) * view;
+
+	Renderer::use_program(shader);
+	Renderer::attach_tex(shader, atlasLoc, surface->get_height_tex(), 0);
+
+	glUniformMatrix4fv(transformLoc, 1, GL_FALSE, transform.m);
+	glUniform1f(heightLoc, heightMultiplier);
+	glUniform3fv(cameraLoc, 1, cameraPos);
+
+	Renderer::set_capability(GL_DEPTH_TEST, true);
+	Renderer::set_capability(GL_BLEND, false);
+	Renderer::set_capability(GL_CULL_FACE, false);
+
+	// every patch of every body in one call
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, patchBuffer);
+	Renderer::bind_vertex_array(patchVao);
+	glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, nullptr, patchCount);
+}
+
+void WaterWorld::imgui_builder(bool* open) {
+	if (!surface || !open || !*open) return;
+
+	if (ImGui::Begin("WaterWorld", open, ImGuiWindowFlags_AlwaysAutoResize)) {
+		ImGui::LabelText("Bodies", "%d", liveCount);
+		ImGui::LabelText("Patches", "%d (1 draw call)", patchCount);
+		ImGui::LabelText("Atlas", "%dx%d, %.0f%% used", atlasWidth, atlasHeight, get_atlas_usage() * 100.0f);
+		ImGui::SliderFloat("Height Scale", &heightMultiplier, 0.0f, 10.0f);
+
+		float imgWidth = 256.0f;
+		float imgHeight = imgWidth * static_cast<float>(atlasHeight) / static_cast<float>(atlasWidth);
+		ImGui::Image(surface->get_display(), ImVec2(imgWidth, imgHeight));
+	}
+
+	ImGui::End();
+}
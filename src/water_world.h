@@ -0,0 +1,105 @@
+#pragma once
+
+#include <GL/gl3w.h>
+#include "gl_renderer.h"
+#include "iwave_gpu.h"
+
+// lots of small bodies of water (ponds, puddles) packed into one atlas, so they're all simulated by a
+// single IWaveSurfaceGPU and drawn with a single instanced draw call
+// every pass of the simulation runs once over the whole atlas, which makes the cost depend on the total
+// number of cells instead of the number of bodies
+//
+// bodies are kept apart by a gutter of walls as wide as the convolution kernel, so the kernel never reaches
+// from one body into the next one, and the walls zero the gutter every step before the kernel reads it
+// the atlas is packed in shelves, removed bodies leave their slot behind for the next body that fits in it
+class WaterWorld {
+public:
+	static constexpr int MAX_BODIES = 1024;
+
+	// quads along one side of a patch, bodies are split into patches of this many cells
+	static constexpr int PATCH_QUADS = 16;
+
+	struct Body {
+		int atlasX, atlasY; // first cell of the body in the atlas
+		int width, height;
+		int slotWidth, slotHeight; // can be bigger than the body after reusing a slot
+		float worldX, worldZ; // where cell (0, 0) goes, the body lies on the y = 0 plane
+		float cellSize; // in world units
+		bool alive;
+	};
+
+private:
+	IWaveSurfaceGPU* surface = nullptr;
+	int atlasWidth = 0, atlasHeight = 0;
+	int gutter = 0;
+
+	Body* bodies = nullptr;
+	int bodyCount = 0; // including dead ones, they keep their slot
+	int liveCount = 0;
+
+	// shelf packing, the next body goes at (shelfX, shelfY) if it fits on the current shelf
+	int shelfX = 0, shelfY = 0, shelfHeight = 0;
+
+	// sources and obstructions are batched up and drawn all at once at the start of sim_frame
+	IWaveSurfaceGPU::Stamp* stamps = nullptr;
+	int stampCount = 0;
+	static constexpr int MAX_STAMPS = 1024;
+
+	// one patch per PATCH_QUADS square of a body, rebuilt only when bodies are added or removed
+	struct Patch {
+		float corner[2]; // first cell of the patch in the atlas
+		float last[2]; // last cell of the body, vertices past it get clamped
+		float first[2]; // first cell of the body
+		float world[2]; // world x and z of the body's first cell
+		float cellSize;
+		float pad[3];
+	};
+
+	Patch* patches = nullptr;
+	int patchCount = 0, patchCapacity = 0;
+	bool patchesDirty = false;
+
+	GLuint patchVao = 0, patchIbo = 0;
+	GLuint patchBuffer = 0; // patchCapacity Patches, as an SSBO
+	GLsizei indexCount = 0;
+
+	GLuint shader = 0;
+	GLint transformLoc, heightLoc, cameraLoc, atlasLoc;
+
+	bool find_slot(int w, int h, int& x, int& y);
+	void add_stamp(int body, int x, int y, float r, float source, float obstruction);
+	void build_patches();
+
+public:
+	// orbit camera around the origin, like SurfaceDraw
+	float yaw = 0.6f, pitch = 0.6f, distance = 2.5f;
+	float heightMultiplier = 1.0f;
+
+	~WaterWorld() { clean(); }
+
+	// kernelRadius is IWaveSurfaceGPU's p, it also sets the width of the gutter between bodies
+	void init(int w, int h, int kernelRadius);
+	void clean();
+
+	// returns the body's id, or -1 if it doesn't fit in the atlas anymore
+	int add_body(int w, int h, float worldX, float worldZ, float cellSize);
+	void remove_body(int body);
+
+	// coordinates are in the body's cells, like SurfaceSim
+	void place_source(int body, int x, int y, float r, float strength);
+	void set_obstruction(int body, int x, int y, float r, float strength);
+
+	void sim_frame(float delta);
+	void reset();
+
+	// draws every body into the current framebuffer with depth testing
+	void draw();
+
+	const Body* get_body(int body) const;
+	int get_body_count() const { return liveCount; }
+	int get_patch_count() const { return patchCount; }
+	float get_atlas_usage() const; // fraction of the atlas covered by live bodies
+	IWaveSurfaceGPU* get_surface() { return surface; } // for readbacks, in atlas coordinates
+
+	void imgui_builder(bool* open = nullptr);
+};